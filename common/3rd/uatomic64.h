@@ -125,4 +125,53 @@ static inline int atomic64_add_negative( int i, atomic64_t *v )
        return (__sync_add_and_fetch(&v->counter, i) < 0);
 }
 
+/**
+ * @brief compare and exchange
+ * @param v pointer of type atomic64_t
+ * @param old expected value
+ * @param new new value
+ *
+ * Atomically sets @v to @new if it was @old, and returns
+ * the value of @v before the operation.
+ */
+static inline long long atomic64_cmpxchg( atomic64_t *v, long long old, long long new )
+{
+       return __sync_val_compare_and_swap(&v->counter, old, new);
+}
+
+/**
+ * @brief increment and return
+ * @param v pointer of type atomic64_t
+ *
+ * Atomically increments @v by 1 and returns the result.
+ */
+static inline long long atomic64_inc_return( atomic64_t *v )
+{
+       return __sync_add_and_fetch(&v->counter, 1);
+}
+
+/**
+ * @brief bitwise or
+ * @param i bits to set
+ * @param v pointer of type atomic64_t
+ *
+ * Atomically sets the bits of @i in @v.
+ */
+static inline void atomic64_or( long long i, atomic64_t *v )
+{
+       __sync_fetch_and_or(&v->counter, i);
+}
+
+/**
+ * @brief bitwise and
+ * @param i bits to keep
+ * @param v pointer of type atomic64_t
+ *
+ * Atomically clears the bits of @v that are not in @i.
+ */
+static inline void atomic64_and( long long i, atomic64_t *v )
+{
+       __sync_fetch_and_and(&v->counter, i);
+}
+
 #endif
@@ -48,6 +48,8 @@ THE SOFTWARE.
 #include "hlm_buf.h"
 #include "hlm_dftl.h"
 #include "hlm_rsd.h"
+#include "hlm_rcache.h"
+#include "hlm_rahead.h"
 #include "devices.h"
 #include "pmu.h"
 
@@ -55,12 +57,12 @@ THE SOFTWARE.
 #include "algo/block_ftl.h"
 #include "algo/page_ftl.h"
 #include "algo/dftl.h"
+#include "algo/hybrid_ftl.h"
 #include "ufile.h"
 
 /* TEMP */
 //h4h_ftl_inf_t _ftl_block_ftl, _ftl_dftl, _ftl_no_ftl;
-h4h_ftl_inf_t _ftl_dftl, _ftl_no_ftl;
-h4h_hlm_inf_t _hlm_dftl_inf, _hlm_buf_inf;
+h4h_ftl_inf_t _ftl_no_ftl;
 h4h_llm_inf_t _llm_noq_inf;
 /* TEMP */
 
@@ -79,6 +81,8 @@ h4h_drv_info_t* h4h_drv_create (void)
 	/* get default driver paramters */
 	bdi->parm_ftl = get_default_ftl_params ();
 	bdi->parm_dev = get_default_device_params ();
+	bdi->ptr_rcache = NULL;
+	bdi->ptr_rahead = NULL;
 
 	return bdi;
 }
@@ -113,6 +117,9 @@ int h4h_drv_setup (
 	case HLM_DFTL:
 		bdi->ptr_hlm_inf = &_hlm_dftl_inf;
 		break;
+	case HLM_RSD:
+		bdi->ptr_hlm_inf = &_hlm_rsd_inf;
+		break;
 	default:
 		h4h_error ("invalid hlm type");
 		h4h_bug_on (1);
@@ -154,6 +161,9 @@ int h4h_drv_setup (
 	case MAPPING_POLICY_DFTL:
 		bdi->ptr_ftl_inf = &_ftl_dftl;
 		break;
+	case MAPPING_POLICY_HYBRID:
+		bdi->ptr_ftl_inf = &_ftl_hybrid_ftl;
+		break;
 	default:
 		h4h_error ("invalid ftl type");
 		h4h_bug_on (1);
@@ -231,6 +241,29 @@ int h4h_drv_run (h4h_drv_info_t* bdi)
 		}
 	}
 
+	/* create a read cache in front of the hlm */
+	if (bdi->ptr_hlm_inf && _param_rcache_mb > 0) {
+		h4h_device_params_t* np = &bdi->parm_dev;
+		if (np->nr_subpages_per_page != 1) {
+			h4h_warning ("[h4h_drv_main] the read cache needs page-level mapping; it is disabled");
+		} else if ((bdi->ptr_rcache = h4h_hlm_rcache_create (
+				(uint64_t)_param_rcache_mb * H4H_MB / np->page_main_size, 
+				np->page_main_size)) == NULL) {
+			h4h_error ("[h4h_drv_main] failed to create a read cache");
+			goto fail;
+		}
+	}
+
+	/* create a read-ahead engine */
+	if (bdi->ptr_hlm_inf && _param_ra_buf_pgs > 0) {
+		if (bdi->parm_dev.nr_subpages_per_page != 1) {
+			h4h_warning ("[h4h_drv_main] read-ahead needs page-level mapping; it is disabled");
+		} else if ((bdi->ptr_rahead = h4h_hlm_rahead_create (bdi, _param_ra_buf_pgs)) == NULL) {
+			h4h_error ("[h4h_drv_main] failed to create a read-ahead engine");
+			goto fail;
+		}
+	}
+
 	/* create a host interface */
 	if (bdi->ptr_host_inf) {
 		host = bdi->ptr_host_inf;
@@ -254,6 +287,10 @@ int h4h_drv_run (h4h_drv_info_t* bdi)
 fail:
 	if (host && host->close)
 		host->close (bdi);
+	if (bdi->ptr_rahead)
+		h4h_hlm_rahead_destroy (bdi->ptr_rahead);
+	if (bdi->ptr_rcache)
+		h4h_hlm_rcache_destroy (bdi->ptr_rcache);
 	if (hlm && hlm->destroy)
 		hlm->destroy (bdi);
 	if (ftl && ftl->destroy)
@@ -284,9 +321,20 @@ void h4h_drv_close (h4h_drv_info_t* bdi)
 	if (bdi->ptr_host_inf)
 		bdi->ptr_host_inf->close (bdi);
 
+	/* read-ahead in progress must finish before the hlm goes away */
+	if (bdi->ptr_rahead) {
+		h4h_hlm_rahead_destroy (bdi->ptr_rahead);
+		bdi->ptr_rahead = NULL;
+	}
+
 	if (bdi->ptr_hlm_inf)
 		bdi->ptr_hlm_inf->destroy (bdi);
 
+	if (bdi->ptr_rcache) {
+		h4h_hlm_rcache_destroy (bdi->ptr_rcache);
+		bdi->ptr_rcache = NULL;
+	}
+
 	if (bdi->ptr_ftl_inf) {
 		if (bdi->parm_ftl.snapshot == SNAPSHOT_ENABLE && bdi->ptr_ftl_inf->store) {
 			h4h_msg ("[h4h_drv_main] storing ftl tables to '/usr/share/h4h_drv/ftl.dat'");
@@ -311,6 +359,19 @@ void h4h_drv_close (h4h_drv_info_t* bdi)
 	h4h_msg ("[h4h_drv_main] h4h_drv is closed");
 }
 
+/* it waits for the reqs sent to 'punit_ids' so far, so that the other
+ * punits keep serving reqs; an llm without barriers drains all the punits */
+void h4h_drv_llm_barrier (
+	h4h_drv_info_t* bdi, 
+	uint64_t* punit_ids, 
+	uint64_t nr_punit_ids)
+{
+	if (bdi->ptr_llm_inf->barrier)
+		bdi->ptr_llm_inf->barrier (bdi, punit_ids, nr_punit_ids);
+	else
+		bdi->ptr_llm_inf->flush (bdi);
+}
+
 void h4h_drv_destroy (h4h_drv_info_t* bdi)
 {
 	h4h_free (bdi);
@@ -45,6 +45,7 @@ THE SOFTWARE.
 #include <linux/semaphore.h>
 #define h4h_sema_t struct semaphore
 #define h4h_sema_init(a) sema_init (a, 1)
+#define h4h_sema_init_count(a,n) sema_init (a, n) /* a counting semaphore */
 #define h4h_sema_lock(a) down (a)
 #define h4h_sema_lock_interruptible(a) down_interruptible(a)
 #define h4h_sema_unlock(a) up (a)
@@ -65,10 +66,21 @@ THE SOFTWARE.
 #define h4h_mutex_try_lock(a) h4h_sema_try_lock(a)
 #define h4h_mutex_free(a) h4h_sema_free(a)
 
+/* synchronization (rwlock) */
+#include <linux/rwsem.h>
+#define h4h_rwlock_t struct rw_semaphore
+#define h4h_rwlock_init(a) init_rwsem(a)
+#define h4h_rwlock_rdlock(a) down_read(a)
+#define h4h_rwlock_rdunlock(a) up_read(a)
+#define h4h_rwlock_wrlock(a) down_write(a)
+#define h4h_rwlock_wrunlock(a) up_write(a)
+#define h4h_rwlock_free(a)
+
 /* spinlock */
 #define h4h_spinlock_t spinlock_t
 #define h4h_spin_lock_init(a) spin_lock_init(a)
 #define h4h_spin_lock(a) spin_lock(a)
+#define h4h_spin_try_lock(a) spin_trylock(a) /* 0: busy, 1: locked */
 #define h4h_spin_lock_irqsave(a,flag) spin_lock_irqsave(a,flag)
 #define h4h_spin_unlock(a) spin_unlock(a)
 #define h4h_spin_unlock_irqrestore(a,flag) spin_unlock_irqrestore(a,flag)
@@ -83,6 +95,7 @@ THE SOFTWARE.
 #define h4h_spinlock_t pthread_spinlock_t
 #define h4h_spin_lock_init(a) pthread_spin_init(a,0)
 #define h4h_spin_lock(a) pthread_spin_lock(a)
+#define h4h_spin_try_lock(a) (pthread_spin_trylock(a) == 0) /* 0: busy, 1: locked */
 #define h4h_spin_lock_irqsave(a,flag) pthread_spin_lock(a);
 #define h4h_spin_unlock(a) pthread_spin_unlock(a)
 #define h4h_spin_unlock_irqrestore(a,flag) pthread_spin_unlock(a)
@@ -92,6 +105,7 @@ THE SOFTWARE.
 #include <semaphore.h>  /* Semaphore */
 #define h4h_sema_t sem_t 
 #define h4h_sema_init(a) sem_init(a, 0, 1)
+#define h4h_sema_init_count(a,n) sem_init(a, 0, n) /* a counting semaphore */
 #define h4h_sema_lock(a) sem_wait(a)
 #define h4h_sema_lock_interruptible(a) sem_wait(a)
 #define h4h_sema_unlock(a) sem_post(a)
@@ -115,6 +129,15 @@ THE SOFTWARE.
 	ret; })
 #define h4h_mutex_free(a) pthread_mutex_destroy(a)
 
+/* synchronization (rwlock) */
+#define h4h_rwlock_t pthread_rwlock_t
+#define h4h_rwlock_init(a) pthread_rwlock_init(a, NULL)
+#define h4h_rwlock_rdlock(a) pthread_rwlock_rdlock(a)
+#define h4h_rwlock_rdunlock(a) pthread_rwlock_unlock(a)
+#define h4h_rwlock_wrlock(a) pthread_rwlock_wrlock(a)
+#define h4h_rwlock_wrunlock(a) pthread_rwlock_unlock(a)
+#define h4h_rwlock_free(a) pthread_rwlock_destroy(a)
+
 #else
 /* ERROR CASE */
 #error Invalid Platform (KERNEL_MODE or USER_MODE)
@@ -141,6 +141,21 @@ int h4h_thread_schedule_sleep (h4h_thread_t* k)
 	return 0;
 }
 
+/* the same as h4h_thread_schedule_sleep (), but it wakes up by itself
+ * after 'us' */
+int h4h_thread_schedule_sleep_us (h4h_thread_t* k, int64_t us)
+{
+	schedule_timeout (usecs_to_jiffies (us));
+	remove_wait_queue (&k->wq, k->wait);
+
+	if (signal_pending (current)) {
+		/* get a kill signal */
+		return SIGKILL;
+	}
+
+	return 0;
+}
+
 void h4h_thread_wakeup (h4h_thread_t* k)
 {
 	if (k == NULL) {
@@ -148,7 +163,10 @@ void h4h_thread_wakeup (h4h_thread_t* k)
 		return;
 	}
 
-	wake_up_interruptible (&k->wq);
+	/* skip the wake-up if the thread is not parked; it is put on 'wq' in
+	 * h4h_thread_schedule_setup () before it checks its work again */
+	if (wq_has_sleeper (&k->wq))
+		wake_up_interruptible (&k->wq);
 }
 
 void h4h_thread_stop (h4h_thread_t* k)
@@ -166,6 +184,17 @@ void h4h_thread_stop (h4h_thread_t* k)
 	h4h_free_atomic (k);
 }
 
+/* it pins a thread to 'cpu'; 'cpu' wraps around the number of online cpus */
+int h4h_thread_bind (h4h_thread_t* k, int cpu)
+{
+	if (k == NULL) {
+		h4h_error ("oops! k is NULL");
+		return 1;
+	}
+
+	return set_cpus_allowed_ptr (k->thread, cpumask_of (cpu % num_online_cpus ()));
+}
+
 void h4h_thread_msleep (uint32_t ms) 
 {
 	msleep (ms);
@@ -189,7 +218,9 @@ void h4h_thread_yield ()
 
 #include <inttypes.h>
 #include <pthread.h>
+#include <sched.h>
 #include <string.h>
+#include <unistd.h>
 
 void h4h_thread_fn (void *data) 
 {
@@ -227,6 +258,7 @@ h4h_thread_t* h4h_thread_create (
 	h4h_mutex_init (&k->thread_done);
 	h4h_mutex_init (&k->thread_sleep);
 	pthread_cond_init (&k->thread_con, NULL);
+	atomic64_set (&k->parked, 0);
 
 	h4h_msg ("new thread created: %p", k);
 
@@ -256,6 +288,8 @@ int h4h_thread_schedule (h4h_thread_t* k)
 
 	/* sleep until wake-up signal */
 	if ((ret = h4h_mutex_lock (&k->thread_sleep)) == 0) {
+		atomic64_set (&k->parked, 1);
+		__sync_synchronize ();
 		/* FIXME: need to fix a time-out bug that occasionally occurs in an exceptional case */
 #ifdef PTHREAD_TIMEOUT
 		if ((ret = pthread_cond_timedwait 
@@ -268,6 +302,7 @@ int h4h_thread_schedule (h4h_thread_t* k)
 			h4h_warning ("pthread timeout: %u %s", ret, strerror (ret));
 		}
 #endif
+		atomic64_set (&k->parked, 0);
 		h4h_mutex_unlock (&k->thread_sleep);
 	} else {
 		h4h_warning ("pthread lock failed: %u %s", ret, strerror (ret));
@@ -282,10 +317,16 @@ void h4h_thread_schedule_setup (h4h_thread_t* k)
 	if ((ret = h4h_mutex_lock (&k->thread_sleep)) != 0) {
 		h4h_warning ("pthread lock failed: %u %s", ret, strerror (ret));
 	}
+
+	/* it is parked from now on; the caller checks its work again after
+	 * this, so a waker either sees it parked or its work is seen */
+	atomic64_set (&k->parked, 1);
+	__sync_synchronize ();
 }
 
 void h4h_thread_schedule_cancel (h4h_thread_t* k)
 {
+	atomic64_set (&k->parked, 0);
 	h4h_mutex_unlock (&k->thread_sleep);
 }
 
@@ -310,11 +351,38 @@ int h4h_thread_schedule_sleep (h4h_thread_t* k)
 	}
 #endif
 
+	atomic64_set (&k->parked, 0);
 	h4h_mutex_unlock (&k->thread_sleep);
 
 	return ret;
 }
 
+/* the same as h4h_thread_schedule_sleep (), but it wakes up by itself
+ * after 'us'; a time-out is not an error */
+int h4h_thread_schedule_sleep_us (h4h_thread_t* k, int64_t us)
+{
+	int ret = 0;
+	struct timespec ts;
+
+	clock_gettime (CLOCK_REALTIME, &ts);
+	ts.tv_sec += us / 1000000;
+	ts.tv_nsec += (us % 1000000) * 1000;
+	if (ts.tv_nsec >= 1000000000) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000;
+	}
+
+	if ((ret = pthread_cond_timedwait 
+			(&k->thread_con, &k->thread_sleep, &ts)) != 0 && ret != ETIMEDOUT) {
+		h4h_warning ("pthread timeout: %u %s", ret, strerror (ret));
+	}
+
+	atomic64_set (&k->parked, 0);
+	h4h_mutex_unlock (&k->thread_sleep);
+
+	return (ret == ETIMEDOUT) ? 0 : ret;
+}
+
 void h4h_thread_wakeup (h4h_thread_t* k)
 {
 	int ret = 0;
@@ -324,12 +392,20 @@ void h4h_thread_wakeup (h4h_thread_t* k)
 		return;
 	}
 
-	/* send a wake-up signal */
-	if ((ret = h4h_mutex_try_lock (&k->thread_sleep)) == 1) {
+	/* skip the wake-up (and its lock) if the thread is not parked; the
+	 * caller has published its work before this */
+	__sync_synchronize ();
+	if (atomic64_read (&k->parked) == 0)
+		return;
+
+	/* send a wake-up signal; a thread that holds 'thread_sleep' is between
+	 * h4h_thread_schedule_setup () and its sleep, so wait for it to sleep
+	 * rather than dropping the signal */
+	if ((ret = h4h_mutex_lock (&k->thread_sleep)) == 0) {
 		pthread_cond_signal (&k->thread_con);
 		h4h_mutex_unlock (&k->thread_sleep);
 	} else {
-		/*h4h_warning ("pthread lock failed: %u %s", ret, strerror (ret));*/
+		h4h_warning ("pthread lock failed: %u %s", ret, strerror (ret));
 	}
 }
 
@@ -358,6 +434,24 @@ void h4h_thread_stop (h4h_thread_t* k)
 	h4h_free_atomic (k);
 }
 
+/* it pins a thread to 'cpu'; 'cpu' wraps around the number of online cpus.
+ * it must be called after h4h_thread_run () */
+int h4h_thread_bind (h4h_thread_t* k, int cpu)
+{
+	cpu_set_t set;
+	long nr_cpus = sysconf (_SC_NPROCESSORS_ONLN);
+
+	if (k == NULL) {
+		h4h_warning ("k is NULL");
+		return 1;
+	}
+
+	CPU_ZERO (&set);
+	CPU_SET (cpu % ((nr_cpus > 0) ? nr_cpus : 1), &set);
+
+	return pthread_setaffinity_np (k->thread, sizeof (cpu_set_t), &set);
+}
+
 void h4h_thread_msleep (uint32_t ms) 
 {
 	int microsecs;
@@ -69,6 +69,7 @@ typedef struct {
 	h4h_mutex_t thread_sleep;
 	pthread_cond_t thread_con;
 	pthread_t thread;
+	atomic64_t parked;	/* 1 while it is between setup and wake-up */
 
 	/* user management */
 	void* user_data;
@@ -82,11 +83,13 @@ int h4h_thread_run (h4h_thread_t* k);
 int h4h_thread_schedule (h4h_thread_t* k);
 void h4h_thread_wakeup (h4h_thread_t* k);
 void h4h_thread_stop (h4h_thread_t* k);
+int h4h_thread_bind (h4h_thread_t* k, int cpu);
 void h4h_thread_msleep (uint32_t ms);
 void h4h_thread_yield (void);
 void h4h_thread_schedule_setup (h4h_thread_t* k);
 void h4h_thread_schedule_cancel (h4h_thread_t* k);
 int h4h_thread_schedule_sleep (h4h_thread_t* k);
+int h4h_thread_schedule_sleep_us (h4h_thread_t* k, int64_t us);
 
 #endif /* _H4H_THREAD_H */
 
@@ -54,6 +54,8 @@ enum H4H_DEFAULT_NAND_PARAMS {
 	NAND_PAGE_PROG_TIME_US = 500,		/* 1.3ms */	
 	NAND_PAGE_READ_TIME_US = 100,		/* 100us */
 	NAND_BLOCK_ERASE_TIME_US = 3000,	/* 3ms */
+	NAND_SUSPEND_TIME_US = 20,			/* 20us to suspend or resume */
+	NAND_MAX_SUSPENDS = 4,				/* per program/erase */
 };
 
 int _param_nr_channels 				= NR_CHANNELS;
@@ -67,6 +69,8 @@ int _param_chip_bus_trans_time_us	= NAND_CHIP_BUS_TRANS_TIME_US;
 int _param_page_prog_time_us		= NAND_PAGE_PROG_TIME_US; 		
 int _param_page_read_time_us		= NAND_PAGE_READ_TIME_US;
 int _param_block_erase_time_us		= NAND_BLOCK_ERASE_TIME_US;
+int _param_suspend_time_us			= NAND_SUSPEND_TIME_US;
+int _param_max_suspends				= NAND_MAX_SUSPENDS;
 
 /* TODO: Hmm... there might be a more fancy way than this... */
 #if defined (CONFIG_DEVICE_TYPE_RAMDRIVE)
@@ -97,6 +101,8 @@ module_param (_param_chip_bus_trans_time_us, int, 0000);
 module_param (_param_page_prog_time_us, int, 0000);
 module_param (_param_page_read_time_us, int, 0000);
 module_param (_param_block_erase_time_us, int, 0000);
+module_param (_param_suspend_time_us, int, 0000);
+module_param (_param_max_suspends, int, 0000);
 module_param (_param_device_type, int, 0000);
 
 MODULE_PARM_DESC (_param_nr_channels, "# of channels");
@@ -111,6 +117,8 @@ MODULE_PARM_DESC (_param_chip_bus_trans_time_us, "NAND bus transfer time");
 MODULE_PARM_DESC (_param_page_prog_time_us, "page program time");
 MODULE_PARM_DESC (_param_page_read_time_us, "page read time");
 MODULE_PARM_DESC (_param_block_erase_time_us, "block erasure time");
+MODULE_PARM_DESC (_param_suspend_time_us, "time to suspend or resume a program/erase");
+MODULE_PARM_DESC (_param_max_suspends, "max. # of suspends per program/erase of the timing ramdrive (0: disable)");
 MODULE_PARM_DESC (_param_device_type, "device type"); /* it must be reset when implementing actual device modules */
 #endif
 
@@ -129,6 +137,9 @@ h4h_device_params_t get_default_device_params (void)
  	p.page_prog_time_us = _param_page_prog_time_us;
  	p.page_read_time_us = _param_page_read_time_us;
  	p.block_erase_time_us = _param_block_erase_time_us;
+	p.chip_bus_trans_time_us = (_param_chip_bus_trans_time_us > 0) ? _param_chip_bus_trans_time_us : 0;
+	p.suspend_time_us = _param_suspend_time_us;
+	p.max_suspends = 0;	/* set by devices that can suspend (e.g., ramdrive timing) */
  
  	/* other parameters derived from user parameters */
  	p.nr_blocks_per_channel = p.nr_chips_per_channel * p.nr_blocks_per_chip;
@@ -37,6 +37,8 @@ extern int _param_chip_bus_trans_time_us;
 extern int _param_page_prog_time_us;
 extern int _param_page_read_time_us;
 extern int _param_block_erase_time_us;
+extern int _param_suspend_time_us;
+extern int _param_max_suspends;
 extern int _param_ramdrv_timing_mode;
 
 h4h_device_params_t get_default_device_params (void);
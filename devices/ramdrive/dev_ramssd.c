@@ -464,7 +464,15 @@ void __ramssd_cmd_done (dev_ramssd_info_t* ri)
 
 			if (elapsed_time_in_us >= punit->target_elapsed_time_us) {
 				void* ptr_req = punit->ptr_req;
-				punit->ptr_req = NULL;
+				if (punit->ptr_req_susp != NULL) {
+					/* resume the program or erase the read suspended */
+					punit->ptr_req = punit->ptr_req_susp;
+					punit->ptr_req_susp = NULL;
+					punit->target_elapsed_time_us = 
+						punit->susp_remaining_us + ri->np->suspend_time_us;
+					h4h_stopwatch_start (&punit->sw);
+				} else
+					punit->ptr_req = NULL;
 				h4h_spin_unlock (&ri->ramssd_lock);
 
 				/* call the interrupt handler */
@@ -479,6 +487,60 @@ void __ramssd_cmd_done (dev_ramssd_info_t* ri)
 }
 
 
+#if defined (USER_MODE)
+/* us until the earliest unit finishes (0 if one has, -1 if all are idle) */
+static int64_t __ramssd_next_done_us (dev_ramssd_info_t* ri)
+{
+	uint64_t loop, nr_parallel_units;
+	int64_t next_us = -1;
+
+	nr_parallel_units = dev_ramssd_get_chips_per_ssd (ri);
+
+	h4h_spin_lock (&ri->ramssd_lock);
+	for (loop = 0; loop < nr_parallel_units && next_us != 0; loop++) {
+		dev_ramssd_punit_t* punit = &ri->ptr_punits[loop];
+		int64_t left_us;
+
+		if (punit->ptr_req == NULL)
+			continue;
+		left_us = punit->target_elapsed_time_us - 
+			h4h_stopwatch_get_elapsed_time_us (&punit->sw);
+		if (left_us < 0)
+			left_us = 0;
+		if (next_us == -1 || left_us < next_us)
+			next_us = left_us;
+	}
+	h4h_spin_unlock (&ri->ramssd_lock);
+
+	return next_us;
+}
+
+/* there is no timer in user mode; a thread sleeps until the earliest unit
+ * finishes, and dev_ramssd_send_cmd () wakes it up for a new command */
+static int __ramssd_timing_thread (void* arg)
+{
+	dev_ramssd_info_t* ri = (dev_ramssd_info_t*)arg;
+	int64_t next_us;
+
+	while (!ri->timer_stop) {
+		__ramssd_cmd_done (ri);
+
+		/* NOTE: the units are checked again after the setup, so a command
+		 * sent before it is seen here and one sent after it wakes us up */
+		h4h_thread_schedule_setup (ri->timer);
+		next_us = __ramssd_next_done_us (ri);
+		if (ri->timer_stop || next_us == 0)
+			h4h_thread_schedule_cancel (ri->timer);
+		else if (next_us < 0)
+			h4h_thread_schedule_sleep (ri->timer);
+		else
+			h4h_thread_schedule_sleep_us (ri->timer, next_us);
+	}
+
+	return 0;
+}
+#endif
+
 #if defined (KERNEL_MODE)
 static void __dev_ramssd_fops_wq_handler (struct work_struct *w)
 {
@@ -514,6 +576,10 @@ uint32_t __ramssd_timing_register_schedule (dev_ramssd_info_t* ri)
 #if defined (KERNEL_MODE)
 	case DEVICE_TYPE_RAMDRIVE_TIMING:
 		break;
+#else
+	case DEVICE_TYPE_RAMDRIVE_TIMING:
+		h4h_thread_wakeup (ri->timer);
+		break;
 #endif
 	default:
 		__ramssd_cmd_done (ri);
@@ -547,6 +613,17 @@ uint32_t __ramssd_timing_create (dev_ramssd_info_t* ri)
 			INIT_WORK (&ri->works.work, __dev_ramssd_fops_wq_handler);
 		}
 		break;
+#else
+	case DEVICE_TYPE_RAMDRIVE_TIMING: 
+		ri->timer_stop = 0;
+		if ((ri->timer = h4h_thread_create (
+				__ramssd_timing_thread, ri, "__ramssd_timing_thread")) == NULL) {
+			h4h_error ("h4h_thread_create failed");
+			ret = 1;
+			break;
+		}
+		h4h_thread_run (ri->timer);
+		break;
 #endif
 	default:
 		h4h_error ("invalid timing mode: %d", ri->emul_mode);
@@ -557,6 +634,29 @@ uint32_t __ramssd_timing_create (dev_ramssd_info_t* ri)
 	return ret;
 }
 
+/* the average wait of pages for the bus, and the channel that waited most */
+static void __ramssd_display_buses (dev_ramssd_info_t* ri)
+{
+	uint64_t loop, nr_xfers = 0, wait_us = 0, hot = 0;
+
+	for (loop = 0; loop < ri->np->nr_channels; loop++) {
+		dev_ramssd_channel_t* ch = &ri->ptr_channels[loop];
+		nr_xfers += ch->nr_xfers;
+		wait_us += ch->bus_wait_us;
+		if (ch->bus_wait_us > ri->ptr_channels[hot].bus_wait_us)
+			hot = loop;
+	}
+	if (nr_xfers == 0)
+		return;
+
+	h4h_msg ("ramssd: %llu pages waited %llu us for channel buses on average", 
+		nr_xfers, wait_us / nr_xfers);
+	h4h_msg ("ramssd: channel %llu waited most (%llu pages, %llu us on average)", 
+		hot, ri->ptr_channels[hot].nr_xfers, 
+		ri->ptr_channels[hot].bus_wait_us / 
+		(ri->ptr_channels[hot].nr_xfers ? ri->ptr_channels[hot].nr_xfers : 1));
+}
+
 void __ramssd_timing_destory (dev_ramssd_info_t* ri)
 {
 	switch (ri->emul_mode) {
@@ -569,10 +669,20 @@ void __ramssd_timing_destory (dev_ramssd_info_t* ri)
 		if (ri->wq) 
 			destroy_workqueue (ri->wq);
 		break;
+#else
+	case DEVICE_TYPE_RAMDRIVE_TIMING:
+		ri->timer_stop = 1;
+		h4h_thread_wakeup (ri->timer);
+		h4h_thread_stop (ri->timer);
+		break;
 #endif
 	default:
 		break;
 	}
+
+	if (ri->nr_suspends)
+		h4h_msg ("ramssd: %llu programs/erases were suspended", ri->nr_suspends);
+	__ramssd_display_buses (ri);
 }
 
 /* Functions Exposed to External Files */
@@ -612,7 +722,26 @@ dev_ramssd_info_t* dev_ramssd_create (
 	}
 	for (loop = 0; loop < nr_parallel_units; loop++) {
 		ri->ptr_punits[loop].ptr_req = NULL;
+		ri->ptr_punits[loop].ptr_req_susp = NULL;
+		ri->ptr_punits[loop].nr_suspends = 0;
+	}
+	ri->nr_suspends = 0;
+
+	/* create channels */
+	if ((ri->ptr_channels = (dev_ramssd_channel_t*)
+			h4h_malloc_atomic (sizeof (dev_ramssd_channel_t) * ri->np->nr_channels)) == NULL) {
+		h4h_error ("h4h_malloc_atomic failed");
+		goto fail_channels;
+	}
+	for (loop = 0; loop < ri->np->nr_channels; loop++) {
+		ri->ptr_channels[loop].bus_free_us = 0;
+		ri->ptr_channels[loop].nr_xfers = 0;
+		ri->ptr_channels[loop].bus_wait_us = 0;
 	}
+	h4h_stopwatch_start (&ri->sw);
+
+	/* create spin_lock; the timer might use it as soon as it starts */
+	h4h_spin_lock_init (&ri->ramssd_lock);
 
 	/* create and register a tasklet */
 	if (__ramssd_timing_create (ri) != 0) {
@@ -620,15 +749,15 @@ dev_ramssd_info_t* dev_ramssd_create (
 		goto fail_timing;
 	}
 
-	/* create spin_lock */
-	h4h_spin_lock_init (&ri->ramssd_lock);
-
 	/* done */
 	ri->is_init = 1;
 
 	return ri;
 
 fail_timing:
+	h4h_free_atomic (ri->ptr_channels);
+
+fail_channels:
 	h4h_free_atomic (ri->ptr_punits);
 
 fail_punits:
@@ -650,10 +779,57 @@ void dev_ramssd_destroy (dev_ramssd_info_t* ri)
 	__ramssd_free_ssdram (ri->ptr_ssdram);
 
 	/* release other stuff */
+	h4h_free_atomic (ri->ptr_channels);
 	h4h_free_atomic (ri->ptr_punits);
 	h4h_free_atomic (ri);
 }
 
+/* a read can suspend the program or erase being served, up to
+ * 'max_suspends' times per op; one op is suspended at a time */
+static int __ramssd_can_suspend (
+	dev_ramssd_info_t* ri, 
+	dev_ramssd_punit_t* punit, 
+	h4h_llm_req_t* r)
+{
+	h4h_llm_req_t* busy = (h4h_llm_req_t*)punit->ptr_req;
+
+	if (ri->emul_mode != DEVICE_TYPE_RAMDRIVE_TIMING || !h4h_is_read (r->req_type))
+		return 0;
+	if (punit->ptr_req_susp != NULL || punit->nr_suspends >= ri->np->max_suspends)
+		return 0;
+	return (h4h_is_write (busy->req_type) || h4h_is_erase (busy->req_type)) ? 1 : 0;
+}
+
+/* it takes the bus of the channel of a req for a page, and returns how long
+ * the req keeps its punit; a page goes in before a program and comes out
+ * after a read. the bus serves pages in the order they are reserved, and
+ * ramssd_lock must be held */
+static int64_t __ramssd_bus_reserve (
+	dev_ramssd_info_t* ri, 
+	h4h_llm_req_t* r, 
+	int64_t array_us)
+{
+	dev_ramssd_channel_t* ch = &ri->ptr_channels[r->phyaddr.channel_no];
+	int64_t bus_us = ri->np->chip_bus_trans_time_us;
+	int64_t now_us, ready_us, start_us;
+
+	if (ri->emul_mode != DEVICE_TYPE_RAMDRIVE_TIMING || bus_us == 0)
+		return array_us;
+	if (!h4h_is_read (r->req_type) && !h4h_is_write (r->req_type))
+		return array_us;	/* erases move no data */
+
+	now_us = h4h_stopwatch_get_elapsed_time_us (&ri->sw);
+	ready_us = h4h_is_read (r->req_type) ? now_us + array_us : now_us;
+	start_us = (ch->bus_free_us > ready_us) ? ch->bus_free_us : ready_us;
+	ch->bus_free_us = start_us + bus_us;
+	ch->bus_wait_us += start_us - ready_us;
+	ch->nr_xfers++;
+
+	if (h4h_is_read (r->req_type))
+		return ch->bus_free_us - now_us;
+	return ch->bus_free_us - now_us + array_us;
+}
+
 uint32_t dev_ramssd_send_cmd (dev_ramssd_info_t* ri, h4h_llm_req_t* r)
 {
 	uint32_t ret;
@@ -661,6 +837,7 @@ uint32_t dev_ramssd_send_cmd (dev_ramssd_info_t* ri, h4h_llm_req_t* r)
 	if ((ret = __ramssd_send_cmd (ri, r)) == 0) {
 		int64_t target_elapsed_time_us = 0;
 		uint64_t punit_id = r->phyaddr.punit_id;
+		dev_ramssd_punit_t* punit = NULL;
 
 		/* get the target elapsed time depending on the type of req */
 		if (ri->emul_mode == DEVICE_TYPE_RAMDRIVE_TIMING) {
@@ -697,10 +874,26 @@ uint32_t dev_ramssd_send_cmd (dev_ramssd_info_t* ri, h4h_llm_req_t* r)
 
 		/* register reqs */
 		h4h_spin_lock (&ri->ramssd_lock);
-		if (ri->ptr_punits[punit_id].ptr_req == NULL) {
-			ri->ptr_punits[punit_id].ptr_req = (void*)r;
-			h4h_stopwatch_start (&ri->ptr_punits[punit_id].sw);
-			ri->ptr_punits[punit_id].target_elapsed_time_us = target_elapsed_time_us;
+		punit = &ri->ptr_punits[punit_id];
+		if (punit->ptr_req == NULL) {
+			punit->ptr_req = (void*)r;
+			h4h_stopwatch_start (&punit->sw);
+			punit->target_elapsed_time_us = 
+				__ramssd_bus_reserve (ri, r, target_elapsed_time_us);
+			punit->nr_suspends = 0;
+		} else if (__ramssd_can_suspend (ri, punit, r)) {
+			/* keep the time left; the read waits for the suspend */
+			punit->susp_remaining_us = punit->target_elapsed_time_us - 
+				h4h_stopwatch_get_elapsed_time_us (&punit->sw);
+			if (punit->susp_remaining_us < 0)
+				punit->susp_remaining_us = 0;
+			punit->ptr_req_susp = punit->ptr_req;
+			punit->nr_suspends++;
+			ri->nr_suspends++;
+			punit->ptr_req = (void*)r;
+			h4h_stopwatch_start (&punit->sw);
+			punit->target_elapsed_time_us = __ramssd_bus_reserve (ri, r, 
+				ri->np->suspend_time_us + target_elapsed_time_us);
 		} else {
 			h4h_error ("More than two requests are assigned to the same parallel unit (ptr=%p, punit=%llu)",
 				ri->ptr_punits[punit_id].ptr_req, punit_id);
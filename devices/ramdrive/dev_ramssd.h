@@ -42,14 +42,28 @@ THE SOFTWARE.
 #include "h4h_drv.h"
 #include "params.h"
 #include "utime.h"
+#include "uthread.h"
 
 
+/* with timing, a read can suspend the program or erase of a unit; the
+ * suspended one resumes with the time it had left once the read is done */
 typedef struct {
 	void* ptr_req;
 	int64_t target_elapsed_time_us;
 	h4h_stopwatch_t sw;
+	void* ptr_req_susp;	/* the suspended program or erase */
+	int64_t susp_remaining_us;
+	uint64_t nr_suspends;	/* # of suspends of the current op */
 } dev_ramssd_punit_t;
 
+/* the chips of a channel share its bus; a page is moved over it one at a
+ * time, while array operations of the chips overlap */
+typedef struct {
+	int64_t bus_free_us;	/* when the bus gets free (on 'sw' of ri) */
+	uint64_t nr_xfers;
+	uint64_t bus_wait_us;	/* in total */
+} dev_ramssd_channel_t;
+
 #if defined (KERNEL_MODE)
 typedef struct {
 	struct work_struct work; /* it must be at the end of structre */
@@ -63,8 +77,16 @@ typedef struct {
 	h4h_device_params_t* np;
 	void* ptr_ssdram; /* DRAM memory for SSD */
 	dev_ramssd_punit_t* ptr_punits;	/* parallel units */
+	dev_ramssd_channel_t* ptr_channels;
+	h4h_stopwatch_t sw;	/* a clock for channel buses */
 	h4h_spinlock_t ramssd_lock;
 	void (*intr_handler) (void*);
+	uint64_t nr_suspends;	/* in total */
+
+#if defined (USER_MODE)
+	h4h_thread_t* timer;	/* polls units for timing */
+	int timer_stop;
+#endif
 
 #if defined (KERNEL_MODE)
 	struct hrtimer hrtimer;	/* hrtimer must be at the end of the structure */
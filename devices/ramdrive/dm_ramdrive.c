@@ -75,6 +75,10 @@ static void __dm_ramdrive_ih (void* arg)
 static void __dm_setup_device_params (h4h_device_params_t* params)
 {
 	*params = get_default_device_params ();
+
+	/* only the timing model emulates program/erase suspends */
+	if (params->device_type == DEVICE_TYPE_RAMDRIVE_TIMING && _param_max_suspends > 0)
+		params->max_suspends = _param_max_suspends;
 }
 
 uint32_t dm_ramdrive_probe (h4h_drv_info_t* bdi, h4h_device_params_t* params)
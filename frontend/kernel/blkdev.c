@@ -33,6 +33,7 @@ THE SOFTWARE.
 #include "blkdev.h"
 #include "blkdev_ioctl.h"
 #include "umemory.h"
+#include "ftl_params.h"
 
 
 int h4h_blk_ioctl (struct block_device *bdev, fmode_t mode, unsigned cmd, unsigned long arg);
@@ -209,6 +210,12 @@ uint32_t host_blkdev_register_device (h4h_drv_info_t* bdi, make_request_fn* fn)
 		h4h_msg ("TRIM is disabled");
 	}
 
+	/* hlm_rsd and the write-back cache of hlm_buf are volatile; let the
+	 * kernel send flush/FUA */
+	if (bdi->parm_ftl.hlm_type == HLM_RSD ||
+		(bdi->parm_ftl.hlm_type == HLM_BUFFER && _param_hlm_buf_cache_pgs > 0))
+		blk_queue_write_cache (h4h_device.queue, true, true);
+
 	/* register a blk device */
 	if ((h4h_device_major_num = register_blkdev (h4h_device_major_num, "H4H")) < 0) {
 		h4h_msg ("register_blkdev failed (%d)", h4h_device_major_num);
@@ -37,6 +37,8 @@ THE SOFTWARE.
 #include "blkdev_ioctl.h"
 
 #include "hlm_reqs_pool.h"
+#include "hlm_reqs_plug.h"
+#include "ftl_params.h"
 
 /*#define ENABLE_DISPLAY*/
 
@@ -54,8 +56,16 @@ typedef struct {
 	h4h_sema_t host_lock;
 	atomic_t nr_host_reqs;
 	h4h_hlm_reqs_pool_t* hlm_reqs_pool;
+
+	/* merging of adjacent bios (NULL if disabled) */
+	h4h_hlm_reqs_plug_t* plug;
+	h4h_thread_t* unplug_thread;
+	atomic_t nr_unplugs;	/* # of completions since the last unplug */
+	atomic_t nr_ending;		/* # of blkio_end_req () in progress */
 } h4h_blkio_private_t;
 
+static void __blkio_submit (h4h_drv_info_t* bdi, h4h_blkio_req_t* br);
+
 
 /* This is a call-back function invoked by a block-device layer */
 static h4h_blkio_req_t* __get_blkio_req (struct bio *bio)
@@ -72,13 +82,24 @@ static h4h_blkio_req_t* __get_blkio_req (struct bio *bio)
 	//if (bio->bi_rw & REQ_DISCARD)
 	if (bio_op(bio) == REQ_OP_DISCARD)
 		br->bi_rw = REQTYPE_TRIM;
+	/* an empty write with PREFLUSH is how a flush reaches bio-based drivers */
+	else if (bio_op(bio) == REQ_OP_FLUSH ||
+			(bio_op(bio) == REQ_OP_WRITE && (bio->bi_opf & REQ_PREFLUSH) && bio_sectors (bio) == 0))
+		br->bi_rw = REQTYPE_FLUSH;
 	//else if (bio_data_dir (bio) == READ || bio_data_dir (bio) == READA)
-	else if (bio_op(bio) == REQ_OP_READ)
+	else if (bio_op(bio) == REQ_OP_READ) {
 		br->bi_rw = REQTYPE_READ;
+		if (bio->bi_opf & REQ_RAHEAD)
+			br->bi_rw |= REQTYPE_NOCACHE;	/* read-ahead of a scan */
+	}
 	//else if (bio_data_dir (bio) == WRITE)
-	else if (bio_op(bio) == REQ_OP_WRITE)
+	else if (bio_op(bio) == REQ_OP_WRITE) {
 		br->bi_rw = REQTYPE_WRITE;
-	else {
+		if (bio->bi_opf & REQ_PREFLUSH)
+			br->bi_rw |= REQTYPE_PREFLUSH;
+		if (bio->bi_opf & REQ_FUA)
+			br->bi_rw |= REQTYPE_FUA;
+	} else {
 		h4h_error ("oops! invalid request type (bi->bi_rw = %lx)", bio->bi_opf);
 		goto fail;
 	}
@@ -90,7 +111,7 @@ static h4h_blkio_req_t* __get_blkio_req (struct bio *bio)
 	br->bio = (void*)bio;
 
 	/* get the data from the bio */
-	if (br->bi_rw != REQTYPE_TRIM) {
+	if (br->bi_rw != REQTYPE_TRIM && br->bi_rw != REQTYPE_FLUSH) {
 		bio_for_each_segment (bvec, bio, iter) {
 			br->bi_bvec_ptr[br->bi_bvec_cnt] = (uint8_t*)page_address (bvec.bv_page);
 			br->bi_bvec_cnt++;
@@ -118,6 +139,48 @@ static void __free_blkio_req (h4h_blkio_req_t* br)
 		h4h_free (br);
 }
 
+static void __end_blkio_req (h4h_blkio_req_t* br, uint8_t ret)
+{
+	/* end bio */
+	if (ret == 0)
+		bio_endio ((struct bio*)br->bio);
+	else {
+		h4h_warning ("oops! make_req () failed with %d", ret);
+		bio_io_error ((struct bio*)br->bio);
+	}
+
+	/* free blkio_req */
+	__free_blkio_req (br);
+}
+
+/* a thread that sends a plugged req when a req in flight finishes */
+static int __blkio_unplug_thread (void* arg)
+{
+	h4h_drv_info_t* bdi = (h4h_drv_info_t*)arg;
+	h4h_blkio_private_t* p = (h4h_blkio_private_t*)H4H_HOST_PRIV(bdi);
+	h4h_blkio_req_t* br = NULL;
+
+	for (;;) {
+		if (atomic_read (&p->nr_unplugs) == 0) {
+			h4h_thread_schedule_setup (p->unplug_thread);
+			if (atomic_read (&p->nr_unplugs) == 0) {
+				if (h4h_thread_schedule_sleep (p->unplug_thread) == SIGKILL)
+					break;
+			} else {
+				h4h_thread_schedule_cancel (p->unplug_thread);
+			}
+		}
+		atomic_set (&p->nr_unplugs, 0);
+
+		h4h_sema_lock (&p->host_lock);
+		if ((br = h4h_hlm_reqs_plug_flush (p->plug)) != NULL)
+			__blkio_submit (bdi, br);
+		h4h_sema_unlock (&p->host_lock);
+	}
+
+	return 0;
+}
+
 //static void __host_blkio_make_request_fn (
 static blk_qc_t __host_blkio_make_request_fn (
 	struct request_queue *q, 
@@ -157,6 +220,24 @@ uint32_t blkio_open (h4h_drv_info_t* bdi)
 		return 1;
 	}
 
+	/* create a plug for merging */
+	p->plug = NULL;
+	p->unplug_thread = NULL;
+	atomic_set (&p->nr_unplugs, 0);
+	atomic_set (&p->nr_ending, 0);
+	if (_param_host_merge_pgs > 1) {
+		if ((p->plug = h4h_hlm_reqs_plug_create (_param_host_merge_pgs)) == NULL) {
+			h4h_warning ("h4h_hlm_reqs_plug_create () failed");
+			return 1;
+		}
+		if ((p->unplug_thread = h4h_thread_create (
+				__blkio_unplug_thread, bdi, "__blkio_unplug_thread")) == NULL) {
+			h4h_warning ("h4h_thread_create () failed");
+			return 1;
+		}
+		h4h_thread_run (p->unplug_thread);
+	}
+
 	/* register H4H */
 	if ((ret = host_blkdev_register_device
 			(bdi, __host_blkio_make_request_fn)) != 0) {
@@ -172,11 +253,27 @@ void blkio_close (h4h_drv_info_t* bdi)
 {
 	h4h_blkio_private_t* p = H4H_HOST_PRIV (bdi); 
 
+	/* send a plugged req */
+	if (p->plug) {
+		h4h_blkio_req_t* br = NULL;
+		h4h_sema_lock (&p->host_lock);
+		if ((br = h4h_hlm_reqs_plug_flush (p->plug)) != NULL)
+			__blkio_submit (bdi, br);
+		h4h_sema_unlock (&p->host_lock);
+	}
+
 	/* wait until requests to finish */
-	if (atomic_read (&p->nr_host_reqs) > 0) {
+	while (atomic_read (&p->nr_host_reqs) > 0 || atomic_read (&p->nr_ending) > 0) {
 		h4h_thread_yield ();
 	}
 
+	if (p->unplug_thread) {
+		h4h_thread_stop (p->unplug_thread);
+	}
+	if (p->plug) {
+		h4h_hlm_reqs_plug_destroy (p->plug);
+	}
+
 	/* close hlm_reqs pool */
 	if (p->hlm_reqs_pool) {
 		h4h_hlm_reqs_pool_destroy (p->hlm_reqs_pool);
@@ -193,14 +290,44 @@ void blkio_make_req (h4h_drv_info_t* bdi, void* bio)
 {
 	h4h_blkio_private_t* p = (h4h_blkio_private_t*)H4H_HOST_PRIV(bdi);
 	h4h_blkio_req_t* br = NULL;
-	h4h_hlm_req_t* hr = NULL;
+	h4h_blkio_req_t* prev = NULL;
 
 	/* get blkio */
 	if ((br = __get_blkio_req ((struct bio*)bio)) == NULL) {
 		h4h_error ("__get_blkio_req () failed");
-		goto fail;
+		return;
 	}
 
+	/* lock a global mutex -- this function must be finished as soon as possible */
+	h4h_sema_lock (&p->host_lock);
+
+	if (!h4h_hlm_reqs_plug_can_merge (p->plug, br)) {
+		/* keep the order: a plugged req goes first */
+		if (p->plug && (prev = h4h_hlm_reqs_plug_flush (p->plug)) != NULL)
+			__blkio_submit (bdi, prev);
+		__blkio_submit (bdi, br);
+	} else if (atomic_read (&p->nr_host_reqs) == 0 && h4h_hlm_reqs_plug_is_empty (p->plug)) {
+		/* nothing is in flight; there is no reason to wait */
+		__blkio_submit (bdi, br);
+	} else {
+		if ((prev = h4h_hlm_reqs_plug_add (p->plug, br)) != NULL)
+			__blkio_submit (bdi, prev);
+		/* the bios in flight might have finished in the meantime */
+		if (atomic_read (&p->nr_host_reqs) == 0 &&
+			(prev = h4h_hlm_reqs_plug_flush (p->plug)) != NULL)
+			__blkio_submit (bdi, prev);
+	}
+
+	/* ulock a global mutex */
+	h4h_sema_unlock (&p->host_lock);
+}
+
+/* it must be called with host_lock */
+static void __blkio_submit (h4h_drv_info_t* bdi, h4h_blkio_req_t* br)
+{
+	h4h_blkio_private_t* p = (h4h_blkio_private_t*)H4H_HOST_PRIV(bdi);
+	h4h_hlm_req_t* hr = NULL;
+
 	/* get a free hlm_req from the hlm_reqs_pool */
 	if ((hr = h4h_hlm_reqs_pool_get_item (p->hlm_reqs_pool)) == NULL) {
 		h4h_error ("h4h_hlm_reqs_pool_get_item () failed");
@@ -213,9 +340,6 @@ void blkio_make_req (h4h_drv_info_t* bdi, void* bio)
 		goto fail;
 	}
 
-	/* lock a global mutex -- this function must be finished as soon as possible */
-	h4h_sema_lock (&p->host_lock);
-
 	/* if success, increase # of host reqs */
 	atomic_inc (&p->nr_host_reqs);
 
@@ -229,38 +353,38 @@ void blkio_make_req (h4h_drv_info_t* bdi, void* bio)
 		atomic_dec (&p->nr_host_reqs);
 	}
 
-	/* ulock a global mutex */
-	h4h_sema_unlock (&p->host_lock);
-
 	return;
 
 fail:
 	if (hr)
 		h4h_hlm_reqs_pool_free_item (p->hlm_reqs_pool, hr);
 	if (br)
-		__free_blkio_req (br);
+		h4h_hlm_reqs_plug_end_req (br, __end_blkio_req, 1);
 }
 
 void blkio_end_req (h4h_drv_info_t* bdi, h4h_hlm_req_t* hr)
 {
 	h4h_blkio_private_t* p = (h4h_blkio_private_t*)H4H_HOST_PRIV(bdi);
 	h4h_blkio_req_t* br = (h4h_blkio_req_t*)hr->blkio_req;
+	uint8_t ret = hr->ret;
 
-	/* end bio */
-	if (hr->ret == 0)
-		bio_endio ((struct bio*)br->bio);
-	else {
-		h4h_warning ("oops! make_req () failed with %d", hr->ret);
-		bio_io_error ((struct bio*)br->bio);
-	}
-
-	/* free blkio_req */
-	__free_blkio_req (br);
+	atomic_inc (&p->nr_ending);
 
 	/* destroy hlm_req */
 	h4h_hlm_reqs_pool_free_item (p->hlm_reqs_pool, hr);
 
 	/* decreate # of reqs */
 	atomic_dec (&p->nr_host_reqs);
+
+	/* end bio(s) */
+	h4h_hlm_reqs_plug_end_req (br, __end_blkio_req, ret);
+
+	/* a plugged req can go now */
+	if (p->plug && !h4h_hlm_reqs_plug_is_empty (p->plug)) {
+		atomic_inc (&p->nr_unplugs);
+		h4h_thread_wakeup (p->unplug_thread);
+	}
+
+	atomic_dec (&p->nr_ending);
 }
 
@@ -0,0 +1,228 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014-2015 CSAIL, MIT
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+
+/* a microbenchmark of hlm_reqs_pool_write_compaction: GC reads of victim
+ * blocks with a given ratio of valid pages are compacted into GC writes,
+ * and the time per call is reported. every call is checked: the GC writes
+ * must be grouped by punit (keeping the order of the pages of a punit),
+ * and they must carry the valid kernel pages of the reads in order */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "h4h_drv.h"
+#include "umemory.h"
+#include "utime.h"
+#include "hlm_reqs_pool.h"
+
+#define NR_CHANNELS		8
+#define NR_CHIPS		8
+#define NR_PAGES		128
+#define NR_PUNITS		(NR_CHANNELS * NR_CHIPS)
+#define NR_PUNITS_PAGES	(NR_PUNITS * NR_PAGES)
+#define NR_ITERS		200
+
+static h4h_device_params_t np;
+static h4h_llm_req_t src_lrs[NR_PUNITS_PAGES];
+static h4h_llm_req_t dst_lrs[NR_PUNITS_PAGES];
+static h4h_phyaddr_t ppas[NR_PUNITS_PAGES];
+static uint64_t punit_ofs[NR_PUNITS];
+
+/* build GC reads as do_gc does: only the pages with valid data are read */
+static uint64_t __bench_build_reads (
+	h4h_hlm_req_gc_t* src, 
+	int valid_pct, 
+	unsigned int* seed)
+{
+	uint64_t i, k, nr_kps = 0;
+
+	src->nr_llm_reqs = 0;
+	for (i = 0; i < NR_PUNITS_PAGES; i++) {
+		h4h_llm_req_t* r = &src->llm_reqs[src->nr_llm_reqs];
+		int has_valid = 0;
+
+		hlm_reqs_pool_reset_fmain (&r->fmain);
+		hlm_reqs_pool_reset_logaddr (&r->logaddr);
+		for (k = 0; k < np.nr_subpages_per_page; k++) {
+			if (rand_r (seed) % 100 < valid_pct) {
+				r->fmain.kp_stt[k] = KP_STT_DATA;
+				((int64_t*)r->foob.data)[k] = (i << 8) | k;
+				has_valid = 1;
+				nr_kps++;
+			}
+		}
+		if (has_valid) {
+			r->req_type = REQTYPE_GC_READ;
+			r->ptr_hlm_req = (void*)src;
+			src->nr_llm_reqs++;
+		}
+	}
+
+	return nr_kps;
+}
+
+/* pages are allocated round-robin, starting from a random punit */
+static uint64_t __bench_alloc_ppas (uint64_t nr_kps, unsigned int* seed)
+{
+	uint64_t nr_ppas = (nr_kps + np.nr_subpages_per_page - 1) / np.nr_subpages_per_page;
+	uint64_t puid = rand_r (seed) % NR_PUNITS, i;
+
+	for (i = 0; i < nr_ppas; i++) {
+		ppas[i].channel_no = puid % NR_CHANNELS;
+		ppas[i].chip_no = puid / NR_CHANNELS;
+		ppas[i].block_no = 0;
+		ppas[i].page_no = i / NR_PUNITS;
+		ppas[i].punit_id = puid;
+		puid = (puid + 1) % NR_PUNITS;
+	}
+
+	return nr_ppas;
+}
+
+static int __bench_check (
+	h4h_hlm_req_gc_t* dst, 
+	h4h_hlm_req_gc_t* src, 
+	uint64_t nr_ppas)
+{
+	static uint64_t next[NR_PUNITS];
+	uint64_t i, k, d = 0, dk = 0;
+
+	if (dst->nr_llm_reqs != nr_ppas) {
+		printf ("compaction_bench: FAILED (%llu gc writes for %llu ppas)\n", 
+			(unsigned long long)dst->nr_llm_reqs, (unsigned long long)nr_ppas);
+		return 1;
+	}
+
+	/* grouped by punit in ascending order; pages of a punit keep their order */
+	for (i = 0; i < NR_PUNITS; i++)
+		next[i] = 0;
+	for (i = 0; i < dst->nr_llm_reqs; i++) {
+		h4h_phyaddr_t* pa = &dst->llm_reqs[i].phyaddr;
+		if ((i > 0 && pa->punit_id < dst->llm_reqs[i-1].phyaddr.punit_id) ||
+			pa->page_no < next[pa->punit_id]) {
+			printf ("compaction_bench: FAILED (gc write %llu is out of order)\n", 
+				(unsigned long long)i);
+			return 1;
+		}
+		next[pa->punit_id] = pa->page_no + 1;
+	}
+
+	/* the valid kernel pages are moved by pointer in the order of ppas */
+	for (i = 0; i < src->nr_llm_reqs; i++) {
+		h4h_llm_req_t* s = &src->llm_reqs[i];
+		for (k = 0; k < np.nr_subpages_per_page; k++) {
+			h4h_llm_req_t* r = NULL;
+			uint64_t j;
+
+			if (s->fmain.kp_stt[k] != KP_STT_DATA)
+				continue;
+			for (j = 0; j < dst->nr_llm_reqs; j++) {
+				if (dst->llm_reqs[j].phyaddr.punit_id == ppas[d].punit_id &&
+					dst->llm_reqs[j].phyaddr.page_no == ppas[d].page_no) {
+					r = &dst->llm_reqs[j];
+					break;
+				}
+			}
+			if (r == NULL || r->fmain.kp_stt[dk] != KP_STT_DATA ||
+				r->fmain.kp_ptr[dk] != s->fmain.kp_ptr[k] ||
+				r->logaddr.lpa[dk] != ((int64_t*)s->foob.data)[k] ||
+				((int64_t*)r->foob.data)[dk] != ((int64_t*)s->foob.data)[k]) {
+				printf ("compaction_bench: FAILED (kernel page %llu:%llu is lost)\n", 
+					(unsigned long long)i, (unsigned long long)k);
+				return 1;
+			}
+			if (++dk == np.nr_subpages_per_page) {
+				dk = 0;
+				d++;
+			}
+		}
+	}
+
+	return 0;
+}
+
+int main (int argc, char** argv)
+{
+	int valid_pcts[] = { 5, 25, 50, 75, 95 };
+	h4h_hlm_req_gc_t src, dst;
+	h4h_hlm_reqs_gc_pads_t* pads = NULL;
+	unsigned int seed = 1;
+	int i, n, ret = 0;
+
+	np.nr_channels = NR_CHANNELS;
+	np.nr_chips_per_channel = NR_CHIPS;
+	np.nr_pages_per_block = NR_PAGES;
+	np.nr_subpages_per_page = H4H_MAX_PAGES;
+
+	src.llm_reqs = src_lrs;
+	dst.llm_reqs = dst_lrs;
+	hlm_reqs_pool_allocate_llm_reqs (src_lrs, NR_PUNITS_PAGES, RP_MEM_PHY);
+	hlm_reqs_pool_allocate_llm_reqs (dst_lrs, NR_PUNITS_PAGES, RP_MEM_PHY);
+	if ((pads = hlm_reqs_pool_create_gc_pads (
+			src_lrs, NR_PUNITS_PAGES, np.nr_subpages_per_page)) == NULL) {
+		printf ("compaction_bench: hlm_reqs_pool_create_gc_pads failed\n");
+		return 1;
+	}
+
+	printf ("compaction_bench: %d punits x %d pages, %llu kernel pages per page\n", 
+		NR_PUNITS, NR_PAGES, (unsigned long long)np.nr_subpages_per_page);
+
+	for (n = 0; n < sizeof (valid_pcts) / sizeof (valid_pcts[0]); n++) {
+		uint64_t total_us = 0, total_reads = 0;
+
+		for (i = 0; i < NR_ITERS && ret == 0; i++) {
+			h4h_stopwatch_t sw;
+			uint64_t nr_kps, nr_ppas;
+
+			nr_kps = __bench_build_reads (&src, valid_pcts[n], &seed);
+			nr_ppas = __bench_alloc_ppas (nr_kps, &seed);
+
+			h4h_stopwatch_start (&sw);
+			hlm_reqs_pool_write_compaction (&dst, &src, ppas, nr_ppas, punit_ofs, &np);
+			total_us += h4h_stopwatch_get_elapsed_time_us (&sw);
+			total_reads += src.nr_llm_reqs;
+
+			/* checking is slow; do it for a few calls only */
+			if (i < 4)
+				ret = __bench_check (&dst, &src, nr_ppas);
+		}
+		if (ret)
+			break;
+
+		printf ("compaction_bench: valid %2d%%: %6llu gc reads/call, %8.2f us/call, %6.2f ns/gc read\n", 
+			valid_pcts[n], 
+			(unsigned long long)(total_reads / NR_ITERS),
+			(double)total_us / NR_ITERS,
+			total_reads ? (double)total_us * 1000 / total_reads : 0.0);
+	}
+
+	hlm_reqs_pool_destroy_gc_pads (pads, src_lrs);
+
+	if (ret == 0)
+		printf ("compaction_bench: OK\n");
+	return ret;
+}
@@ -0,0 +1,307 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014-2015 CSAIL, MIT
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+
+/* a stress test of the admission credits of llm_mq: submitters send reads,
+ * writes and rmws to random punits through llm_mq_make_req (), which
+ * sleeps when it runs out of credits, and a fake device completes them
+ * after a random delay. the reqs that are sent and not done must stay
+ * within the global and the punit credits (a req whose credit was just
+ * returned is still counted until its end_req, so one more is allowed), a
+ * punit must not be given two reqs at once, and all the reqs must be done.
+ * it fails if the submitters get stuck; e.g., if a credit is leaked or if
+ * rmws that hold a credit each wait for the other ones */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "h4h_drv.h"
+#include "umemory.h"
+#include "ftl_params.h"
+#include "pmu.h"
+#include "llm_mq.h"
+#include "queue/pu_queue.h"
+
+#define NR_CHANNELS		2
+#define NR_CHIPS		4
+#define NR_PUNITS		(NR_CHANNELS * NR_CHIPS)
+#define NR_SUBMITTERS	8
+#define NR_REQS			2000	/* per submitter */
+#define NR_LPAS			64
+#define TIMEOUT_SEC		10
+
+typedef struct {
+	const char* name;
+	int max_inflight;
+	int punit_max_inflight;	/* 0: the ring size */
+	int nr_dispatchers;
+	int rmw_percent;
+} test_phase_t;
+
+static test_phase_t phases[] = {
+	{ "a credit in total", 1, 2, 1, 10 },
+	{ "few credits", 8, 2, 2, 10 },
+	{ "rmws on few credits", 8, 2, 2, 70 },
+	{ "default punit credits", 64, 0, 2, 10 },
+};
+
+static h4h_drv_info_t _bdi;
+static h4h_drv_info_t* bdi = &_bdi;
+static test_phase_t* phase = NULL;
+
+/* the fake device serves reqs in their arrival order */
+static pthread_mutex_t dev_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t dev_cond = PTHREAD_COND_INITIALIZER;
+static h4h_llm_req_t* dev_reqs[NR_PUNITS * 2];
+static uint32_t dev_head = 0, dev_nr_reqs = 0;
+static uint8_t dev_busy[NR_PUNITS];
+
+static volatile int64_t nr_inflight = 0;
+static volatile int64_t nr_punit_inflight[NR_PUNITS];
+static volatile int64_t max_inflight = 0;
+static volatile int64_t max_punit_inflight = 0;
+static volatile uint64_t nr_done = 0;
+static volatile int failed = 0;
+static volatile int stop = 0;
+
+static void __test_max (volatile int64_t* max, int64_t v)
+{
+	int64_t old;
+
+	while ((old = *max) < v && !__sync_bool_compare_and_swap (max, old, v))
+		;
+}
+
+static int __test_is_rmw (h4h_llm_req_t* r)
+{
+	return h4h_is_rmw (r->req_type);
+}
+
+static uint32_t __test_dm_make_req (h4h_drv_info_t* bdi, h4h_llm_req_t* r)
+{
+	uint64_t punit = r->phyaddr.punit_id;
+
+	if (__sync_lock_test_and_set (&dev_busy[punit], 1) != 0) {
+		printf ("llm_credits_test: FAILED (punit %llu gets two reqs at once)\n", 
+			(unsigned long long)punit);
+		failed = 1;
+	}
+
+	pthread_mutex_lock (&dev_lock);
+	if (dev_nr_reqs == NR_PUNITS * 2) {
+		printf ("llm_credits_test: FAILED (too many reqs in the device)\n");
+		failed = 1;
+		pthread_mutex_unlock (&dev_lock);
+		return 1;
+	}
+	dev_reqs[(dev_head + dev_nr_reqs++) % (NR_PUNITS * 2)] = r;
+	pthread_cond_signal (&dev_cond);
+	pthread_mutex_unlock (&dev_lock);
+
+	return 0;
+}
+
+static void* __test_device (void* arg)
+{
+	unsigned int seed = 31;
+
+	for (;;) {
+		h4h_llm_req_t* r = NULL;
+
+		pthread_mutex_lock (&dev_lock);
+		while (dev_nr_reqs == 0 && !stop)
+			pthread_cond_wait (&dev_cond, &dev_lock);
+		if (dev_nr_reqs == 0) {
+			pthread_mutex_unlock (&dev_lock);
+			break;
+		}
+		r = dev_reqs[dev_head];
+		dev_head = (dev_head + 1) % (NR_PUNITS * 2);
+		dev_nr_reqs--;
+		pthread_mutex_unlock (&dev_lock);
+
+		if (rand_r (&seed) % 4 == 0)
+			usleep (rand_r (&seed) % 20);
+		__sync_lock_release (&dev_busy[r->phyaddr.punit_id]);
+		bdi->ptr_llm_inf->end_req (bdi, r);
+	}
+
+	return NULL;
+}
+
+static void __test_hlm_end_req (h4h_drv_info_t* bdi, h4h_llm_req_t* r)
+{
+	h4h_hlm_req_t* hr = (h4h_hlm_req_t*)r->ptr_hlm_req;
+
+	if (!__test_is_rmw (r))
+		__sync_fetch_and_sub (&nr_punit_inflight[r->phyaddr.punit_id], 1);
+	__sync_fetch_and_sub (&nr_inflight, 1);
+	__sync_fetch_and_add (&nr_done, 1);
+	h4h_free (r);
+	h4h_free (hr);
+}
+
+static void* __test_submitter (void* arg)
+{
+	unsigned int seed = (unsigned int)(uintptr_t)arg;
+	int64_t punit_max = (phase->punit_max_inflight > 0) ? 
+		phase->punit_max_inflight : H4H_PU_QUEUE_RING_SIZE;
+	uint64_t i;
+
+	for (i = 0; i < NR_REQS && !failed; i++) {
+		h4h_hlm_req_t* hr = NULL;
+		h4h_llm_req_t* r = NULL;
+		uint64_t punit = rand_r (&seed) % NR_PUNITS;
+		int is_rmw;
+		int64_t n;
+
+		if ((hr = (h4h_hlm_req_t*)h4h_zmalloc (sizeof (h4h_hlm_req_t))) == NULL ||
+			(r = (h4h_llm_req_t*)h4h_zmalloc (sizeof (h4h_llm_req_t))) == NULL) {
+			failed = 1;
+			break;
+		}
+		h4h_stopwatch_start (&hr->sw);
+		r->ptr_hlm_req = (void*)hr;
+		r->logaddr.lpa[0] = rand_r (&seed) % NR_LPAS;
+		r->phyaddr.punit_id = punit;
+		if (rand_r (&seed) % 100 < phase->rmw_percent) {
+			/* an rmw takes a credit of each punit, and they can be the same */
+			r->req_type = REQTYPE_RMW_READ;
+			r->phyaddr_src.punit_id = punit;
+			r->phyaddr_dst.punit_id = rand_r (&seed) % NR_PUNITS;
+		} else if (rand_r (&seed) % 2)
+			r->req_type = REQTYPE_WRITE;
+		else
+			r->req_type = REQTYPE_READ;
+
+		/* it sleeps here if there are no credits; 'r' can be done before
+		 * it returns */
+		is_rmw = __test_is_rmw (r);
+		llm_mq_make_req (bdi, r);
+		if (!is_rmw) {
+			n = __sync_add_and_fetch (&nr_punit_inflight[punit], 1);
+			__test_max (&max_punit_inflight, n);
+			if (n > punit_max + 1) {
+				printf ("llm_credits_test: FAILED (%lld reqs on punit %llu; %lld credits)\n", 
+					(long long)n, (unsigned long long)punit, (long long)punit_max);
+				failed = 1;
+			}
+		}
+		n = __sync_add_and_fetch (&nr_inflight, 1);
+		__test_max (&max_inflight, n);
+		if (n > phase->max_inflight + 1) {
+			printf ("llm_credits_test: FAILED (%lld reqs in flight; %d credits)\n", 
+				(long long)n, phase->max_inflight);
+			failed = 1;
+		}
+	}
+
+	return NULL;
+}
+
+static void* __test_watchdog (void* arg)
+{
+	uint64_t last = (uint64_t)-1;
+
+	while (!stop) {
+		sleep (TIMEOUT_SEC);
+		if (!stop && nr_done == last) {
+			printf ("llm_credits_test: FAILED (%s: stuck at %llu reqs)\n", 
+				phase->name, (unsigned long long)nr_done);
+			exit (1);
+		}
+		last = nr_done;
+	}
+
+	return NULL;
+}
+
+static int __test_run_phase (test_phase_t* ph)
+{
+	pthread_t submitters[NR_SUBMITTERS], device, watchdog;
+	int i;
+
+	phase = ph;
+	nr_inflight = max_inflight = max_punit_inflight = 0;
+	nr_done = 0;
+	stop = 0;
+	_param_llm_max_inflight = ph->max_inflight;
+	_param_llm_punit_max_inflight = ph->punit_max_inflight;
+	_param_llm_nr_dispatchers = ph->nr_dispatchers;
+	if (llm_mq_create (bdi) != 0) {
+		printf ("llm_credits_test: llm_mq_create failed\n");
+		return 1;
+	}
+
+	pthread_create (&device, NULL, __test_device, NULL);
+	pthread_create (&watchdog, NULL, __test_watchdog, NULL);
+	for (i = 0; i < NR_SUBMITTERS; i++)
+		pthread_create (&submitters[i], NULL, __test_submitter, (void*)(uintptr_t)(i + 1));
+	for (i = 0; i < NR_SUBMITTERS; i++)
+		pthread_join (submitters[i], NULL);
+	while (!failed && nr_done != NR_SUBMITTERS * NR_REQS)
+		usleep (1000);
+	if (failed)
+		return 1;
+
+	llm_mq_destroy (bdi);
+	pthread_mutex_lock (&dev_lock);
+	stop = 1;
+	pthread_cond_signal (&dev_cond);
+	pthread_mutex_unlock (&dev_lock);
+	pthread_join (device, NULL);
+
+	printf ("llm_credits_test: %s: %llu reqs, up to %lld in flight (%d credits), %lld on a punit\n", 
+		ph->name, (unsigned long long)nr_done, (long long)max_inflight, 
+		ph->max_inflight, (long long)max_punit_inflight);
+
+	return 0;
+}
+
+int main (int argc, char** argv)
+{
+	static h4h_hlm_inf_t hlm_inf = { .end_req = __test_hlm_end_req };
+	static h4h_dm_inf_t dm_inf = { .make_req = __test_dm_make_req };
+	int i;
+
+	bdi->parm_dev.nr_channels = NR_CHANNELS;
+	bdi->parm_dev.nr_chips_per_channel = NR_CHIPS;
+	bdi->ptr_hlm_inf = &hlm_inf;
+	bdi->ptr_dm_inf = &dm_inf;
+	bdi->ptr_llm_inf = &_llm_mq_inf;
+	pmu_create (bdi);
+
+	for (i = 0; i < sizeof (phases) / sizeof (phases[0]); i++) {
+		if (__test_run_phase (&phases[i]) != 0)
+			return 1;
+	}
+
+	pmu_destory (bdi);
+	printf ("llm_credits_test: OK\n");
+	return 0;
+}
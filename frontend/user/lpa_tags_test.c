@@ -0,0 +1,287 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014-2015 CSAIL, MIT
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+
+/* a stress test of the lpa ordering tags of the llm queues: producers
+ * enqueue reads and writes to random queues, and consumers dequeue, move,
+ * and remove them concurrently. lpas share their low 32 bits or are close
+ * to 2^64, and the lpa table is made to collide and grow. a read must see
+ * the last write queued before it (RAW), and a write must come after the
+ * last one (WAW). it fails if they are served out of order or if the queue
+ * gets stuck */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "h4h_drv.h"
+#include "umemory.h"
+#include "queue/prior_queue.h"
+
+#define NR_QUEUES		8
+#define NR_PRODUCERS	4
+#define NR_CONSUMERS	8
+#define NR_REQS			500000
+#define TIMEOUT_SEC		10
+
+typedef struct {
+	uint32_t idx;		/* the index of its lpa in lpas[] */
+	uint8_t is_write;
+	uint64_t seq;		/* # of reqs to the lpa queued before it + 1 */
+	uint64_t version;	/* the seq of the last write queued before it */
+} test_req_t;
+
+typedef struct {
+	const char* name;
+	int64_t max_size;	/* of the queue */
+	uint32_t nr_lpas;
+	uint64_t max_inflight;
+} test_phase_t;
+
+static test_phase_t phases[] = {
+	{ "bounded, colliding lpas", 64, 48, 64 },
+	{ "bounded, few lpas", 256, 4, 256 },
+	{ "unbounded, table growth", INFINITE_PRIOR_QUEUE, 8192, 8192 },
+};
+
+static h4h_prior_queue_t* mq = NULL;
+static test_phase_t* phase = NULL;
+static uint64_t* lpas = NULL;
+
+/* per lpa; 'issued' and 'last_write' are updated by producers under
+ * 'issue_lock', and the others by the consumer that holds the lpa */
+static uint64_t* issued = NULL;
+static uint64_t* last_write = NULL;
+static volatile uint64_t* done = NULL;
+static volatile uint64_t* version = NULL;
+
+static pthread_mutex_t issue_lock = PTHREAD_MUTEX_INITIALIZER;
+static volatile uint64_t nr_queued = 0;
+static volatile uint64_t nr_served = 0;
+static volatile int failed = 0;
+static volatile int stop = 0;
+
+/* half of lpas share the low 32 bits; the others are close to 2^64 */
+static void __test_make_lpas (uint32_t nr_lpas)
+{
+	uint32_t i;
+
+	for (i = 0; i < nr_lpas; i++) {
+		if (i % 2 == 0)
+			lpas[i] = ((uint64_t)(i / 2) << 32) | 0x1234ULL;
+		else
+			lpas[i] = -2ULL - i;
+	}
+}
+
+static void* __test_producer (void* arg)
+{
+	unsigned int seed = (unsigned int)(uintptr_t)arg;
+
+	while (!failed) {
+		test_req_t* r = NULL;
+		uint64_t qid;
+
+		if (__sync_fetch_and_add (&nr_queued, 0) >= NR_REQS)
+			break;
+		if (nr_queued - nr_served >= phase->max_inflight) {
+			sched_yield ();
+			continue;
+		}
+		if ((r = (test_req_t*)h4h_malloc (sizeof (test_req_t))) == NULL) {
+			failed = 1;
+			break;
+		}
+		r->idx = rand_r (&seed) % phase->nr_lpas;
+		r->is_write = rand_r (&seed) % 2;
+		qid = rand_r (&seed) % NR_QUEUES;
+
+		/* the order of reqs to an lpa is the order they get tags; the
+		 * req is filled in before a consumer can see it */
+		for (;;) {
+			pthread_mutex_lock (&issue_lock);
+			r->seq = issued[r->idx] + 1;
+			r->version = last_write[r->idx];
+			if (h4h_prior_queue_enqueue (mq, qid, lpas[r->idx], (void*)r) == 0)
+				break;
+			pthread_mutex_unlock (&issue_lock);
+			if (failed) {
+				h4h_free (r);
+				return NULL;
+			}
+			sched_yield ();
+		}
+		issued[r->idx] = r->seq;
+		if (r->is_write)
+			last_write[r->idx] = r->seq;
+		__sync_fetch_and_add (&nr_queued, 1);
+		pthread_mutex_unlock (&issue_lock);
+	}
+
+	return NULL;
+}
+
+static void* __test_consumer (void* arg)
+{
+	unsigned int seed = (unsigned int)(uintptr_t)arg;
+	uint64_t qid = seed % NR_QUEUES;
+
+	while (!stop && !failed) {
+		h4h_prior_queue_item_t* q = NULL;
+		test_req_t* r = NULL;
+
+		qid = (qid + 1) % NR_QUEUES;
+		if ((r = (test_req_t*)h4h_prior_queue_dequeue (mq, qid, &q)) == NULL) {
+			sched_yield ();
+			continue;
+		}
+
+		/* sometimes give it back to another queue, as llm_mq does for
+		 * reqs that cannot be served now */
+		if (rand_r (&seed) % 16 == 0) {
+			h4h_prior_queue_move (mq, rand_r (&seed) % NR_QUEUES, q);
+			continue;
+		}
+
+		if (done[r->idx] != r->seq - 1) {
+			printf ("lpa_tags_test: FAILED (lpa %llx: req %llu is served after %llu)\n", 
+				(unsigned long long)lpas[r->idx], 
+				(unsigned long long)r->seq, (unsigned long long)done[r->idx]);
+			failed = 1;
+			break;
+		}
+		if (version[r->idx] != r->version) {
+			printf ("lpa_tags_test: FAILED (lpa %llx: %s %llu sees write %llu, not %llu)\n", 
+				(unsigned long long)lpas[r->idx], r->is_write ? "write" : "read",
+				(unsigned long long)r->seq, (unsigned long long)version[r->idx], 
+				(unsigned long long)r->version);
+			failed = 1;
+			break;
+		}
+		if (rand_r (&seed) % 8 == 0)
+			usleep (rand_r (&seed) % 20);
+		if (r->is_write)
+			version[r->idx] = r->seq;
+		done[r->idx] = r->seq;
+		__sync_synchronize ();
+
+		h4h_prior_queue_remove (mq, q);
+		__sync_fetch_and_add (&nr_served, 1);
+		h4h_free (r);
+	}
+
+	return NULL;
+}
+
+static void* __test_watchdog (void* arg)
+{
+	uint64_t last = (uint64_t)-1;
+
+	while (!stop) {
+		sleep (TIMEOUT_SEC);
+		if (!stop && nr_served == last) {
+			printf ("lpa_tags_test: FAILED (%s: stuck at %llu of %llu reqs)\n", 
+				phase->name, (unsigned long long)nr_served, 
+				(unsigned long long)nr_queued);
+			exit (1);
+		}
+		last = nr_served;
+	}
+
+	return NULL;
+}
+
+static int __test_run_phase (test_phase_t* ph)
+{
+	pthread_t producers[NR_PRODUCERS], consumers[NR_CONSUMERS], watchdog;
+	uint32_t bits;
+	int i;
+
+	phase = ph;
+	nr_queued = nr_served = 0;
+	stop = 0;
+	if ((mq = h4h_prior_queue_create (NR_QUEUES, ph->max_size)) == NULL ||
+		(lpas = (uint64_t*)h4h_zmalloc (sizeof (uint64_t) * ph->nr_lpas)) == NULL ||
+		(issued = (uint64_t*)h4h_zmalloc (sizeof (uint64_t) * ph->nr_lpas)) == NULL ||
+		(last_write = (uint64_t*)h4h_zmalloc (sizeof (uint64_t) * ph->nr_lpas)) == NULL ||
+		(done = (uint64_t*)h4h_zmalloc (sizeof (uint64_t) * ph->nr_lpas)) == NULL ||
+		(version = (uint64_t*)h4h_zmalloc (sizeof (uint64_t) * ph->nr_lpas)) == NULL) {
+		printf ("lpa_tags_test: allocation failed\n");
+		return 1;
+	}
+	__test_make_lpas (ph->nr_lpas);
+	bits = mq->tags.bits;
+
+	for (i = 0; i < NR_CONSUMERS; i++)
+		pthread_create (&consumers[i], NULL, __test_consumer, (void*)(uintptr_t)(i + 1));
+	for (i = 0; i < NR_PRODUCERS; i++)
+		pthread_create (&producers[i], NULL, __test_producer, (void*)(uintptr_t)(i + 101));
+	pthread_create (&watchdog, NULL, __test_watchdog, NULL);
+
+	for (i = 0; i < NR_PRODUCERS; i++)
+		pthread_join (producers[i], NULL);
+	while (!failed && nr_served != nr_queued)
+		usleep (1000);
+	stop = 1;
+	for (i = 0; i < NR_CONSUMERS; i++)
+		pthread_join (consumers[i], NULL);
+
+	if (!failed && (h4h_prior_queue_get_nr_items (mq) != 0 || 
+			h4h_lpa_tags_get_nr_lpas (&mq->tags) != 0)) {
+		printf ("lpa_tags_test: FAILED (%s: %llu items and %llu lpas are left)\n", 
+			ph->name, (unsigned long long)h4h_prior_queue_get_nr_items (mq), 
+			(unsigned long long)h4h_lpa_tags_get_nr_lpas (&mq->tags));
+		failed = 1;
+	}
+	if (!failed)
+		printf ("lpa_tags_test: %s: %llu reqs, %u lpas, table 2^%u -> 2^%u slots\n", 
+			ph->name, (unsigned long long)nr_served, ph->nr_lpas, bits, mq->tags.bits);
+
+	/* reqs left by a failure are not freed */
+	if (!failed)
+		h4h_prior_queue_destroy (mq);
+	h4h_free ((void*)version);
+	h4h_free ((void*)done);
+	h4h_free (last_write);
+	h4h_free (issued);
+	h4h_free (lpas);
+
+	return failed;
+}
+
+int main (int argc, char** argv)
+{
+	int i;
+
+	for (i = 0; i < sizeof (phases) / sizeof (phases[0]); i++) {
+		if (__test_run_phase (&phases[i]) != 0)
+			return 1;
+	}
+
+	printf ("lpa_tags_test: OK\n");
+	return 0;
+}
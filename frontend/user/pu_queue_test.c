@@ -0,0 +1,305 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014-2015 CSAIL, MIT
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+
+/* a stress test of the MPSC rings of pu_queue: producers push reqs to
+ * random rings, which are small enough to wrap around and get full, and a
+ * single consumer finds them through the work bitmap only, as the llm_mq
+ * dispatcher does. it holds some reqs in flight before it removes them. a
+ * req must be seen exactly once, in the order its producer pushed it to the
+ * ring, and the reqs to an lpa must be served one at a time in the order
+ * they were queued across all the rings. a few lpas are shared by all the
+ * producers; their order is only known to the queue, so they are checked
+ * for being served one at a time. it fails if any of them is broken or if
+ * the queue gets stuck (e.g., a lost work bit or crossed tags) */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "h4h_drv.h"
+#include "umemory.h"
+#include "queue/pu_queue.h"
+
+#define NR_PRODUCERS	6
+#define NR_REQS			300000
+#define MAX_INFLIGHT	16
+#define NR_SHARED_LPAS	4
+#define TIMEOUT_SEC		10
+#define NO_LPA			((uint64_t)-1)
+
+typedef struct {
+	h4h_pu_queue_item_t q;
+	uint32_t producer;
+	uint32_t idx;		/* the index of its lpa (or -1 if it has none) */
+	uint64_t seq;		/* # of reqs to the lpa queued before it + 1 (0 if shared) */
+	uint64_t ring_seq;	/* # of reqs of its producer to the ring + 1 */
+} test_req_t;
+
+typedef struct {
+	const char* name;
+	uint64_t nr_queues;
+	int64_t ring_size;	/* 0: the default */
+	uint32_t nr_lpas;	/* a multiple of NR_PRODUCERS; the shared ones follow */
+} test_phase_t;
+
+static test_phase_t phases[] = {
+	{ "tiny rings over two bitmap words", 70, 4, 36 },
+	{ "a single ring", 1, 2, 12 },
+	{ "default rings, many lpas", 16, 0, 4096 },
+};
+
+static h4h_pu_queue_t* mq = NULL;
+static test_phase_t* phase = NULL;
+
+/* 'issued' of an lpa is only updated by the producer that owns it, and
+ * the others only by the consumer */
+static uint64_t* issued = NULL;
+static uint64_t* done = NULL;
+static uint8_t* busy = NULL;
+static uint64_t* last_seen = NULL;	/* [producer][ring] */
+
+static volatile uint64_t nr_queued = 0;
+static volatile uint64_t nr_served = 0;
+static volatile int failed = 0;
+static volatile int stop = 0;
+
+static inline uint64_t __test_lpa (uint32_t idx)
+{
+	/* lpas are spread over the stripes and buckets of the tag table */
+	return ((uint64_t)idx << 20) | 0x5A5;
+}
+
+static void* __test_producer (void* arg)
+{
+	uint32_t id = (uint32_t)(uintptr_t)arg;
+	unsigned int seed = id + 101;
+	uint64_t* ring_seq = NULL;
+
+	if ((ring_seq = (uint64_t*)h4h_zmalloc (sizeof (uint64_t) * phase->nr_queues)) == NULL) {
+		failed = 1;
+		return NULL;
+	}
+
+	while (!failed && __sync_fetch_and_add (&nr_queued, 1) < NR_REQS) {
+		test_req_t* r = NULL;
+		uint64_t qid = rand_r (&seed) % phase->nr_queues;
+
+		if ((r = (test_req_t*)h4h_malloc (sizeof (test_req_t))) == NULL) {
+			failed = 1;
+			break;
+		}
+		r->producer = id;
+		r->ring_seq = ++ring_seq[qid];
+
+		/* a producer only sends the lpas it owns, so their order is the
+		 * order it queues them in */
+		if (rand_r (&seed) % 4 == 0) {
+			r->idx = (uint32_t)-1;
+			r->seq = 0;
+		} else if (rand_r (&seed) % 4 == 0) {
+			r->idx = phase->nr_lpas + rand_r (&seed) % NR_SHARED_LPAS;
+			r->seq = 0;
+		} else {
+			r->idx = (rand_r (&seed) % (phase->nr_lpas / NR_PRODUCERS)) * NR_PRODUCERS + id;
+			r->seq = ++issued[r->idx];
+		}
+
+		/* it waits inside if the ring is full */
+		h4h_pu_queue_enqueue (mq, qid, 
+			(r->idx == (uint32_t)-1) ? NO_LPA : __test_lpa (r->idx), (void*)r, &r->q);
+	}
+
+	h4h_free (ring_seq);
+	return NULL;
+}
+
+static void __test_complete (test_req_t* r)
+{
+	if (r->idx != (uint32_t)-1) {
+		if (r->seq > 0)
+			done[r->idx] = r->seq;
+		busy[r->idx] = 0;
+	}
+	__sync_synchronize ();
+	h4h_pu_queue_remove (mq, &r->q);
+	__sync_fetch_and_add (&nr_served, 1);
+	h4h_free (r);
+}
+
+static void* __test_consumer (void* arg)
+{
+	unsigned int seed = 7;
+	test_req_t* inflight[MAX_INFLIGHT];
+	uint32_t head = 0, nr_inflight = 0;
+
+	while (!stop && !failed) {
+		uint64_t qid, nr = 0;
+
+		/* only the rings with their work bits set are visited */
+		for (qid = h4h_pu_queue_next_work (mq, 0); 
+				qid < mq->nr_queues && !failed; 
+				qid = h4h_pu_queue_next_work (mq, qid + 1)) {
+			h4h_pu_queue_item_t* q = NULL;
+			test_req_t* r = NULL;
+			uint64_t* seen = NULL;
+
+			if ((r = (test_req_t*)h4h_pu_queue_dequeue (mq, qid, &q)) == NULL)
+				continue;
+
+			seen = &last_seen[r->producer * phase->nr_queues + qid];
+			if (q != &r->q || r->q.qid != qid || *seen + 1 != r->ring_seq) {
+				printf ("pu_queue_test: FAILED (ring %llu: req %llu of producer %u is seen after %llu)\n", 
+					(unsigned long long)qid, (unsigned long long)r->ring_seq, 
+					r->producer, (unsigned long long)*seen);
+				failed = 1;
+				break;
+			}
+			*seen = r->ring_seq;
+			if (r->idx != (uint32_t)-1 && busy[r->idx]) {
+				printf ("pu_queue_test: FAILED (lpa %llx: two reqs are served at once)\n", 
+					(unsigned long long)__test_lpa (r->idx));
+				failed = 1;
+				break;
+			}
+			if (r->seq > 0 && done[r->idx] != r->seq - 1) {
+				printf ("pu_queue_test: FAILED (lpa %llx: req %llu is served after %llu)\n", 
+					(unsigned long long)__test_lpa (r->idx), 
+					(unsigned long long)r->seq, (unsigned long long)done[r->idx]);
+				failed = 1;
+				break;
+			}
+			if (r->idx != (uint32_t)-1)
+				busy[r->idx] = 1;
+
+			/* keep it in flight for a while */
+			if (nr_inflight == MAX_INFLIGHT) {
+				__test_complete (inflight[head]);
+				head = (head + 1) % MAX_INFLIGHT;
+				nr_inflight--;
+			}
+			inflight[(head + nr_inflight) % MAX_INFLIGHT] = r;
+			nr_inflight++;
+			nr++;
+		}
+
+		/* complete the oldest one if nothing could be taken, or sometimes */
+		if (nr_inflight > 0 && (nr == 0 || rand_r (&seed) % 2 == 0)) {
+			__test_complete (inflight[head]);
+			head = (head + 1) % MAX_INFLIGHT;
+			nr_inflight--;
+		} else if (nr == 0) {
+			sched_yield ();
+		}
+	}
+
+	return NULL;
+}
+
+static void* __test_watchdog (void* arg)
+{
+	uint64_t last = (uint64_t)-1;
+
+	while (!stop) {
+		sleep (TIMEOUT_SEC);
+		if (!stop && nr_served == last) {
+			printf ("pu_queue_test: FAILED (%s: stuck at %llu of %llu reqs)\n", 
+				phase->name, (unsigned long long)nr_served, 
+				(unsigned long long)h4h_pu_queue_get_nr_items (mq) + nr_served);
+			exit (1);
+		}
+		last = nr_served;
+	}
+
+	return NULL;
+}
+
+static int __test_run_phase (test_phase_t* ph)
+{
+	pthread_t producers[NR_PRODUCERS], consumer, watchdog;
+	int i;
+
+	phase = ph;
+	nr_queued = nr_served = 0;
+	stop = 0;
+	if ((mq = h4h_pu_queue_create (ph->nr_queues, ph->ring_size)) == NULL ||
+		(issued = (uint64_t*)h4h_zmalloc (sizeof (uint64_t) * ph->nr_lpas)) == NULL ||
+		(done = (uint64_t*)h4h_zmalloc (sizeof (uint64_t) * ph->nr_lpas)) == NULL ||
+		(busy = (uint8_t*)h4h_zmalloc (ph->nr_lpas + NR_SHARED_LPAS)) == NULL ||
+		(last_seen = (uint64_t*)h4h_zmalloc 
+			(sizeof (uint64_t) * NR_PRODUCERS * ph->nr_queues)) == NULL) {
+		printf ("pu_queue_test: allocation failed\n");
+		return 1;
+	}
+
+	pthread_create (&consumer, NULL, __test_consumer, NULL);
+	for (i = 0; i < NR_PRODUCERS; i++)
+		pthread_create (&producers[i], NULL, __test_producer, (void*)(uintptr_t)i);
+	pthread_create (&watchdog, NULL, __test_watchdog, NULL);
+
+	for (i = 0; i < NR_PRODUCERS; i++)
+		pthread_join (producers[i], NULL);
+	while (!failed && nr_served != NR_REQS)
+		usleep (1000);
+	stop = 1;
+	pthread_join (consumer, NULL);
+
+	if (!failed && (h4h_pu_queue_get_nr_items (mq) != 0 || 
+			h4h_pu_queue_has_work (mq) || !h4h_pu_queue_is_all_empty (mq))) {
+		printf ("pu_queue_test: FAILED (%s: %llu items are left)\n", 
+			ph->name, (unsigned long long)h4h_pu_queue_get_nr_items (mq));
+		failed = 1;
+	}
+	if (!failed)
+		printf ("pu_queue_test: %s: %llu reqs, %llu rings of %llu slots, %u lpas\n", 
+			ph->name, (unsigned long long)nr_served, 
+			(unsigned long long)mq->nr_queues, (unsigned long long)mq->ring_size, 
+			ph->nr_lpas + NR_SHARED_LPAS);
+
+	/* reqs left by a failure are not freed */
+	if (!failed)
+		h4h_pu_queue_destroy (mq);
+	h4h_free (last_seen);
+	h4h_free (busy);
+	h4h_free (done);
+	h4h_free (issued);
+
+	return failed;
+}
+
+int main (int argc, char** argv)
+{
+	int i;
+
+	for (i = 0; i < sizeof (phases) / sizeof (phases[0]); i++) {
+		if (__test_run_phase (&phases[i]) != 0)
+			return 1;
+	}
+
+	printf ("pu_queue_test: OK\n");
+	return 0;
+}
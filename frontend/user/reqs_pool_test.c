@@ -0,0 +1,251 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014-2015 CSAIL, MIT
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+
+/* a stress test of hlm_reqs_pool: threads take and free hlm_reqs and the
+ * slabs of their llm_reqs at once, more threads than cpus, so that they
+ * share per-cpu caches and fall back on the lock-free stacks. they hold
+ * more items than the pool starts with, so that it grows while the stacks
+ * are in use. an item or a slab must never be handed out twice, its
+ * llm_reqs must not be touched by others while it is held, and all of them
+ * must be back in the caches and stacks at the end */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "h4h_drv.h"
+#include "umemory.h"
+#include "hlm_reqs_pool.h"
+
+#define NR_THREADS		8
+#define NR_HELD			32	/* per thread */
+#define NR_OPS			300000	/* per thread */
+#define MAX_OBJS		(H4H_HLM_REQS_LFS_CHUNK * H4H_HLM_REQS_LFS_MAX_CHUNKS)
+#define TIMEOUT_SEC		10
+
+static h4h_hlm_reqs_pool_t* pool = NULL;
+static uint8_t* item_held = NULL;	/* by pool_idx */
+static uint8_t* slab_held[H4H_HLM_REQS_NR_SLAB_CLASSES];	/* by slab idx */
+static volatile uint64_t nr_ops = 0;
+static volatile int failed = 0;
+static volatile int stop = 0;
+
+/* llm_reqs are stamped with the item that holds them */
+static void __test_stamp (h4h_hlm_req_t* hr)
+{
+	uint64_t i;
+
+	for (i = 0; i < hr->nr_llm_reqs; i++) {
+		hr->llm_reqs[i].ptr_hlm_req = (void*)hr;
+		hr->llm_reqs[i].logaddr.lpa[0] = (int64_t)i;
+	}
+}
+
+static int __test_check (h4h_hlm_req_t* hr)
+{
+	uint64_t i;
+
+	for (i = 0; i < hr->nr_llm_reqs; i++) {
+		if (hr->llm_reqs[i].ptr_hlm_req != (void*)hr || 
+			hr->llm_reqs[i].logaddr.lpa[0] != (int64_t)i)
+			return 1;
+	}
+	return 0;
+}
+
+static h4h_hlm_req_t* __test_get (unsigned int* seed)
+{
+	h4h_hlm_req_t* hr = NULL;
+	h4h_hlm_reqs_slab_t* slab = NULL;
+
+	if ((hr = h4h_hlm_reqs_pool_get_item (pool)) == NULL) {
+		printf ("reqs_pool_test: FAILED (no item)\n");
+		return NULL;
+	}
+	if (__sync_lock_test_and_set (&item_held[hr->pool_idx], 1) != 0) {
+		printf ("reqs_pool_test: FAILED (item %u is handed out twice)\n", hr->pool_idx);
+		return NULL;
+	}
+	h4h_sema_lock (&hr->done);
+
+	/* a random size, so that all the slab classes are used */
+	hr->nr_llm_reqs = 0;
+	if (rand_r (seed) % 4 != 0) {
+		hr->nr_llm_reqs = 1 + rand_r (seed) % ((rand_r (seed) % 2) ? 8 : H4H_BLKIO_MAX_VECS);
+		if (h4h_hlm_reqs_pool_alloc_llm_reqs (pool, hr, hr->nr_llm_reqs) != 0) {
+			printf ("reqs_pool_test: FAILED (no slab for %llu llm_reqs)\n", 
+				(unsigned long long)hr->nr_llm_reqs);
+			return NULL;
+		}
+		slab = (h4h_hlm_reqs_slab_t*)hr->llm_slab;
+		if (__sync_lock_test_and_set (&slab_held[slab->class][slab->idx], 1) != 0) {
+			printf ("reqs_pool_test: FAILED (slab %u of class %d is handed out twice)\n", 
+				slab->idx, slab->class);
+			return NULL;
+		}
+		__test_stamp (hr);
+	}
+
+	return hr;
+}
+
+static int __test_put (h4h_hlm_req_t* hr)
+{
+	h4h_hlm_reqs_slab_t* slab = (h4h_hlm_reqs_slab_t*)hr->llm_slab;
+
+	if (__test_check (hr) != 0) {
+		printf ("reqs_pool_test: FAILED (llm_reqs of item %u are changed while it is held)\n", 
+			hr->pool_idx);
+		return 1;
+	}
+	if (slab)
+		__sync_lock_release (&slab_held[slab->class][slab->idx]);
+	__sync_lock_release (&item_held[hr->pool_idx]);
+	h4h_hlm_reqs_pool_free_item (pool, hr);
+
+	return 0;
+}
+
+static void* __test_worker (void* arg)
+{
+	unsigned int seed = (unsigned int)(uintptr_t)arg;
+	h4h_hlm_req_t* held[NR_HELD] = { NULL, };
+	uint64_t op, i;
+
+	for (op = 0; op < NR_OPS && !failed; op++) {
+		i = rand_r (&seed) % NR_HELD;
+		if (held[i] != NULL) {
+			if (__test_put (held[i]) != 0)
+				goto fail;
+			held[i] = NULL;
+		} else if ((held[i] = __test_get (&seed)) == NULL)
+			goto fail;
+		if (rand_r (&seed) % 64 == 0)
+			sched_yield ();
+		__sync_fetch_and_add (&nr_ops, 1);
+	}
+
+	for (i = 0; i < NR_HELD; i++) {
+		if (held[i] != NULL && __test_put (held[i]) != 0)
+			goto fail;
+	}
+	return NULL;
+
+fail:
+	failed = 1;
+	return NULL;
+}
+
+static void* __test_watchdog (void* arg)
+{
+	uint64_t last = (uint64_t)-1;
+
+	while (!stop) {
+		sleep (TIMEOUT_SEC);
+		if (!stop && nr_ops == last) {
+			printf ("reqs_pool_test: FAILED (stuck at %llu ops)\n", 
+				(unsigned long long)nr_ops);
+			exit (1);
+		}
+		last = nr_ops;
+	}
+
+	return NULL;
+}
+
+/* # of objects in a stack; a loop or a lost object shows up as a wrong
+ * count, since all of them must be free now */
+static uint32_t __test_count_stack (h4h_hlm_reqs_lfstack_t* s)
+{
+	uint32_t idx = (uint32_t)atomic64_read (&s->head);
+	uint32_t count = 0;
+
+	while (idx != 0 && count <= s->nr_objs) {
+		idx = s->dir[(idx - 1) / H4H_HLM_REQS_LFS_CHUNK][(idx - 1) % H4H_HLM_REQS_LFS_CHUNK].next;
+		count++;
+	}
+	return count;
+}
+
+int main (int argc, char** argv)
+{
+	pthread_t workers[NR_THREADS], watchdog;
+	uint32_t nr_free = 0;
+	int i, c;
+
+	if ((pool = h4h_hlm_reqs_pool_create (KPAGE_SIZE, KPAGE_SIZE)) == NULL ||
+		(item_held = (uint8_t*)h4h_zmalloc (MAX_OBJS)) == NULL) {
+		printf ("reqs_pool_test: allocation failed\n");
+		return 1;
+	}
+	for (c = 0; c < H4H_HLM_REQS_NR_SLAB_CLASSES; c++) {
+		if ((slab_held[c] = (uint8_t*)h4h_zmalloc (MAX_OBJS)) == NULL) {
+			printf ("reqs_pool_test: allocation failed\n");
+			return 1;
+		}
+	}
+
+	pthread_create (&watchdog, NULL, __test_watchdog, NULL);
+	for (i = 0; i < NR_THREADS; i++)
+		pthread_create (&workers[i], NULL, __test_worker, (void*)(uintptr_t)(i + 1));
+	for (i = 0; i < NR_THREADS; i++)
+		pthread_join (workers[i], NULL);
+	stop = 1;
+	if (failed)
+		return 1;
+
+	/* every item and slab must be free */
+	for (i = 0; i < H4H_HLM_REQS_NR_CACHES; i++)
+		nr_free += pool->caches[i].nr_items;
+	nr_free += __test_count_stack (&pool->items);
+	if (nr_free != (uint32_t)pool->pool_size || pool->items.nr_objs != (uint32_t)pool->pool_size) {
+		printf ("reqs_pool_test: FAILED (%u of %d items are free)\n", nr_free, pool->pool_size);
+		return 1;
+	}
+	for (c = 0; c < H4H_HLM_REQS_NR_SLAB_CLASSES; c++) {
+		if (__test_count_stack (&pool->slabs[c]) != pool->slabs[c].nr_objs) {
+			printf ("reqs_pool_test: FAILED (%u of %u slabs of class %d are free)\n", 
+				__test_count_stack (&pool->slabs[c]), pool->slabs[c].nr_objs, c);
+			return 1;
+		}
+	}
+
+	printf ("reqs_pool_test: %llu ops by %d threads, %d items, slabs =", 
+		(unsigned long long)nr_ops, NR_THREADS, pool->pool_size);
+	for (c = 0; c < H4H_HLM_REQS_NR_SLAB_CLASSES; c++)
+		printf (" %u", pool->slabs[c].nr_objs);
+	printf ("\n");
+
+	h4h_hlm_reqs_pool_destroy (pool);
+	for (c = 0; c < H4H_HLM_REQS_NR_SLAB_CLASSES; c++)
+		h4h_free (slab_held[c]);
+	h4h_free (item_held);
+
+	printf ("reqs_pool_test: OK\n");
+	return 0;
+}
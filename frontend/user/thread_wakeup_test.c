@@ -0,0 +1,184 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014-2015 CSAIL, MIT
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+
+/* a stress test of parked wake-ups: consumer threads park themselves as
+ * the llm_mq dispatchers do (setup, check for work again, then sleep or
+ * cancel), and producers add work and wake them up, which is skipped if a
+ * consumer is not parked. producers pause now and then, so that consumers
+ * park often. a wake-up must never be lost: a consumer must not sleep
+ * while it has work. it fails if the work is not all done or if a
+ * consumer gets stuck */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "h4h_drv.h"
+#include "umemory.h"
+#include "uthread.h"
+
+#define NR_CONSUMERS	4
+#define NR_PRODUCERS	4
+#define NR_WORKS		200000	/* per producer */
+#define TIMEOUT_SEC		10
+
+typedef struct {
+	h4h_thread_t* thread;
+	atomic64_t nr_works;	/* queued and not done yet */
+	uint64_t nr_done;
+	uint64_t nr_sleeps;
+	volatile int exited;
+} test_consumer_t;
+
+static test_consumer_t consumers[NR_CONSUMERS];
+static volatile uint64_t nr_queued = 0;
+static volatile int stop = 0;
+
+static int __test_consumer (void* arg)
+{
+	test_consumer_t* c = (test_consumer_t*)arg;
+	int64_t n;
+
+	for (;;) {
+		if (atomic64_read (&c->nr_works) == 0) {
+			if (stop)
+				break;
+			h4h_thread_schedule_setup (c->thread);
+			if (atomic64_read (&c->nr_works) == 0 && !stop) {
+				c->nr_sleeps++;
+				if (h4h_thread_schedule_sleep (c->thread) == SIGKILL)
+					break;
+			} else {
+				h4h_thread_schedule_cancel (c->thread);
+			}
+		}
+
+		/* take all the works queued so far */
+		while ((n = atomic64_read (&c->nr_works)) > 0) {
+			if (atomic64_cmpxchg (&c->nr_works, n, 0) == n) {
+				c->nr_done += n;
+				break;
+			}
+		}
+	}
+
+	c->exited = 1;
+	return 0;
+}
+
+static void* __test_producer (void* arg)
+{
+	unsigned int seed = (unsigned int)(uintptr_t)arg;
+	uint64_t i;
+
+	for (i = 0; i < NR_WORKS; i++) {
+		test_consumer_t* c = &consumers[rand_r (&seed) % NR_CONSUMERS];
+
+		atomic64_inc (&c->nr_works);
+		__sync_fetch_and_add (&nr_queued, 1);
+		h4h_thread_wakeup (c->thread);
+
+		/* let consumers run out of work and park */
+		if (rand_r (&seed) % 256 == 0)
+			usleep (rand_r (&seed) % 50);
+		else if (rand_r (&seed) % 16 == 0)
+			sched_yield ();
+	}
+
+	return NULL;
+}
+
+static uint64_t __test_nr_done (void)
+{
+	uint64_t nr_done = 0;
+	int i;
+
+	for (i = 0; i < NR_CONSUMERS; i++)
+		nr_done += consumers[i].nr_done;
+	return nr_done;
+}
+
+static void* __test_watchdog (void* arg)
+{
+	uint64_t last = (uint64_t)-1;
+
+	while (!stop) {
+		sleep (TIMEOUT_SEC);
+		if (!stop && __test_nr_done () == last) {
+			printf ("thread_wakeup_test: FAILED (stuck at %llu of %llu works)\n", 
+				(unsigned long long)last, (unsigned long long)nr_queued);
+			exit (1);
+		}
+		last = __test_nr_done ();
+	}
+
+	return NULL;
+}
+
+int main (int argc, char** argv)
+{
+	pthread_t producers[NR_PRODUCERS], watchdog;
+	uint64_t nr_sleeps = 0;
+	int i;
+
+	for (i = 0; i < NR_CONSUMERS; i++) {
+		test_consumer_t* c = &consumers[i];
+		atomic64_set (&c->nr_works, 0);
+		if ((c->thread = h4h_thread_create (
+				__test_consumer, c, "__test_consumer")) == NULL) {
+			printf ("thread_wakeup_test: h4h_thread_create failed\n");
+			return 1;
+		}
+		h4h_thread_run (c->thread);
+	}
+	pthread_create (&watchdog, NULL, __test_watchdog, NULL);
+	for (i = 0; i < NR_PRODUCERS; i++)
+		pthread_create (&producers[i], NULL, __test_producer, (void*)(uintptr_t)(i + 1));
+	for (i = 0; i < NR_PRODUCERS; i++)
+		pthread_join (producers[i], NULL);
+
+	/* all the works must be done without any more wake-ups */
+	while (__test_nr_done () != NR_PRODUCERS * NR_WORKS)
+		usleep (1000);
+
+	stop = 1;
+	for (i = 0; i < NR_CONSUMERS; i++) {
+		test_consumer_t* c = &consumers[i];
+		while (!c->exited) {
+			h4h_thread_wakeup (c->thread);
+			usleep (1000);
+		}
+		nr_sleeps += c->nr_sleeps;
+		h4h_thread_stop (c->thread);
+	}
+
+	printf ("thread_wakeup_test: %llu works, %llu sleeps of %d consumers\n", 
+		(unsigned long long)__test_nr_done (), (unsigned long long)nr_sleeps, NR_CONSUMERS);
+	printf ("thread_wakeup_test: OK\n");
+	return 0;
+}
@@ -0,0 +1,308 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014-2015 CSAIL, MIT
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "h4h_drv.h"
+#include "debug.h"
+#include "umemory.h"
+#include "uthread.h"
+#include "uring.h"
+
+
+static inline uint32_t __uring_pow2_roundup (uint32_t v)
+{
+	uint32_t r = 1;
+	while (r < v)
+		r <<= 1;
+	return r;
+}
+
+h4h_uring_t* h4h_uring_create (
+	h4h_drv_info_t* bdi, 
+	uint32_t depth, 
+	uint64_t nr_bufs)
+{
+	h4h_uring_t* ring = NULL;
+	uint32_t i = 0;
+
+	if (depth == 0) {
+		h4h_error ("the depth of a ring must be larger than 0");
+		return NULL;
+	}
+
+	if ((ring = (h4h_uring_t*)h4h_zmalloc (sizeof (h4h_uring_t))) == NULL) {
+		h4h_error ("h4h_zmalloc () failed");
+		return NULL;
+	}
+	ring->bdi = bdi;
+	ring->depth = __uring_pow2_roundup (depth);
+	ring->mask = ring->depth - 1;
+	ring->nr_bufs = nr_bufs;
+
+	/* allocate rings, slots, and buffers */
+	if ((ring->sqes = (h4h_uring_sqe_t*)h4h_zmalloc (
+			sizeof (h4h_uring_sqe_t) * ring->depth)) == NULL ||
+		(ring->cqes = (h4h_uring_cqe_t*)h4h_zmalloc (
+			sizeof (h4h_uring_cqe_t) * ring->depth)) == NULL ||
+		(ring->slots = (h4h_uring_slot_t*)h4h_zmalloc (
+			sizeof (h4h_uring_slot_t) * ring->depth)) == NULL ||
+		(ring->free_slots = (uint32_t*)h4h_zmalloc (
+			sizeof (uint32_t) * ring->depth)) == NULL) {
+		h4h_error ("h4h_zmalloc () failed");
+		goto fail;
+	}
+	if (nr_bufs > 0 && 
+		(ring->bufs = (uint8_t*)h4h_malloc_phy (nr_bufs * KPAGE_SIZE)) == NULL) {
+		h4h_error ("h4h_malloc_phy () failed");
+		goto fail;
+	}
+
+	for (i = 0; i < ring->depth; i++) {
+		ring->slots[i].ring = (void*)ring;
+		ring->free_slots[i] = ring->depth - 1 - i;
+	}
+	ring->nr_free_slots = ring->depth;
+	atomic_set (&ring->nr_inflight, 0);
+
+	pthread_mutex_init (&ring->wait_lock, NULL);
+	pthread_cond_init (&ring->wait_cond, NULL);
+
+	return ring;
+
+fail:
+	h4h_uring_destroy (ring);
+	return NULL;
+}
+
+void h4h_uring_destroy (h4h_uring_t* ring)
+{
+	if (ring == NULL)
+		return;
+
+	/* wait for reqs in flight; their cqes are posted to the ring */
+	while (atomic_read (&ring->nr_inflight) > 0)
+		h4h_thread_msleep (1);
+
+	if (ring->cqes) {
+		pthread_mutex_destroy (&ring->wait_lock);
+		pthread_cond_destroy (&ring->wait_cond);
+	}
+	if (ring->bufs)
+		h4h_free_phy (ring->bufs);
+	if (ring->free_slots)
+		h4h_free (ring->free_slots);
+	if (ring->slots)
+		h4h_free (ring->slots);
+	if (ring->cqes)
+		h4h_free (ring->cqes);
+	if (ring->sqes)
+		h4h_free (ring->sqes);
+	h4h_free (ring);
+}
+
+uint8_t* h4h_uring_get_buf (h4h_uring_t* ring, uint64_t buf_idx)
+{
+	if (buf_idx >= ring->nr_bufs)
+		return NULL;
+	return ring->bufs + buf_idx * KPAGE_SIZE;
+}
+
+/* get an empty sqe at the tail of the submission ring (NULL if full) */
+h4h_uring_sqe_t* h4h_uring_get_sqe (h4h_uring_t* ring)
+{
+	h4h_uring_sqe_t* sqe = NULL;
+
+	if (ring->sq_tail - ring->sq_head >= ring->depth)
+		return NULL;
+
+	sqe = &ring->sqes[ring->sq_tail & ring->mask];
+	ring->sq_tail++;
+
+	return sqe;
+}
+
+/* # of cqes posted in a row from the head (up to 'max') */
+static uint32_t __uring_nr_posted (h4h_uring_t* ring, uint64_t max)
+{
+	uint64_t head = ring->cq_head;
+	uint32_t n = 0;
+
+	while (n < max && ring->cqes[(head + n) & ring->mask].seq == head + n + 1)
+		n++;
+
+	return n;
+}
+
+/* post a cqe; it can be called by any thread */
+static void __uring_post_cqe (
+	h4h_uring_t* ring, 
+	uint32_t slot, 
+	uint64_t user_data, 
+	uint8_t ret)
+{
+	uint64_t pos = __sync_fetch_and_add (&ring->cq_tail, 1);
+	h4h_uring_cqe_t* cqe = &ring->cqes[pos & ring->mask];
+
+	/* the cqe is free; the slot that used it was released before 'pos' 
+	 * could be reserved */
+	cqe->user_data = user_data;
+	cqe->ret = ret;
+	cqe->slot = slot;
+	__sync_synchronize ();
+	cqe->seq = pos + 1;
+	__sync_synchronize ();
+
+	/* wake up a waiter only if enough cqes are there in a row; cqes are
+	 * posted out of order, so the poster of the last one of the run might
+	 * not be the one with the largest 'pos' */
+	if (ring->nr_waiters > 0 && __uring_nr_posted (ring, ring->wait_nr) >= ring->wait_nr) {
+		pthread_mutex_lock (&ring->wait_lock);
+		pthread_cond_broadcast (&ring->wait_cond);
+		pthread_mutex_unlock (&ring->wait_lock);
+	}
+}
+
+static void __uring_end_req (void* req)
+{
+	h4h_blkio_req_t* br = (h4h_blkio_req_t*)req;
+	h4h_uring_slot_t* s = (h4h_uring_slot_t*)br->user;
+	h4h_uring_t* ring = (h4h_uring_t*)s->ring;
+
+	__uring_post_cqe (ring, s - ring->slots, s->user_data, br->ret);
+	atomic_dec (&ring->nr_inflight);
+}
+
+/* send sqes to the FTL; returns # of sqes consumed. sqes are left in the
+ * ring if there is no free slot (i.e., too many cqes are not seen yet) */
+uint32_t h4h_uring_submit (h4h_uring_t* ring)
+{
+	h4h_drv_info_t* bdi = ring->bdi;
+	uint32_t nr_submitted = 0;
+
+	while (ring->sq_head != ring->sq_tail && ring->nr_free_slots > 0) {
+		h4h_uring_sqe_t* sqe = &ring->sqes[ring->sq_head & ring->mask];
+		uint32_t slot = ring->free_slots[--ring->nr_free_slots];
+		h4h_uring_slot_t* s = &ring->slots[slot];
+		h4h_blkio_req_t* br = &s->br;
+		uint8_t has_data = h4h_is_read (sqe->rw) || h4h_is_write (sqe->rw);
+		uint64_t i;
+
+		ring->sq_head++;
+		nr_submitted++;
+		s->user_data = sqe->user_data;
+
+		/* check the buffers that the sqe refers to */
+		if (sqe->len > H4H_BLKIO_MAX_VECS ||
+			(has_data && (sqe->len == 0 || sqe->buf_idx + sqe->len > ring->nr_bufs))) {
+			h4h_warning ("invalid sqe: lpa=%llu len=%llu buf_idx=%llu", 
+				sqe->lpa, sqe->len, sqe->buf_idx);
+			__uring_post_cqe (ring, slot, sqe->user_data, 1);
+			continue;
+		}
+
+		/* build a blkio_req */
+		br->bi_rw = sqe->rw;
+		br->bi_offset = sqe->lpa * NR_KSECTORS_IN(KPAGE_SIZE);
+		br->bi_size = sqe->len * NR_KSECTORS_IN(KPAGE_SIZE);
+		br->bi_bvec_cnt = has_data ? sqe->len : 0;
+		for (i = 0; i < br->bi_bvec_cnt; i++)
+			br->bi_bvec_ptr[i] = ring->bufs + (sqe->buf_idx + i) * KPAGE_SIZE;
+		br->ret = 0;
+		br->bio = NULL;
+		br->user = (void*)s;
+		br->cb_done = __uring_end_req;
+
+		atomic_inc (&ring->nr_inflight);
+		bdi->ptr_host_inf->make_req (bdi, br);
+	}
+
+	return nr_submitted;
+}
+
+/* get up to 'count' cqes at the head of the completion ring without 
+ * consuming them */
+uint32_t h4h_uring_peek_batch_cqe (
+	h4h_uring_t* ring, 
+	h4h_uring_cqe_t** cqes, 
+	uint32_t count)
+{
+	uint64_t head = ring->cq_head;
+	uint32_t n, i;
+
+	/* cqes are posted out of order; stop at the first one not posted yet */
+	n = __uring_nr_posted (ring, count);
+	for (i = 0; i < n; i++)
+		cqes[i] = &ring->cqes[(head + i) & ring->mask];
+	__sync_synchronize ();
+
+	return n;
+}
+
+/* consume 'nr' cqes; their slots can be reused by new sqes */
+void h4h_uring_cq_advance (h4h_uring_t* ring, uint32_t nr)
+{
+	uint32_t i;
+
+	for (i = 0; i < nr; i++) {
+		h4h_uring_cqe_t* cqe = &ring->cqes[(ring->cq_head + i) & ring->mask];
+		ring->free_slots[ring->nr_free_slots++] = cqe->slot;
+	}
+	__sync_synchronize ();
+	ring->cq_head += nr;
+}
+
+/* wait until 'wait_nr' cqes are there (or fewer if not that many reqs 
+ * are outstanding) */
+uint32_t h4h_uring_wait_cqe_nr (
+	h4h_uring_t* ring, 
+	h4h_uring_cqe_t** cqes, 
+	uint32_t wait_nr)
+{
+	uint32_t nr_outstanding = ring->depth - ring->nr_free_slots;
+	uint32_t n = 0;
+
+	if (wait_nr > nr_outstanding)
+		wait_nr = nr_outstanding;
+
+	for (;;) {
+		if ((n = h4h_uring_peek_batch_cqe (ring, cqes, wait_nr)) >= wait_nr)
+			break;
+
+		/* sleep; a poster rechecks 'nr_waiters' after posting its cqe */
+		ring->wait_nr = wait_nr;
+		__sync_fetch_and_add (&ring->nr_waiters, 1);
+		pthread_mutex_lock (&ring->wait_lock);
+		if (h4h_uring_peek_batch_cqe (ring, cqes, wait_nr) < wait_nr)
+			pthread_cond_wait (&ring->wait_cond, &ring->wait_lock);
+		pthread_mutex_unlock (&ring->wait_lock);
+		__sync_fetch_and_sub (&ring->nr_waiters, 1);
+	}
+
+	return n;
+}
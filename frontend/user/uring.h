@@ -0,0 +1,106 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014-2015 CSAIL, MIT
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+#ifndef _H4H_HOST_URING_H
+#define _H4H_HOST_URING_H
+
+#include <pthread.h>
+
+/* 
+ * h4h_uring is a submission/completion ring interface for user-mode hosts.
+ * An application registers a pool of 4KB buffers once, fills submission
+ * entries (sqes) that refer to the buffers by index, and submits them in
+ * batches. Completions are posted to a completion ring (cqes) by the FTL
+ * threads without locks; the application polls the ring or waits for a
+ * given number of completions. A ring is owned by a single application
+ * thread; use one ring per thread.
+ */
+
+typedef struct {
+	uint64_t rw;		/* REQTYPE_READ, REQTYPE_WRITE, REQTYPE_TRIM, ... (with host flags) */
+	uint64_t lpa;		/* unit: kernel-page (4KB) */
+	uint64_t len;		/* unit: kernel-page (4KB); at most H4H_BLKIO_MAX_VECS */
+	uint64_t buf_idx;	/* the first of 'len' consecutive buffers in the pool */
+	uint64_t user_data;	/* returned as it is in the cqe */
+} h4h_uring_sqe_t;
+
+typedef struct {
+	uint64_t user_data;
+	uint8_t ret;		/* 0: success */
+	uint32_t slot;		/* internal: released when the cqe is seen */
+	volatile uint64_t seq;	/* internal: set when the cqe is posted */
+} h4h_uring_cqe_t;
+
+typedef struct {
+	h4h_blkio_req_t br;
+	uint64_t user_data;
+	void* ring;
+} h4h_uring_slot_t;
+
+typedef struct {
+	h4h_drv_info_t* bdi;
+	uint32_t depth;		/* power of 2; max # of reqs in flight */
+	uint32_t mask;
+
+	/* submission ring: filled and consumed by the owner */
+	h4h_uring_sqe_t* sqes;
+	volatile uint32_t sq_head;
+	volatile uint32_t sq_tail;
+
+	/* completion ring: posted by FTL threads, consumed by the owner */
+	h4h_uring_cqe_t* cqes;
+	volatile uint64_t cq_head;
+	volatile uint64_t cq_tail;	/* reserved by posters with fetch-and-add */
+
+	/* reqs in flight (free slots are kept in a stack) */
+	h4h_uring_slot_t* slots;
+	uint32_t* free_slots;
+	uint32_t nr_free_slots;
+
+	/* registered buffers */
+	uint8_t* bufs;
+	uint64_t nr_bufs;
+
+	atomic_t nr_inflight;	/* # of reqs sent to the FTL and not posted yet */
+
+	/* a waiter is woken up only when 'wait_nr' cqes are there */
+	volatile uint32_t nr_waiters;
+	volatile uint64_t wait_nr;
+	pthread_mutex_t wait_lock;
+	pthread_cond_t wait_cond;
+} h4h_uring_t;
+
+h4h_uring_t* h4h_uring_create (h4h_drv_info_t* bdi, uint32_t depth, uint64_t nr_bufs);
+void h4h_uring_destroy (h4h_uring_t* ring);
+uint8_t* h4h_uring_get_buf (h4h_uring_t* ring, uint64_t buf_idx);
+
+h4h_uring_sqe_t* h4h_uring_get_sqe (h4h_uring_t* ring);
+uint32_t h4h_uring_submit (h4h_uring_t* ring);
+
+uint32_t h4h_uring_peek_batch_cqe (h4h_uring_t* ring, h4h_uring_cqe_t** cqes, uint32_t count);
+void h4h_uring_cq_advance (h4h_uring_t* ring, uint32_t nr);
+uint32_t h4h_uring_wait_cqe_nr (h4h_uring_t* ring, h4h_uring_cqe_t** cqes, uint32_t wait_nr);
+
+#endif
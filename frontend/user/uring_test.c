@@ -0,0 +1,183 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014-2015 CSAIL, MIT
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+/* a stress test of the wait path of h4h_uring: reqs are completed by
+ * several threads in a random order, and the owner waits for a random
+ * number of cqes. it fails if a wait does not return in time (e.g., a
+ * wake-up is lost) or a cqe is seen twice or never */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "h4h_drv.h"
+#include "umemory.h"
+#include "uring.h"
+
+#define NR_POSTERS	16
+#define RING_DEPTH	64
+#define NR_REQS		1000000
+#define TIMEOUT_SEC	10
+
+static pthread_mutex_t pending_lock = PTHREAD_MUTEX_INITIALIZER;
+static h4h_blkio_req_t* pending[RING_DEPTH];
+static int nr_pending = 0;
+static volatile int stop = 0;
+static volatile uint64_t progress = 0;
+
+/* reqs are kept here; posters complete them in a random order */
+static void __test_make_req (h4h_drv_info_t* bdi, void* req)
+{
+	pthread_mutex_lock (&pending_lock);
+	pending[nr_pending++] = (h4h_blkio_req_t*)req;
+	pthread_mutex_unlock (&pending_lock);
+}
+
+static h4h_host_inf_t __test_host_inf = {
+	.make_req = __test_make_req,
+};
+
+static void* __test_poster (void* arg)
+{
+	unsigned int seed = (unsigned int)(uintptr_t)arg;
+
+	while (!stop) {
+		h4h_blkio_req_t* br = NULL;
+
+		pthread_mutex_lock (&pending_lock);
+		if (nr_pending > 0) {
+			int i = rand_r (&seed) % nr_pending;
+			br = pending[i];
+			pending[i] = pending[--nr_pending];
+		}
+		pthread_mutex_unlock (&pending_lock);
+
+		if (br == NULL) {
+			sched_yield ();
+			continue;
+		}
+		if (rand_r (&seed) % 4 == 0)
+			usleep (rand_r (&seed) % 50);
+		br->cb_done (br);
+	}
+
+	return NULL;
+}
+
+static void* __test_watchdog (void* arg)
+{
+	uint64_t last = (uint64_t)-1;
+
+	while (!stop) {
+		sleep (TIMEOUT_SEC);
+		if (!stop && progress == last) {
+			printf ("uring_test: FAILED (a wait did not return in %d seconds)\n", TIMEOUT_SEC);
+			exit (1);
+		}
+		last = progress;
+	}
+
+	return NULL;
+}
+
+int main (int argc, char** argv)
+{
+	h4h_drv_info_t bdi = { 0, };
+	h4h_uring_t* ring = NULL;
+	h4h_uring_cqe_t* cqes[RING_DEPTH];
+	pthread_t posters[NR_POSTERS], watchdog;
+	static uint8_t seen[NR_REQS / 8 + 1];
+	uint64_t nr_sent = 0, nr_done = 0;
+	unsigned int seed = 1;
+	int i, ret = 0;
+
+	bdi.ptr_host_inf = &__test_host_inf;
+	if ((ring = h4h_uring_create (&bdi, RING_DEPTH, 0)) == NULL) {
+		printf ("uring_test: h4h_uring_create failed\n");
+		return 1;
+	}
+
+	for (i = 0; i < NR_POSTERS; i++)
+		pthread_create (&posters[i], NULL, __test_poster, (void*)(uintptr_t)(i + 1));
+	pthread_create (&watchdog, NULL, __test_watchdog, NULL);
+
+	for (;;) {
+		uint32_t nr_outstanding, wait_nr, n, k;
+		h4h_uring_sqe_t* sqe;
+
+		/* fill the ring with trims; they need no buffers */
+		while (nr_sent < NR_REQS && 
+				(sqe = h4h_uring_get_sqe (ring)) != NULL) {
+			sqe->rw = REQTYPE_TRIM;
+			sqe->lpa = nr_sent;
+			sqe->len = 1;
+			sqe->buf_idx = 0;
+			sqe->user_data = nr_sent++;
+		}
+		h4h_uring_submit (ring);
+
+		nr_outstanding = ring->depth - ring->nr_free_slots;
+		if (nr_outstanding == 0)
+			break;
+		wait_nr = 1 + rand_r (&seed) % nr_outstanding;
+
+		if ((n = h4h_uring_wait_cqe_nr (ring, cqes, wait_nr)) < wait_nr) {
+			printf ("uring_test: FAILED (%u cqes for wait_nr=%u)\n", n, wait_nr);
+			ret = 1;
+			break;
+		}
+		for (k = 0; k < n; k++) {
+			uint64_t tag = cqes[k]->user_data;
+			if (seen[tag / 8] & (1 << (tag % 8))) {
+				printf ("uring_test: FAILED (cqe %llu is seen twice)\n", (unsigned long long)tag);
+				ret = 1;
+			}
+			seen[tag / 8] |= (1 << (tag % 8));
+		}
+		h4h_uring_cq_advance (ring, n);
+		nr_done += n;
+		progress++;
+		if (ret)
+			break;
+	}
+
+	if (ret == 0 && nr_done != nr_sent) {
+		printf ("uring_test: FAILED (%llu of %llu cqes are seen)\n", 
+			(unsigned long long)nr_done, (unsigned long long)nr_sent);
+		ret = 1;
+	}
+
+	stop = 1;
+	for (i = 0; i < NR_POSTERS; i++)
+		pthread_join (posters[i], NULL);
+	h4h_uring_destroy (ring);
+
+	if (ret == 0)
+		printf ("uring_test: OK (%llu cqes, %llu waits)\n", 
+			(unsigned long long)nr_done, (unsigned long long)progress);
+	return ret;
+}
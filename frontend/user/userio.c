@@ -35,6 +35,8 @@ THE SOFTWARE.
 #include "utime.h"
 #include "uthread.h"
 #include "hlm_reqs_pool.h"
+#include "hlm_reqs_plug.h"
+#include "ftl_params.h"
 
 h4h_host_inf_t _userio_inf = {
 	.ptr_private = NULL,
@@ -48,8 +50,44 @@ typedef struct {
 	atomic_t nr_host_reqs;
 	h4h_sema_t host_lock;
 	h4h_hlm_reqs_pool_t* hlm_reqs_pool;
+
+	/* merging of adjacent reqs (NULL if disabled) */
+	h4h_hlm_reqs_plug_t* plug;
+	h4h_thread_t* unplug_thread;
+	atomic_t nr_unplugs;	/* # of completions since the last unplug */
+	atomic_t nr_ending;		/* # of userio_end_req () in progress */
 } h4h_userio_private_t;
 
+static void __userio_submit (h4h_drv_info_t* bdi, h4h_blkio_req_t* br);
+
+/* a thread that sends a plugged req when a req in flight finishes */
+static int __userio_unplug_thread (void* arg)
+{
+	h4h_drv_info_t* bdi = (h4h_drv_info_t*)arg;
+	h4h_userio_private_t* p = (h4h_userio_private_t*)H4H_HOST_PRIV(bdi);
+	h4h_blkio_req_t* br = NULL;
+
+	for (;;) {
+		if (atomic_read (&p->nr_unplugs) == 0) {
+			h4h_thread_schedule_setup (p->unplug_thread);
+			if (atomic_read (&p->nr_unplugs) == 0) {
+				if (h4h_thread_schedule_sleep (p->unplug_thread) == SIGKILL)
+					break;
+			} else {
+				h4h_thread_schedule_cancel (p->unplug_thread);
+			}
+		}
+		atomic_set (&p->nr_unplugs, 0);
+
+		h4h_sema_lock (&p->host_lock);
+		if ((br = h4h_hlm_reqs_plug_flush (p->plug)) != NULL)
+			__userio_submit (bdi, br);
+		h4h_sema_unlock (&p->host_lock);
+	}
+
+	return 0;
+}
+
 
 uint32_t userio_open (h4h_drv_info_t* bdi)
 {
@@ -82,6 +120,24 @@ uint32_t userio_open (h4h_drv_info_t* bdi)
 
 	bdi->ptr_host_inf->ptr_private = (void*)p;
 
+	/* create a plug for merging */
+	p->plug = NULL;
+	p->unplug_thread = NULL;
+	atomic_set (&p->nr_unplugs, 0);
+	atomic_set (&p->nr_ending, 0);
+	if (_param_host_merge_pgs > 1) {
+		if ((p->plug = h4h_hlm_reqs_plug_create (_param_host_merge_pgs)) == NULL) {
+			h4h_warning ("h4h_hlm_reqs_plug_create () failed");
+			return 1;
+		}
+		if ((p->unplug_thread = h4h_thread_create (
+				__userio_unplug_thread, bdi, "__userio_unplug_thread")) == NULL) {
+			h4h_warning ("h4h_thread_create () failed");
+			return 1;
+		}
+		h4h_thread_run (p->unplug_thread);
+	}
+
 	return 0;
 }
 
@@ -91,15 +147,32 @@ void userio_close (h4h_drv_info_t* bdi)
 
 	p = (h4h_userio_private_t*)H4H_HOST_PRIV(bdi);
 
+	/* send a plugged req */
+	if (p->plug) {
+		h4h_blkio_req_t* br = NULL;
+		h4h_sema_lock (&p->host_lock);
+		if ((br = h4h_hlm_reqs_plug_flush (p->plug)) != NULL)
+			__userio_submit (bdi, br);
+		h4h_sema_unlock (&p->host_lock);
+	}
+
 	/* wait for host reqs to finish */
 	h4h_msg ("wait for host reqs to finish");
 	for (;;) {
-		if (atomic_read (&p->nr_host_reqs) == 0)
+		/* a completion may still be about to wake up the unplug thread */
+		if (atomic_read (&p->nr_host_reqs) == 0 && atomic_read (&p->nr_ending) == 0)
 			break;
 		h4h_msg ("p->nr_host_reqs = %llu", p->nr_host_reqs);
 		h4h_thread_msleep (1);
 	}
 
+	if (p->unplug_thread) {
+		h4h_thread_stop (p->unplug_thread);
+	}
+	if (p->plug) {
+		h4h_hlm_reqs_plug_destroy (p->plug);
+	}
+
 	if (p->hlm_reqs_pool) {
 		h4h_hlm_reqs_pool_destroy (p->hlm_reqs_pool);
 	}
@@ -146,6 +219,43 @@ void userio_make_req (h4h_drv_info_t* bdi, void *bio)
 
 	h4h_userio_private_t* p = (h4h_userio_private_t*)H4H_HOST_PRIV(bdi);
 	h4h_blkio_req_t* br = (h4h_blkio_req_t*)bio;
+	h4h_blkio_req_t* prev = NULL;
+
+	h4h_sema_lock (&p->host_lock);
+
+	if (!h4h_hlm_reqs_plug_can_merge (p->plug, br)) {
+		/* keep the order: a plugged req goes first */
+		if (p->plug && (prev = h4h_hlm_reqs_plug_flush (p->plug)) != NULL)
+			__userio_submit (bdi, prev);
+		__userio_submit (bdi, br);
+	} else if (atomic_read (&p->nr_host_reqs) == 0 && h4h_hlm_reqs_plug_is_empty (p->plug)) {
+		/* nothing is in flight; there is no reason to wait */
+		__userio_submit (bdi, br);
+	} else {
+		if ((prev = h4h_hlm_reqs_plug_add (p->plug, br)) != NULL)
+			__userio_submit (bdi, prev);
+		/* the reqs in flight might have finished in the meantime */
+		if (atomic_read (&p->nr_host_reqs) == 0 &&
+			(prev = h4h_hlm_reqs_plug_flush (p->plug)) != NULL)
+			__userio_submit (bdi, prev);
+	}
+
+	h4h_sema_unlock (&p->host_lock);
+}
+
+static void __userio_end_blkio_req (h4h_blkio_req_t* br, uint8_t ret)
+{
+	br->ret = ret;
+
+	/* call call-back function */
+	if (br->cb_done)
+		br->cb_done (br);
+}
+
+/* it must be called with host_lock */
+static void __userio_submit (h4h_drv_info_t* bdi, h4h_blkio_req_t* br)
+{
+	h4h_userio_private_t* p = (h4h_userio_private_t*)H4H_HOST_PRIV(bdi);
 	h4h_hlm_req_t* hr = NULL;
 
 	/* get a free hlm_req from the hlm_reqs_pool */
@@ -165,8 +275,6 @@ void userio_make_req (h4h_drv_info_t* bdi, void *bio)
 	/* if success, increase # of host reqs */
 	atomic_inc (&p->nr_host_reqs);
 
-	h4h_sema_lock (&p->host_lock);
-
 	/* NOTE: it would be possible that 'hlm_req' becomes NULL 
 	 * if 'bdi->ptr_hlm_inf->make_req' is success. */
 	if (bdi->ptr_hlm_inf->make_req (bdi, hr) != 0) {
@@ -176,10 +284,11 @@ void userio_make_req (h4h_drv_info_t* bdi, void *bio)
 		/* cancel the request */
 		atomic_dec (&p->nr_host_reqs);
 		h4h_hlm_reqs_pool_free_item (p->hlm_reqs_pool, hr);
+		h4h_hlm_reqs_plug_end_req (br, __userio_end_blkio_req, 1);
 	}
-	h4h_sema_unlock (&p->host_lock);
 }
 
+
 void userio_end_req (h4h_drv_info_t* bdi, h4h_hlm_req_t* req)
 {
 #if 0
@@ -200,6 +309,9 @@ void userio_end_req (h4h_drv_info_t* bdi, h4h_hlm_req_t* req)
 
 	h4h_userio_private_t* p = (h4h_userio_private_t*)H4H_HOST_PRIV(bdi);
 	h4h_blkio_req_t* r = (h4h_blkio_req_t*)req->blkio_req;
+	uint8_t ret = req->ret;
+
+	atomic_inc (&p->nr_ending);
 
 	/* remove blkio_req */
 	/*
@@ -229,8 +341,15 @@ void userio_end_req (h4h_drv_info_t* bdi, h4h_hlm_req_t* req)
 	/* decreate # of reqs */
 	atomic_dec (&p->nr_host_reqs);
 
-	/* call call-back function */
-	if (r->cb_done)
-		r->cb_done (r);
+	/* finish the host req(s) */
+	h4h_hlm_reqs_plug_end_req (r, __userio_end_blkio_req, ret);
+
+	/* a plugged req can go now */
+	if (p->plug && !h4h_hlm_reqs_plug_is_empty (p->plug)) {
+		atomic_inc (&p->nr_unplugs);
+		h4h_thread_wakeup (p->unplug_thread);
+	}
+
+	atomic_dec (&p->nr_ending);
 }
 
@@ -41,6 +41,8 @@ THE SOFTWARE.
 #include "debug.h"
 #include "abm.h"
 #include "umemory.h"
+#include "uthread.h"
+#include "hlm_reqs_pool.h"
 #include "block_ftl.h"
 
 #define DBG_ALLOW_INPLACE_UPDATE
@@ -90,6 +92,22 @@ typedef struct {
 	uint8_t* pst;	/* status of pages in a block */
 } h4h_block_mapping_entry_t;
 
+enum H4H_BFTL_MERGE_STAGE {
+	BFTL_MERGE_DONE = 0,
+	BFTL_MERGE_READ,
+	BFTL_MERGE_ERASE,
+	BFTL_MERGE_WRITE,
+};
+
+/* a merge pipeline of a block; completion is tracked by 'gc' */
+typedef struct {
+	uint8_t stage;	/* H4H_BFTL_MERGE_STAGE */
+	uint64_t nr_valid_pgs;
+	uint64_t nr_trim_pgs;
+	h4h_hlm_req_gc_t gc;
+	h4h_llm_req_t erase_req;
+} h4h_block_ftl_merge_t;
+
 typedef struct {
 	uint64_t nr_segs;	/* a segment is the unit of mapping */
 	uint64_t nr_pgs_per_seg;	/* how many pages belong to a segment */
@@ -100,6 +118,7 @@ typedef struct {
 	h4h_block_mapping_entry_t** mt;
 	h4h_abm_block_t** gc_bab;
 	h4h_hlm_req_gc_t gc_hlm;
+	h4h_block_ftl_merge_t* gc_merge;	/* a pipeline per punit */
 
 	uint64_t* nr_trim_pgs;
 	uint64_t* nr_valid_pgs;
@@ -109,7 +128,7 @@ typedef struct {
 
 /* function prototypes */
 uint32_t __h4h_block_ftl_do_gc_segment (h4h_drv_info_t* bdi, uint64_t seg_no);
-uint32_t __h4h_block_ftl_do_gc_block_merge (h4h_drv_info_t* bdi, uint64_t seg_no, uint64_t blk_no);
+uint32_t __h4h_block_ftl_do_gc_segment_merge (h4h_drv_info_t* bdi, uint64_t seg_no, uint64_t blk_no);
 //uint32_t __hlm_rsd_make_rm_seg (h4h_drv_info_t* bdi, uint32_t seg_no);
 
 
@@ -227,6 +246,23 @@ uint32_t h4h_block_ftl_create (h4h_drv_info_t* bdi)
 	}
 	h4h_sema_init (&p->gc_hlm.done);
 
+	/* initialize merge pipelines */
+	if ((p->gc_merge = (h4h_block_ftl_merge_t*)h4h_zmalloc
+			(sizeof (h4h_block_ftl_merge_t) * p->nr_blks_per_seg)) == NULL) {
+		h4h_error ("h4h_zmalloc failed");
+		goto fail;
+	}
+	for (i = 0; i < p->nr_blks_per_seg; i++) {
+		h4h_block_ftl_merge_t* m = &p->gc_merge[i];
+		if ((m->gc.llm_reqs = (h4h_llm_req_t*)h4h_zmalloc
+				(sizeof (h4h_llm_req_t) * np->nr_pages_per_block)) == NULL) {
+			h4h_error ("h4h_zmalloc failed");
+			goto fail;
+		}
+		hlm_reqs_pool_allocate_llm_reqs (m->gc.llm_reqs, np->nr_pages_per_block, RP_MEM_PHY);
+		h4h_sema_init (&m->gc.done);
+	}
+
 	h4h_msg ("nr_segs = %llu, nr_blks_per_seg = %llu, nr_pgs_per_seg = %llu",
 		p->nr_segs, p->nr_blks_per_seg, p->nr_pgs_per_seg);
 
@@ -241,6 +277,7 @@ void h4h_block_ftl_destroy (
 	h4h_drv_info_t* bdi)
 {
 	h4h_block_ftl_private_t* p = H4H_FTL_PRIV (bdi);
+	h4h_device_params_t* np = H4H_GET_DEVICE_PARAMS (bdi);
 	uint64_t i, j;
 
 	if (p == NULL)
@@ -253,6 +290,17 @@ void h4h_block_ftl_destroy (
 		h4h_free (p->gc_bab);
 	if (p->gc_hlm.llm_reqs)
 		h4h_free (p->gc_hlm.llm_reqs);
+	if (p->gc_merge) {
+		for (i = 0; i < p->nr_blks_per_seg; i++) {
+			h4h_block_ftl_merge_t* m = &p->gc_merge[i];
+			if (m->gc.llm_reqs == NULL)
+				continue;
+			hlm_reqs_pool_release_llm_reqs (m->gc.llm_reqs, np->nr_pages_per_block, RP_MEM_PHY);
+			h4h_sema_free (&m->gc.done);
+			h4h_free (m->gc.llm_reqs);
+		}
+		h4h_free (p->gc_merge);
+	}
 	if (p->mt != NULL) {
 		for (i = 0; i < p->nr_segs; i++) {
 			if (p->mt[i] != NULL) {
@@ -871,30 +919,25 @@ uint32_t __h4h_block_ftl_do_gc_segment (
 	return 0;
 }
 
-#include "hlm_reqs_pool.h"
-
-uint32_t __h4h_block_ftl_do_gc_block_merge (
+/* start the read stage of a block merge; valid pages are kept in the
+ * pads of the pipeline until they are written back */
+static void __h4h_block_ftl_merge_issue_reads (
 	h4h_drv_info_t* bdi,
-	uint64_t seg_no,
-	uint64_t blk_no)
+	h4h_block_ftl_merge_t* m,
+	h4h_block_mapping_entry_t* e)
 {
-	h4h_block_ftl_private_t* p = H4H_FTL_PRIV (bdi);
-	h4h_block_mapping_entry_t* e = &p->mt[seg_no][blk_no];
 	h4h_device_params_t* np = H4H_GET_DEVICE_PARAMS (bdi);
-	h4h_hlm_req_gc_t* hlm_gc = &p->gc_hlm;
-	uint64_t j, nr_valid_pgs = 0, nr_trim_pgs = 0;
+	h4h_hlm_req_gc_t* hlm_gc = &m->gc;
+	uint64_t j;
 
-	if (e->status == BFTL_NOT_ALLOCATED)
-		return 0; /* if it is, ignore it */
-
-	/* ---------------------------------------------------------------- */
-	/* [STEP1] build hlm_req_gc for reads */
+	m->nr_valid_pgs = 0;
+	m->nr_trim_pgs = 0;
 	for (j = 0; j < np->nr_pages_per_block; j++) {
-		/* are there any valid page in a block */
 		if (e->pst[j] == BFTL_PG_VALID) {
-			h4h_llm_req_t* r = &hlm_gc->llm_reqs[nr_valid_pgs++];
+			h4h_llm_req_t* r = &hlm_gc->llm_reqs[m->nr_valid_pgs++];
 
 			hlm_reqs_pool_reset_fmain (&r->fmain);
+			hlm_reqs_pool_alloc_fmain_pad (&r->fmain);
 			hlm_reqs_pool_reset_logaddr (&r->logaddr);
 
 			r->logaddr.lpa[0] = -1; /* the subpage contains new data */
@@ -908,118 +951,218 @@ uint32_t __h4h_block_ftl_do_gc_block_merge (
 			r->ptr_hlm_req = (void*)hlm_gc;
 			r->ret = 0;
 		} else if (e->pst[j] == BFTL_PG_INVALID) {
-			nr_trim_pgs++;
+			m->nr_trim_pgs++;
 		}
 	}
 
-	h4h_msg ("[MERGE-BEGIN] valid: %llu invalid: %llu", nr_valid_pgs, nr_trim_pgs);
-
-	/* wait until Q in llm becomes empty 
-	 * TODO: it might be possible to further optimize this */
-	bdi->ptr_llm_inf->flush (bdi);
+	/* NOTE: if there are no valid pages, 'done' is left unlocked and
+	 * the erase stage begins right away */
+	m->stage = BFTL_MERGE_READ;
+	if (m->nr_valid_pgs == 0)
+		return;
 
-	/* send read reqs to llm */
-	if (nr_valid_pgs > 0) {
-		hlm_gc->req_type = REQTYPE_GC_READ;
-		hlm_gc->nr_llm_reqs = nr_valid_pgs;
-		atomic64_set (&hlm_gc->nr_llm_reqs_done, 0);
-		h4h_sema_lock (&hlm_gc->done);
-		for (j = 0; j < nr_valid_pgs; j++) {
-			if ((bdi->ptr_llm_inf->make_req (bdi, &hlm_gc->llm_reqs[j])) != 0) {
-				h4h_error ("llm_make_req failed");
-				h4h_bug_on (1);
-			}
+	hlm_gc->req_type = REQTYPE_GC_READ;
+	hlm_gc->nr_llm_reqs = m->nr_valid_pgs;
+	atomic64_set (&hlm_gc->nr_llm_reqs_done, 0);
+	h4h_sema_lock (&hlm_gc->done);
+	for (j = 0; j < m->nr_valid_pgs; j++) {
+		if ((bdi->ptr_llm_inf->make_req (bdi, &hlm_gc->llm_reqs[j])) != 0) {
+			h4h_error ("llm_make_req failed");
+			h4h_bug_on (1);
 		}
-		h4h_sema_lock (&hlm_gc->done);
-		h4h_sema_unlock (&hlm_gc->done);
 	}
+}
 
-	/* ---------------------------------------------------------------- */
-	/* [STEP2] erase a block (do not consider wear-leveling new) */
-	{
-		uint8_t is_bad = 0;
-		//h4h_llm_req_t* r = &hlm_gc->llm_reqs[0];
-		h4h_llm_req_t rr;
-		h4h_llm_req_t* r = &rr;
+static void __h4h_block_ftl_merge_issue_erase (
+	h4h_drv_info_t* bdi,
+	h4h_block_ftl_merge_t* m,
+	h4h_block_mapping_entry_t* e)
+{
+	h4h_hlm_req_gc_t* hlm_gc = &m->gc;
+	h4h_llm_req_t* r = &m->erase_req;
+
+	r->req_type = REQTYPE_GC_ERASE;
+	r->logaddr.lpa[0] = -1ULL; /* lpa is not available now */
+	r->phyaddr.channel_no = e->channel_no;
+	r->phyaddr.chip_no = e->chip_no;
+	r->phyaddr.block_no = e->block_no;
+	r->phyaddr.page_no = 0;
+	r->phyaddr.punit_id = H4H_GET_PUNIT_ID (bdi, (&r->phyaddr));
+	r->ptr_hlm_req = (void*)hlm_gc;
+	r->ret = 0;
+
+	m->stage = BFTL_MERGE_ERASE;
+	hlm_gc->req_type = REQTYPE_GC_ERASE;
+	hlm_gc->nr_llm_reqs = 1;
+	atomic64_set (&hlm_gc->nr_llm_reqs_done, 0);
+	h4h_sema_lock (&hlm_gc->done);
+	if ((bdi->ptr_llm_inf->make_req (bdi, r)) != 0) {
+		h4h_error ("llm_make_req failed");
+		h4h_bug_on (1);
+	}
+}
+
+/* the old block is erased; move the valid pages to a new block on the
+ * same punit and start the write stage */
+static void __h4h_block_ftl_merge_issue_writes (
+	h4h_drv_info_t* bdi,
+	h4h_block_ftl_merge_t* m,
+	uint64_t seg_no,
+	h4h_block_mapping_entry_t* e)
+{
+	h4h_block_ftl_private_t* p = H4H_FTL_PRIV (bdi);
+	h4h_device_params_t* np = H4H_GET_DEVICE_PARAMS (bdi);
+	h4h_hlm_req_gc_t* hlm_gc = &m->gc;
+	h4h_abm_block_t* b = NULL;
+	uint64_t channel_no = e->channel_no;
+	uint64_t chip_no = e->chip_no;
+	uint64_t j;
+
+	h4h_abm_erase_block (p->abm, e->channel_no, e->chip_no, e->block_no, 
+		(m->erase_req.ret != 0) ? 1 : 0);
+
+	/* reset all the variables */
+	e->status = BFTL_NOT_ALLOCATED;
+	e->channel_no = -1;
+	e->chip_no = -1;
+	e->block_no = -1;
+	e->rw_pg_ofs = -1;
+	h4h_memset (e->pst, BFTL_PG_FREE, sizeof (uint8_t) * np->nr_pages_per_block);
+
+	h4h_bug_on (m->nr_trim_pgs > p->nr_trim_pgs[seg_no]);
+	h4h_bug_on (m->nr_valid_pgs > p->nr_valid_pgs[seg_no]); 	
+	p->nr_trim_pgs[seg_no] -= m->nr_trim_pgs;
+
+	/* allocate a new block; the merge keeps all blocks of the segment allocated */
+	if ((b = h4h_abm_get_free_block_prepare (p->abm, channel_no, chip_no)) == NULL) {
+		h4h_error ("oops! h4h_abm_get_free_block_prepare failed (%llu %llu)", channel_no, chip_no);
+		h4h_bug_on (1);
+	}
+	h4h_abm_get_free_block_commit (p->abm, b);
+	e->status = BFTL_ALLOCATED;
+	e->channel_no = b->channel_no;
+	e->chip_no = b->chip_no;
+	e->block_no = b->block_no;
+
+	if (m->nr_valid_pgs == 0) {
+		m->stage = BFTL_MERGE_DONE;
+		return;
+	}
+
+	/* build write reqs; pages keep their offsets in the block */
+	for (j = 0; j < m->nr_valid_pgs; j++) {
+		h4h_llm_req_t* r = &hlm_gc->llm_reqs[j];
+		uint64_t page_ofs;
+
+		h4h_bug_on (r->fmain.kp_stt[0] != KP_STT_DATA);
+
+		r->req_type = REQTYPE_GC_WRITE;	/* change to write */
+		r->logaddr.lpa[0] = ((uint64_t*)r->foob.data)[0];
+		page_ofs = r->phyaddr.page_no;
+		h4h_bug_on (page_ofs != __h4h_block_ftl_get_page_ofs (p, r->logaddr.lpa[0]));
 
-		/* setup an erase request */
-		r->req_type = REQTYPE_GC_ERASE;
-		r->logaddr.lpa[0] = -1ULL; /* lpa is not available now */
 		r->phyaddr.channel_no = e->channel_no;
 		r->phyaddr.chip_no = e->chip_no;
 		r->phyaddr.block_no = e->block_no;
-		r->phyaddr.page_no = 0;
 		r->phyaddr.punit_id = H4H_GET_PUNIT_ID (bdi, (&r->phyaddr));
-		r->ptr_hlm_req = (void*)hlm_gc;
 		r->ret = 0;
 
-		/* send erase reqs to llm */
-		hlm_gc->req_type = REQTYPE_GC_ERASE;
-		hlm_gc->nr_llm_reqs = 1;
-		atomic64_set (&hlm_gc->nr_llm_reqs_done, 0);
-		h4h_sema_lock (&hlm_gc->done);
-		if ((bdi->ptr_llm_inf->make_req (bdi, r)) != 0) {
+		e->pst[page_ofs] = BFTL_PG_VALID;
+		e->rw_pg_ofs = page_ofs;
+	}
+
+	m->stage = BFTL_MERGE_WRITE;
+	hlm_gc->req_type = REQTYPE_GC_WRITE;
+	hlm_gc->nr_llm_reqs = m->nr_valid_pgs;
+	atomic64_set (&hlm_gc->nr_llm_reqs_done, 0);
+	h4h_sema_lock (&hlm_gc->done);
+	for (j = 0; j < m->nr_valid_pgs; j++) {
+		if ((bdi->ptr_llm_inf->make_req (bdi, &hlm_gc->llm_reqs[j])) != 0) {
 			h4h_error ("llm_make_req failed");
 			h4h_bug_on (1);
 		}
-		h4h_sema_lock (&hlm_gc->done);
-		h4h_sema_unlock (&hlm_gc->done);
-
-		if (r->ret != 0)
-			is_bad = 1; /* bad block */
-		h4h_abm_erase_block (p->abm, e->channel_no, e->chip_no, e->block_no, is_bad);
+	}
+}
 
-		/* reset all the variables */
-		e->status = BFTL_NOT_ALLOCATED;
-		e->channel_no = -1;
-		e->chip_no = -1;
-		e->block_no = -1;
-		e->rw_pg_ofs = -1;
-		h4h_memset (e->pst, BFTL_PG_FREE, sizeof (uint8_t) * np->nr_pages_per_block);
+/* merge the blocks of a segment; each block has its own pipeline
+ * (read -> erase -> write) on its punit, so the blocks are merged in
+ * parallel and each one advances as soon as its own stage completes */
+uint32_t __h4h_block_ftl_do_gc_segment_merge (
+	h4h_drv_info_t* bdi,
+	uint64_t seg_no,
+	uint64_t blk_no)
+{
+	h4h_block_ftl_private_t* p = H4H_FTL_PRIV (bdi);
+	h4h_device_params_t* np = H4H_GET_DEVICE_PARAMS (bdi);
+	uint64_t i, nr_merges = 0, nr_done = 0;
+	uint64_t nr_valid_pgs = 0, nr_trim_pgs = 0;
 
-		h4h_bug_on (nr_trim_pgs > p->nr_trim_pgs[seg_no]);
-		h4h_bug_on (nr_valid_pgs > p->nr_valid_pgs[seg_no]); 	
-		p->nr_trim_pgs[seg_no] -= nr_trim_pgs;
-		p->nr_valid_pgs[seg_no] -= nr_valid_pgs;
-	}
+	/* wait until Q in llm becomes empty 
+	 * TODO: it might be possible to further optimize this */
+	bdi->ptr_llm_inf->flush (bdi);
 
-	/* ---------------------------------------------------------------- */
-	/* [STEP3] build hlm_req_gc for writes */
-	if (nr_valid_pgs > 0) {
-		for (j = 0; j < nr_valid_pgs; j++) {
-			h4h_llm_req_t* r = &hlm_gc->llm_reqs[j];
+	/* [STEP1] start pipelines for the block to be overwritten and the
+	 * blocks that have trimmed pages */
+	for (i = 0; i < p->nr_blks_per_seg; i++) {
+		h4h_block_mapping_entry_t* e = &p->mt[seg_no][i];
+		h4h_block_ftl_merge_t* m = &p->gc_merge[i];
+		uint64_t j, nr_invalid = 0;
 
-			h4h_bug_on (r->fmain.kp_stt[0] != KP_STT_DATA);
+		m->stage = BFTL_MERGE_DONE;
+		if (e->status == BFTL_NOT_ALLOCATED)
+			continue;
+		for (j = 0; j < np->nr_pages_per_block; j++)
+			if (e->pst[j] == BFTL_PG_INVALID)
+				nr_invalid++;
+		if (i != blk_no && nr_invalid == 0)
+			continue;
 
-			r->req_type = REQTYPE_GC_WRITE;	/* change to write */
-			r->logaddr.lpa[0] = ((uint64_t*)r->foob.data)[0];
+		__h4h_block_ftl_merge_issue_reads (bdi, m, e);
+		nr_valid_pgs += m->nr_valid_pgs;
+		nr_trim_pgs += m->nr_trim_pgs;
+		nr_merges++;
+	}
 
-			if (h4h_block_ftl_get_free_ppa (bdi, r->logaddr.lpa[0], &r->phyaddr) != 0) {
-				h4h_error ("h4h_page_ftl_get_free_ppa failed");
-				h4h_bug_on (1);
-			}
-			if (h4h_block_ftl_map_lpa_to_ppa (bdi, &r->logaddr, &r->phyaddr) != 0) {
-				h4h_error ("h4h_page_ftl_map_lpa_to_ppa failed");
+	h4h_msg ("[MERGE-BEGIN] blocks: %llu valid: %llu invalid: %llu", nr_merges, nr_valid_pgs, nr_trim_pgs);
+
+	/* [STEP2] advance each pipeline when its stage is completed */
+	while (nr_done < nr_merges) {
+		uint8_t progress = 0;
+
+		for (i = 0; i < p->nr_blks_per_seg; i++) {
+			h4h_block_mapping_entry_t* e = &p->mt[seg_no][i];
+			h4h_block_ftl_merge_t* m = &p->gc_merge[i];
+
+			if (m->stage == BFTL_MERGE_DONE)
+				continue;
+			if (h4h_sema_try_lock (&m->gc.done) == 0)
+				continue; /* the stage is in progress */
+			h4h_sema_unlock (&m->gc.done);
+
+			switch (m->stage) {
+			case BFTL_MERGE_READ:
+				__h4h_block_ftl_merge_issue_erase (bdi, m, e);
+				break;
+			case BFTL_MERGE_ERASE:
+				__h4h_block_ftl_merge_issue_writes (bdi, m, seg_no, e);
+				break;
+			case BFTL_MERGE_WRITE:
+				m->stage = BFTL_MERGE_DONE;
+				break;
+			default:
 				h4h_bug_on (1);
+				break;
 			}
+			if (m->stage == BFTL_MERGE_DONE)
+				nr_done++;
+			progress = 1;
 		}
 
-		/* send write reqs to llm */
-		hlm_gc->req_type = REQTYPE_GC_WRITE;
-		hlm_gc->nr_llm_reqs = nr_valid_pgs;
-		atomic64_set (&hlm_gc->nr_llm_reqs_done, 0);
-		h4h_sema_lock (&hlm_gc->done);
-		for (j = 0; j < nr_valid_pgs; j++) {
-			if ((bdi->ptr_llm_inf->make_req (bdi, &hlm_gc->llm_reqs[j])) != 0) {
-				h4h_error ("llm_make_req failed");
-				h4h_bug_on (1);
-			}
-		}
-		h4h_sema_lock (&hlm_gc->done);
-		h4h_sema_unlock (&hlm_gc->done);
+		if (progress == 0)
+			h4h_thread_yield ();
 	}
 
-	h4h_msg ("[MERGE-END] valid: %llu invalid: %llu", nr_valid_pgs, nr_trim_pgs);
+	h4h_msg ("[MERGE-END] blocks: %llu valid: %llu invalid: %llu", nr_merges, nr_valid_pgs, nr_trim_pgs);
 
 	return 0;
 }
@@ -1062,7 +1205,7 @@ uint32_t h4h_block_ftl_do_gc (
 	if (p->nr_valid_pgs[segment_no] == 0) {
 		return __h4h_block_ftl_do_gc_segment (bdi, segment_no);
 	} else
-		return __h4h_block_ftl_do_gc_block_merge (bdi, segment_no, block_no);
+		return __h4h_block_ftl_do_gc_segment_merge (bdi, segment_no, block_no);
 }
 
 uint64_t h4h_block_ftl_get_segno (h4h_drv_info_t* bdi, uint64_t lpa)
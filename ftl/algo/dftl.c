@@ -42,6 +42,8 @@ THE SOFTWARE.
 #include "debug.h"
 #include "utime.h"
 #include "ufile.h"
+#include "umemory.h"
+#include "hlm_reqs_pool.h"
 
 #include "algo/abm.h"
 #include "algo/dftl.h"
@@ -78,15 +80,29 @@ typedef struct {
 	dftl_mapping_table_t* mt;
 	h4h_spinlock_t ftl_lock;
 	uint64_t nr_punits;	
+	uint64_t nr_punits_pages;
 
 	/* for the management of active blocks */
 	uint64_t curr_puid;
 	uint64_t curr_page_ofs;
 	h4h_abm_block_t** ac_bab;
 
+	/* active blocks for translation pages (separated from user data) */
+	uint64_t map_curr_puid;
+	uint64_t map_curr_page_ofs;
+	h4h_abm_block_t** map_bab;
+
+	/* gc accounting */
+	uint64_t nr_gc_data_blks;	/* # of victims that had user data */
+	uint64_t nr_gc_map_blks;	/* # of victims that had translation pages */
+	uint64_t nr_gc_data_pgs;	/* # of user-data pages copied by gc */
+	uint64_t nr_gc_map_pgs;		/* # of translation pages copied by gc */
+	uint64_t nr_map_writes;		/* # of translation pages written by eviction */
+
 	/* reserved for gc (reused whenever gc is invoked) */
 	h4h_abm_block_t** gc_bab;
 	h4h_hlm_req_gc_t gc_hlm;
+	h4h_hlm_reqs_gc_pads_t* gc_pads;
 
 	/* for bad-block scanning */
 	h4h_sema_t badblk;
@@ -165,8 +181,12 @@ uint32_t h4h_dftl_create (h4h_drv_info_t* bdi)
 {
 	h4h_dftl_private_t* p = NULL;
 	h4h_device_params_t* np = H4H_GET_DEVICE_PARAMS (bdi);
-	uint64_t i = 0, j = 0;
-	uint64_t nr_kp_per_fp = np->page_main_size / KERNEL_PAGE_SIZE;	/* e.g., 2 = 8 KB / 4 KB */
+
+	/* a translation page and a data page are a single kernel page */
+	if (np->nr_subpages_per_page != 1) {
+		h4h_error ("DFTL does not support subpages (%llu)", np->nr_subpages_per_page);
+		return 1;
+	}
 
 	/* create a private data structure */
 	if ((p = (h4h_dftl_private_t*)h4h_zmalloc 
@@ -176,7 +196,10 @@ uint32_t h4h_dftl_create (h4h_drv_info_t* bdi)
 	}
 	p->curr_puid = 0;
 	p->curr_page_ofs = 0;
+	p->map_curr_puid = 0;
+	p->map_curr_page_ofs = 0;
 	p->nr_punits = np->nr_chips_per_channel * np->nr_channels;
+	p->nr_punits_pages = p->nr_punits * np->nr_pages_per_block;
 	h4h_spin_lock_init (&p->ftl_lock);
 	_ftl_dftl.ptr_private = (void*)p;
 
@@ -200,6 +223,11 @@ uint32_t h4h_dftl_create (h4h_drv_info_t* bdi)
 		h4h_dftl_destroy (bdi);
 		return 1;
 	}
+	if ((p->map_bab = __h4h_dftl_create_active_blocks (np, p->bai)) == NULL) {
+		h4h_error ("__h4h_dftl_create_active_blocks failed");
+		h4h_dftl_destroy (bdi);
+		return 1;
+	}
 
 	/* allocate gc stuffs */
 	if ((p->gc_bab = (h4h_abm_block_t**)h4h_zmalloc 
@@ -209,22 +237,22 @@ uint32_t h4h_dftl_create (h4h_drv_info_t* bdi)
 		return 1;
 	}
 	if ((p->gc_hlm.llm_reqs = (h4h_llm_req_t*)h4h_zmalloc
-			(sizeof (h4h_llm_req_t) * p->nr_punits * np->nr_pages_per_block)) == NULL) {
+			(sizeof (h4h_llm_req_t) * p->nr_punits_pages)) == NULL) {
 		h4h_error ("h4h_zmalloc failed");
 		h4h_dftl_destroy (bdi);
 		return 1;
 	}
-
-	while (i < p->nr_punits * np->nr_pages_per_block) {
-		h4h_llm_req_t* r = &p->gc_hlm.llm_reqs[i];
-		r->kpg_flags = NULL;
-		r->pptr_kpgs = (uint8_t**)h4h_malloc_atomic (sizeof(uint8_t*) * nr_kp_per_fp);
-		for (j = 0; j < nr_kp_per_fp; j++)
-			r->pptr_kpgs[j] = (uint8_t*)get_zeroed_page (GFP_KERNEL);
-		r->ptr_oob = (uint8_t*)h4h_malloc_atomic (sizeof (uint8_t) * np->page_oob_size);
-		i++;
+	h4h_sema_init (&p->gc_hlm.done);
+	hlm_reqs_pool_allocate_llm_reqs (p->gc_hlm.llm_reqs, p->nr_punits_pages, RP_MEM_PHY);
+
+	/* gc copies a page with the same llm_req, so its pads keep the data
+	 * from the read until the write is done */
+	if ((p->gc_pads = hlm_reqs_pool_create_gc_pads (
+			p->gc_hlm.llm_reqs, p->nr_punits_pages, np->nr_subpages_per_page)) == NULL) {
+		h4h_error ("hlm_reqs_pool_create_gc_pads failed");
+		h4h_dftl_destroy (bdi);
+		return 1;
 	}
-	h4h_sema_init (&p->gc_hlm.gc_done);
 
 	return 0;
 }
@@ -232,28 +260,28 @@ uint32_t h4h_dftl_create (h4h_drv_info_t* bdi)
 void h4h_dftl_destroy (h4h_drv_info_t* bdi)
 {
 	h4h_dftl_private_t* p = _ftl_dftl.ptr_private;
-	h4h_device_params_t* np = H4H_GET_DEVICE_PARAMS (bdi);
 
 	if (!p)
 		return;
 
+	h4h_msg ("DFTL: gc victims (data: %llu, map: %llu), gc copies (data: %llu, map: %llu), map writes: %llu",
+		p->nr_gc_data_blks, p->nr_gc_map_blks, 
+		p->nr_gc_data_pgs, p->nr_gc_map_pgs, 
+		p->nr_map_writes);
+
+	if (p->gc_pads)
+		hlm_reqs_pool_destroy_gc_pads (p->gc_pads, p->gc_hlm.llm_reqs);
 	if (p->gc_hlm.llm_reqs) {
-		uint64_t i = 0, j = 0;
-		uint64_t nr_kp_per_fp = np->page_main_size / KERNEL_PAGE_SIZE;	/* e.g., 2 = 8 KB / 4 KB */
-		while (i < p->nr_punits * np->nr_pages_per_block) {
-			h4h_llm_req_t* r = &p->gc_hlm.llm_reqs[i];
-			for (j = 0; j < nr_kp_per_fp; j++)
-				free_page ((unsigned long)r->pptr_kpgs[j]);
-			h4h_free_atomic (r->pptr_kpgs);
-			h4h_free_atomic (r->ptr_oob);
-			i++;
-		}
+		hlm_reqs_pool_release_llm_reqs (p->gc_hlm.llm_reqs, p->nr_punits_pages, RP_MEM_PHY);
+		h4h_sema_free (&p->gc_hlm.done);
 		h4h_free (p->gc_hlm.llm_reqs);
 	}
 	if (p->gc_bab)
 		h4h_free (p->gc_bab);
 	if (p->ac_bab)
 		__h4h_dftl_destroy_active_blocks (p->ac_bab);
+	if (p->map_bab)
+		__h4h_dftl_destroy_active_blocks (p->map_bab);
 	if (p->mt) 
 		h4h_dftl_destroy_mapping_table (p->mt);
 	if (p->bai)
@@ -261,7 +289,12 @@ void h4h_dftl_destroy (h4h_drv_info_t* bdi)
 	h4h_free (p);
 }
 
-uint32_t h4h_dftl_get_free_ppa (h4h_drv_info_t* bdi, uint64_t lpa, h4h_phyaddr_t* ppa)
+static uint32_t __h4h_dftl_get_free_ppa_from (
+	h4h_drv_info_t* bdi, 
+	h4h_abm_block_t** bab,
+	uint64_t* curr_puid,
+	uint64_t* curr_page_ofs,
+	h4h_phyaddr_t* ppa)
 {
 	h4h_dftl_private_t* p = _ftl_dftl.ptr_private;
 	h4h_device_params_t* np = H4H_GET_DEVICE_PARAMS (bdi);
@@ -270,15 +303,15 @@ uint32_t h4h_dftl_get_free_ppa (h4h_drv_info_t* bdi, uint64_t lpa, h4h_phyaddr_t
 	uint64_t curr_chip;
 
 	/* get the channel & chip numbers */
-	curr_channel = p->curr_puid % np->nr_channels;
-	curr_chip = p->curr_puid / np->nr_channels;
+	curr_channel = *curr_puid % np->nr_channels;
+	curr_chip = *curr_puid / np->nr_channels;
 
 	/* get the physical offset of the active blocks */
-	b = p->ac_bab[curr_channel * np->nr_chips_per_channel + curr_chip];
+	b = bab[curr_channel * np->nr_chips_per_channel + curr_chip];
 	ppa->channel_no =  b->channel_no;
 	ppa->chip_no = b->chip_no;
 	ppa->block_no = b->block_no;
-	ppa->page_no = p->curr_page_ofs;
+	ppa->page_no = *curr_page_ofs;
 	ppa->punit_id = H4H_GET_PUNIT_ID (bdi, ppa);
 
 	/* check some error cases before returning the physical address */
@@ -287,14 +320,14 @@ uint32_t h4h_dftl_get_free_ppa (h4h_drv_info_t* bdi, uint64_t lpa, h4h_phyaddr_t
 	h4h_bug_on (ppa->page_no >= np->nr_pages_per_block);
 
 	/* go to the next parallel unit */
-	if ((p->curr_puid + 1) == p->nr_punits) {
-		p->curr_puid = 0;
-		p->curr_page_ofs++;	/* go to the next page */
+	if ((*curr_puid + 1) == p->nr_punits) {
+		*curr_puid = 0;
+		(*curr_page_ofs)++;	/* go to the next page */
 
 		/* see if there are sufficient free pages or not */
-		if (p->curr_page_ofs == np->nr_pages_per_block) {
+		if (*curr_page_ofs == np->nr_pages_per_block) {
 			/* get active blocks */
-			if (__h4h_dftl_get_active_blocks (np, p->bai, p->ac_bab) != 0) {
+			if (__h4h_dftl_get_active_blocks (np, p->bai, bab) != 0) {
 				/*
 				h4h_msg ("free_blks: %llu clean_blks: %llu, dirty_blks: %llu, total_blks: %llu",
 						h4h_abm_get_nr_free_blocks (p->bai),
@@ -307,25 +340,41 @@ uint32_t h4h_dftl_get_free_ppa (h4h_drv_info_t* bdi, uint64_t lpa, h4h_phyaddr_t
 				return 1;
 			}
 			/* ok; go ahead with 0 offset */
-			/*h4h_msg ("curr_puid = %llu", p->curr_puid);*/
-			p->curr_page_ofs = 0;
+			/*h4h_msg ("curr_puid = %llu", *curr_puid);*/
+			*curr_page_ofs = 0;
 		}
 	} else {
-		/*h4h_msg ("curr_puid = %llu", p->curr_puid);*/
-		p->curr_puid++;
+		/*h4h_msg ("curr_puid = %llu", *curr_puid);*/
+		(*curr_puid)++;
 	}
 
 	return 0;
 }
 
-uint32_t h4h_dftl_map_lpa_to_ppa (h4h_drv_info_t* bdi, uint64_t lpa, h4h_phyaddr_t* ptr_phyaddr)
+uint32_t h4h_dftl_get_free_ppa (h4h_drv_info_t* bdi, int64_t lpa, h4h_phyaddr_t* ppa)
+{
+	h4h_dftl_private_t* p = _ftl_dftl.ptr_private;
+
+	/* translation pages (lpa = -2) are written to their own active blocks,
+	 * so that map-page churn does not fragment user-data blocks */
+	if (lpa == -2LL) {
+		return __h4h_dftl_get_free_ppa_from (
+			bdi, p->map_bab, &p->map_curr_puid, &p->map_curr_page_ofs, ppa);
+	}
+
+	return __h4h_dftl_get_free_ppa_from (
+		bdi, p->ac_bab, &p->curr_puid, &p->curr_page_ofs, ppa);
+}
+
+uint32_t h4h_dftl_map_lpa_to_ppa (h4h_drv_info_t* bdi, h4h_logaddr_t* logaddr, h4h_phyaddr_t* ptr_phyaddr)
 {
 	h4h_device_params_t* np = H4H_GET_DEVICE_PARAMS (bdi);
 	h4h_dftl_private_t* p = _ftl_dftl.ptr_private;
+	int64_t lpa = logaddr->lpa[0];
 	mapping_entry_t me;
 
 	/* is it a valid logical address */
-	if (lpa >= np->nr_pages_per_ssd) {
+	if (lpa < 0 || lpa >= np->nr_pages_per_ssd) {
 		h4h_error ("LPA is beyond logical space (%llX)", lpa);
 		return 1;
 	}
@@ -344,7 +393,8 @@ uint32_t h4h_dftl_map_lpa_to_ppa (h4h_drv_info_t* bdi, uint64_t lpa, h4h_phyaddr
 			me.phyaddr.channel_no, 
 			me.phyaddr.chip_no,
 			me.phyaddr.block_no,
-			me.phyaddr.page_no
+			me.phyaddr.page_no,
+			0
 		);
 	}
 
@@ -359,7 +409,7 @@ uint32_t h4h_dftl_map_lpa_to_ppa (h4h_drv_info_t* bdi, uint64_t lpa, h4h_phyaddr
 	return 0;
 }
 
-uint32_t h4h_dftl_get_ppa (h4h_drv_info_t* bdi, uint64_t lpa, h4h_phyaddr_t* ppa)
+uint32_t h4h_dftl_get_ppa (h4h_drv_info_t* bdi, int64_t lpa, h4h_phyaddr_t* ppa, uint64_t* sp_off)
 {
 	h4h_device_params_t* np = H4H_GET_DEVICE_PARAMS (bdi);
 	h4h_dftl_private_t* p = _ftl_dftl.ptr_private;
@@ -367,7 +417,7 @@ uint32_t h4h_dftl_get_ppa (h4h_drv_info_t* bdi, uint64_t lpa, h4h_phyaddr_t* ppa
 	uint32_t ret;
 
 	/* is it a valid logical address */
-	if (lpa >= np->nr_pages_per_ssd) {
+	if (lpa < 0 || lpa >= np->nr_pages_per_ssd) {
 		h4h_error ("A given lpa is beyond logical space (%llu)", lpa);
 		return 1;
 	}
@@ -389,6 +439,7 @@ uint32_t h4h_dftl_get_ppa (h4h_drv_info_t* bdi, uint64_t lpa, h4h_phyaddr_t* ppa
 		ppa->chip_no = 0;
 		ppa->block_no = 0;
 		ppa->page_no = 0;
+		ppa->punit_id = 0;
 		ret = 1;
 	} else {
 		ppa->channel_no = me.phyaddr.channel_no;
@@ -398,11 +449,12 @@ uint32_t h4h_dftl_get_ppa (h4h_drv_info_t* bdi, uint64_t lpa, h4h_phyaddr_t* ppa
 		ppa->punit_id = H4H_GET_PUNIT_ID (bdi, ppa);
 		ret = 0;
 	}
+	*sp_off = 0;
 
 	return ret;
 }
 
-uint32_t h4h_dftl_invalidate_lpa (h4h_drv_info_t* bdi, uint64_t lpa, uint64_t len)
+uint32_t h4h_dftl_invalidate_lpa (h4h_drv_info_t* bdi, int64_t lpa, uint64_t len)
 {	
 	h4h_device_params_t* np = H4H_GET_DEVICE_PARAMS (bdi);
 	h4h_dftl_private_t* p = _ftl_dftl.ptr_private;
@@ -433,7 +485,8 @@ uint32_t h4h_dftl_invalidate_lpa (h4h_drv_info_t* bdi, uint64_t lpa, uint64_t le
 				me.phyaddr.channel_no, 
 				me.phyaddr.chip_no,
 				me.phyaddr.block_no,
-				me.phyaddr.page_no
+				me.phyaddr.page_no,
+				0
 			);
 
 			/* update a mapping entry to invalid */
@@ -446,7 +499,7 @@ uint32_t h4h_dftl_invalidate_lpa (h4h_drv_info_t* bdi, uint64_t lpa, uint64_t le
 	return 0;
 }
 
-uint8_t h4h_dftl_is_gc_needed (h4h_drv_info_t* bdi)
+uint8_t h4h_dftl_is_gc_needed (h4h_drv_info_t* bdi, int64_t lpa)
 {
 	h4h_dftl_private_t* p = _ftl_dftl.ptr_private;
 	uint64_t nr_total_blks = h4h_abm_get_nr_total_blocks (p->bai);
@@ -490,13 +543,15 @@ h4h_abm_block_t* __h4h_dftl_victim_selection (
 	h4h_dftl_private_t* p = _ftl_dftl.ptr_private;
 	h4h_device_params_t* np = H4H_GET_DEVICE_PARAMS (bdi);
 	h4h_abm_block_t* a = NULL;
+	h4h_abm_block_t* m = NULL;
 	h4h_abm_block_t* b = NULL;
 	struct list_head* pos = NULL;
 
 	a = p->ac_bab[channel_no*np->nr_chips_per_channel + chip_no];
+	m = p->map_bab[channel_no*np->nr_chips_per_channel + chip_no];
 	h4h_abm_list_for_each_dirty_block (pos, p->bai, channel_no, chip_no) {
 		b = h4h_abm_fetch_dirty_block (pos);
-		if (a != b)
+		if (a != b && m != b)
 			break;
 		b = NULL;
 	}
@@ -514,17 +569,19 @@ h4h_abm_block_t* __h4h_dftl_victim_selection_greedy (
 	h4h_dftl_private_t* p = _ftl_dftl.ptr_private;
 	h4h_device_params_t* np = H4H_GET_DEVICE_PARAMS (bdi);
 	h4h_abm_block_t* a = NULL;
+	h4h_abm_block_t* m = NULL;
 	h4h_abm_block_t* b = NULL;
 	h4h_abm_block_t* v = NULL;
 	struct list_head* pos = NULL;
 
 	a = p->ac_bab[channel_no*np->nr_chips_per_channel + chip_no];
+	m = p->map_bab[channel_no*np->nr_chips_per_channel + chip_no];
 
 	h4h_abm_list_for_each_dirty_block (pos, p->bai, channel_no, chip_no) {
 		b = h4h_abm_fetch_dirty_block (pos);
-		if (a == b)
+		if (a == b || m == b)
 			continue;
-		if (b->nr_invalid_pages == np->nr_pages_per_block) {
+		if (b->nr_invalid_subpages == np->nr_subpages_per_block) {
 			v = b;
 			break;
 		}
@@ -532,7 +589,7 @@ h4h_abm_block_t* __h4h_dftl_victim_selection_greedy (
 			v = b;
 			continue;
 		}
-		if (a->nr_invalid_pages > v->nr_invalid_pages)
+		if (b->nr_invalid_subpages > v->nr_invalid_subpages)
 			v = b;
 	}
 
@@ -540,7 +597,7 @@ h4h_abm_block_t* __h4h_dftl_victim_selection_greedy (
 }
 
 /* TODO: need to improve it for background gc */
-uint32_t h4h_dftl_do_gc (h4h_drv_info_t* bdi)
+uint32_t h4h_dftl_do_gc (h4h_drv_info_t* bdi, int64_t lpa)
 {
 	h4h_dftl_private_t* p = _ftl_dftl.ptr_private;
 	h4h_device_params_t* np = H4H_GET_DEVICE_PARAMS (bdi);
@@ -569,23 +626,25 @@ uint32_t h4h_dftl_do_gc (h4h_drv_info_t* bdi)
 		return 0;
 	}
 
-	/* build hlm_req_gc for reads */
+	/* build hlm_req_gc for reads; the pads of gc reads are already bound
+	 * to them */
 	for (i = 0, nr_llm_reqs = 0; i < nr_gc_blks; i++) {
 		h4h_abm_block_t* b = p->gc_bab[i];
 		if (b == NULL)
 			break;
 		for (j = 0; j < np->nr_pages_per_block; j++) {
-			if (b->pst[j] != H4H_ABM_PAGE_INVALID) {
+			if (b->pst[j] != H4H_ABM_SUBPAGE_INVALID) {
 				h4h_llm_req_t* r = &hlm_gc->llm_reqs[nr_llm_reqs];
+				hlm_reqs_pool_reset_fmain (&r->fmain);
+				hlm_reqs_pool_reset_logaddr (&r->logaddr); /* lpa is read from oob */
+				r->fmain.kp_stt[0] = KP_STT_DATA;
 				r->req_type = REQTYPE_GC_READ;
-				r->lpa = -1ULL; /* lpa is not available now */
 				r->ptr_hlm_req = (void*)hlm_gc;
-				r->phyaddr = &r->phyaddr_r;
-				r->phyaddr->channel_no = b->channel_no;
-				r->phyaddr->chip_no = b->chip_no;
-				r->phyaddr->block_no = b->block_no;
-				r->phyaddr->page_no = j;
-				r->phyaddr->punit_id = H4H_GET_PUNIT_ID (bdi, r->phyaddr);
+				r->phyaddr.channel_no = b->channel_no;
+				r->phyaddr.chip_no = b->chip_no;
+				r->phyaddr.block_no = b->block_no;
+				r->phyaddr.page_no = j;
+				r->phyaddr.punit_id = H4H_GET_PUNIT_ID (bdi, (&r->phyaddr));
 				r->ret = 0;
 				nr_llm_reqs++;
 			}
@@ -601,32 +660,44 @@ uint32_t h4h_dftl_do_gc (h4h_drv_info_t* bdi)
 
 	/* send read reqs to llm */
 	hlm_gc->req_type = REQTYPE_GC_READ;
-	hlm_gc->nr_done_reqs = 0;
-	hlm_gc->nr_reqs = nr_llm_reqs;
-	h4h_sema_lock (&hlm_gc->gc_done);
+	hlm_gc->nr_llm_reqs = nr_llm_reqs;
+	atomic64_set (&hlm_gc->nr_llm_reqs_done, 0);
+	h4h_sema_lock (&hlm_gc->done);
 	for (i = 0; i < nr_llm_reqs; i++) {
 		if ((bdi->ptr_llm_inf->make_req (bdi, &hlm_gc->llm_reqs[i])) != 0) {
 			h4h_error ("llm_make_req failed");
 			h4h_bug_on (1);
 		}
 	}
-	h4h_sema_lock (&hlm_gc->gc_done);
-	h4h_sema_unlock (&hlm_gc->gc_done);
+	h4h_sema_lock (&hlm_gc->done);
+	h4h_sema_unlock (&hlm_gc->done);
+
+	/* account victims by the type of pages they keep; the data and 
+	 * translation streams never share a block, so the first valid page tells it */
+	for (i = 0; i < nr_llm_reqs; i++) {
+		h4h_llm_req_t* r = &hlm_gc->llm_reqs[i];
+		if (i > 0 && r->phyaddr.punit_id == hlm_gc->llm_reqs[i-1].phyaddr.punit_id)
+			continue;
+		if (((int64_t*)r->foob.data)[0] == -2LL)
+			p->nr_gc_map_blks++;
+		else
+			p->nr_gc_data_blks++;
+	}
 
 	/* load mapping entries that do existing in DRAM */
 	{
-		h4h_llm_req_t** rr = (h4h_llm_req_t**)h4h_malloc (sizeof (h4h_llm_req_t*)*nr_llm_reqs);
+		h4h_llm_req_t** rr = (h4h_llm_req_t**)h4h_zmalloc (sizeof (h4h_llm_req_t*)*nr_llm_reqs);
 
 		/* FIXME: need to improve to exploit parallelism */
 		for (i = 0; i < nr_llm_reqs; i++) {
-			uint64_t lpa = ((uint64_t*)hlm_gc->llm_reqs[i].ptr_oob)[0]; /* update LPA */
+			int64_t lpa = ((int64_t*)hlm_gc->llm_reqs[i].foob.data)[0];
 
 			/* is it a mapping entry? */
-			if ((int64_t)lpa == -2LL) {
+			if (lpa == -2LL) {
 				continue;
 			}
 
-			if ((int64_t)lpa >= np->nr_pages_per_ssd || (int64_t)lpa < 0) {
+			if (lpa >= np->nr_pages_per_ssd || lpa < 0) {
 				/*h4h_msg ("what??? %llu", lpa);*/
 				continue;
 			}
@@ -653,58 +724,65 @@ uint32_t h4h_dftl_do_gc (h4h_drv_info_t* bdi)
 		h4h_free (rr);
 	}
 
-	/* build hlm_req_gc for writes */
-	for (i = 0; i < nr_llm_reqs; i++) {
+	/* build hlm_req_gc for writes; a page is written back from the pad it
+	 * was read into, and pages with a broken oob are dropped */
+	for (i = 0, j = 0; i < nr_llm_reqs; i++) {
 		h4h_llm_req_t* r = &hlm_gc->llm_reqs[i];
-		r->req_type = REQTYPE_GC_WRITE;	/* change to write */
-		r->lpa = ((uint64_t*)r->ptr_oob)[0]; /* update LPA */
+		int64_t lpa = ((int64_t*)r->foob.data)[0];
 
-		if ((int64_t)r->lpa == -2LL) {
+		if (lpa == -2LL) {
 			/* This page currently keeps mapping entries;
 			 * its phyaddr in DS must be updated */
-			int64_t id = ((uint64_t*)r->ptr_oob)[1];
+			int64_t id = ((int64_t*)r->foob.data)[1];
+
+			p->nr_gc_map_pgs++;
 			
-			if (h4h_dftl_get_free_ppa (bdi, r->lpa, r->phyaddr) != 0) {
+			if (h4h_dftl_get_free_ppa (bdi, lpa, &r->phyaddr) != 0) {
 				h4h_error ("h4h_dftl_get_free_ppa failed");
 				h4h_bug_on (1);
 			}
 
-			h4h_dftl_update_dir_phyaddr (p->mt, id, r->phyaddr);
-		} else if ((int64_t)r->lpa >= np->nr_pages_per_ssd || (int64_t)r->lpa < 0) {
-			/*h4h_msg ("what??? %llu", r->lpa);*/
+			h4h_dftl_update_dir_phyaddr (p->mt, id, &r->phyaddr);
+			r->logaddr.lpa[0] = -1; /* not ordered against data pages */
+		} else if (lpa >= np->nr_pages_per_ssd || lpa < 0) {
+			/*h4h_msg ("what??? %llu", lpa);*/
+			continue;
 		} else {
-			if (h4h_dftl_get_free_ppa (bdi, r->lpa, r->phyaddr) != 0) {
+			p->nr_gc_data_pgs++;
+
+			r->logaddr.lpa[0] = lpa;
+			if (h4h_dftl_get_free_ppa (bdi, lpa, &r->phyaddr) != 0) {
 				h4h_error ("h4h_dftl_get_free_ppa failed");
 				h4h_bug_on (1);
 			}
 
-			if (h4h_dftl_map_lpa_to_ppa (bdi, r->lpa, r->phyaddr) != 0) {
+			if (h4h_dftl_map_lpa_to_ppa (bdi, &r->logaddr, &r->phyaddr) != 0) {
 				h4h_error ("h4h_dftl_map_lpa_to_ppa failed");
 				h4h_bug_on (1);
 			}
 		}
+		r->req_type = REQTYPE_GC_WRITE;	/* change to write */
+		j++;
 	}
 
+	if (j == 0)
+		goto erase_blks;
+
 	/* send write reqs to llm */
 	hlm_gc->req_type = REQTYPE_GC_WRITE;
-	hlm_gc->nr_done_reqs = 0;
-	hlm_gc->nr_reqs = nr_llm_reqs;
-	h4h_sema_lock (&hlm_gc->gc_done);
+	hlm_gc->nr_llm_reqs = j;
+	atomic64_set (&hlm_gc->nr_llm_reqs_done, 0);
+	h4h_sema_lock (&hlm_gc->done);
 	for (i = 0; i < nr_llm_reqs; i++) {
-		h4h_llm_req_t* r = &hlm_gc->llm_reqs[i];
-		if ((int64_t)r->lpa >= np->nr_pages_per_ssd || (int64_t)r->lpa < 0) {
-			/*h4h_msg ("what??? %llu", r->lpa);*/
-			hlm_gc->nr_reqs--;
+		if (hlm_gc->llm_reqs[i].req_type != REQTYPE_GC_WRITE)
 			continue;
-		}
 		if ((bdi->ptr_llm_inf->make_req (bdi, &hlm_gc->llm_reqs[i])) != 0) {
 			h4h_error ("llm_make_req failed");
 			h4h_bug_on (1);
 		}
 	}
-	/*h4h_msg ("gc-3");*/
-	h4h_sema_lock (&hlm_gc->gc_done);
-	h4h_sema_unlock (&hlm_gc->gc_done);
+	h4h_sema_lock (&hlm_gc->done);
+	h4h_sema_unlock (&hlm_gc->done);
 
 	/* erase blocks */
 erase_blks:
@@ -712,31 +790,29 @@ erase_blks:
 		h4h_abm_block_t* b = p->gc_bab[i];
 		h4h_llm_req_t* r = &hlm_gc->llm_reqs[i];
 		r->req_type = REQTYPE_GC_ERASE;
-		r->lpa = -1ULL; /* lpa is not available now */
+		r->logaddr.lpa[0] = -1ULL; /* lpa is not available now */
 		r->ptr_hlm_req = (void*)hlm_gc;
-		r->phyaddr = &r->phyaddr_w;
-		r->phyaddr->channel_no = b->channel_no;
-		r->phyaddr->chip_no = b->chip_no;
-		r->phyaddr->block_no = b->block_no;
-		r->phyaddr->page_no = 0;
-		r->phyaddr->punit_id = H4H_GET_PUNIT_ID (bdi, r->phyaddr);
+		r->phyaddr.channel_no = b->channel_no;
+		r->phyaddr.chip_no = b->chip_no;
+		r->phyaddr.block_no = b->block_no;
+		r->phyaddr.page_no = 0;
+		r->phyaddr.punit_id = H4H_GET_PUNIT_ID (bdi, (&r->phyaddr));
 		r->ret = 0;
 	}
 
 	/* send erase reqs to llm */
 	hlm_gc->req_type = REQTYPE_GC_ERASE;
-	hlm_gc->nr_done_reqs = 0;
-	hlm_gc->nr_reqs = nr_gc_blks;
-	h4h_sema_lock (&hlm_gc->gc_done);
+	hlm_gc->nr_llm_reqs = nr_gc_blks;
+	atomic64_set (&hlm_gc->nr_llm_reqs_done, 0);
+	h4h_sema_lock (&hlm_gc->done);
 	for (i = 0; i < nr_gc_blks; i++) {
 		if ((bdi->ptr_llm_inf->make_req (bdi, &hlm_gc->llm_reqs[i])) != 0) {
 			h4h_error ("llm_make_req failed");
 			h4h_bug_on (1);
 		}
 	}
-	/*h4h_msg ("gc-5");*/
-	h4h_sema_lock (&hlm_gc->gc_done);
-	h4h_sema_unlock (&hlm_gc->gc_done);
+	h4h_sema_lock (&hlm_gc->done);
+	h4h_sema_unlock (&hlm_gc->done);
 
 	/* FIXME: what happens if block erasure fails */
 	for (i = 0; i < nr_gc_blks; i++) {
@@ -788,31 +864,30 @@ static void __h4h_dftl_badblock_scan_eraseblks (
 
 			r = &hlm_gc->llm_reqs[punit_id];
 			r->req_type = REQTYPE_GC_ERASE;
-			r->lpa = -1ULL; /* lpa is not available now */
+			r->logaddr.lpa[0] = -1ULL; /* lpa is not available now */
 			r->ptr_hlm_req = (void*)hlm_gc;
-			r->phyaddr = &r->phyaddr_w;
-			r->phyaddr->channel_no = b->channel_no;
-			r->phyaddr->chip_no = b->chip_no;
-			r->phyaddr->block_no = b->block_no;
-			r->phyaddr->page_no = 0;
-			r->phyaddr->punit_id = H4H_GET_PUNIT_ID (bdi, r->phyaddr);
+			r->phyaddr.channel_no = b->channel_no;
+			r->phyaddr.chip_no = b->chip_no;
+			r->phyaddr.block_no = b->block_no;
+			r->phyaddr.page_no = 0;
+			r->phyaddr.punit_id = H4H_GET_PUNIT_ID (bdi, (&r->phyaddr));
 			r->ret = 0;
 		}
 	}
 
 	/* send erase reqs to llm */
 	hlm_gc->req_type = REQTYPE_GC_ERASE;
-	hlm_gc->nr_done_reqs = 0;
-	hlm_gc->nr_reqs = p->nr_punits;
-	h4h_sema_lock (&hlm_gc->gc_done);
+	hlm_gc->nr_llm_reqs = p->nr_punits;
+	atomic64_set (&hlm_gc->nr_llm_reqs_done, 0);
+	h4h_sema_lock (&hlm_gc->done);
 	for (i = 0; i < p->nr_punits; i++) {
 		if ((bdi->ptr_llm_inf->make_req (bdi, &hlm_gc->llm_reqs[i])) != 0) {
 			h4h_error ("llm_make_req failed");
 			h4h_bug_on (1);
 		}
 	}
-	h4h_sema_lock (&hlm_gc->gc_done);
-	h4h_sema_unlock (&hlm_gc->gc_done);
+	h4h_sema_lock (&hlm_gc->done);
+	h4h_sema_unlock (&hlm_gc->done);
 
 	for (i = 0; i < p->nr_punits; i++) {
 		uint8_t ret = 0;
@@ -828,6 +903,8 @@ static void __h4h_dftl_badblock_scan_eraseblks (
 	/* measure gc elapsed time */
 }
 
+/* only used by the on-demand format below, which is disabled */
+#if 0
 static void __h4h_dftl_mark_it_dead (
 	h4h_drv_info_t* bdi,
 	uint64_t block_no)
@@ -849,6 +926,7 @@ static void __h4h_dftl_mark_it_dead (
 		}
 	}
 }
+#endif
 
 
 uint32_t h4h_dftl_badblock_scan (h4h_drv_info_t* bdi)
@@ -879,12 +957,15 @@ uint32_t h4h_dftl_badblock_scan (h4h_drv_info_t* bdi)
 
 	/* step4: get active blocks */
 	h4h_msg ("step2: get active blocks");
-	if (__h4h_dftl_get_active_blocks (np, p->bai, p->ac_bab) != 0) {
+	if (__h4h_dftl_get_active_blocks (np, p->bai, p->ac_bab) != 0 ||
+		__h4h_dftl_get_active_blocks (np, p->bai, p->map_bab) != 0) {
 		h4h_error ("__h4h_dftl_get_active_blocks failed");
 		return 1;
 	}
 	p->curr_puid = 0;
 	p->curr_page_ofs = 0;
+	p->map_curr_puid = 0;
+	p->map_curr_page_ofs = 0;
 
 	h4h_msg ("done");
 	 
@@ -953,17 +1034,52 @@ uint8_t h4h_dftl_check_mapblk (
 	return h4h_dftl_check_mapping_entry (p->mt, lpa);
 }
 
+/* a mapblk is read or written with an llm_req of its own; it keeps the
+ * directory slot in 'ptr_hlm_req', and 'done' is unlocked by hlm_dftl */
+static h4h_llm_req_t* __h4h_dftl_alloc_mapblk_req (
+	h4h_dftl_private_t* p,
+	h4h_device_params_t* np,
+	directory_slot_t* ds,
+	uint32_t req_type)
+{
+	h4h_llm_req_t* r = NULL;
+	dftl_packed_me_t* me = NULL;
+
+	h4h_bug_on ((sizeof (dftl_packed_me_t) * p->mt->nr_entires_per_dir_slot) != np->page_main_size);
+
+	if ((r = (h4h_llm_req_t*)h4h_zmalloc (sizeof (h4h_llm_req_t))) == NULL ||
+		(me = (dftl_packed_me_t*)h4h_malloc (np->page_main_size)) == NULL ||
+		(r->done = (h4h_sema_t*)h4h_malloc (sizeof (h4h_sema_t))) == NULL) {
+		h4h_error ("h4h_malloc failed");
+		h4h_bug_on (1);
+	}
+	h4h_sema_init (r->done);
+
+	r->req_type = req_type;
+	r->logaddr.lpa[0] = -1;	/* mapblks are not ordered against data pages */
+	r->fmain.kp_stt[0] = KP_STT_DATA;
+	r->fmain.kp_ptr[0] = (uint8_t*)me;
+	r->ptr_hlm_req = (void*)ds;
+
+	return r;
+}
+
+static void __h4h_dftl_free_mapblk_req (h4h_llm_req_t* r)
+{
+	h4h_sema_free (r->done);
+	h4h_free (r->done);
+	h4h_free (r->fmain.kp_ptr[0]);	/* free an array of mapblks */
+	h4h_free (r);
+}
+
 h4h_llm_req_t* h4h_dftl_prepare_mapblk_load (
 	h4h_drv_info_t* bdi,
 	uint64_t lpa)
 {
 	h4h_dftl_private_t* p = (h4h_dftl_private_t*)H4H_FTL_PRIV (bdi);
 	h4h_device_params_t* np = H4H_GET_DEVICE_PARAMS (bdi);
-	mapping_entry_t* me = NULL;
 	directory_slot_t* ds = NULL;
 	h4h_llm_req_t* r = NULL;
-	uint32_t nr_kp_per_fp = np->page_main_size / KERNEL_PAGE_SIZE;
-	uint32_t i;
 
 	/* is there a victim mapblk to evict to flash */
 	if ((ds = h4h_dftl_missing_dir_prepare (p->mt, lpa)) == NULL) {
@@ -971,28 +1087,9 @@ h4h_llm_req_t* h4h_dftl_prepare_mapblk_load (
 		return NULL;
 	}
 
-	/* create a hlm_req that stores mapping entries */
-	r = (h4h_llm_req_t*)h4h_malloc(sizeof (h4h_llm_req_t));
-	r->pptr_kpgs = (uint8_t**)h4h_malloc(sizeof (uint8_t*) * nr_kp_per_fp);
-	me = (mapping_entry_t*)h4h_malloc(
-			(sizeof (mapping_entry_t) * p->mt->nr_entires_per_dir_slot));
-	h4h_bug_on ((sizeof (mapping_entry_t) * p->mt->nr_entires_per_dir_slot) != 4096);
-	for (i = 0; i < nr_kp_per_fp; i++)
-		r->pptr_kpgs[i] = (uint8_t*)(me) + (i * KERNEL_PAGE_SIZE);
-
-	/* build the parameters of the hlm_req */
-	r->req_type = REQTYPE_META_READ;
-	r->lpa = -2ULL;	/* not available for mapblks */
-	r->phyaddr_r = ds->phyaddr;
-	r->phyaddr_w = ds->phyaddr;
-	r->phyaddr = &r->phyaddr_r;
-	r->ds = (void*)ds;
-	r->ptr_hlm_req = (void*)NULL;
-	r->ptr_oob = (uint8_t*)h4h_malloc(sizeof (uint8_t) * np->page_oob_size);
-
-	r->done = NULL;
-	r->done = (h4h_sema_t*)h4h_malloc(sizeof (h4h_sema_t));
-	h4h_sema_init (r->done);
+	/* create a llm_req that loads mapping entries */
+	r = __h4h_dftl_alloc_mapblk_req (p, np, ds, REQTYPE_META_READ);
+	r->phyaddr = ds->phyaddr;
 
 #ifdef DFTL_DEBUG
 	h4h_msg ("[dftl] [Fetch] lpa: %llu dir: %llu (phyaddr: %llu %lld %lld %lld %lld)", 
@@ -1013,17 +1110,16 @@ void h4h_dftl_finish_mapblk_load (
 	h4h_llm_req_t* r)
 {
 	h4h_dftl_private_t* p = (h4h_dftl_private_t*)H4H_FTL_PRIV (bdi);
-	directory_slot_t* ds = (directory_slot_t*)r->ds;
-	mapping_entry_t* me = NULL;
+	directory_slot_t* ds = (directory_slot_t*)r->ptr_hlm_req;
+	dftl_packed_me_t* me = NULL;
 
 	/* copy mapping entries to ds */
-	me = (mapping_entry_t*)r->pptr_kpgs[0];
+	me = (dftl_packed_me_t*)r->fmain.kp_ptr[0];
 
-	if (((int64_t*)r->ptr_oob)[0] != -2LL) {
+	if (((int64_t*)r->foob.data)[0] != -2LL) {
 		/*
 		h4h_msg ("---------------------------------------------------------------------");
-		h4h_warning ("oob is not match: %lld", ((int64_t*)r->ptr_oob)[0]);
-		h4h_warning ("lpa: %lld", r->lpa);
+		h4h_warning ("oob is not match: %lld", ((int64_t*)r->foob.data)[0]);
 		h4h_warning ("dir: %llu (phyaddr: %llu %lld %lld %lld %lld)", 
 			ds->id,
 			ds->phyaddr.punit_id,
@@ -1031,7 +1127,7 @@ void h4h_dftl_finish_mapblk_load (
 			ds->phyaddr.chip_no,
 			ds->phyaddr.block_no,
 			ds->phyaddr.page_no);
-		h4h_warning ("flash-dir: %lld", ((int64_t*)r->ptr_oob)[1]);
+		h4h_warning ("flash-dir: %lld", ((int64_t*)r->foob.data)[1]);
 		h4h_msg ("---------------------------------------------------------------------");
 		*/
 
@@ -1042,11 +1138,7 @@ void h4h_dftl_finish_mapblk_load (
 	}
 
 	/* remove a llm_req */
-	h4h_free(r->ptr_oob);
-	h4h_free(r->done);
-	h4h_free(me); /* free an array of mapblks */
-	h4h_free(r->pptr_kpgs); /* free pptr_kpgs */
-	h4h_free(r);
+	__h4h_dftl_free_mapblk_req (r);
 
 #ifdef DFTL_DEBUG
 	h4h_msg ("[dftl] [Fetch] dir: %llu (done)\n", ds->id);
@@ -1058,10 +1150,9 @@ h4h_llm_req_t* h4h_dftl_prepare_mapblk_eviction (
 {
 	h4h_dftl_private_t* p = (h4h_dftl_private_t*)H4H_FTL_PRIV (bdi);
 	h4h_device_params_t* np = H4H_GET_DEVICE_PARAMS (bdi);
-	mapping_entry_t* me = NULL;
+	dftl_packed_me_t* me = NULL;
 	directory_slot_t* ds = NULL;
 	h4h_llm_req_t* r = NULL;
-	uint32_t nr_kp_per_fp = np->page_main_size / KERNEL_PAGE_SIZE;
 	uint32_t i;
 
 	/* is there a victim mapblk to evict to flash */
@@ -1070,47 +1161,30 @@ h4h_llm_req_t* h4h_dftl_prepare_mapblk_eviction (
 		return NULL;
 	}
 
-	/* create a hlm_req that stores mapping entries */
-	r = (h4h_llm_req_t*)h4h_malloc(sizeof (h4h_llm_req_t));
-	r->pptr_kpgs = (uint8_t**)h4h_malloc(sizeof (uint8_t*) * nr_kp_per_fp);
-	me = (mapping_entry_t*)h4h_malloc(
-			(sizeof (mapping_entry_t) * p->mt->nr_entires_per_dir_slot));
-	h4h_bug_on ((sizeof (mapping_entry_t) * p->mt->nr_entires_per_dir_slot) != 4096);
-	for (i = 0; i < nr_kp_per_fp; i++)
-		r->pptr_kpgs[i] = (uint8_t*)(me) + (i * KERNEL_PAGE_SIZE);
-
-	/* build the parameters of the hlm_req */
-	r->req_type = REQTYPE_META_WRITE;
-	r->lpa = -2ULL;	/* not available for me */
-	r->phyaddr = &r->phyaddr_w;
-	r->ds = (void*)ds;
+	/* create a llm_req that stores mapping entries */
+	r = __h4h_dftl_alloc_mapblk_req (p, np, ds, REQTYPE_META_WRITE);
 	if (ds->status != DFTL_DIR_CLEAN) {
-		h4h_dftl_get_free_ppa (bdi, r->lpa, r->phyaddr); /* get a new page */
+		h4h_dftl_get_free_ppa (bdi, -2LL, &r->phyaddr); /* get a new page */
+		p->nr_map_writes++;
 	} else {
 		/* if ds->status is not dirty, 
 		 * we don't need to write it to NAND flash */
 	}
-	r->phyaddr_r = r->phyaddr_w;
+	me = (dftl_packed_me_t*)r->fmain.kp_ptr[0];
 	for (i = 0; i < p->mt->nr_entires_per_dir_slot; i++)
 		me[i] = ds->me[i];
-	r->ptr_oob = (uint8_t*)h4h_malloc(np->page_oob_size);
-	r->ptr_hlm_req = (void*)NULL;
-	((int64_t*)r->ptr_oob)[0] = -2LL; /* magic # */
-	((int64_t*)r->ptr_oob)[1] = ds->id; /* ds ID */
-
-	r->done = NULL;
-	r->done = (h4h_sema_t*)h4h_malloc(sizeof (h4h_sema_t));
-	h4h_sema_init (r->done);
+	((int64_t*)r->foob.data)[0] = -2LL; /* magic # */
+	((int64_t*)r->foob.data)[1] = ds->id; /* ds ID */
 
 #ifdef DFTL_DEBUG
 	if (ds->status != DFTL_DIR_CLEAN) {
 		h4h_msg ("[dftl] [Evict] dir: %llu (phyaddr: %llu %lld %lld %lld %lld)", 
 			ds->id,
-			r->phyaddr->punit_id,
-			r->phyaddr->channel_no,
-			r->phyaddr->chip_no,
-			r->phyaddr->block_no,
-			r->phyaddr->page_no);
+			r->phyaddr.punit_id,
+			r->phyaddr.channel_no,
+			r->phyaddr.chip_no,
+			r->phyaddr.block_no,
+			r->phyaddr.page_no);
 	}
 #endif
 	/* ok! return it */
@@ -1122,8 +1196,7 @@ void h4h_dftl_finish_mapblk_eviction (
 	h4h_llm_req_t* r)
 {
 	h4h_dftl_private_t* p = (h4h_dftl_private_t*)H4H_FTL_PRIV (bdi);
-	directory_slot_t* ds = (directory_slot_t*)r->ds;
-	mapping_entry_t* me = (mapping_entry_t*)r->pptr_kpgs[0];
+	directory_slot_t* ds = (directory_slot_t*)r->ptr_hlm_req;
 
 	/* invalidate an old page if ds was kept in flash before */
 	if (ds->status != DFTL_DIR_CLEAN) {
@@ -1141,20 +1214,17 @@ void h4h_dftl_finish_mapblk_eviction (
 				ds->phyaddr.channel_no, 
 				ds->phyaddr.chip_no,
 				ds->phyaddr.block_no,
-				ds->phyaddr.page_no
+				ds->phyaddr.page_no,
+				0
 			);
 		}
 	}
 
 	/* finish the eviction */
-	h4h_dftl_finish_victim_mapblk (p->mt, ds, r->phyaddr);
+	h4h_dftl_finish_victim_mapblk (p->mt, ds, &r->phyaddr);
 
 	/* remove a llm_req */
-	h4h_free(r->done);
-	h4h_free(r->ptr_oob);
-	h4h_free(me);
-	h4h_free(r->pptr_kpgs); /* free pptr_kpgs */
-	h4h_free(r);
+	__h4h_dftl_free_mapblk_req (r);
 
 #ifdef DFTL_DEBUG
 	h4h_msg ("[dftl] [Evict] dir: %llu (done)\n", ds->id);
@@ -29,12 +29,12 @@ extern h4h_ftl_inf_t _ftl_dftl;
 
 uint32_t h4h_dftl_create (h4h_drv_info_t* bdi);
 void h4h_dftl_destroy (h4h_drv_info_t* bdi);
-uint32_t h4h_dftl_get_free_ppa (h4h_drv_info_t* bdi, uint64_t lpa, h4h_phyaddr_t* ppa);
-uint32_t h4h_dftl_get_ppa (h4h_drv_info_t* bdi, uint64_t lpa, h4h_phyaddr_t* ppa);
-uint32_t h4h_dftl_map_lpa_to_ppa (h4h_drv_info_t* bdi, uint64_t lpa, h4h_phyaddr_t* ptr_phyaddr);
-uint32_t h4h_dftl_invalidate_lpa (h4h_drv_info_t* bdi, uint64_t lpa, uint64_t len);
-uint8_t h4h_dftl_is_gc_needed (h4h_drv_info_t* bdi);
-uint32_t h4h_dftl_do_gc (h4h_drv_info_t* bdi);
+uint32_t h4h_dftl_get_free_ppa (h4h_drv_info_t* bdi, int64_t lpa, h4h_phyaddr_t* ppa);
+uint32_t h4h_dftl_get_ppa (h4h_drv_info_t* bdi, int64_t lpa, h4h_phyaddr_t* ppa, uint64_t* sp_off);
+uint32_t h4h_dftl_map_lpa_to_ppa (h4h_drv_info_t* bdi, h4h_logaddr_t* logaddr, h4h_phyaddr_t* ptr_phyaddr);
+uint32_t h4h_dftl_invalidate_lpa (h4h_drv_info_t* bdi, int64_t lpa, uint64_t len);
+uint8_t h4h_dftl_is_gc_needed (h4h_drv_info_t* bdi, int64_t lpa);
+uint32_t h4h_dftl_do_gc (h4h_drv_info_t* bdi, int64_t lpa);
 
 uint32_t h4h_dftl_badblock_scan (h4h_drv_info_t* bdi);
 uint32_t h4h_dftl_load (h4h_drv_info_t* bdi, const char* fn);
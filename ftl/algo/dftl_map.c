@@ -42,11 +42,66 @@ THE SOFTWARE.
 #include "debug.h"
 #include "utime.h"
 #include "ufile.h"
+#include "umemory.h"
 
 #include "algo/abm.h"
 #include "algo/dftl_map.h"
 
 
+static inline dftl_packed_me_t __h4h_dftl_pack_me (
+	dftl_mapping_table_t* mt, 
+	mapping_entry_t* me)
+{
+	uint64_t ppn = DFTL_ME_INVALID_PPN;
+
+	if (me->status == DFTL_PAGE_VALID) {
+		ppn = me->phyaddr.channel_no;
+		ppn = ppn * mt->nr_chips_per_channel + me->phyaddr.chip_no;
+		ppn = ppn * mt->nr_blocks_per_chip + me->phyaddr.block_no;
+		ppn = ppn * mt->nr_pages_per_block + me->phyaddr.page_no;
+		h4h_bug_on (ppn >= DFTL_ME_INVALID_PPN);
+	}
+
+	return ((dftl_packed_me_t)me->status << DFTL_ME_STATUS_SHIFT) | (dftl_packed_me_t)ppn;
+}
+
+static inline mapping_entry_t __h4h_dftl_unpack_me (
+	dftl_mapping_table_t* mt, 
+	dftl_packed_me_t pme)
+{
+	mapping_entry_t me;
+	uint64_t ppn = pme & DFTL_ME_PPN_MASK;
+
+	me.status = pme >> DFTL_ME_STATUS_SHIFT;
+	if (ppn == DFTL_ME_INVALID_PPN) {
+		me.phyaddr.channel_no = DFTL_PAGE_INVALID_ADDR;
+		me.phyaddr.chip_no = DFTL_PAGE_INVALID_ADDR;
+		me.phyaddr.block_no = DFTL_PAGE_INVALID_ADDR;
+		me.phyaddr.page_no = DFTL_PAGE_INVALID_ADDR;
+	} else {
+		me.phyaddr.page_no = ppn % mt->nr_pages_per_block;
+		ppn /= mt->nr_pages_per_block;
+		me.phyaddr.block_no = ppn % mt->nr_blocks_per_chip;
+		ppn /= mt->nr_blocks_per_chip;
+		me.phyaddr.chip_no = ppn % mt->nr_chips_per_channel;
+		me.phyaddr.channel_no = ppn / mt->nr_chips_per_channel;
+	}
+
+	return me;
+}
+
+static inline void __h4h_dftl_init_dir_entries (
+	dftl_mapping_table_t* mt,
+	directory_slot_t* ds)
+{
+	uint64_t j;
+
+	for (j = 0; j < mt->nr_entires_per_dir_slot; j++) {
+		ds->me[j] = ((dftl_packed_me_t)DFTL_PAGE_NOT_MAPPED << DFTL_ME_STATUS_SHIFT) | 
+			DFTL_ME_INVALID_PPN;
+	}
+}
+
 dftl_mapping_table_t* h4h_dftl_create_mapping_table (h4h_device_params_t* np)
 {
 	dftl_mapping_table_t* mt = NULL;
@@ -58,7 +113,19 @@ dftl_mapping_table_t* h4h_dftl_create_mapping_table (h4h_device_params_t* np)
 		return NULL;
 	}
 	INIT_LIST_HEAD (&mt->lru_list);
-	mt->mapping_entry_size = sizeof (mapping_entry_t);
+
+	/* physical page numbers must fit into a packed mapping entry */
+	if (np->nr_pages_per_ssd >= DFTL_ME_INVALID_PPN) {
+		h4h_error ("too many physical pages for packed mapping entries (%llu)", 
+			np->nr_pages_per_ssd);
+		h4h_free (mt);
+		return NULL;
+	}
+	mt->nr_chips_per_channel = np->nr_chips_per_channel;
+	mt->nr_blocks_per_chip = np->nr_blocks_per_chip;
+	mt->nr_pages_per_block = np->nr_pages_per_block;
+
+	mt->mapping_entry_size = sizeof (dftl_packed_me_t);
 	mt->nr_entires_per_dir_slot = np->page_main_size / mt->mapping_entry_size;
 	mt->nr_total_dir_slots = np->nr_pages_per_ssd / mt->nr_entires_per_dir_slot;
 	/*mt->max_cached_dir_slots = 20000;*/
@@ -187,7 +254,7 @@ mapping_entry_t h4h_dftl_get_mapping_entry (dftl_mapping_table_t* mt, uint64_t l
 	if (ds->status == DFTL_DIR_DIRTY || 
 		ds->status == DFTL_DIR_CLEAN) {
 		/* get the mapping entry */
-		me = ds->me[map_idx];
+		me = __h4h_dftl_unpack_me (mt, ds->me[map_idx]);
 		goto found;
 	}
 
@@ -218,7 +285,7 @@ int h4h_dftl_set_mapping_entry (dftl_mapping_table_t* mt, uint64_t lpa, mapping_
 	h4h_bug_on (ds->me == NULL);
 
 	/* update the mapping entry */
-	ds->me[map_idx] = *me;
+	ds->me[map_idx] = __h4h_dftl_pack_me (mt, me);
 	ds->status = DFTL_DIR_DIRTY;
 
 	/* the directory slot is moved to the tail */
@@ -243,7 +310,8 @@ int h4h_dftl_invalidate_mapping_entry (dftl_mapping_table_t* mt, uint64_t lpa)
 	h4h_bug_on (ds->me == NULL);
 
 	/* update the mapping entry */
-	ds->me[map_idx].status = DFTL_PAGE_INVALID;
+	ds->me[map_idx] = (ds->me[map_idx] & DFTL_ME_PPN_MASK) | 
+		((dftl_packed_me_t)DFTL_PAGE_INVALID << DFTL_ME_STATUS_SHIFT);
 	ds->status = DFTL_DIR_DIRTY;
 
 	return 0;
@@ -293,21 +361,13 @@ directory_slot_t* h4h_dftl_missing_dir_prepare (
 	}
 
 	if (ds->status == DFTL_DIR_EMPTY) {
-		int j = 0;
-
 		/* this directory slot is not written before */
-		ds->me = (mapping_entry_t*)h4h_malloc
-			(sizeof (mapping_entry_t) * mt->nr_entires_per_dir_slot);
+		ds->me = (dftl_packed_me_t*)h4h_malloc
+			(sizeof (dftl_packed_me_t) * mt->nr_entires_per_dir_slot);
 		h4h_bug_on (ds->me == NULL);
 
 		/* initialize all the entries */
-		for (j = 0; j < mt->nr_entires_per_dir_slot; j++) {
-			ds->me[j].status = DFTL_PAGE_NOT_MAPPED;
-			ds->me[j].phyaddr.channel_no = DFTL_PAGE_INVALID_ADDR;
-			ds->me[j].phyaddr.chip_no = DFTL_PAGE_INVALID_ADDR;
-			ds->me[j].phyaddr.block_no = DFTL_PAGE_INVALID_ADDR;
-			ds->me[j].phyaddr.page_no = DFTL_PAGE_INVALID_ADDR;
-		}
+		__h4h_dftl_init_dir_entries (mt, ds);
 		ds->status = DFTL_DIR_DIRTY; /* this table is newly created, so it starts with dirty */
 
 		/* add the directory slot to the tail of the dirty linked-list */
@@ -328,15 +388,15 @@ directory_slot_t* h4h_dftl_missing_dir_prepare (
 int h4h_dftl_missing_dir_done (
 	dftl_mapping_table_t* mt, 
 	directory_slot_t* ds,
-	mapping_entry_t* me)
+	dftl_packed_me_t* me)
 {
 	uint32_t i;
 
 	/* build mapping entires for ds */
 	if (ds->me == NULL) {
 		h4h_bug_on (ds->status != DFTL_DIR_EMPTY);
-		ds->me = (mapping_entry_t*)h4h_malloc
-			(sizeof (mapping_entry_t) * mt->nr_entires_per_dir_slot);
+		ds->me = (dftl_packed_me_t*)h4h_malloc
+			(sizeof (dftl_packed_me_t) * mt->nr_entires_per_dir_slot);
 	}
 
 	for (i = 0; i < mt->nr_entires_per_dir_slot; i++) {
@@ -358,7 +418,7 @@ int h4h_dftl_missing_dir_done (
 int h4h_dftl_missing_dir_done_error (
 	dftl_mapping_table_t* mt, 
 	directory_slot_t* ds,
-	mapping_entry_t* me)
+	dftl_packed_me_t* me)
 {
 	uint32_t i;
 
@@ -54,13 +54,22 @@ typedef struct {
 	mapblk_phyaddr_t phyaddr; /* physical location */
 } mapping_entry_t;
 
+/* mapping entries are kept in DRAM and in translation pages in a packed
+ * form: 2 bits for the status and 30 bits for a physical page number.
+ * mapping_entry_t is only used to exchange an entry with the FTL */
+typedef uint32_t dftl_packed_me_t;
+
+#define DFTL_ME_STATUS_SHIFT	30
+#define DFTL_ME_PPN_MASK		((1U << DFTL_ME_STATUS_SHIFT) - 1)
+#define DFTL_ME_INVALID_PPN		DFTL_ME_PPN_MASK
+
 typedef struct {
 	/* linked-list: to quickly find a victim for eviction */
 	struct list_head list;
 	uint64_t id;
 	dir_stat status;
 	h4h_phyaddr_t phyaddr;	/* the physical location where mapping entries are stored */
-	mapping_entry_t* me;	/* the size of me is equal to a single flash size */
+	dftl_packed_me_t* me;	/* the size of me is equal to a single flash size */
 
 	uint32_t is_under_load;
 } directory_slot_t;
@@ -72,6 +81,11 @@ typedef struct {
 	uint64_t nr_total_dir_slots;
 	uint64_t max_cached_dir_slots;
 	atomic64_t nr_cached_slots;
+
+	/* geometry for packing physical addresses */
+	uint64_t nr_chips_per_channel;
+	uint64_t nr_blocks_per_chip;
+	uint64_t nr_pages_per_block;
 	directory_slot_t* dir;	/* always maintained in DRAM */
 } dftl_mapping_table_t;
 
@@ -97,7 +111,7 @@ directory_slot_t*
 h4h_dftl_missing_dir_prepare (dftl_mapping_table_t* mt, uint64_t lpa);
 
 int 
-h4h_dftl_missing_dir_done (dftl_mapping_table_t* mt, directory_slot_t* ds, mapping_entry_t* me);
+h4h_dftl_missing_dir_done (dftl_mapping_table_t* mt, directory_slot_t* ds, dftl_packed_me_t* me);
 
 void h4h_dftl_update_dir_phyaddr (
 	dftl_mapping_table_t* mt, 
@@ -108,7 +122,7 @@ int
 h4h_dftl_missing_dir_done_error (
 	dftl_mapping_table_t* mt, 
 	directory_slot_t* ds,
-	mapping_entry_t* me);
+	dftl_packed_me_t* me);
 
 
 #endif
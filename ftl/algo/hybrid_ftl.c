@@ -0,0 +1,1082 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014-2015 CSAIL, MIT
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#if defined (KERNEL_MODE)
+#include <linux/module.h>
+#include <linux/slab.h>
+
+#elif defined (USER_MODE)
+#include <stdio.h>
+#include <stdint.h>
+#include "uilog.h"
+
+#else
+#error Invalid Platform (KERNEL_MODE or USER_MODE)
+#endif
+
+#include "h4h_drv.h"
+#include "params.h"
+#include "debug.h"
+#include "abm.h"
+#include "umemory.h"
+#include "ftl_params.h"
+#include "hlm_reqs_pool.h"
+#include "hybrid_ftl.h"
+
+/* A log-block hybrid FTL (FAST-style).
+ *
+ * Data blocks are block-mapped with the same striping as block_ftl: a
+ * logical block (lbn) is one flash block on a fixed punit. Each punit
+ * keeps a small pool of page-mapped log blocks: logs[0] is a sequential
+ * (SW) log that is owned by one lbn at a time, and the others are random
+ * (RW) logs shared by all the lbns of that punit. A full SW log becomes a
+ * data block by a switch merge (or a partial merge if it has holes), and
+ * a victim RW log is reclaimed by full merges of the lbns it contains. */
+
+/* FTL interface */
+h4h_ftl_inf_t _ftl_hybrid_ftl = {
+	.ptr_private = NULL,
+	.create = h4h_hybrid_ftl_create,
+	.destroy = h4h_hybrid_ftl_destroy,
+	.get_free_ppa = h4h_hybrid_ftl_get_free_ppa,
+	.get_ppa = h4h_hybrid_ftl_get_ppa,
+	.map_lpa_to_ppa = h4h_hybrid_ftl_map_lpa_to_ppa,
+	.invalidate_lpa = h4h_hybrid_ftl_invalidate_lpa,
+	.do_gc = h4h_hybrid_ftl_do_gc,
+	.is_gc_needed = h4h_hybrid_ftl_is_gc_needed,
+	.scan_badblocks = h4h_hybrid_ftl_badblock_scan,
+	.load = NULL,
+	.store = NULL,
+	.get_segno = h4h_hybrid_ftl_get_segno,
+};
+
+
+/* data structures for the hybrid FTL */
+enum H4H_HFTL_PAGE_STATUS {
+	HFTL_PG_FREE = 0,
+	HFTL_PG_VALID,	/* the latest copy is in the data block */
+	HFTL_PG_LOG,	/* the latest copy is in a log block */
+	HFTL_PG_INVALID,	/* trimmed */
+};
+
+#define HFTL_SW_LOG		0	/* logs[0] of each punit is the sequential log */
+#define HFTL_NO_OWNER	(-1)
+
+#define HFTL_LOG_LOC(idx,pg)	(((uint32_t)(idx) << 16) | (uint32_t)(pg))
+#define HFTL_LOG_IDX(loc)		((loc) >> 16)
+#define HFTL_LOG_PG(loc)		((loc) & 0xFFFF)
+
+typedef struct {
+	h4h_abm_block_t* b;	/* NULL if not allocated */
+	int64_t rw_pg_ofs;	/* recently-written page offset */
+	uint8_t* pst;	/* status of pages (H4H_HFTL_PAGE_STATUS) */
+	uint32_t* log_loc;	/* locations of HFTL_PG_LOG pages (allocated on demand) */
+	uint32_t nr_log_pgs;
+} h4h_hybrid_data_blk_t;
+
+typedef struct {
+	h4h_abm_block_t* b;	/* NULL if not allocated */
+	int64_t owner;	/* lbn owning a SW log (HFTL_NO_OWNER if none) */
+	uint64_t wr_ofs;	/* the next page to be written */
+	uint64_t nr_valid_pgs;
+	uint64_t seq;	/* allocation order; the oldest RW log is a victim */
+	int64_t* lpa;	/* lpa of each page (-1 if obsolete) */
+} h4h_hybrid_log_blk_t;
+
+typedef struct {
+	h4h_hybrid_log_blk_t* logs;
+	int64_t rw_cur;	/* RW log being written (-1 if none) */
+	uint64_t nr_rsv_pgs;	/* pages reserved by the write being checked */
+} h4h_hybrid_punit_t;
+
+typedef struct {
+	uint64_t nr_segs;	/* a segment is a set of data blocks over all punits */
+	uint64_t nr_pgs_per_seg;
+	uint64_t nr_blks_per_seg;
+	uint64_t nr_lbns;
+	uint64_t nr_log_blks;	/* # of log blocks per punit (1 SW + RWs) */
+	uint64_t seq;
+
+	h4h_abm_info_t* abm;
+	h4h_hybrid_data_blk_t* dt;	/* data blocks indexed by lbn */
+	h4h_hybrid_punit_t* pu;	/* log blocks of individual punits */
+
+	/* for page copies during merges */
+	h4h_hlm_req_gc_t gc_hlm;
+	uint64_t nr_gc_reqs;
+	h4h_phyaddr_t* gc_src;
+	h4h_phyaddr_t* gc_dst;
+	int64_t* gc_lpa;
+
+	/* statistics */
+	uint64_t nr_switch_merges;
+	uint64_t nr_partial_merges;
+	uint64_t nr_full_merges;
+	uint64_t nr_copied_pgs;
+} h4h_hybrid_ftl_private_t;
+
+
+/* inline functions */
+static inline
+uint64_t __h4h_hybrid_ftl_get_lbn (h4h_hybrid_ftl_private_t* p, uint64_t lpa)
+{
+	uint64_t seg_no = lpa / p->nr_pgs_per_seg;
+	uint64_t blk_no = (lpa % p->nr_pgs_per_seg) % p->nr_blks_per_seg;
+	return seg_no * p->nr_blks_per_seg + blk_no;
+}
+
+static inline
+uint64_t __h4h_hybrid_ftl_get_page_ofs (h4h_hybrid_ftl_private_t* p, uint64_t lpa)
+{
+	return (lpa % p->nr_pgs_per_seg) / p->nr_blks_per_seg;
+}
+
+static inline
+uint64_t __h4h_hybrid_ftl_get_punit (h4h_hybrid_ftl_private_t* p, uint64_t lbn)
+{
+	return lbn % p->nr_blks_per_seg;
+}
+
+static inline
+int64_t __h4h_hybrid_ftl_get_lpa (h4h_hybrid_ftl_private_t* p, uint64_t lbn, uint64_t ofs)
+{
+	return (lbn / p->nr_blks_per_seg) * p->nr_pgs_per_seg + 
+		ofs * p->nr_blks_per_seg + lbn % p->nr_blks_per_seg;
+}
+
+static inline
+void __h4h_hybrid_ftl_set_ppa (
+	h4h_drv_info_t* bdi,
+	h4h_phyaddr_t* ppa,
+	h4h_abm_block_t* b,
+	uint64_t page_no)
+{
+	ppa->channel_no = b->channel_no;
+	ppa->chip_no = b->chip_no;
+	ppa->block_no = b->block_no;
+	ppa->page_no = page_no;
+	ppa->punit_id = H4H_GET_PUNIT_ID (bdi, ppa);
+}
+
+/* the data block must be able to take a page at 'ofs' in place */
+static inline
+uint8_t __h4h_hybrid_ftl_is_inplace (h4h_hybrid_data_blk_t* e, uint64_t ofs)
+{
+	return (e->b == NULL || 
+		(e->rw_pg_ofs < (int64_t)ofs && e->pst[ofs] != HFTL_PG_LOG));
+}
+
+
+/* functions for the hybrid FTL */
+uint32_t h4h_hybrid_ftl_create (h4h_drv_info_t* bdi)
+{
+	h4h_hybrid_ftl_private_t* p = NULL;
+	h4h_device_params_t* np = H4H_GET_DEVICE_PARAMS (bdi);
+	h4h_ftl_params* dp = H4H_GET_DRIVER_PARAMS (bdi);
+	uint64_t i, j;
+
+	/* check FTL parameters */
+	if (dp->mapping_type != MAPPING_POLICY_HYBRID)
+		return 1;
+	if (_param_hybrid_nr_log_blks < 3 ||
+		_param_hybrid_nr_log_blks + 1 >= np->nr_blocks_per_chip ||
+		np->nr_pages_per_block > 0xFFFF) {
+		h4h_error ("invalid # of log blocks (%d)", _param_hybrid_nr_log_blks);
+		return 1;
+	}
+
+	/* create a private data structure */
+	if ((p = (h4h_hybrid_ftl_private_t*)h4h_zmalloc
+			(sizeof (h4h_hybrid_ftl_private_t))) == NULL) {
+		h4h_error ("h4h_malloc failed");
+		return 1;
+	}
+	_ftl_hybrid_ftl.ptr_private = (void*)p;
+
+	/* create 'h4h_abm_info' */
+	if ((p->abm = h4h_abm_create (np, 0)) == NULL) {
+		h4h_error ("h4h_abm_create failed");
+		goto fail;
+	}
+
+	/* each punit keeps its log blocks and one spare block for full merges */
+	p->nr_log_blks = _param_hybrid_nr_log_blks;
+	p->nr_blks_per_seg = np->nr_chips_per_channel * np->nr_channels;
+	p->nr_pgs_per_seg = np->nr_pages_per_block * p->nr_blks_per_seg;
+	p->nr_segs = np->nr_blocks_per_chip - (p->nr_log_blks + 1);
+	p->nr_lbns = p->nr_segs * p->nr_blks_per_seg;
+
+	/* initialize data blocks */
+	if ((p->dt = (h4h_hybrid_data_blk_t*)h4h_zmalloc
+			(sizeof (h4h_hybrid_data_blk_t) * p->nr_lbns)) == NULL) {
+		h4h_error ("h4h_malloc failed");
+		goto fail;
+	}
+	for (i = 0; i < p->nr_lbns; i++) {
+		p->dt[i].rw_pg_ofs = -1;
+		if ((p->dt[i].pst = (uint8_t*)h4h_zmalloc
+				(sizeof (uint8_t) * np->nr_pages_per_block)) == NULL) {
+			h4h_error ("h4h_malloc failed");
+			goto fail;
+		}
+	}
+
+	/* initialize log blocks */
+	if ((p->pu = (h4h_hybrid_punit_t*)h4h_zmalloc
+			(sizeof (h4h_hybrid_punit_t) * p->nr_blks_per_seg)) == NULL) {
+		h4h_error ("h4h_malloc failed");
+		goto fail;
+	}
+	for (i = 0; i < p->nr_blks_per_seg; i++) {
+		p->pu[i].rw_cur = -1;
+		p->pu[i].nr_rsv_pgs = 0;
+		if ((p->pu[i].logs = (h4h_hybrid_log_blk_t*)h4h_zmalloc
+				(sizeof (h4h_hybrid_log_blk_t) * p->nr_log_blks)) == NULL) {
+			h4h_error ("h4h_malloc failed");
+			goto fail;
+		}
+		for (j = 0; j < p->nr_log_blks; j++) {
+			h4h_hybrid_log_blk_t* l = &p->pu[i].logs[j];
+			l->owner = HFTL_NO_OWNER;
+			if ((l->lpa = (int64_t*)h4h_malloc
+					(sizeof (int64_t) * np->nr_pages_per_block)) == NULL) {
+				h4h_error ("h4h_malloc failed");
+				goto fail;
+			}
+			h4h_memset (l->lpa, 0xFF, sizeof (int64_t) * np->nr_pages_per_block);
+		}
+	}
+
+	/* initialize gc_hlm; it is used for page copies and for erasing blocks
+	 * of all the punits when scanning bad blocks */
+	p->nr_gc_reqs = np->nr_pages_per_block;
+	if (p->nr_gc_reqs < p->nr_blks_per_seg)
+		p->nr_gc_reqs = p->nr_blks_per_seg;
+	if ((p->gc_src = (h4h_phyaddr_t*)h4h_zmalloc
+			(sizeof (h4h_phyaddr_t) * p->nr_gc_reqs)) == NULL ||
+		(p->gc_dst = (h4h_phyaddr_t*)h4h_zmalloc
+			(sizeof (h4h_phyaddr_t) * p->nr_gc_reqs)) == NULL ||
+		(p->gc_lpa = (int64_t*)h4h_zmalloc
+			(sizeof (int64_t) * p->nr_gc_reqs)) == NULL) {
+		h4h_error ("h4h_malloc failed");
+		goto fail;
+	}
+	if ((p->gc_hlm.llm_reqs = (h4h_llm_req_t*)h4h_zmalloc
+			(sizeof (h4h_llm_req_t) * p->nr_gc_reqs)) == NULL) {
+		h4h_error ("h4h_zmalloc failed");
+		goto fail;
+	}
+	h4h_sema_init (&p->gc_hlm.done);
+	hlm_reqs_pool_allocate_llm_reqs (p->gc_hlm.llm_reqs, p->nr_gc_reqs, RP_MEM_PHY);
+
+	h4h_msg ("nr_segs = %llu, nr_blks_per_seg = %llu, nr_pgs_per_seg = %llu, nr_log_blks = %llu",
+		p->nr_segs, p->nr_blks_per_seg, p->nr_pgs_per_seg, p->nr_log_blks);
+
+	return 0;
+
+fail:
+	h4h_hybrid_ftl_destroy (bdi);
+	return 1;
+}
+
+void h4h_hybrid_ftl_destroy (h4h_drv_info_t* bdi)
+{
+	h4h_hybrid_ftl_private_t* p = H4H_FTL_PRIV (bdi);
+	uint64_t i, j;
+
+	if (p == NULL)
+		return;
+
+	h4h_msg ("merges: switch = %llu, partial = %llu, full = %llu, copied pages = %llu",
+		p->nr_switch_merges, p->nr_partial_merges, p->nr_full_merges, p->nr_copied_pgs);
+
+	if (p->gc_hlm.llm_reqs) {
+		hlm_reqs_pool_release_llm_reqs (p->gc_hlm.llm_reqs, p->nr_gc_reqs, RP_MEM_PHY);
+		h4h_sema_free (&p->gc_hlm.done);
+		h4h_free (p->gc_hlm.llm_reqs);
+	}
+	if (p->gc_lpa)
+		h4h_free (p->gc_lpa);
+	if (p->gc_dst)
+		h4h_free (p->gc_dst);
+	if (p->gc_src)
+		h4h_free (p->gc_src);
+	if (p->pu) {
+		for (i = 0; i < p->nr_blks_per_seg; i++) {
+			if (p->pu[i].logs == NULL)
+				continue;
+			for (j = 0; j < p->nr_log_blks; j++)
+				if (p->pu[i].logs[j].lpa)
+					h4h_free (p->pu[i].logs[j].lpa);
+			h4h_free (p->pu[i].logs);
+		}
+		h4h_free (p->pu);
+	}
+	if (p->dt) {
+		for (i = 0; i < p->nr_lbns; i++) {
+			if (p->dt[i].pst)
+				h4h_free (p->dt[i].pst);
+			if (p->dt[i].log_loc)
+				h4h_free (p->dt[i].log_loc);
+		}
+		h4h_free (p->dt);
+	}
+	if (p->abm)
+		h4h_abm_destroy (p->abm);
+	h4h_free (p);
+	_ftl_hybrid_ftl.ptr_private = NULL;
+}
+
+static h4h_abm_block_t* __h4h_hybrid_ftl_alloc_block (
+	h4h_drv_info_t* bdi,
+	uint64_t punit)
+{
+	h4h_hybrid_ftl_private_t* p = H4H_FTL_PRIV (bdi);
+	h4h_device_params_t* np = H4H_GET_DEVICE_PARAMS (bdi);
+	uint64_t channel_no = punit % np->nr_channels;
+	uint64_t chip_no = punit / np->nr_channels;
+	h4h_abm_block_t* b = NULL;
+
+	if ((b = h4h_abm_get_free_block_prepare (p->abm, channel_no, chip_no)) == NULL) {
+		h4h_error ("oops! h4h_abm_get_free_block_prepare failed (%llu %llu)", channel_no, chip_no);
+		return NULL;
+	}
+	h4h_abm_get_free_block_commit (p->abm, b);
+
+	return b;
+}
+
+static void __h4h_hybrid_ftl_erase_block (
+	h4h_drv_info_t* bdi,
+	h4h_abm_block_t* b)
+{
+	h4h_hybrid_ftl_private_t* p = H4H_FTL_PRIV (bdi);
+	h4h_hlm_req_gc_t* hlm_gc = &p->gc_hlm;
+	h4h_llm_req_t rr;
+	h4h_llm_req_t* r = &rr;
+
+	/* setup an erase request */
+	r->req_type = REQTYPE_GC_ERASE;
+	r->logaddr.lpa[0] = -1ULL; /* lpa is not available now */
+	__h4h_hybrid_ftl_set_ppa (bdi, &r->phyaddr, b, 0);
+	r->ptr_hlm_req = (void*)hlm_gc;
+	r->ret = 0;
+
+	/* send an erase req to llm */
+	hlm_gc->req_type = REQTYPE_GC_ERASE;
+	hlm_gc->nr_llm_reqs = 1;
+	atomic64_set (&hlm_gc->nr_llm_reqs_done, 0);
+	h4h_sema_lock (&hlm_gc->done);
+	if ((bdi->ptr_llm_inf->make_req (bdi, r)) != 0) {
+		h4h_error ("llm_make_req failed");
+		h4h_bug_on (1);
+	}
+	h4h_sema_lock (&hlm_gc->done);
+	h4h_sema_unlock (&hlm_gc->done);
+
+	h4h_abm_erase_block (p->abm, b->channel_no, b->chip_no, b->block_no, (r->ret != 0) ? 1 : 0);
+}
+
+/* copy 'nr_pgs' pages from gc_src[] to gc_dst[] */
+static void __h4h_hybrid_ftl_copy_pages (
+	h4h_drv_info_t* bdi,
+	uint64_t nr_pgs)
+{
+	h4h_hybrid_ftl_private_t* p = H4H_FTL_PRIV (bdi);
+	h4h_device_params_t* np = H4H_GET_DEVICE_PARAMS (bdi);
+	h4h_hlm_req_gc_t* hlm_gc = &p->gc_hlm;
+	uint64_t i, j;
+
+	if (nr_pgs == 0)
+		return;
+
+	/* [STEP1] read valid pages */
+	for (i = 0; i < nr_pgs; i++) {
+		h4h_llm_req_t* r = &hlm_gc->llm_reqs[i];
+
+		hlm_reqs_pool_reset_fmain (&r->fmain);
+		hlm_reqs_pool_alloc_fmain_pad (&r->fmain);
+		hlm_reqs_pool_reset_logaddr (&r->logaddr);
+		for (j = 0; j < np->nr_subpages_per_page; j++)
+			r->fmain.kp_stt[j] = KP_STT_DATA;
+		r->logaddr.lpa[0] = p->gc_lpa[i];
+		r->req_type = REQTYPE_GC_READ;
+		r->phyaddr = p->gc_src[i];
+		r->ptr_hlm_req = (void*)hlm_gc;
+		r->ret = 0;
+	}
+
+	hlm_gc->req_type = REQTYPE_GC_READ;
+	hlm_gc->nr_llm_reqs = nr_pgs;
+	atomic64_set (&hlm_gc->nr_llm_reqs_done, 0);
+	h4h_sema_lock (&hlm_gc->done);
+	for (i = 0; i < nr_pgs; i++) {
+		if ((bdi->ptr_llm_inf->make_req (bdi, &hlm_gc->llm_reqs[i])) != 0) {
+			h4h_error ("llm_make_req failed");
+			h4h_bug_on (1);
+		}
+	}
+	h4h_sema_lock (&hlm_gc->done);
+	h4h_sema_unlock (&hlm_gc->done);
+
+	/* [STEP2] write them to their new locations (in page order) */
+	for (i = 0; i < nr_pgs; i++) {
+		h4h_llm_req_t* r = &hlm_gc->llm_reqs[i];
+
+		r->req_type = REQTYPE_GC_WRITE;
+		r->phyaddr = p->gc_dst[i];
+		((int64_t*)r->foob.data)[0] = p->gc_lpa[i];
+		r->ret = 0;
+	}
+
+	hlm_gc->req_type = REQTYPE_GC_WRITE;
+	hlm_gc->nr_llm_reqs = nr_pgs;
+	atomic64_set (&hlm_gc->nr_llm_reqs_done, 0);
+	h4h_sema_lock (&hlm_gc->done);
+	for (i = 0; i < nr_pgs; i++) {
+		if ((bdi->ptr_llm_inf->make_req (bdi, &hlm_gc->llm_reqs[i])) != 0) {
+			h4h_error ("llm_make_req failed");
+			h4h_bug_on (1);
+		}
+	}
+	h4h_sema_lock (&hlm_gc->done);
+	h4h_sema_unlock (&hlm_gc->done);
+
+	p->nr_copied_pgs += nr_pgs;
+}
+
+/* forget the log copy of a page (if any) */
+static void __h4h_hybrid_ftl_drop_log_page (
+	h4h_hybrid_ftl_private_t* p,
+	uint64_t lbn,
+	uint64_t ofs)
+{
+	h4h_hybrid_data_blk_t* e = &p->dt[lbn];
+	h4h_hybrid_log_blk_t* l = NULL;
+	uint32_t loc;
+
+	if (e->pst[ofs] != HFTL_PG_LOG)
+		return;
+
+	loc = e->log_loc[ofs];
+	l = &p->pu[__h4h_hybrid_ftl_get_punit (p, lbn)].logs[HFTL_LOG_IDX (loc)];
+	h4h_bug_on (l->nr_valid_pgs == 0);
+	l->lpa[HFTL_LOG_PG (loc)] = -1;
+	l->nr_valid_pgs--;
+
+	h4h_bug_on (e->nr_log_pgs == 0);
+	if (--e->nr_log_pgs == 0) {
+		h4h_free (e->log_loc);
+		e->log_loc = NULL;
+	}
+	e->pst[ofs] = HFTL_PG_INVALID;
+}
+
+/* the location of the latest copy of a page */
+static uint8_t __h4h_hybrid_ftl_lookup (
+	h4h_drv_info_t* bdi,
+	uint64_t lbn,
+	uint64_t ofs,
+	h4h_phyaddr_t* ppa)
+{
+	h4h_hybrid_ftl_private_t* p = H4H_FTL_PRIV (bdi);
+	h4h_hybrid_data_blk_t* e = &p->dt[lbn];
+
+	if (e->pst[ofs] == HFTL_PG_VALID) {
+		__h4h_hybrid_ftl_set_ppa (bdi, ppa, e->b, ofs);
+	} else if (e->pst[ofs] == HFTL_PG_LOG) {
+		uint32_t loc = e->log_loc[ofs];
+		h4h_hybrid_log_blk_t* l = 
+			&p->pu[__h4h_hybrid_ftl_get_punit (p, lbn)].logs[HFTL_LOG_IDX (loc)];
+		__h4h_hybrid_ftl_set_ppa (bdi, ppa, l->b, HFTL_LOG_PG (loc));
+	}
+
+	return e->pst[ofs];
+}
+
+static void __h4h_hybrid_ftl_reset_log (
+	h4h_hybrid_ftl_private_t* p,
+	h4h_hybrid_log_blk_t* l,
+	uint64_t nr_pages_per_block)
+{
+	l->b = NULL;
+	l->owner = HFTL_NO_OWNER;
+	l->wr_ofs = 0;
+	l->nr_valid_pgs = 0;
+	l->seq = 0;
+	h4h_memset (l->lpa, 0xFF, sizeof (int64_t) * nr_pages_per_block);
+}
+
+/* turn the SW log of a punit into the data block of its owner */
+static void __h4h_hybrid_ftl_merge_sw_log (
+	h4h_drv_info_t* bdi,
+	uint64_t punit)
+{
+	h4h_hybrid_ftl_private_t* p = H4H_FTL_PRIV (bdi);
+	h4h_device_params_t* np = H4H_GET_DEVICE_PARAMS (bdi);
+	h4h_hybrid_log_blk_t* sw = &p->pu[punit].logs[HFTL_SW_LOG];
+	h4h_hybrid_data_blk_t* e = NULL;
+	h4h_abm_block_t* old = NULL;
+	uint64_t lbn, k, nr_pgs = 0;
+	int64_t last = -1;
+
+	if (sw->owner == HFTL_NO_OWNER)
+		return;
+
+	lbn = sw->owner;
+	e = &p->dt[lbn];
+	old = e->b;
+
+	if (sw->nr_valid_pgs == np->nr_pages_per_block) {
+		/* [CASE1] switch merge: the SW log is complete and sequential */
+		last = np->nr_pages_per_block - 1;
+		p->nr_switch_merges++;
+	} else {
+		/* [CASE2] partial merge: fill the tail of the SW log with the
+		 * latest copies of the remaining pages */
+		for (k = sw->wr_ofs; k < np->nr_pages_per_block; k++) {
+			uint8_t st = __h4h_hybrid_ftl_lookup (bdi, lbn, k, &p->gc_src[nr_pgs]);
+			if (st != HFTL_PG_VALID && st != HFTL_PG_LOG)
+				continue;
+			__h4h_hybrid_ftl_set_ppa (bdi, &p->gc_dst[nr_pgs], sw->b, k);
+			p->gc_lpa[nr_pgs] = sw->lpa[k] = __h4h_hybrid_ftl_get_lpa (p, lbn, k);
+			nr_pgs++;
+		}
+		__h4h_hybrid_ftl_copy_pages (bdi, nr_pgs);
+		p->nr_partial_merges++;
+	}
+
+	/* update the page status of the new data block */
+	for (k = 0; k < np->nr_pages_per_block; k++) {
+		if (sw->lpa[k] != -1) {
+			if (k < sw->wr_ofs) {
+				/* written to the SW log by the host */
+				h4h_bug_on (e->pst[k] != HFTL_PG_LOG);
+				h4h_bug_on (HFTL_LOG_IDX (e->log_loc[k]) != HFTL_SW_LOG);
+				if (--e->nr_log_pgs == 0) {
+					h4h_free (e->log_loc);
+					e->log_loc = NULL;
+				}
+			} else {
+				/* copied by the partial merge */
+				__h4h_hybrid_ftl_drop_log_page (p, lbn, k);
+			}
+			e->pst[k] = HFTL_PG_VALID;
+			last = k;
+		} else if (k >= sw->wr_ofs) {
+			e->pst[k] = HFTL_PG_FREE;	/* not programmed */
+		}
+	}
+
+	e->b = sw->b;
+	e->rw_pg_ofs = last;
+	__h4h_hybrid_ftl_reset_log (p, sw, np->nr_pages_per_block);
+
+	/* all the pages in the old data block are obsolete now */
+	if (old != NULL)
+		__h4h_hybrid_ftl_erase_block (bdi, old);
+}
+
+/* copy the latest pages of a lbn to a new data block */
+static void __h4h_hybrid_ftl_full_merge (
+	h4h_drv_info_t* bdi,
+	uint64_t lbn)
+{
+	h4h_hybrid_ftl_private_t* p = H4H_FTL_PRIV (bdi);
+	h4h_device_params_t* np = H4H_GET_DEVICE_PARAMS (bdi);
+	uint64_t punit = __h4h_hybrid_ftl_get_punit (p, lbn);
+	h4h_hybrid_data_blk_t* e = &p->dt[lbn];
+	h4h_abm_block_t* nb = NULL;
+	h4h_abm_block_t* old = NULL;
+	uint64_t k, nr_pgs = 0;
+	int64_t last = -1;
+
+	/* the SW log of the lbn is merged first */
+	if (p->pu[punit].logs[HFTL_SW_LOG].owner == (int64_t)lbn)
+		__h4h_hybrid_ftl_merge_sw_log (bdi, punit);
+	if (e->nr_log_pgs == 0)
+		return;
+
+	if ((nb = __h4h_hybrid_ftl_alloc_block (bdi, punit)) == NULL) {
+		h4h_bug_on (1);
+		return;
+	}
+
+	for (k = 0; k < np->nr_pages_per_block; k++) {
+		uint8_t st = __h4h_hybrid_ftl_lookup (bdi, lbn, k, &p->gc_src[nr_pgs]);
+		if (st != HFTL_PG_VALID && st != HFTL_PG_LOG)
+			continue;
+		__h4h_hybrid_ftl_set_ppa (bdi, &p->gc_dst[nr_pgs], nb, k);
+		p->gc_lpa[nr_pgs] = __h4h_hybrid_ftl_get_lpa (p, lbn, k);
+		nr_pgs++;
+	}
+	__h4h_hybrid_ftl_copy_pages (bdi, nr_pgs);
+
+	for (k = 0; k < np->nr_pages_per_block; k++) {
+		if (e->pst[k] == HFTL_PG_VALID || e->pst[k] == HFTL_PG_LOG) {
+			__h4h_hybrid_ftl_drop_log_page (p, lbn, k);
+			e->pst[k] = HFTL_PG_VALID;
+			last = k;
+		} else {
+			e->pst[k] = HFTL_PG_FREE;
+		}
+	}
+
+	old = e->b;
+	e->b = nb;
+	e->rw_pg_ofs = last;
+	if (old != NULL)
+		__h4h_hybrid_ftl_erase_block (bdi, old);
+
+	p->nr_full_merges++;
+}
+
+/* reclaim the oldest RW log of a punit (1 if there is none) */
+static uint32_t __h4h_hybrid_ftl_merge_rw_log (
+	h4h_drv_info_t* bdi,
+	uint64_t punit)
+{
+	h4h_hybrid_ftl_private_t* p = H4H_FTL_PRIV (bdi);
+	h4h_device_params_t* np = H4H_GET_DEVICE_PARAMS (bdi);
+	h4h_hybrid_punit_t* u = &p->pu[punit];
+	h4h_hybrid_log_blk_t* v = NULL;
+	uint64_t i, victim = 0;
+
+	/* [STEP1] select a victim; the one being written is the last choice */
+	for (i = 1; i < p->nr_log_blks; i++) {
+		h4h_hybrid_log_blk_t* l = &u->logs[i];
+		if (l->b == NULL)
+			continue;
+		if (victim == 0 ||
+			(victim == u->rw_cur && i != u->rw_cur) ||
+			(i != u->rw_cur && l->seq < u->logs[victim].seq))
+			victim = i;
+	}
+	if (victim == 0)
+		return 1;
+	v = &u->logs[victim];
+
+	/* [STEP2] full merges of all the lbns that have valid pages in it */
+	for (i = 0; i < np->nr_pages_per_block && v->nr_valid_pgs > 0; i++) {
+		if (v->lpa[i] == -1)
+			continue;
+		__h4h_hybrid_ftl_full_merge (bdi, __h4h_hybrid_ftl_get_lbn (p, v->lpa[i]));
+	}
+	h4h_bug_on (v->nr_valid_pgs != 0);
+
+	/* [STEP3] erase the victim */
+	__h4h_hybrid_ftl_erase_block (bdi, v->b);
+	__h4h_hybrid_ftl_reset_log (p, v, np->nr_pages_per_block);
+	if (u->rw_cur == (int64_t)victim)
+		u->rw_cur = -1;
+
+	return 0;
+}
+
+static uint64_t __h4h_hybrid_ftl_nr_free_rw_logs (
+	h4h_hybrid_ftl_private_t* p,
+	uint64_t punit)
+{
+	uint64_t i, nr_free = 0;
+
+	for (i = 1; i < p->nr_log_blks; i++)
+		if (p->pu[punit].logs[i].b == NULL)
+			nr_free++;
+
+	return nr_free;
+}
+
+/* # of pages that RW logs of a punit can take without a merge */
+static uint64_t __h4h_hybrid_ftl_nr_free_rw_pgs (
+	h4h_hybrid_ftl_private_t* p,
+	uint64_t punit,
+	uint64_t nr_pages_per_block)
+{
+	h4h_hybrid_punit_t* u = &p->pu[punit];
+	uint64_t nr_free = __h4h_hybrid_ftl_nr_free_rw_logs (p, punit) * nr_pages_per_block;
+
+	if (u->rw_cur != -1)
+		nr_free += nr_pages_per_block - u->logs[u->rw_cur].wr_ofs;
+
+	return nr_free;
+}
+
+/* a RW log that can take a page */
+static h4h_hybrid_log_blk_t* __h4h_hybrid_ftl_get_rw_log (
+	h4h_drv_info_t* bdi,
+	uint64_t punit,
+	uint64_t* log_idx)
+{
+	h4h_hybrid_ftl_private_t* p = H4H_FTL_PRIV (bdi);
+	h4h_device_params_t* np = H4H_GET_DEVICE_PARAMS (bdi);
+	h4h_hybrid_punit_t* u = &p->pu[punit];
+	uint64_t i;
+
+	if (u->rw_cur != -1 && u->logs[u->rw_cur].wr_ofs < np->nr_pages_per_block) {
+		*log_idx = u->rw_cur;
+		return &u->logs[u->rw_cur];
+	}
+	for (i = 1; i < p->nr_log_blks; i++) {
+		h4h_hybrid_log_blk_t* l = &u->logs[i];
+		if (l->b != NULL)
+			continue;
+		if ((l->b = __h4h_hybrid_ftl_alloc_block (bdi, punit)) == NULL)
+			return NULL;
+		l->wr_ofs = 0;
+		l->seq = ++p->seq;
+		u->rw_cur = i;
+		*log_idx = i;
+		return l;
+	}
+
+	/* NOTE: pages of the request are already mapped, so RW logs are
+	 * never merged here; do_gc () makes room for the request before */
+	return NULL;
+}
+
+uint32_t h4h_hybrid_ftl_get_ppa (
+	h4h_drv_info_t* bdi,
+	int64_t lpa,
+	h4h_phyaddr_t* ppa,
+	uint64_t* sp_off)
+{
+	h4h_hybrid_ftl_private_t* p = H4H_FTL_PRIV (bdi);
+	uint64_t lbn = __h4h_hybrid_ftl_get_lbn (p, lpa);
+	uint8_t st;
+
+	*sp_off = 0;
+	if (lbn >= p->nr_lbns)
+		return 1;
+
+	/* NOTE: the host could send reads to not-written pages; the caller
+	 * treats them as dummy reads */
+	st = __h4h_hybrid_ftl_lookup (bdi, lbn, __h4h_hybrid_ftl_get_page_ofs (p, lpa), ppa);
+	if (st != HFTL_PG_VALID && st != HFTL_PG_LOG)
+		return 1;
+
+	return 0;
+}
+
+uint32_t h4h_hybrid_ftl_get_free_ppa (
+	h4h_drv_info_t* bdi,
+	int64_t lpa,
+	h4h_phyaddr_t* ppa)
+{
+	h4h_hybrid_ftl_private_t* p = H4H_FTL_PRIV (bdi);
+	h4h_device_params_t* np = H4H_GET_DEVICE_PARAMS (bdi);
+	uint64_t lbn = __h4h_hybrid_ftl_get_lbn (p, lpa);
+	uint64_t ofs = __h4h_hybrid_ftl_get_page_ofs (p, lpa);
+	uint64_t punit = __h4h_hybrid_ftl_get_punit (p, lbn);
+	h4h_hybrid_data_blk_t* e = NULL;
+	h4h_hybrid_log_blk_t* l = NULL;
+	uint64_t log_idx;
+
+	if (lbn >= p->nr_lbns) {
+		h4h_error ("lpa is out of range (%lld)", lpa);
+		return 1;
+	}
+	e = &p->dt[lbn];
+	if (p->pu[punit].nr_rsv_pgs > 0)
+		p->pu[punit].nr_rsv_pgs--;
+
+	/* [STEP1] in-place writes go to the data block */
+	if (__h4h_hybrid_ftl_is_inplace (e, ofs)) {
+		if (e->b == NULL && (e->b = __h4h_hybrid_ftl_alloc_block (bdi, punit)) == NULL)
+			return 1;
+		__h4h_hybrid_ftl_set_ppa (bdi, ppa, e->b, ofs);
+		return 0;
+	}
+
+	/* [STEP2] a write to the first page starts the SW log */
+	l = &p->pu[punit].logs[HFTL_SW_LOG];
+	if (ofs == 0 && l->owner == HFTL_NO_OWNER) {
+		if (l->b == NULL && (l->b = __h4h_hybrid_ftl_alloc_block (bdi, punit)) == NULL)
+			return 1;
+		l->owner = lbn;
+		l->wr_ofs = 0;
+	}
+	if (l->owner == (int64_t)lbn && l->wr_ofs == ofs && ofs < np->nr_pages_per_block) {
+		__h4h_hybrid_ftl_set_ppa (bdi, ppa, l->b, l->wr_ofs++);
+		return 0;
+	}
+
+	/* [STEP3] the others go to RW logs */
+	if ((l = __h4h_hybrid_ftl_get_rw_log (bdi, punit, &log_idx)) == NULL) {
+		h4h_error ("oops! no free RW log on punit %llu", punit);
+		/* the request fails; drop what is left of its reservations */
+		for (punit = 0; punit < p->nr_blks_per_seg; punit++)
+			p->pu[punit].nr_rsv_pgs = 0;
+		return 1;
+	}
+	__h4h_hybrid_ftl_set_ppa (bdi, ppa, l->b, l->wr_ofs++);
+
+	return 0;
+}
+
+uint32_t h4h_hybrid_ftl_map_lpa_to_ppa (
+	h4h_drv_info_t* bdi,
+	h4h_logaddr_t* logaddr,
+	h4h_phyaddr_t* ppa)
+{
+	h4h_hybrid_ftl_private_t* p = H4H_FTL_PRIV (bdi);
+	h4h_device_params_t* np = H4H_GET_DEVICE_PARAMS (bdi);
+	int64_t lpa = logaddr->lpa[0];
+	uint64_t lbn = __h4h_hybrid_ftl_get_lbn (p, lpa);
+	uint64_t ofs = __h4h_hybrid_ftl_get_page_ofs (p, lpa);
+	uint64_t punit = __h4h_hybrid_ftl_get_punit (p, lbn);
+	h4h_hybrid_data_blk_t* e = NULL;
+	h4h_hybrid_log_blk_t* l = NULL;
+	uint64_t i;
+
+	if (lbn >= p->nr_lbns) {
+		h4h_error ("lpa is out of range (%lld)", lpa);
+		return 1;
+	}
+	e = &p->dt[lbn];
+
+	/* [CASE1] an in-place write to the data block */
+	if (e->b != NULL && e->b->block_no == ppa->block_no) {
+		h4h_bug_on (e->pst[ofs] == HFTL_PG_VALID || e->pst[ofs] == HFTL_PG_LOG);
+		h4h_bug_on ((int64_t)ofs <= e->rw_pg_ofs);
+		e->pst[ofs] = HFTL_PG_VALID;
+		e->rw_pg_ofs = ofs;
+		return 0;
+	}
+
+	/* [CASE2] a write to a log block */
+	for (i = 0; i < p->nr_log_blks; i++) {
+		l = &p->pu[punit].logs[i];
+		if (l->b != NULL && l->b->block_no == ppa->block_no)
+			break;
+	}
+	if (i == p->nr_log_blks) {
+		h4h_error ("oops! no log block for (%llu %llu %llu)", 
+			ppa->channel_no, ppa->chip_no, ppa->block_no);
+		return 1;
+	}
+
+	/* invalidate the previous copy */
+	if (e->pst[ofs] == HFTL_PG_VALID)
+		e->pst[ofs] = HFTL_PG_INVALID;
+	else
+		__h4h_hybrid_ftl_drop_log_page (p, lbn, ofs);
+
+	if (e->log_loc == NULL &&
+		(e->log_loc = (uint32_t*)h4h_zmalloc 
+			(sizeof (uint32_t) * np->nr_pages_per_block)) == NULL) {
+		h4h_error ("h4h_malloc failed");
+		return 1;
+	}
+	l->lpa[ppa->page_no] = lpa;
+	l->nr_valid_pgs++;
+	e->log_loc[ofs] = HFTL_LOG_LOC (i, ppa->page_no);
+	e->nr_log_pgs++;
+	e->pst[ofs] = HFTL_PG_LOG;
+
+	return 0;
+}
+
+uint32_t h4h_hybrid_ftl_invalidate_lpa (
+	h4h_drv_info_t* bdi,
+	int64_t lpa,
+	uint64_t len)
+{
+	h4h_hybrid_ftl_private_t* p = H4H_FTL_PRIV (bdi);
+	uint64_t i;
+
+	for (i = 0; i < len; i++) {
+		uint64_t lbn = __h4h_hybrid_ftl_get_lbn (p, lpa + i);
+		uint64_t ofs = __h4h_hybrid_ftl_get_page_ofs (p, lpa + i);
+		h4h_hybrid_data_blk_t* e = NULL;
+
+		if (lbn >= p->nr_lbns)
+			return 1;
+		e = &p->dt[lbn];
+		if (e->pst[ofs] == HFTL_PG_VALID)
+			e->pst[ofs] = HFTL_PG_INVALID;
+		else
+			__h4h_hybrid_ftl_drop_log_page (p, lbn, ofs);
+	}
+
+	return 0;
+}
+
+/* the SW log must be merged before the write to 'lpa' can be served */
+static uint8_t __h4h_hybrid_ftl_is_sw_merge_needed (
+	h4h_hybrid_ftl_private_t* p,
+	uint64_t lbn,
+	uint64_t ofs,
+	uint64_t nr_pages_per_block)
+{
+	h4h_hybrid_log_blk_t* sw = &p->pu[__h4h_hybrid_ftl_get_punit (p, lbn)].logs[HFTL_SW_LOG];
+
+	if (sw->owner == HFTL_NO_OWNER)
+		return 0;
+	if (sw->wr_ofs == nr_pages_per_block)
+		return 1;	/* the SW log is full */
+	if (ofs == 0 && !__h4h_hybrid_ftl_is_inplace (&p->dt[lbn], ofs))
+		return 1;	/* a new sequential stream begins */
+
+	return 0;
+}
+
+uint8_t h4h_hybrid_ftl_is_gc_needed (
+	h4h_drv_info_t* bdi,
+	int64_t lpa)
+{
+	h4h_hybrid_ftl_private_t* p = H4H_FTL_PRIV (bdi);
+	h4h_device_params_t* np = H4H_GET_DEVICE_PARAMS (bdi);
+	uint64_t lbn = __h4h_hybrid_ftl_get_lbn (p, lpa);
+	uint64_t ofs = __h4h_hybrid_ftl_get_page_ofs (p, lpa);
+	uint64_t punit;
+
+	if (lbn >= p->nr_lbns)
+		return 0;
+	punit = __h4h_hybrid_ftl_get_punit (p, lbn);
+
+	/* NOTE: all the pages of a write are checked before any of them is
+	 * mapped; each of them reserves a page of the RW logs in case it goes
+	 * there, and get_free_ppa () releases it */
+	p->pu[punit].nr_rsv_pgs++;
+
+	if (__h4h_hybrid_ftl_is_sw_merge_needed (p, lbn, ofs, np->nr_pages_per_block))
+		return 1;
+	if (__h4h_hybrid_ftl_nr_free_rw_pgs (p, punit, np->nr_pages_per_block) < 
+			p->pu[punit].nr_rsv_pgs)
+		return 1;
+
+	return 0;
+}
+
+uint32_t h4h_hybrid_ftl_do_gc (
+	h4h_drv_info_t* bdi,
+	int64_t lpa)
+{
+	h4h_hybrid_ftl_private_t* p = H4H_FTL_PRIV (bdi);
+	h4h_device_params_t* np = H4H_GET_DEVICE_PARAMS (bdi);
+	uint64_t lbn = __h4h_hybrid_ftl_get_lbn (p, lpa);
+	uint64_t ofs = __h4h_hybrid_ftl_get_page_ofs (p, lpa);
+	uint64_t punit = __h4h_hybrid_ftl_get_punit (p, lbn);
+
+	if (lbn >= p->nr_lbns)
+		return 1;
+
+	/* wait for the reqs in flight on the punit; merges read pages written
+	 * by them, and the blocks of an lbn are all on its punit */
+	h4h_drv_llm_barrier (bdi, &punit, 1);
+
+	if (__h4h_hybrid_ftl_is_sw_merge_needed (p, lbn, ofs, np->nr_pages_per_block))
+		__h4h_hybrid_ftl_merge_sw_log (bdi, punit);
+	while (__h4h_hybrid_ftl_nr_free_rw_pgs (p, punit, np->nr_pages_per_block) < 
+			p->pu[punit].nr_rsv_pgs) {
+		if (__h4h_hybrid_ftl_merge_rw_log (bdi, punit) != 0) {
+			h4h_warning ("RW logs of punit %llu cannot take %llu pages", 
+				punit, p->pu[punit].nr_rsv_pgs);
+			break;
+		}
+	}
+
+	return 0;
+}
+
+uint64_t h4h_hybrid_ftl_get_segno (
+	h4h_drv_info_t* bdi,
+	uint64_t lpa)
+{
+	h4h_hybrid_ftl_private_t* p = H4H_FTL_PRIV (bdi);
+	return lpa / p->nr_pgs_per_seg;
+}
+
+uint32_t h4h_hybrid_ftl_badblock_scan (h4h_drv_info_t* bdi)
+{
+	h4h_hybrid_ftl_private_t* p = H4H_FTL_PRIV (bdi);
+	h4h_device_params_t* np = H4H_GET_DEVICE_PARAMS (bdi);
+	h4h_hlm_req_gc_t* hlm_gc = &p->gc_hlm;
+	uint64_t i, j;
+
+	h4h_msg ("[WARNING] 'h4h_hybrid_ftl_badblock_scan' is called! All of the flash blocks will be erased!!!");
+
+	/* step1: reset data and log blocks */
+	h4h_msg ("step1: reset data and log blocks");
+	for (i = 0; i < p->nr_lbns; i++) {
+		h4h_hybrid_data_blk_t* e = &p->dt[i];
+		e->b = NULL;
+		e->rw_pg_ofs = -1;
+		e->nr_log_pgs = 0;
+		if (e->log_loc) {
+			h4h_free (e->log_loc);
+			e->log_loc = NULL;
+		}
+		h4h_memset (e->pst, HFTL_PG_FREE, sizeof (uint8_t) * np->nr_pages_per_block);
+	}
+	for (i = 0; i < p->nr_blks_per_seg; i++) {
+		p->pu[i].rw_cur = -1;
+		p->pu[i].nr_rsv_pgs = 0;
+		for (j = 0; j < p->nr_log_blks; j++)
+			__h4h_hybrid_ftl_reset_log (p, &p->pu[i].logs[j], np->nr_pages_per_block);
+	}
+
+	/* step2: erase all the blocks */
+	h4h_msg ("step2: erase all the blocks");
+	bdi->ptr_llm_inf->flush (bdi);
+	for (i = 0; i < np->nr_blocks_per_chip; i++) {
+		for (j = 0; j < p->nr_blks_per_seg; j++) {
+			h4h_llm_req_t* r = &hlm_gc->llm_reqs[j];
+			h4h_abm_block_t* b = NULL;
+
+			if ((b = h4h_abm_get_block (p->abm, j % np->nr_channels, j / np->nr_channels, i)) == NULL) {
+				h4h_error ("oops! h4h_abm_get_block failed");
+				h4h_bug_on (1);
+			}
+			r->req_type = REQTYPE_GC_ERASE;
+			r->logaddr.lpa[0] = -1ULL; /* lpa is not available now */
+			__h4h_hybrid_ftl_set_ppa (bdi, &r->phyaddr, b, 0);
+			r->ptr_hlm_req = (void*)hlm_gc;
+			r->ret = 0;
+		}
+
+		hlm_gc->req_type = REQTYPE_GC_ERASE;
+		hlm_gc->nr_llm_reqs = p->nr_blks_per_seg;
+		atomic64_set (&hlm_gc->nr_llm_reqs_done, 0);
+		h4h_sema_lock (&hlm_gc->done);
+		for (j = 0; j < p->nr_blks_per_seg; j++) {
+			if ((bdi->ptr_llm_inf->make_req (bdi, &hlm_gc->llm_reqs[j])) != 0) {
+				h4h_error ("llm_make_req failed");
+				h4h_bug_on (1);
+			}
+		}
+		h4h_sema_lock (&hlm_gc->done);
+		h4h_sema_unlock (&hlm_gc->done);
+
+		for (j = 0; j < p->nr_blks_per_seg; j++) {
+			h4h_llm_req_t* r = &hlm_gc->llm_reqs[j];
+			h4h_abm_erase_block (p->abm, r->phyaddr.channel_no, r->phyaddr.chip_no, 
+				r->phyaddr.block_no, (r->ret != 0) ? 1 : 0);
+		}
+	}
+
+	h4h_msg ("done");
+
+	return 0;
+}
@@ -97,8 +97,12 @@ typedef struct {
 
 	/* reserved for gc (reused whenever gc is invoked) */
 	h4h_abm_block_t** gc_bab;
+	uint64_t* gc_punits;	/* punits gc waits for (victims, then gc writes) */
 	h4h_hlm_req_gc_t gc_hlm;
 	h4h_hlm_req_gc_t gc_hlm_w;
+	h4h_hlm_reqs_gc_pads_t* gc_pads;
+	h4h_phyaddr_t* gc_ppas;	/* pages for gc writes */
+	uint64_t* gc_punit_ofs;	/* scratch for write compaction */
 
 	/* for bad-block scanning */
 	h4h_sema_t badblk;
@@ -253,6 +257,12 @@ uint32_t h4h_page_ftl_create (h4h_drv_info_t* bdi)
 		h4h_page_ftl_destroy (bdi);
 		return 1;
 	}
+	if ((p->gc_punits = (uint64_t*)h4h_zmalloc 
+			(sizeof (uint64_t) * p->nr_punits)) == NULL) {
+		h4h_error ("h4h_zmalloc failed");
+		h4h_page_ftl_destroy (bdi);
+		return 1;
+	}
 
 	if ((p->gc_hlm.llm_reqs = (h4h_llm_req_t*)h4h_zmalloc
 			(sizeof (h4h_llm_req_t) * p->nr_punits_pages)) == NULL) {
@@ -263,6 +273,14 @@ uint32_t h4h_page_ftl_create (h4h_drv_info_t* bdi)
 	h4h_sema_init (&p->gc_hlm.done);
 	hlm_reqs_pool_allocate_llm_reqs (p->gc_hlm.llm_reqs, p->nr_punits_pages, RP_MEM_PHY);
 
+	/* pads for gc reads are allocated once and reused */
+	if ((p->gc_pads = hlm_reqs_pool_create_gc_pads (
+			p->gc_hlm.llm_reqs, p->nr_punits_pages, np->nr_subpages_per_page)) == NULL) {
+		h4h_error ("hlm_reqs_pool_create_gc_pads failed");
+		h4h_page_ftl_destroy (bdi);
+		return 1;
+	}
+
 	if ((p->gc_hlm_w.llm_reqs = (h4h_llm_req_t*)h4h_zmalloc
 			(sizeof (h4h_llm_req_t) * p->nr_punits_pages)) == NULL) {
 		h4h_error ("h4h_zmalloc failed");
@@ -272,6 +290,15 @@ uint32_t h4h_page_ftl_create (h4h_drv_info_t* bdi)
 	h4h_sema_init (&p->gc_hlm_w.done);
 	hlm_reqs_pool_allocate_llm_reqs (p->gc_hlm_w.llm_reqs, p->nr_punits_pages, RP_MEM_PHY);
 
+	if ((p->gc_ppas = (h4h_phyaddr_t*)h4h_zmalloc
+			(sizeof (h4h_phyaddr_t) * p->nr_punits_pages)) == NULL ||
+		(p->gc_punit_ofs = (uint64_t*)h4h_zmalloc
+			(sizeof (uint64_t) * p->nr_punits)) == NULL) {
+		h4h_error ("h4h_zmalloc failed");
+		h4h_page_ftl_destroy (bdi);
+		return 1;
+	}
+
 	return 0;
 }
 
@@ -281,16 +308,24 @@ void h4h_page_ftl_destroy (h4h_drv_info_t* bdi)
 
 	if (!p)
 		return;
+	if (p->gc_punit_ofs)
+		h4h_free (p->gc_punit_ofs);
+	if (p->gc_ppas)
+		h4h_free (p->gc_ppas);
 	if (p->gc_hlm_w.llm_reqs) {
 		hlm_reqs_pool_release_llm_reqs (p->gc_hlm_w.llm_reqs, p->nr_punits_pages, RP_MEM_PHY);
 		h4h_sema_free (&p->gc_hlm_w.done);
 		h4h_free (p->gc_hlm_w.llm_reqs);
 	}
+	if (p->gc_pads)
+		hlm_reqs_pool_destroy_gc_pads (p->gc_pads, p->gc_hlm.llm_reqs);
 	if (p->gc_hlm.llm_reqs) {
 		hlm_reqs_pool_release_llm_reqs (p->gc_hlm.llm_reqs, p->nr_punits_pages, RP_MEM_PHY);
 		h4h_sema_free (&p->gc_hlm.done);
 		h4h_free (p->gc_hlm.llm_reqs);
 	}
+	if (p->gc_punits)
+		h4h_free (p->gc_punits);
 	if (p->gc_bab)
 		h4h_free (p->gc_bab);
 	if (p->ac_bab)
@@ -824,6 +859,7 @@ uint32_t h4h_page_ftl_do_gc (h4h_drv_info_t* bdi, int64_t lpa)
 	h4h_hlm_req_gc_t* hlm_gc_w = &p->gc_hlm_w;
 	uint64_t nr_gc_blks = 0;
 	uint64_t nr_llm_reqs = 0;
+	uint64_t nr_kps = 0;
 	uint64_t nr_punits = 0;
 	uint64_t i, j, k;
 	h4h_stopwatch_t sw;
@@ -848,16 +884,8 @@ uint32_t h4h_page_ftl_do_gc (h4h_drv_info_t* bdi, int64_t lpa)
 		return 0;
 	}
 
-	/* TEMP */
-	for (i = 0; i < nr_punits * np->nr_pages_per_block; i++) {
-		hlm_reqs_pool_reset_fmain (&hlm_gc->llm_reqs[i].fmain);
-		/* The memory for pads must be allocated for GC 
-		 * because there are no buffers from bio */
-		hlm_reqs_pool_alloc_fmain_pad (&hlm_gc->llm_reqs[i].fmain);
-	}
-	/* TEMP */
-
-	/* build hlm_req_gc for reads */
+	/* build hlm_req_gc for reads; the pads of gc reads are already bound
+	 * to them, and only the pages with valid subpages are touched */
 	for (i = 0, nr_llm_reqs = 0; i < nr_gc_blks; i++) {
 		h4h_abm_block_t* b = p->gc_bab[i];
 		if (b == NULL)
@@ -866,21 +894,23 @@ uint32_t h4h_page_ftl_do_gc (h4h_drv_info_t* bdi, int64_t lpa)
 			h4h_llm_req_t* r = &hlm_gc->llm_reqs[nr_llm_reqs];
 			int has_valid = 0;
 			/* are there any valid subpages in a block */
-			hlm_reqs_pool_reset_fmain (&r->fmain);
-			hlm_reqs_pool_reset_logaddr (&r->logaddr);
 			for (k = 0; k < np->nr_subpages_per_page; k++) {
 				if (b->pst[j*np->nr_subpages_per_page+k] != H4H_ABM_SUBPAGE_INVALID) {
 					has_valid = 1;
-					r->logaddr.lpa[k] = -1; /* the subpage contains new data */
-					r->fmain.kp_stt[k] = KP_STT_DATA;
-				} else {
-					r->logaddr.lpa[k] = -1;	/* the subpage contains obsolate data */
-					r->fmain.kp_stt[k] = KP_STT_HOLE;
+					break;
 				}
 			}
-			hlm_reqs_pool_alloc_fmain_pad (&r->fmain);
 			/* if it is, selects it as the gc candidates */
 			if (has_valid) {
+				hlm_reqs_pool_reset_fmain (&r->fmain);
+				hlm_reqs_pool_reset_logaddr (&r->logaddr);
+				for (k = 0; k < np->nr_subpages_per_page; k++) {
+					/* lpas are read from oob */
+					if (b->pst[j*np->nr_subpages_per_page+k] != H4H_ABM_SUBPAGE_INVALID) {
+						r->fmain.kp_stt[k] = KP_STT_DATA;
+						nr_kps++;
+					}
+				}
 				r->req_type = REQTYPE_GC_READ;
 				r->phyaddr.channel_no = b->channel_no;
 				r->phyaddr.chip_no = b->chip_no;
@@ -900,9 +930,11 @@ uint32_t h4h_page_ftl_do_gc (h4h_drv_info_t* bdi, int64_t lpa)
 		nr_llm_reqs, nr_gc_blks, h4h_stopwatch_get_elapsed_time_us (&sw));
 	*/
 
-	/* wait until Q in llm becomes empty 
-	 * TODO: it might be possible to further optimize this */
-	bdi->ptr_llm_inf->flush (bdi);
+	/* wait for the reqs sent to the victims' punits before; victim pages
+	 * might still be written by them, while the other punits keep going */
+	for (i = 0; i < nr_gc_blks; i++)
+		p->gc_punits[i] = H4H_GET_PUNIT_ID (bdi, p->gc_bab[i]);
+	h4h_drv_llm_barrier (bdi, p->gc_punits, nr_gc_blks);
 
 	if (nr_llm_reqs == 0) 
 		goto erase_blks;
@@ -967,38 +999,40 @@ uint32_t h4h_page_ftl_do_gc (h4h_drv_info_t* bdi, int64_t lpa)
 
 	/* perform write compaction for gc */
 #include "hlm_reqs_pool.h"
-	hlm_reqs_pool_write_compaction (hlm_gc_w, hlm_gc, np);
-
-	/*h4h_msg ("compaction: %llu => %llu", nr_llm_reqs, hlm_gc_w->nr_llm_reqs);*/
-
-	nr_llm_reqs = hlm_gc_w->nr_llm_reqs;
 
-	/* build hlm_req_gc for writes */
+	/* allocate the pages of gc writes first; compaction groups the gc
+	 * writes by the punits of the pages */
+	nr_llm_reqs = (nr_kps + np->nr_subpages_per_page - 1) / np->nr_subpages_per_page;
 	for (i = 0; i < nr_llm_reqs; i++) {
-		h4h_llm_req_t* r = &hlm_gc_w->llm_reqs[i];
-		r->req_type = REQTYPE_GC_WRITE;	/* change to write */
-		for (k = 0; k < np->nr_subpages_per_page; k++) {
-			/* move subpages that contain new data */
-			if (r->fmain.kp_stt[k] == KP_STT_DATA) {
-				r->logaddr.lpa[k] = ((uint64_t*)r->foob.data)[k];
-			} else if (r->fmain.kp_stt[k] == KP_STT_HOLE) {
-				((uint64_t*)r->foob.data)[k] = -1;
-				r->logaddr.lpa[k] = -1;
-			} else {
-				h4h_bug_on (1);
-			}
-		}
-		r->ptr_hlm_req = (void*)hlm_gc_w;
-		if (h4h_page_ftl_get_free_ppa (bdi, 0, &r->phyaddr) != 0) {
+		if (h4h_page_ftl_get_free_ppa (bdi, 0, &p->gc_ppas[i]) != 0) {
 			h4h_error ("h4h_page_ftl_get_free_ppa failed");
 			h4h_bug_on (1);
 		}
+	}
+	hlm_reqs_pool_write_compaction (hlm_gc_w, hlm_gc, p->gc_ppas, nr_llm_reqs, p->gc_punit_ofs, np);
+
+	/*h4h_msg ("compaction: %llu => %llu", hlm_gc->nr_llm_reqs, hlm_gc_w->nr_llm_reqs);*/
+
+	/* build hlm_req_gc for writes; compaction has already filled in lpas,
+	 * holes, and ppas, so only the mapping is updated here */
+	for (i = 0; i < nr_llm_reqs; i++) {
+		h4h_llm_req_t* r = &hlm_gc_w->llm_reqs[i];
 		if (h4h_page_ftl_map_lpa_to_ppa (bdi, &r->logaddr, &r->phyaddr) != 0) {
 			h4h_error ("h4h_page_ftl_map_lpa_to_ppa failed");
 			h4h_bug_on (1);
 		}
 	}
 
+	/* host writes fill the same active blocks; wait for the reqs sent to
+	 * the punits of the gc writes before, so that the pages of a block are
+	 * programmed in order. gc writes are grouped by punit */
+	for (i = 0, j = 0; i < nr_llm_reqs; i++) {
+		uint64_t punit_id = hlm_gc_w->llm_reqs[i].phyaddr.punit_id;
+		if (j == 0 || p->gc_punits[j-1] != punit_id)
+			p->gc_punits[j++] = punit_id;
+	}
+	h4h_drv_llm_barrier (bdi, p->gc_punits, j);
+
 	/* send write reqs to llm */
 	hlm_gc_w->req_type = REQTYPE_GC_WRITE;
 	hlm_gc_w->nr_llm_reqs = nr_llm_reqs;
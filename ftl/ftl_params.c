@@ -57,6 +57,78 @@ int _param_llm_type					= LLM_MULTI_QUEUE;
 /*int _param_llm_type					= LLM_NO_QUEUE;*/
 int _param_hlm_type					= HLM_NO_BUFFER;
 
+/* dftl: stream detection & prefetch of directory slots */
+int _param_dftl_prefetch_depth		= 4;	/* # of dir slots to prefetch (0: disable) */
+int _param_dftl_prefetch_trigger	= 2;	/* # of stream hits before prefetching */
+int _param_dftl_stream_max_stride	= 4096;	/* max. distance (in pages) of a strided stream */
+
+/* hybrid: log blocks per punit (1 sequential + random ones; at least 3) */
+int _param_hybrid_nr_log_blks		= 8;
+
+/* hlm_buf: worker shards and the depth of a shard queue (0: unbounded) */
+int _param_hlm_buf_nr_shards		= 4;
+int _param_hlm_buf_qdepth			= 256;
+
+/* hlm_buf: write-back cache capacity (in pages; 0: disabled) and the
+ * percentage of dirty pages that starts background destage */
+int _param_hlm_buf_cache_pgs		= 0;
+int _param_hlm_buf_destage_pct		= 50;
+
+/* rsd: capacity of the write-combining buffer (in segments) */
+int _param_rsd_nr_buf_segs			= 4;
+
+/* read cache: memory budget (in MB; 0: disabled), reads of this many pages
+ * or more bypass it (0: never), and the interval of hit-ratio reports */
+int _param_rcache_mb				= 0;
+int _param_rcache_bypass_pgs		= 128;
+int _param_rcache_report_sec		= 10;
+
+/* read-ahead: staging buffer (in pages; 0: disabled), the first and the
+ * largest window (in pages; 0: one page per punit), and # of back-to-back
+ * reads that make a stream sequential */
+int _param_ra_buf_pgs				= 0;
+int _param_ra_init_pgs				= 0;
+int _param_ra_max_pgs				= 1024;
+int _param_ra_trigger				= 2;
+
+/* host: merge adjacent reqs up to this many 4KB pages (0 or 1: disabled) */
+int _param_host_merge_pgs			= 0;
+
+/* llm_mq: # of dispatcher threads, each of which serves a disjoint range of
+ * punits (whole channels if possible), and whether they are pinned to cpus */
+int _param_llm_nr_dispatchers		= 1;
+int _param_llm_pin_dispatchers		= 0;
+
+/* llm_mq: the longest time (in us) a dispatcher polls its idle punits
+ * before it parks (0: park at once); it adapts to the idle gaps below it.
+ * polling only pays off if dispatchers have cpus of their own */
+int _param_llm_poll_max_us			= 0;
+
+/* llm_mq: admission limits; reqs in flight in total, and queue items in
+ * flight per punit (0: the ring size of a punit). submitters sleep until
+ * completions return credits */
+int _param_llm_max_inflight			= 20480;
+int _param_llm_punit_max_inflight	= 0;
+
+/* llm_mq: the scheduler of a punit (LLM_SCHED_FIFO or LLM_SCHED_QOS). qos
+ * keeps a queue per class (host reads, writes, gc and meta); all programs
+ * go to the write queue, so gc and meta weights cover reads and erases.
+ * the classes share a punit's time by their weights, and a req waiting
+ * longer than the deadline of its class (in us; 0: none) goes first */
+int _param_llm_sched				= LLM_SCHED_FIFO;
+int _param_llm_weight_read			= 4;
+int _param_llm_weight_write			= 2;
+int _param_llm_weight_gc			= 1;
+int _param_llm_weight_meta			= 2;
+int _param_llm_deadline_read_us		= 2000;
+int _param_llm_deadline_write_us	= 0;
+int _param_llm_deadline_gc_us		= 0;
+int _param_llm_deadline_meta_us		= 5000;
+
+/* llm_mq: which ops of a busy punit a host read may suspend, if the device
+ * supports suspends (see max_suspends of the device params) */
+int _param_llm_suspend				= LLM_SUSPEND_ERASE;
+
 h4h_ftl_params get_default_ftl_params (void)
 {
 	h4h_ftl_params p;
@@ -85,7 +157,7 @@ void display_ftl_params (h4h_ftl_params* p)
 	h4h_msg ("=====================================================================");
 	h4h_msg ("FTL CONFIGURATION");
 	h4h_msg ("=====================================================================");
-	h4h_msg ("mapping type = %d (1: no ftl, 2: block-mapping, 3: RSD, 4: page-mapping, 5: dftl)", p->mapping_type);
+	h4h_msg ("mapping type = %d (1: no ftl, 2: block-mapping, 3: RSD, 4: page-mapping, 5: dftl, 6: hybrid)", p->mapping_type);
 	h4h_msg ("gc policy = %d (1: merge 2: random, 3: greedy, 4: cost-benefit)", p->gc_policy);
 	h4h_msg ("wl policy = %d (1: none, 2: swap)", p->wl_policy);
 	h4h_msg ("trim mode = %d (1: enable, 2: disable)", p->trim);
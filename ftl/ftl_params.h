@@ -34,6 +34,38 @@ extern int _param_snapshot;
 extern int _param_mapping_type;
 extern int _param_llm_type;
 extern int _param_hlm_type;
+extern int _param_dftl_prefetch_depth;
+extern int _param_dftl_prefetch_trigger;
+extern int _param_dftl_stream_max_stride;
+extern int _param_hybrid_nr_log_blks;
+extern int _param_hlm_buf_nr_shards;
+extern int _param_hlm_buf_qdepth;
+extern int _param_hlm_buf_cache_pgs;
+extern int _param_hlm_buf_destage_pct;
+extern int _param_rsd_nr_buf_segs;
+extern int _param_rcache_mb;
+extern int _param_rcache_bypass_pgs;
+extern int _param_rcache_report_sec;
+extern int _param_ra_buf_pgs;
+extern int _param_ra_init_pgs;
+extern int _param_ra_max_pgs;
+extern int _param_ra_trigger;
+extern int _param_host_merge_pgs;
+extern int _param_llm_nr_dispatchers;
+extern int _param_llm_pin_dispatchers;
+extern int _param_llm_poll_max_us;
+extern int _param_llm_max_inflight;
+extern int _param_llm_punit_max_inflight;
+extern int _param_llm_sched;
+extern int _param_llm_weight_read;
+extern int _param_llm_weight_write;
+extern int _param_llm_weight_gc;
+extern int _param_llm_weight_meta;
+extern int _param_llm_deadline_read_us;
+extern int _param_llm_deadline_write_us;
+extern int _param_llm_deadline_gc_us;
+extern int _param_llm_deadline_meta_us;
+extern int _param_llm_suspend;
 
 h4h_ftl_params get_default_ftl_params (void);
 void display_ftl_params (h4h_ftl_params* p);
@@ -21,7 +21,6 @@ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
 OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 THE SOFTWARE.
 */
-
 #if defined(KERNEL_MODE)
 #include <linux/module.h>
 #include <linux/blkdev.h>
@@ -39,7 +38,11 @@ THE SOFTWARE.
 #include "h4h_drv.h"
 #include "hlm_nobuf.h"
 #include "hlm_buf.h"
+#include "hlm_reqs_pool.h"
+#include "ftl_params.h"
+#include "umemory.h"
 #include "uthread.h"
+#include "uthash.h"
 
 #include "algo/no_ftl.h"
 #include "algo/block_ftl.h"
@@ -56,40 +59,558 @@ h4h_hlm_inf_t _hlm_buf_inf = {
 	.end_req = hlm_buf_end_req,
 };
 
+/* an lpa belongs to the shard of its stripe; a stripe is as large as the
+ * biggest hlm_req so that most requests stay in a single shard */
+#define HLM_BUF_STRIPE_PGS	H4H_BLKIO_MAX_VECS
 
 /* data structures for hlm_buf */
+struct h4h_hlm_buf_shard {
+	h4h_drv_info_t* bdi;
+	h4h_queue_t* q;
+	h4h_thread_t* hlm_thread;
+	atomic64_t nr_pending;	/* # of reqs not yet passed to hlm_nobuf */
+	int64_t qdepth;			/* 0 if 'q' is unbounded */
+	h4h_sema_t credits;		/* free slots of 'q' if it is bounded */
+};
+
+/* a cached page; 'data' is owned by the cache unless a destage took it
+ * and the page was overwritten or trimmed afterwards */
+struct h4h_hlm_buf_page {
+	int64_t lpa;
+	uint8_t* data;
+	uint8_t dirty;
+	uint8_t wout;			/* 'data' is being written by a destage */
+	struct list_head lru;	/* all the pages (the head is the MRU) */
+	struct list_head dirty_list;	/* dirty pages (the head is the oldest) */
+	UT_hash_handle hh;
+};
+
+struct h4h_hlm_buf_cache {
+	h4h_spinlock_t lock;
+	struct h4h_hlm_buf_page* pages;	/* hashed by lpa */
+	struct list_head lru;
+	struct list_head dirty_list;
+	uint64_t nr_pgs;
+	uint64_t nr_dirty;
+	uint64_t max_pgs;
+	uint64_t destage_pgs;	/* start destage above it */
+
+	h4h_hlm_reqs_pool_t* pool;	/* hlm_reqs for destage */
+	h4h_mutex_t destage_lock;	/* a destage batch is sent as a unit */
+	h4h_thread_t* destage_thread;
+	atomic64_t nr_wouts;	/* # of destage reqs in progress */
+
+	/* statistics */
+	uint64_t nr_read_hits;
+	uint64_t nr_read_misses;
+	uint64_t nr_absorbed;
+	uint64_t nr_destaged;
+};
+
 struct h4h_hlm_buf_private {
 	h4h_ftl_inf_t* ptr_ftl_inf;	/* for hlm_nobuff (it must be on top of this structure) */
 
 	/* for thread management */
-	h4h_queue_t* q;
-	h4h_thread_t* hlm_thread;
+	uint64_t nr_shards;
+	struct h4h_hlm_buf_shard* shards;
+
+	/* FTLs are not thread-safe: reads may translate in parallel, but
+	 * writes, trims, and on-demand gc must be alone */
+	h4h_rwlock_t ftl_lock;
+
+	/* write-back cache (NULL if disabled) */
+	struct h4h_hlm_buf_cache* c;
 };
 
 
-/* kernel thread for _llm_q */
-int __hlm_buf_thread (void* arg)
+static uint32_t __hlm_buf_dispatch (
+	h4h_drv_info_t* bdi, 
+	h4h_hlm_req_t* r)
+{
+	struct h4h_hlm_buf_private* p = (struct h4h_hlm_buf_private*)H4H_HLM_PRIV(bdi);
+	uint32_t ret;
+
+	if (h4h_is_read (r->req_type)) {
+		h4h_rwlock_rdlock (&p->ftl_lock);
+		ret = hlm_nobuf_make_req (bdi, r);
+		h4h_rwlock_rdunlock (&p->ftl_lock);
+	} else {
+		h4h_rwlock_wrlock (&p->ftl_lock);
+		ret = hlm_nobuf_make_req (bdi, r);
+		h4h_rwlock_wrunlock (&p->ftl_lock);
+	}
+
+	return ret;
+}
+
+/* 
+ * write-back cache 
+ */
+static struct h4h_hlm_buf_page* __hlm_buf_cache_find (
+	struct h4h_hlm_buf_cache* c, 
+	int64_t lpa)
+{
+	struct h4h_hlm_buf_page* pg = NULL;
+	HASH_FIND (hh, c->pages, &lpa, sizeof (int64_t), pg);
+	return pg;
+}
+
+/* it must be called with c->lock */
+static void __hlm_buf_cache_drop (
+	struct h4h_hlm_buf_cache* c, 
+	struct h4h_hlm_buf_page* pg)
+{
+	HASH_DEL (c->pages, pg);
+	list_del (&pg->lru);
+	if (pg->dirty) {
+		list_del (&pg->dirty_list);
+		c->nr_dirty--;
+	}
+	if (!pg->wout)
+		h4h_free_phy (pg->data);
+	h4h_free (pg);
+	c->nr_pgs--;
+}
+
+typedef struct {
+	int64_t lpa;
+	uint8_t* data;
+} h4h_hlm_buf_destage_ent_t;
+
+/* send the oldest dirty pages in lpa order; returns # of pages sent */
+static uint64_t __hlm_buf_destage_batch (h4h_drv_info_t* bdi)
+{
+	struct h4h_hlm_buf_private* p = (struct h4h_hlm_buf_private*)H4H_HLM_PRIV(bdi);
+	struct h4h_hlm_buf_cache* c = p->c;
+	h4h_hlm_buf_destage_ent_t ents[H4H_BLKIO_MAX_VECS];
+	h4h_hlm_req_t* hr = NULL;
+	h4h_llm_req_t* lr = NULL;
+	uint64_t n = 0, i, j;
+
+	h4h_mutex_lock (&c->destage_lock);
+
+	/* (1) take dirty pages; new writes go to new buffers from now on */
+	h4h_spin_lock (&c->lock);
+	while (n < H4H_BLKIO_MAX_VECS && !list_empty (&c->dirty_list)) {
+		struct h4h_hlm_buf_page* pg = list_entry 
+			(c->dirty_list.next, struct h4h_hlm_buf_page, dirty_list);
+		list_del (&pg->dirty_list);
+		pg->dirty = 0;
+		pg->wout = 1;
+		c->nr_dirty--;
+		ents[n].lpa = pg->lpa;
+		ents[n].data = pg->data;
+		n++;
+	}
+	h4h_spin_unlock (&c->lock);
+
+	if (n == 0) {
+		h4h_mutex_unlock (&c->destage_lock);
+		return 0;
+	}
+
+	/* (2) sort them by lpa */
+	for (i = 1; i < n; i++) {
+		h4h_hlm_buf_destage_ent_t e = ents[i];
+		for (j = i; j > 0 && ents[j-1].lpa > e.lpa; j--)
+			ents[j] = ents[j-1];
+		ents[j] = e;
+	}
+
+	/* (3) build a write and send it */
+	if ((hr = h4h_hlm_reqs_pool_get_item (c->pool)) == NULL ||
+		h4h_hlm_reqs_pool_alloc_llm_reqs (c->pool, hr, n) != 0) {
+		h4h_error ("h4h_hlm_reqs_pool_get_item () failed");
+		h4h_bug_on (1);
+	}
+	hr->req_type = REQTYPE_WRITE;
+	h4h_stopwatch_start (&hr->sw);
+	hr->nr_llm_reqs = n;
+	atomic64_set (&hr->nr_llm_reqs_done, n);	/* counts down */
+	h4h_sema_lock (&hr->done);
+	hr->blkio_req = NULL;	/* it tells a destage from host reqs */
+	hr->ret = 0;
+	for (i = 0; i < n; i++) {
+		lr = &hr->llm_reqs[i];
+		hlm_reqs_pool_reset_fmain (&lr->fmain);
+		hlm_reqs_pool_reset_logaddr (&lr->logaddr);
+		lr->logaddr.lpa[0] = ents[i].lpa;
+		lr->fmain.kp_stt[0] = KP_STT_DATA;
+		lr->fmain.kp_ptr[0] = ents[i].data;
+		lr->req_type = REQTYPE_WRITE;
+		lr->ptr_hlm_req = (void*)hr;
+	}
+	atomic64_inc (&c->nr_wouts);
+	c->nr_destaged += n;
+	if (__hlm_buf_dispatch (bdi, hr) != 0) {
+		h4h_error ("oops! destage failed");
+		h4h_bug_on (1);
+	}
+
+	h4h_mutex_unlock (&c->destage_lock);
+
+	return n;
+}
+
+static void __hlm_buf_destage_end (
+	h4h_drv_info_t* bdi, 
+	h4h_hlm_req_t* hr)
+{
+	struct h4h_hlm_buf_private* p = (struct h4h_hlm_buf_private*)H4H_HLM_PRIV(bdi);
+	struct h4h_hlm_buf_cache* c = p->c;
+	h4h_llm_req_t* lr = NULL;
+	uint64_t i;
+
+	h4h_spin_lock (&c->lock);
+	h4h_hlm_for_each_llm_req (lr, hr, i) {
+		struct h4h_hlm_buf_page* pg = __hlm_buf_cache_find (c, lr->logaddr.lpa[0]);
+		uint8_t* data = lr->fmain.kp_ptr[0];
+
+		if (pg && pg->data == data) {
+			pg->wout = 0;	/* it is clean now */
+		} else {
+			h4h_free_phy (data);	/* overwritten or trimmed in the meantime */
+		}
+		lr->fmain.kp_ptr[0] = lr->fmain.kp_pad[0];
+	}
+	h4h_spin_unlock (&c->lock);
+
+	h4h_hlm_reqs_pool_free_item (c->pool, hr);
+	atomic64_dec (&c->nr_wouts);
+}
+
+/* a flush barrier: every dirty page reaches the device */
+static void __hlm_buf_cache_flush (h4h_drv_info_t* bdi)
+{
+	struct h4h_hlm_buf_private* p = (struct h4h_hlm_buf_private*)H4H_HLM_PRIV(bdi);
+
+	while (__hlm_buf_destage_batch (bdi) > 0)
+		;
+	while (atomic64_read (&p->c->nr_wouts) > 0)
+		h4h_thread_yield ();
+}
+
+/* kernel thread for background destage */
+int __hlm_buf_destage_thread (void* arg)
 {
 	h4h_drv_info_t* bdi = (h4h_drv_info_t*)arg;
 	struct h4h_hlm_buf_private* p = (struct h4h_hlm_buf_private*)H4H_HLM_PRIV(bdi);
-	h4h_hlm_req_t* r;
+	struct h4h_hlm_buf_cache* c = p->c;
 
 	for (;;) {
-		if (h4h_queue_is_all_empty (p->q)) {
-			if (h4h_thread_schedule (p->hlm_thread) == SIGKILL) {
+		if (c->nr_dirty <= c->destage_pgs) {
+			h4h_thread_schedule_setup (c->destage_thread);
+			if (c->nr_dirty <= c->destage_pgs) {
+				if (h4h_thread_schedule_sleep (c->destage_thread) == SIGKILL)
+					break;
+			} else {
+				h4h_thread_schedule_cancel (c->destage_thread);
+			}
+		}
+
+		/* destage down to half of the threshold */
+		while (c->nr_dirty > c->destage_pgs / 2) {
+			if (__hlm_buf_destage_batch (bdi) == 0)
 				break;
+		}
+	}
+
+	return 0;
+}
+
+/* make room for 'nr' pages by evicting clean ones */
+static void __hlm_buf_cache_reserve (
+	h4h_drv_info_t* bdi, 
+	uint64_t nr)
+{
+	struct h4h_hlm_buf_private* p = (struct h4h_hlm_buf_private*)H4H_HLM_PRIV(bdi);
+	struct h4h_hlm_buf_cache* c = p->c;
+
+	for (;;) {
+		struct list_head* pos = NULL;
+		struct list_head* prev = NULL;
+
+		/* walk from the LRU end */
+		h4h_spin_lock (&c->lock);
+		for (pos = c->lru.prev; pos != &c->lru && c->nr_pgs + nr > c->max_pgs; pos = prev) {
+			struct h4h_hlm_buf_page* pg = list_entry (pos, struct h4h_hlm_buf_page, lru);
+			prev = pos->prev;
+			if (pg->dirty || pg->wout)
+				continue;
+			__hlm_buf_cache_drop (c, pg);
+		}
+		if (c->nr_pgs + nr <= c->max_pgs) {
+			h4h_spin_unlock (&c->lock);
+			break;
+		}
+		h4h_spin_unlock (&c->lock);
+
+		/* every page is dirty or in flight; destage in the foreground */
+		if (__hlm_buf_destage_batch (bdi) == 0)
+			h4h_thread_yield ();
+	}
+}
+
+static uint32_t __hlm_buf_cache_write (
+	h4h_drv_info_t* bdi, 
+	h4h_hlm_req_t* hr)
+{
+	struct h4h_hlm_buf_private* p = (struct h4h_hlm_buf_private*)H4H_HLM_PRIV(bdi);
+	struct h4h_hlm_buf_cache* c = p->c;
+	h4h_blkio_req_t* br = (h4h_blkio_req_t*)hr->blkio_req;
+	h4h_llm_req_t* lr = NULL;
+	uint64_t i;
+
+	__hlm_buf_cache_reserve (bdi, hr->nr_llm_reqs);
+
+	h4h_hlm_for_each_llm_req (lr, hr, i) {
+		struct h4h_hlm_buf_page* pg = NULL;
+		uint8_t* data = NULL;
+
+		/* copy the data outside the lock */
+		if ((data = (uint8_t*)h4h_malloc_phy (KPAGE_SIZE)) == NULL) {
+			h4h_error ("h4h_malloc_phy failed");
+			return 1;
+		}
+		h4h_memcpy (data, lr->fmain.kp_ptr[0], KPAGE_SIZE);
+
+		h4h_spin_lock (&c->lock);
+		if ((pg = __hlm_buf_cache_find (c, lr->logaddr.lpa[0])) != NULL) {
+			/* absorb the overwrite */
+			if (!pg->wout)
+				h4h_free_phy (pg->data);
+			pg->wout = 0;
+			list_del (&pg->lru);
+			if (pg->dirty) {
+				c->nr_absorbed++;
+				list_del (&pg->dirty_list);
+				c->nr_dirty--;
 			}
+		} else {
+			if ((pg = (struct h4h_hlm_buf_page*)h4h_zmalloc 
+					(sizeof (struct h4h_hlm_buf_page))) == NULL) {
+				h4h_spin_unlock (&c->lock);
+				h4h_error ("h4h_zmalloc failed");
+				h4h_free_phy (data);
+				return 1;
+			}
+			pg->lpa = lr->logaddr.lpa[0];
+			HASH_ADD (hh, c->pages, lpa, sizeof (int64_t), pg);
+			c->nr_pgs++;
 		}
+		pg->data = data;
+		pg->dirty = 1;
+		list_add (&pg->lru, &c->lru);
+		list_add_tail (&pg->dirty_list, &c->dirty_list);
+		c->nr_dirty++;
+		h4h_spin_unlock (&c->lock);
+	}
+
+	/* kick the destage if there are too many dirty pages */
+	if (c->nr_dirty > c->destage_pgs)
+		h4h_thread_wakeup (c->destage_thread);
+
+	/* FUA is handled as write-through */
+	if (h4h_is_fua (br->bi_rw))
+		__hlm_buf_cache_flush (bdi);
+
+	bdi->ptr_host_inf->end_req (bdi, hr);
 
-		/* if nothing is in Q, then go to the next punit */
-		while (!h4h_queue_is_empty (p->q, 0)) {
-			if ((r = (h4h_hlm_req_t*)h4h_queue_dequeue (p->q, 0)) != NULL) {
-				if (hlm_nobuf_make_req (bdi, r)) {
+	return 0;
+}
+
+/* serve reads from the cache; returns 1 if no llm_reqs need the device */
+static uint8_t __hlm_buf_cache_read (
+	h4h_drv_info_t* bdi, 
+	h4h_hlm_req_t* hr)
+{
+	struct h4h_hlm_buf_private* p = (struct h4h_hlm_buf_private*)H4H_HLM_PRIV(bdi);
+	struct h4h_hlm_buf_cache* c = p->c;
+	h4h_llm_req_t* lr = NULL;
+	uint64_t i, nr_hits = 0;
+
+	h4h_hlm_for_each_llm_req (lr, hr, i) {
+		struct h4h_hlm_buf_page* pg = NULL;
+		uint8_t* data = NULL;
+
+		h4h_spin_lock (&c->lock);
+		if ((pg = __hlm_buf_cache_find (c, lr->logaddr.lpa[0])) != NULL) {
+			data = pg->data;
+			list_del (&pg->lru);
+			list_add (&pg->lru, &c->lru);
+		}
+		h4h_spin_unlock (&c->lock);
+
+		if (data == NULL) {
+			c->nr_read_misses++;
+			continue;
+		}
+
+		/* only the host thread frees pg->data, so copy it without the lock */
+		h4h_memcpy (lr->fmain.kp_ptr[lr->logaddr.ofs], data, KPAGE_SIZE);
+		h4h_memset (&lr->phyaddr, 0x00, sizeof (h4h_phyaddr_t));
+		lr->req_type = REQTYPE_READ_DUMMY;
+		c->nr_read_hits++;
+		nr_hits++;
+	}
+
+	return (nr_hits == hr->nr_llm_reqs) ? 1 : 0;
+}
+
+static void __hlm_buf_drain_shards (struct h4h_hlm_buf_private* p)
+{
+	uint64_t i;
+
+	for (i = 0; i < p->nr_shards; i++) {
+		while (atomic64_read (&p->shards[i].nr_pending) > 0)
+			h4h_thread_yield ();
+	}
+}
+
+/* a trim is sent here rather than through a shard: destage writes skip the
+ * shards, so a queued trim could reach the ftl after a write that came after
+ * it and destroy the data. it is ordered after the reqs in the shards and the
+ * destage batches before it, and the ones after it wait for destage_lock */
+static uint32_t __hlm_buf_cache_trim (
+	h4h_drv_info_t* bdi, 
+	h4h_hlm_req_t* hr)
+{
+	struct h4h_hlm_buf_private* p = (struct h4h_hlm_buf_private*)H4H_HLM_PRIV(bdi);
+	struct h4h_hlm_buf_cache* c = p->c;
+	struct h4h_hlm_buf_page* pg = NULL;
+	struct h4h_hlm_buf_page* tmp = NULL;
+	uint32_t ret;
+
+	h4h_spin_lock (&c->lock);
+	HASH_ITER (hh, c->pages, pg, tmp) {
+		if (pg->lpa >= hr->lpa && pg->lpa < hr->lpa + hr->len)
+			__hlm_buf_cache_drop (c, pg);
+	}
+	h4h_spin_unlock (&c->lock);
+
+	__hlm_buf_drain_shards (p);
+
+	h4h_mutex_lock (&c->destage_lock);
+	ret = __hlm_buf_dispatch (bdi, hr);
+	h4h_mutex_unlock (&c->destage_lock);
+
+	return ret;
+}
+
+static uint32_t __hlm_buf_cache_create (h4h_drv_info_t* bdi)
+{
+	struct h4h_hlm_buf_private* p = (struct h4h_hlm_buf_private*)H4H_HLM_PRIV(bdi);
+	h4h_device_params_t* np = H4H_GET_DEVICE_PARAMS (bdi);
+	struct h4h_hlm_buf_cache* c = NULL;
+
+	if (_param_hlm_buf_cache_pgs <= 0)
+		return 0;
+
+	/* a cached page must be mapped by a single lpa */
+	if (np->nr_subpages_per_page != 1 || np->page_main_size != KPAGE_SIZE) {
+		h4h_warning ("the write-back cache needs 4KB mapping units; it is disabled");
+		return 0;
+	}
+
+	if ((c = (struct h4h_hlm_buf_cache*)h4h_zmalloc 
+			(sizeof (struct h4h_hlm_buf_cache))) == NULL) {
+		h4h_error ("h4h_zmalloc failed");
+		return 1;
+	}
+	h4h_spin_lock_init (&c->lock);
+	h4h_mutex_init (&c->destage_lock);
+	c->pages = NULL;
+	INIT_LIST_HEAD (&c->lru);
+	INIT_LIST_HEAD (&c->dirty_list);
+	c->max_pgs = _param_hlm_buf_cache_pgs;
+	c->destage_pgs = c->max_pgs * _param_hlm_buf_destage_pct / 100;
+	atomic64_set (&c->nr_wouts, 0);
+
+	if ((c->pool = h4h_hlm_reqs_pool_create (
+			np->page_main_size, np->page_main_size)) == NULL) {
+		h4h_error ("h4h_hlm_reqs_pool_create () failed");
+		h4h_free (c);
+		return 1;
+	}
+	p->c = c;
+
+	if ((c->destage_thread = h4h_thread_create (
+			__hlm_buf_destage_thread, bdi, "__hlm_buf_destage_thread")) == NULL) {
+		h4h_error ("kthread_create failed");
+		p->c = NULL;
+		h4h_hlm_reqs_pool_destroy (c->pool);
+		h4h_mutex_free (&c->destage_lock);
+		h4h_spin_lock_destory (&c->lock);
+		h4h_free (c);
+		return 1;
+	}
+	h4h_thread_run (c->destage_thread);
+
+	h4h_msg ("hlm_buf: cache = %llu pages, destage above %llu pages",
+		c->max_pgs, c->destage_pgs);
+
+	return 0;
+}
+
+static void __hlm_buf_cache_destroy (h4h_drv_info_t* bdi)
+{
+	struct h4h_hlm_buf_private* p = (struct h4h_hlm_buf_private*)H4H_HLM_PRIV(bdi);
+	struct h4h_hlm_buf_cache* c = p->c;
+	struct h4h_hlm_buf_page* pg = NULL;
+	struct h4h_hlm_buf_page* tmp = NULL;
+
+	if (c == NULL)
+		return;
+
+	__hlm_buf_cache_flush (bdi);
+	h4h_thread_stop (c->destage_thread);
+
+	h4h_msg ("hlm_buf: read hits = %llu, read misses = %llu, absorbed = %llu, destaged = %llu",
+		c->nr_read_hits, c->nr_read_misses, c->nr_absorbed, c->nr_destaged);
+
+	HASH_ITER (hh, c->pages, pg, tmp) {
+		__hlm_buf_cache_drop (c, pg);
+	}
+	h4h_hlm_reqs_pool_destroy (c->pool);
+	h4h_mutex_free (&c->destage_lock);
+	h4h_spin_lock_destory (&c->lock);
+	h4h_free (c);
+	p->c = NULL;
+}
+
+/* kernel thread for a shard */
+int __hlm_buf_thread (void* arg)
+{
+	struct h4h_hlm_buf_shard* s = (struct h4h_hlm_buf_shard*)arg;
+	h4h_drv_info_t* bdi = s->bdi;
+	h4h_hlm_req_t* r;
+
+	for (;;) {
+		if (h4h_queue_is_all_empty (s->q)) {
+			h4h_thread_schedule_setup (s->hlm_thread);
+			if (h4h_queue_is_all_empty (s->q)) {
+				/* ok... go to sleep */
+				if (h4h_thread_schedule_sleep (s->hlm_thread) == SIGKILL)
+					break;
+			} else {
+				/* there are items in Q; wake up */
+				h4h_thread_schedule_cancel (s->hlm_thread);
+			}
+		}
+
+		/* reqs in a shard are sent in order */
+		while (!h4h_queue_is_empty (s->q, 0)) {
+			if ((r = (h4h_hlm_req_t*)h4h_queue_dequeue (s->q, 0)) != NULL) {
+				/* its slot is free; a submitter sleeping for it can go */
+				if (s->qdepth > 0)
+					h4h_sema_unlock (&s->credits);
+				if (__hlm_buf_dispatch (bdi, r)) {
 					/* if it failed, we directly call 'ptr_host_inf->end_req' */
 					bdi->ptr_host_inf->end_req (bdi, r);
 					h4h_warning ("oops! make_req failed");
 					/* [CAUTION] r is now NULL */
 				}
+				atomic64_dec (&s->nr_pending);
 			} else {
 				h4h_error ("r == NULL");
 				h4h_bug_on (1);
@@ -104,6 +625,7 @@ int __hlm_buf_thread (void* arg)
 uint32_t hlm_buf_create (h4h_drv_info_t* bdi)
 {
 	struct h4h_hlm_buf_private* p;
+	uint64_t i, nr_queues = 0, nr_threads = 0;
 
 	/* create private */
 	if ((p = (struct h4h_hlm_buf_private*)h4h_malloc_atomic
@@ -115,73 +637,185 @@ uint32_t hlm_buf_create (h4h_drv_info_t* bdi)
 	/* setup FTL function pointers */
 	if ((p->ptr_ftl_inf = H4H_GET_FTL_INF (bdi)) == NULL) {
 		h4h_error ("ftl is not valid");
-		return 1;
+		goto fail_private;
 	}
 
-	/* create a single queue */
-	if ((p->q = h4h_queue_create (1, INFINITE_QUEUE)) == NULL) {
-		h4h_error ("h4h_queue_create failed");
-		return -1;
+	/* create queue shards */
+	p->nr_shards = (_param_hlm_buf_nr_shards > 0) ? _param_hlm_buf_nr_shards : 1;
+	if ((p->shards = (struct h4h_hlm_buf_shard*)h4h_zmalloc 
+			(sizeof (struct h4h_hlm_buf_shard) * p->nr_shards)) == NULL) {
+		h4h_error ("h4h_zmalloc failed");
+		goto fail_private;
+	}
+	h4h_rwlock_init (&p->ftl_lock);
+	p->c = NULL;
+
+	for (i = 0; i < p->nr_shards; i++) {
+		struct h4h_hlm_buf_shard* s = &p->shards[i];
+
+		s->bdi = bdi;
+		atomic64_set (&s->nr_pending, 0);
+		s->qdepth = (_param_hlm_buf_qdepth > 0) ? _param_hlm_buf_qdepth : 0;
+		if ((s->q = h4h_queue_create (1, 
+				(s->qdepth > 0) ? s->qdepth : INFINITE_QUEUE)) == NULL) {
+			h4h_error ("h4h_queue_create failed");
+			goto fail_queues;
+		}
+		if (s->qdepth > 0)
+			h4h_sema_init_count (&s->credits, s->qdepth);
+		nr_queues++;
 	}
 
 	/* keep the private structure */
 	bdi->ptr_hlm_inf->ptr_private = (void*)p;
 
-	/* create & run a thread */
-	if ((p->hlm_thread = h4h_thread_create (
-			__hlm_buf_thread, bdi, "__hlm_buf_thread")) == NULL) {
-		h4h_error ("kthread_create failed");
-		return -1;
+	/* create & run threads */
+	for (i = 0; i < p->nr_shards; i++) {
+		struct h4h_hlm_buf_shard* s = &p->shards[i];
+
+		if ((s->hlm_thread = h4h_thread_create (
+				__hlm_buf_thread, s, "__hlm_buf_thread")) == NULL) {
+			h4h_error ("kthread_create failed");
+			goto fail_threads;
+		}
+		h4h_thread_run (s->hlm_thread);
+		nr_threads++;
 	}
-	h4h_thread_run (p->hlm_thread);
+
+	h4h_msg ("hlm_buf: nr_shards = %llu, qdepth = %d", 
+		p->nr_shards, _param_hlm_buf_qdepth);
+
+	/* create the write-back cache */
+	if (__hlm_buf_cache_create (bdi) != 0)
+		goto fail_threads;
 
 	return 0;
+
+fail_threads:
+	for (i = 0; i < nr_threads; i++)
+		h4h_thread_stop (p->shards[i].hlm_thread);
+	bdi->ptr_hlm_inf->ptr_private = NULL;
+
+fail_queues:
+	for (i = 0; i < nr_queues; i++) {
+		h4h_queue_destroy (p->shards[i].q);
+		if (p->shards[i].qdepth > 0)
+			h4h_sema_free (&p->shards[i].credits);
+	}
+	h4h_rwlock_free (&p->ftl_lock);
+	h4h_free (p->shards);
+
+fail_private:
+	h4h_free_atomic (p);
+	return 1;
 }
 
 void hlm_buf_destroy (h4h_drv_info_t* bdi)
 {
 	struct h4h_hlm_buf_private* p = (struct h4h_hlm_buf_private*)bdi->ptr_hlm_inf->ptr_private;
+	uint64_t i;
 
-	/* wait until Q becomes empty */
-	while (!h4h_queue_is_all_empty (p->q)) {
-		h4h_msg ("hlm items = %llu", h4h_queue_get_nr_items (p->q));
-		h4h_thread_msleep (1);
-	}
+	/* write back dirty pages */
+	__hlm_buf_cache_destroy (bdi);
 
-	/* kill kthread */
-	h4h_thread_stop (p->hlm_thread);
+	for (i = 0; i < p->nr_shards; i++) {
+		struct h4h_hlm_buf_shard* s = &p->shards[i];
 
-	/* destroy queue */
-	h4h_queue_destroy (p->q);
+		/* wait until Q becomes empty */
+		while (atomic64_read (&s->nr_pending) > 0) {
+			h4h_msg ("hlm items = %llu", h4h_queue_get_nr_items (s->q));
+			h4h_thread_msleep (1);
+		}
+
+		/* kill kthread */
+		h4h_thread_stop (s->hlm_thread);
+
+		/* destroy queue */
+		h4h_queue_destroy (s->q);
+		if (s->qdepth > 0)
+			h4h_sema_free (&s->credits);
+	}
 
 	/* free priv */
+	h4h_rwlock_free (&p->ftl_lock);
+	h4h_free (p->shards);
 	h4h_free_atomic (p);
 }
 
+static int64_t __hlm_buf_get_shard (
+	struct h4h_hlm_buf_private* p,
+	h4h_hlm_req_t* r)
+{
+	uint64_t first, last;
+
+	if (h4h_is_flush (r->req_type)) {
+		/* it must come after everything queued so far */
+		return -1;
+	} else if (h4h_is_trim (r->req_type)) {
+		first = r->lpa;
+		last = (r->len > 0) ? r->lpa + r->len - 1 : r->lpa;
+	} else {
+		first = r->llm_reqs[0].logaddr.lpa[0];
+		last = r->llm_reqs[r->nr_llm_reqs-1].logaddr.lpa[0];
+	}
+
+	if (first / HLM_BUF_STRIPE_PGS != last / HLM_BUF_STRIPE_PGS)
+		return -1;
+
+	return (first / HLM_BUF_STRIPE_PGS) % p->nr_shards;
+}
+
 uint32_t hlm_buf_make_req (
 	h4h_drv_info_t* bdi, 
 	h4h_hlm_req_t* r)
 {
 	uint32_t ret;
 	struct h4h_hlm_buf_private* p = (struct h4h_hlm_buf_private*)H4H_HLM_PRIV(bdi);
+	h4h_blkio_req_t* br = (h4h_blkio_req_t*)r->blkio_req;
+	struct h4h_hlm_buf_shard* s = NULL;
+	int64_t shard;
+
+	/* go through the write-back cache first */
+	if (p->c) {
+		if (h4h_is_preflush (br->bi_rw) || h4h_is_flush (r->req_type)) {
+			__hlm_buf_cache_flush (bdi);
+		}
+		if (h4h_is_write (r->req_type)) {
+			return __hlm_buf_cache_write (bdi, r);
+		} else if (h4h_is_read (r->req_type)) {
+			if (__hlm_buf_cache_read (bdi, r) == 1) {
+				/* all hits; the device is not touched */
+				bdi->ptr_host_inf->end_req (bdi, r);
+				return 0;
+			}
+		} else if (h4h_is_trim (r->req_type)) {
+			return __hlm_buf_cache_trim (bdi, r);
+		}
+	}
 
-	if (h4h_queue_is_full (p->q)) {
-		/* FIXME: wait unti queue has a enough room */
-		h4h_error ("it should not be happened!");
-		h4h_bug_on (1);
-	} 
-
-	while (h4h_queue_get_nr_items (p->q) >= 256) {
-		h4h_thread_yield ();
+	if ((shard = __hlm_buf_get_shard (p, r)) < 0) {
+		/* it spans several shards; let the shards drain so that it is
+		 * ordered after every req queued before, and send it here */
+		__hlm_buf_drain_shards (p);
+		return __hlm_buf_dispatch (bdi, r);
 	}
+	s = &p->shards[shard];
+
+	/* sleep until the shard has a room */
+	if (s->qdepth > 0)
+		h4h_sema_lock (&s->credits);
 	
 	/* put a request into Q */
-	if ((ret = h4h_queue_enqueue (p->q, 0, (void*)r))) {
+	atomic64_inc (&s->nr_pending);
+	if ((ret = h4h_queue_enqueue (s->q, 0, (void*)r))) {
 		h4h_msg ("h4h_queue_enqueue failed");
+		atomic64_dec (&s->nr_pending);
+		if (s->qdepth > 0)
+			h4h_sema_unlock (&s->credits);
 	}
 
 	/* wake up thread if it sleeps */
-	h4h_thread_wakeup (p->hlm_thread);
+	h4h_thread_wakeup (s->hlm_thread);
 
 	return ret;
 }
@@ -190,6 +824,15 @@ void hlm_buf_end_req (
 	h4h_drv_info_t* bdi, 
 	h4h_llm_req_t* r)
 {
+	h4h_hlm_req_t* hr = (h4h_hlm_req_t*)r->ptr_hlm_req;
+
+	/* destage reqs are handled here; the others by hlm_nobuf */
+	if (!h4h_is_gc (r->req_type) && hr->blkio_req == NULL && h4h_is_write (hr->req_type)) {
+		r->req_type |= REQTYPE_DONE;
+		if (atomic64_dec_and_test (&hr->nr_llm_reqs_done))
+			__hlm_buf_destage_end (bdi, hr);
+		return;
+	}
+
 	hlm_nobuf_end_req (bdi, r);
 }
-
@@ -40,10 +40,13 @@ THE SOFTWARE.
 #include "hlm_nobuf.h"
 #include "hlm_dftl.h"
 #include "uthread.h"
+#include "umemory.h"
+#include "ftl_params.h"
 
 #include "algo/no_ftl.h"
 #include "algo/block_ftl.h"
 #include "algo/page_ftl.h"
+#include "algo/dftl_map.h"
 #include "queue/queue.h"
 
 
@@ -59,6 +62,17 @@ h4h_hlm_inf_t _hlm_dftl_inf = {
 };
 
 /* data structures for hlm_dftl */
+#define DFTL_MAX_STREAMS	8
+#define DFTL_MAX_PREFETCH	64
+
+typedef struct {
+	uint64_t last_lpa;	/* lpa of the last request of the stream */
+	uint64_t last_len;
+	int64_t stride;		/* distance (in pages) between two requests */
+	uint32_t hits;		/* # of requests that followed the stride */
+	uint64_t last_use;	/* 0: not used yet */
+} h4h_dftl_stream_t;
+
 typedef struct {
 	h4h_ftl_inf_t* ftl;	/* for hlm_nobuff (it must be on top of this structure) */
 
@@ -68,6 +82,14 @@ typedef struct {
 	h4h_thread_t* hlm_thread;
 	h4h_sema_t ftl_lock;
 #endif
+
+	/* for stream detection & prefetch of directory slots */
+	uint64_t nr_entries_per_dir;
+	uint64_t nr_total_dirs;
+	uint64_t stream_clock;
+	h4h_dftl_stream_t streams[DFTL_MAX_STREAMS];
+	uint32_t nr_prefetch;
+	h4h_llm_req_t* prefetch[DFTL_MAX_PREFETCH];
 } h4h_hlm_dftl_private_t;
 
 #ifdef USE_THREAD
@@ -103,18 +125,237 @@ int __hlm_dftl_thread (void* arg)
 }
 #endif
 
+/* the lpas of a hlm_req; a rw req keeps them in its llm_reqs, which cover
+ * consecutive lpas */
+static void __hlm_dftl_get_range (
+	h4h_hlm_req_t* r, 
+	uint64_t* lpa, 
+	uint64_t* len)
+{
+	if (h4h_is_trim (r->req_type)) {
+		*lpa = r->lpa;
+		*len = r->len;
+	} else if (r->nr_llm_reqs > 0) {
+		*lpa = r->llm_reqs[0].logaddr.lpa[0];
+		*len = r->nr_llm_reqs;
+	} else {
+		*lpa = 0;
+		*len = 0;
+	}
+}
+
+/* find a stream that [lpa, lpa+len) belongs to; if there is none, it starts
+ * a new stream by replacing the least recently used one */
+static h4h_dftl_stream_t* __hlm_dftl_detect_stream (
+	h4h_hlm_dftl_private_t* p, 
+	uint64_t lpa,
+	uint64_t len)
+{
+	h4h_dftl_stream_t* s = NULL;
+	h4h_dftl_stream_t* victim = &p->streams[0];
+	int64_t max_stride = _param_dftl_stream_max_stride;
+	int64_t delta;
+	int i;
+
+	p->stream_clock++;
+
+	/* see if r follows one of the known streams */
+	for (i = 0; i < DFTL_MAX_STREAMS; i++) {
+		s = &p->streams[i];
+		if (s->last_use == 0)
+			continue;
+		if (lpa == s->last_lpa + s->last_len) {
+			/* sequential */
+			s->stride = s->last_len;
+			goto hit;
+		}
+		if (lpa + len == s->last_lpa) {
+			/* sequential (backward) */
+			s->stride = -(int64_t)len;
+			goto hit;
+		}
+		if (s->stride != 0 && lpa == s->last_lpa + s->stride) {
+			/* strided */
+			goto hit;
+		}
+	}
+
+	/* see if r builds up a strided stream with a recent request */
+	for (i = 0; i < DFTL_MAX_STREAMS; i++) {
+		s = &p->streams[i];
+		if (s->last_use != 0 && s->hits == 0) {
+			delta = (int64_t)(lpa - s->last_lpa);
+			if (delta != 0 && delta >= -max_stride && delta <= max_stride) {
+				s->stride = delta;
+				goto hit;
+			}
+		}
+		if (s->last_use < victim->last_use)
+			victim = s;
+	}
+
+	/* start a new stream */
+	victim->last_lpa = lpa;
+	victim->last_len = len;
+	victim->stride = 0;
+	victim->hits = 0;
+	victim->last_use = p->stream_clock;
+	return victim;
+
+hit:
+	s->hits++;
+	s->last_lpa = lpa;
+	s->last_len = len;
+	s->last_use = p->stream_clock;
+	return s;
+}
+
+/* evict mapping entries if there is not enough DRAM space */
+static void __hlm_dftl_evict_mapblks (h4h_drv_info_t* bdi, uint64_t nr_dirs)
+{
+	h4h_hlm_dftl_private_t* p = (h4h_hlm_dftl_private_t*)H4H_HLM_PRIV(bdi);
+	h4h_llm_req_t** rr = NULL;
+	uint64_t i;
+
+	if (nr_dirs == 0)
+		return;
+
+	rr = (h4h_llm_req_t**)h4h_malloc (sizeof (h4h_llm_req_t*) * nr_dirs);
+	h4h_memset (rr, 0x00, sizeof (h4h_llm_req_t*) * nr_dirs);
+	for (i = 0; i < nr_dirs; i++) {
+		directory_slot_t* ds;
+
+		/* drop mapping enries to Flash */
+		if ((rr[i] = p->ftl->prepare_mapblk_eviction (bdi)) == NULL)
+			break;
+
+		/* send a req to llm */
+		ds = (directory_slot_t*)rr[i]->ptr_hlm_req;
+		if (ds->status != DFTL_DIR_CLEAN) {
+			h4h_sema_lock (rr[i]->done);
+			bdi->ptr_llm_inf->make_req (bdi, rr[i]);
+		}
+	}
+
+	for (i = 0; i < nr_dirs; i++) {
+		if (rr[i]) {
+			h4h_sema_lock (rr[i]->done);
+			p->ftl->finish_mapblk_eviction (bdi, rr[i]);
+		}
+	}
+
+	h4h_free (rr);
+}
+
+/* finish prefetch requests that have been completed. If 'wait_all' is set,
+ * or a prefetch request is loading 'dir', it waits for its completion */
+static void __hlm_dftl_reap_prefetch (
+	h4h_drv_info_t* bdi, 
+	uint64_t dir, 
+	uint8_t wait_all)
+{
+	h4h_hlm_dftl_private_t* p = (h4h_hlm_dftl_private_t*)H4H_HLM_PRIV(bdi);
+	h4h_llm_req_t* rr = NULL;
+	uint64_t nr_reaped = 0;
+	uint32_t i = 0;
+
+	while (i < p->nr_prefetch) {
+		rr = p->prefetch[i];
+		if (wait_all || ((directory_slot_t*)rr->ptr_hlm_req)->id == dir) {
+			h4h_sema_lock (rr->done);
+		} else if (h4h_sema_try_lock (rr->done) == 0) {
+			/* it is still under load */
+			i++;
+			continue;
+		}
+		p->ftl->finish_mapblk_load (bdi, rr);
+		p->prefetch[i] = p->prefetch[--p->nr_prefetch];
+		nr_reaped++;
+	}
+
+	__hlm_dftl_evict_mapblks (bdi, nr_reaped);
+}
+
+/* asynchronously load the directory slots that the stream is likely to 
+ * access next. They are finished by __hlm_dftl_reap_prefetch later */
+static void __hlm_dftl_prefetch (
+	h4h_drv_info_t* bdi, 
+	h4h_dftl_stream_t* s)
+{
+	h4h_hlm_dftl_private_t* p = (h4h_hlm_dftl_private_t*)H4H_HLM_PRIV(bdi);
+	h4h_llm_req_t* rr = NULL;
+	int64_t n = p->nr_entries_per_dir;
+	int64_t cur, dir, k;
+	uint64_t nr_created = 0;
+
+	if (_param_dftl_prefetch_depth <= 0 || 
+		s->hits < _param_dftl_prefetch_trigger)
+		return;
+
+	if (s->stride > 0)
+		cur = (s->last_lpa + s->last_len - 1) / n;
+	else
+		cur = s->last_lpa / n;
+
+	for (k = 1; k <= _param_dftl_prefetch_depth; k++) {
+		if (p->nr_prefetch >= DFTL_MAX_PREFETCH)
+			break;
+
+		if (s->stride > -n && s->stride < n) {
+			/* dense stream: the next dir slots in a row */
+			dir = (s->stride > 0) ? cur + k : cur - k;
+		} else {
+			/* sparse stream: the dir slots of the next strides */
+			dir = ((int64_t)s->last_lpa + s->stride * k) / n;
+			if ((int64_t)s->last_lpa + s->stride * k < 0)
+				break;
+		}
+		if (dir < 0 || (uint64_t)dir >= p->nr_total_dirs)
+			break;
+
+		/* skip the dir slots kept in DRAM or being loaded */
+		if (p->ftl->check_mapblk (bdi, dir * n) == 0)
+			continue;
+		if ((rr = p->ftl->prepare_mapblk_load (bdi, dir * n)) == NULL) {
+			/* a dir slot never written before is created in DRAM at once */
+			if (p->ftl->check_mapblk (bdi, dir * n) == 0)
+				nr_created++;
+			continue;
+		}
+
+		/* send a read request to llm, but do not wait for it */
+		h4h_sema_lock (rr->done);
+		bdi->ptr_llm_inf->make_req (bdi, rr);
+		p->prefetch[p->nr_prefetch++] = rr;
+	}
+
+	__hlm_dftl_evict_mapblks (bdi, nr_created);
+}
+
+static void __hlm_dftl_do_gc (h4h_drv_info_t* bdi)
+{
+	h4h_hlm_dftl_private_t* p = (h4h_hlm_dftl_private_t*)H4H_HLM_PRIV(bdi);
+
+	/* GC relocates mapblks, so prefetch requests must be finished first */
+	__hlm_dftl_reap_prefetch (bdi, -1ULL, 1);
+	p->ftl->do_gc (bdi, 0);
+}
+
 int __fetch_me_and_make_req (h4h_drv_info_t* bdi, h4h_hlm_req_t* r)
 {
 	h4h_hlm_dftl_private_t* p = (h4h_hlm_dftl_private_t*)H4H_HLM_PRIV(bdi);
+	uint64_t lpa, len;
 	int i = 0, nr_missed_dir = 0;
 
+	__hlm_dftl_get_range (r, &lpa, &len);
+
 	/* see if foreground GC is needed or not */
 	for (i = 0; i < 10; i++) {
 		if ((r->req_type == REQTYPE_WRITE || r->req_type == REQTYPE_READ) &&
 			 p->ftl->is_gc_needed != NULL && 
-			 p->ftl->is_gc_needed (bdi)) {
+			 p->ftl->is_gc_needed (bdi, 0)) {
 			/* perform GC before sending requests */ 
-			p->ftl->do_gc (bdi);
+			__hlm_dftl_do_gc (bdi);
 		} else
 			break;
 	}
@@ -123,19 +364,22 @@ int __fetch_me_and_make_req (h4h_drv_info_t* bdi, h4h_hlm_req_t* r)
 	}
 
 	/* STEP1: read missing mapping entries */
-	nr_missed_dir = r->len;
+	nr_missed_dir = len;
 	{
 		h4h_llm_req_t** rr = (h4h_llm_req_t**)h4h_malloc (sizeof (h4h_llm_req_t*) * nr_missed_dir);
 
 		/* FIXME: need to improve to exploit parallelism */
-		memset (rr, 0x00, sizeof (h4h_llm_req_t*) * nr_missed_dir);
+		h4h_memset (rr, 0x00, sizeof (h4h_llm_req_t*) * nr_missed_dir);
 		for (i = 0; i < nr_missed_dir; i++) {
+			/* wait for the entries if they are being prefetched */
+			__hlm_dftl_reap_prefetch (bdi, (lpa + i) / p->nr_entries_per_dir, 0);
+
 			/* check the availability of mapping entries again */
-			if (p->ftl->check_mapblk (bdi, r->lpa + i) == 0)
+			if (p->ftl->check_mapblk (bdi, lpa + i) == 0)
 				continue;
 
 			/* fetch mapping entries to DRAM from Flash */
-			if ((rr[i] = p->ftl->prepare_mapblk_load (bdi, r->lpa + i)) == NULL)
+			if ((rr[i] = p->ftl->prepare_mapblk_load (bdi, lpa + i)) == NULL)
 				continue;
 
 			/* send read requets to llm */
@@ -160,35 +404,7 @@ int __fetch_me_and_make_req (h4h_drv_info_t* bdi, h4h_hlm_req_t* r)
 	}
 
 	/* STEP4: evict mapping entries if there is not enough DRAM space */
-	{
-		h4h_llm_req_t** rr = (h4h_llm_req_t**)h4h_malloc (sizeof (h4h_llm_req_t*) * nr_missed_dir);
-
-		memset (rr, 0x00, sizeof (h4h_llm_req_t*) * nr_missed_dir);
-		for (i = 0; i < nr_missed_dir; i++) {
-#include "algo/dftl_map.h"
-			directory_slot_t* ds;
-
-			/* drop mapping enries to Flash */
-			if ((rr[i] = p->ftl->prepare_mapblk_eviction (bdi)) == NULL)
-				break;
-
-			/* send a req to llm */
-			ds = (directory_slot_t*)rr[i]->ds;
-			if (ds->status != DFTL_DIR_CLEAN) {
-				h4h_sema_lock (rr[i]->done);
-				bdi->ptr_llm_inf->make_req (bdi, rr[i]);
-			}
-		}
-
-		for (i = 0; i < nr_missed_dir; i++) {
-			if (rr[i]) {
-				h4h_sema_lock (rr[i]->done);
-				p->ftl->finish_mapblk_eviction (bdi, rr[i]);
-			}
-		}
-
-		h4h_free (rr);
-	}
+	__hlm_dftl_evict_mapblks (bdi, nr_missed_dir);
 
 	return 0;
 }
@@ -196,6 +412,7 @@ int __fetch_me_and_make_req (h4h_drv_info_t* bdi, h4h_hlm_req_t* r)
 /* interface functions for hlm_dftl */
 uint32_t hlm_dftl_create (h4h_drv_info_t* bdi)
 {
+	h4h_device_params_t* np = H4H_GET_DEVICE_PARAMS (bdi);
 	h4h_hlm_dftl_private_t* p;
 
 	/* create private */
@@ -211,6 +428,13 @@ uint32_t hlm_dftl_create (h4h_drv_info_t* bdi)
 		return 1;
 	}
 
+	/* setup stream detection */
+	p->nr_entries_per_dir = np->page_main_size / sizeof (dftl_packed_me_t);
+	p->nr_total_dirs = np->nr_pages_per_ssd / p->nr_entries_per_dir;
+	p->stream_clock = 0;
+	p->nr_prefetch = 0;
+	h4h_memset (p->streams, 0x00, sizeof (h4h_dftl_stream_t) * DFTL_MAX_STREAMS);
+
 	/* create a single queue */
 	if ((p->q = h4h_queue_create (1, INFINITE_QUEUE)) == NULL) {
 		h4h_error ("h4h_queue_create failed");
@@ -245,6 +469,9 @@ void hlm_dftl_destroy (h4h_drv_info_t* bdi)
 		h4h_thread_msleep (1);
 	}
 
+	/* wait until prefetch requests are finished */
+	__hlm_dftl_reap_prefetch (bdi, -1ULL, 1);
+
 #ifdef USE_THREAD
 	h4h_sema_free (&p->ftl_lock);
 
@@ -266,6 +493,8 @@ uint32_t hlm_dftl_make_req (
 	uint32_t ret, i, loop;
 	uint32_t avail = 0;
 	h4h_hlm_dftl_private_t* p = (h4h_hlm_dftl_private_t*)H4H_HLM_PRIV(bdi);
+	h4h_dftl_stream_t* s = NULL;
+	uint64_t lpa, len;
 
 	/*h4h_stopwatch_t sw;*/
 	/*h4h_stopwatch_start (&sw);*/
@@ -276,7 +505,8 @@ uint32_t hlm_dftl_make_req (
 		h4h_bug_on (1);
 	} 
 
-	/*h4h_msg ("%llu %llu", r->lpa, r->len);*/
+	__hlm_dftl_get_range (r, &lpa, &len);
+	/*h4h_msg ("%llu %llu", lpa, len);*/
 
 	/* see if mapping entries for hlm_req are available */
 #ifdef USE_THREAD
@@ -287,21 +517,25 @@ uint32_t hlm_dftl_make_req (
 	for (loop = 0; loop < 10; loop++) {
 		if ((r->req_type == REQTYPE_WRITE || r->req_type == REQTYPE_READ) &&
 			 p->ftl->is_gc_needed != NULL && 
-			 p->ftl->is_gc_needed (bdi)) {
-			p->ftl->do_gc (bdi);
+			 p->ftl->is_gc_needed (bdi, 0)) {
+			__hlm_dftl_do_gc (bdi);
 		} else
 			break;
 	}
 
+	/* finish prefetch requests that have been completed */
+	__hlm_dftl_reap_prefetch (bdi, -1ULL, 0);
+
 	/* see if there are missing entries */
 	if (r->req_type == REQTYPE_WRITE ||
 		r->req_type == REQTYPE_READ) {
-		for (i = 0; i < r->len; i++) {
-			if ((avail = p->ftl->check_mapblk (bdi, r->lpa + i)) == 1)
+		s = __hlm_dftl_detect_stream (p, lpa, len);
+		for (i = 0; i < len; i++) {
+			if ((avail = p->ftl->check_mapblk (bdi, lpa + i)) == 1)
 				break;
 		}
-	} else if (r->req_type == REQTYPE_TRIM) {
-		/* don't fetch mapping entries for TRIM */
+	} else if (r->req_type == REQTYPE_TRIM || r->req_type == REQTYPE_FLUSH) {
+		/* don't fetch mapping entries for TRIM and FLUSH */
 	} else {
 		h4h_msg ("oops! invalid req_type (%d)", r->req_type);
 		h4h_bug_on (1);
@@ -330,6 +564,11 @@ uint32_t hlm_dftl_make_req (
 		ret = __fetch_me_and_make_req (bdi, r);
 	}
 
+	/* prefetch the dir slots that the stream will access next
+	 * [CAUTION] r may be already freed, so do not touch r */
+	if (s != NULL)
+		__hlm_dftl_prefetch (bdi, s);
+
 #ifdef USE_THREAD
 	h4h_sema_unlock (&p->ftl_lock);
 
@@ -347,8 +586,8 @@ void hlm_dftl_end_req (
 	h4h_drv_info_t* bdi, 
 	h4h_llm_req_t* r)
 {
-	if (r->done && r->ds) {
-		/* FIXME: r->done is set to not NULL for mapblk */
+	if (h4h_is_meta (r->req_type)) {
+		/* a mapblk is waited for by whoever has sent it */
 		h4h_sema_unlock (r->done);
 		return;
 	}
@@ -39,6 +39,8 @@ THE SOFTWARE.
 #include "h4h_drv.h"
 #include "hlm_nobuf.h"
 #include "hlm_reqs_pool.h"
+#include "hlm_rcache.h"
+#include "hlm_rahead.h"
 #include "utime.h"
 #include "umemory.h"
 
@@ -95,6 +97,11 @@ uint32_t __hlm_nobuf_make_trim_req (h4h_drv_info_t* bdi, h4h_hlm_req_t* ptr_hlm_
 	h4h_ftl_inf_t* ftl = (h4h_ftl_inf_t*)H4H_GET_FTL_INF(bdi);
 	uint64_t i;
 
+	if (bdi->ptr_rcache)
+		h4h_hlm_rcache_invalidate (bdi->ptr_rcache, ptr_hlm_req->lpa, ptr_hlm_req->len);
+	if (bdi->ptr_rahead)
+		h4h_hlm_rahead_invalidate (bdi->ptr_rahead, ptr_hlm_req->lpa, ptr_hlm_req->len);
+
 	for (i = 0; i < ptr_hlm_req->len; i++) {
 		ftl->invalidate_lpa (bdi, ptr_hlm_req->lpa + i, 1);
 	}
@@ -106,8 +113,14 @@ uint32_t __hlm_nobuf_make_rw_req (h4h_drv_info_t* bdi, h4h_hlm_req_t* hr)
 {
 	h4h_device_params_t* np = H4H_GET_DEVICE_PARAMS(bdi);
 	h4h_ftl_inf_t* ftl = H4H_GET_FTL_INF(bdi);
+	h4h_hlm_rcache_t* rc = (h4h_hlm_rcache_t*)bdi->ptr_rcache;
+	h4h_hlm_rahead_t* ra = (h4h_hlm_rahead_t*)bdi->ptr_rahead;
 	h4h_llm_req_t* lr = NULL;
 	uint64_t i = 0, j = 0, sp_ofs;
+	uint64_t nr_dummies = 0, nr_hits = 0, nr_ra_hits = 0;
+	uint8_t use_rc = 0, use_ra = 0;
+	int64_t ra_lpa = 0;
+	uint64_t ra_len = 0;
 
 //	h4h_phyaddr_t start_ppa;
 //	h4h_phyaddr_t* phyaddrs = NULL;
@@ -140,20 +153,53 @@ uint32_t __hlm_nobuf_make_rw_req (h4h_drv_info_t* bdi, h4h_hlm_req_t* hr)
 //		}
 //	}
 
+	/* reads are filled into the read cache when they complete */
+	if (h4h_is_read (hr->req_type) && !h4h_hlm_rcache_bypass (bdi, hr)) {
+		hr->rc_seq = h4h_hlm_rcache_get_seq (rc);
+		use_rc = 1;
+	}
+	if (ra && h4h_is_read (hr->req_type) && hr->blkio_req != NULL && hr->nr_llm_reqs > 0) {
+		ra_lpa = hr->llm_reqs[0].logaddr.lpa[0];
+		ra_len = hr->nr_llm_reqs;
+		use_ra = 1;
+	}
+
 	/* perform mapping with the FTL */
 	h4h_hlm_for_each_llm_req (lr, hr, i) {
 		/* (1) get the physical locations through the FTL */
 		if (h4h_is_normal (lr->req_type)) {
 			/* handling normal I/O operations */
-			if (h4h_is_read (lr->req_type)) {
-				if (ftl->get_ppa (bdi, lr->logaddr.lpa[0], &lr->phyaddr, &sp_ofs) != 0) {
+			if (lr->req_type == REQTYPE_READ_DUMMY) {
+				/* it was already served by an upper layer (e.g., hlm_rsd) */
+				nr_dummies++;
+			} else if (h4h_is_read (lr->req_type)) {
+				if (use_rc && h4h_hlm_rcache_get (rc, 
+						lr->logaddr.lpa[0], lr->fmain.kp_ptr[lr->logaddr.ofs])) {
+					/* served by the read cache */
+					h4h_memset (&lr->phyaddr, 0x00, sizeof (h4h_phyaddr_t));
+					lr->req_type = REQTYPE_READ_DUMMY;
+					nr_dummies++;
+					nr_hits++;
+				} else if (use_ra && h4h_hlm_rahead_get (ra, 
+						lr->logaddr.lpa[0], lr->fmain.kp_ptr[lr->logaddr.ofs])) {
+					/* served by read-ahead */
+					h4h_memset (&lr->phyaddr, 0x00, sizeof (h4h_phyaddr_t));
+					lr->req_type = REQTYPE_READ_DUMMY;
+					nr_dummies++;
+					nr_ra_hits++;
+				} else if (ftl->get_ppa (bdi, lr->logaddr.lpa[0], &lr->phyaddr, &sp_ofs) != 0) {
 					/* Note that there could be dummy reads (e.g., when the
 					 * file-systems are initialized) */
 					lr->req_type = REQTYPE_READ_DUMMY;
+					nr_dummies++;
 				} else {
 					hlm_reqs_pool_relocate_kp (lr, sp_ofs);
 				}
 			} else if (h4h_is_write (lr->req_type)) {
+				if (rc)
+					h4h_hlm_rcache_invalidate (rc, lr->logaddr.lpa[0], 1);
+				if (ra)
+					h4h_hlm_rahead_invalidate (ra, lr->logaddr.lpa[0], 1);
 				/*
 				if (ftl->get_free_ppa (bdi, lr->logaddr.lpa[0], &lr->phyaddr) != 0) {
 					h4h_error ("`ftl->get_free_ppa' failed");
@@ -166,7 +212,17 @@ uint32_t __hlm_nobuf_make_rw_req (h4h_drv_info_t* bdi, h4h_hlm_req_t* hr)
 //					h4h_error ("`ftl->map_lpa_to_ppa' failed");
 //					goto fail;
 //				}
-				if (ftl->get_ppa (bdi, lr->logaddr.lpa[0], &lr->phyaddr, &sp_ofs) != 0) {
+				if (ftl->get_free_ppas == NULL) {
+					/* FTLs that are not pre-mapped by LBL allocate pages on writes */
+					if (ftl->get_free_ppa (bdi, lr->logaddr.lpa[0], &lr->phyaddr) != 0) {
+						h4h_error ("`ftl->get_free_ppa' failed");
+						goto fail;
+					}
+					if (ftl->map_lpa_to_ppa (bdi, &lr->logaddr, &lr->phyaddr) != 0) {
+						h4h_error ("`ftl->map_lpa_to_ppa' failed");
+						goto fail;
+					}
+				} else if (ftl->get_ppa (bdi, lr->logaddr.lpa[0], &lr->phyaddr, &sp_ofs) != 0) {
 					h4h_error ("'ftl->get_ppa' failed: invalid write");
 					goto fail;
 				}
@@ -177,6 +233,11 @@ uint32_t __hlm_nobuf_make_rw_req (h4h_drv_info_t* bdi, h4h_hlm_req_t* hr)
 		} else if (h4h_is_rmw (lr->req_type)) {
 			h4h_phyaddr_t* phyaddr = &lr->phyaddr_src;
 
+			if (rc)
+				h4h_hlm_rcache_invalidate (rc, lr->logaddr.lpa[0], 1);
+			if (ra)
+				h4h_hlm_rahead_invalidate (ra, lr->logaddr.lpa[0], 1);
+
 			/* finding the location of the previous data */ 
 			if (ftl->get_ppa (bdi, lr->logaddr.lpa[0], phyaddr, &sp_ofs) != 0) {
 				/* if it was not written before, change it to a write request */
@@ -207,11 +268,25 @@ uint32_t __hlm_nobuf_make_rw_req (h4h_drv_info_t* bdi, h4h_hlm_req_t* hr)
 		}
 	}
 
-	/* (3) send llm_req to llm */
+	/* (3) all the pages were in the read cache or staged by read-ahead;
+	 * the device is not touched */
+	if (nr_hits + nr_ra_hits > 0 && nr_dummies == hr->nr_llm_reqs) {
+		bdi->ptr_host_inf->end_req (bdi, hr);
+		/* hr is now NULL */
+		if (use_ra)
+			h4h_hlm_rahead_update (bdi, ra_lpa, ra_len, nr_ra_hits);
+		return 0;
+	}
+
+	/* (4) send llm_req to llm; hr can be done and recycled as soon as its
+	 * last llm_req is sent, so it is not touched afterwards */
 	if (bdi->ptr_llm_inf->make_reqs == NULL) {
 		/* send individual llm-reqs to llm */
-		h4h_hlm_for_each_llm_req (lr, hr, i) {
-			if (bdi->ptr_llm_inf->make_req (bdi, lr) != 0) {
+		h4h_llm_req_t* lrs = hr->llm_reqs;
+		uint64_t nr_llm_reqs = hr->nr_llm_reqs;
+
+		for (i = 0; i < nr_llm_reqs; i++) {
+			if (bdi->ptr_llm_inf->make_req (bdi, &lrs[i]) != 0) {
 				h4h_error ("oops! make_req () failed");
 				h4h_bug_on (1);
 			}
@@ -224,7 +299,9 @@ uint32_t __hlm_nobuf_make_rw_req (h4h_drv_info_t* bdi, h4h_hlm_req_t* hr)
 		}
 	}
 
-	h4h_bug_on (hr->nr_llm_reqs != i);
+	/* (5) look ahead after the host read went out (hr may be gone now) */
+	if (use_ra)
+		h4h_hlm_rahead_update (bdi, ra_lpa, ra_len, nr_ra_hits);
 
 //	if (phyaddrs != NULL)
 //		h4h_free (phyaddrs);
@@ -255,7 +332,8 @@ void __hlm_nobuf_check_ondemand_gc (h4h_drv_info_t* bdi, h4h_hlm_req_t* hr)
 				break;
 		}
 	} else if (dp->mapping_type == MAPPING_POLICY_RSD ||
-			   dp->mapping_type == MAPPING_POLICY_BLOCK) {
+			   dp->mapping_type == MAPPING_POLICY_BLOCK ||
+			   dp->mapping_type == MAPPING_POLICY_HYBRID) {
 		/* perform mapping with the FTL */
 		if (hr->req_type == REQTYPE_WRITE && ftl->is_gc_needed != NULL) {
 			h4h_llm_req_t* lr = NULL;
@@ -308,6 +386,10 @@ uint32_t hlm_nobuf_make_req (h4h_drv_info_t* bdi, h4h_hlm_req_t* hr)
 			bdi->ptr_host_inf->end_req (bdi, hr);
 			/* hr is now NULL */
 		}
+	} else if (h4h_is_flush (hr->req_type)) {
+		/* nothing is buffered; acked writes are already in the llm */
+		bdi->ptr_host_inf->end_req (bdi, hr);
+		ret = 0;
 	} else {
 		/* do we need to do garbage collection? */
 		__hlm_nobuf_check_ondemand_gc (bdi, hr);
@@ -322,6 +404,12 @@ void __hlm_nobuf_end_blkio_req (h4h_drv_info_t* bdi, h4h_llm_req_t* lr)
 {
 	h4h_hlm_req_t* hr = (h4h_hlm_req_t* )lr->ptr_hlm_req;
 
+	/* keep the data read from the device */
+	if (lr->req_type == REQTYPE_READ && !h4h_hlm_rcache_bypass (bdi, hr)) {
+		h4h_hlm_rcache_put ((h4h_hlm_rcache_t*)bdi->ptr_rcache, 
+			lr->logaddr.lpa[0], lr->fmain.kp_ptr[0], hr->rc_seq);
+	}
+
 	/* increase # of reqs finished */
 	atomic64_inc (&hr->nr_llm_reqs_done);
 	lr->req_type |= REQTYPE_DONE;
@@ -348,6 +436,8 @@ void hlm_nobuf_end_req (h4h_drv_info_t* bdi, h4h_llm_req_t* lr)
 {
 	if (h4h_is_gc (lr->req_type)) {
 		__hlm_nobuf_end_gcio_req (bdi, lr);
+	} else if (h4h_hlm_rahead_end_req (bdi, lr)) {
+		/* it was read-ahead */
 	} else {
 		__hlm_nobuf_end_blkio_req (bdi, lr);
 	}
@@ -0,0 +1,472 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014-2015 CSAIL, MIT
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+/*
+ * hlm_rahead detects sequential host reads per stream and reads the next
+ * window of pages into a staging buffer before the host asks for them.
+ * A stream becomes active after a few back-to-back reads; its window is
+ * doubled whenever a host read is fully served from the staging buffer
+ * and halved whenever staged pages are evicted without being read.
+ */
+
+#if defined(KERNEL_MODE)
+#include <linux/module.h>
+#include <linux/blkdev.h>
+
+#elif defined(USER_MODE)
+#include <stdio.h>
+#include <stdint.h>
+
+#else
+#error Invalid Platform (KERNEL_MODE or USER_MODE)
+#endif
+
+#include "debug.h"
+#include "params.h"
+#include "h4h_drv.h"
+#include "hlm_rahead.h"
+#include "hlm_reqs_pool.h"
+#include "ftl_params.h"
+#include "umemory.h"
+#include "uthread.h"
+#include "uthash.h"
+
+#define RAHEAD_NR_STREAMS	8
+
+typedef struct {
+	int64_t lpa;
+	uint8_t* data;
+	uint8_t ready;			/* 0: it is being read from the device */
+	int32_t stream;
+	struct list_head list;	/* the head is the oldest */
+	UT_hash_handle hh;
+} h4h_hlm_rahead_ent_t;
+
+typedef struct {
+	int64_t next_lpa;	/* the lpa expected next */
+	int64_t ra_end;		/* pages before it are staged (or being read) */
+	uint64_t win;
+	uint64_t nr_seq;	/* # of back-to-back reads (0: unused) */
+	uint64_t last_use;
+} h4h_hlm_rahead_stream_t;
+
+struct h4h_hlm_rahead {
+	h4h_drv_info_t* bdi;
+	h4h_spinlock_t lock;
+	h4h_hlm_rahead_ent_t* ents;	/* hashed by lpa */
+	struct list_head fifo;
+	uint64_t nr_ents;
+	uint64_t max_pgs;
+	uint64_t nr_lpas;
+	uint64_t init_win;
+	uint64_t max_win;
+
+	h4h_hlm_rahead_stream_t streams[RAHEAD_NR_STREAMS];
+	uint64_t tick;
+
+	h4h_hlm_reqs_pool_t* pool;	/* hlm_reqs for read-ahead */
+	atomic64_t nr_inflight;
+
+	/* statistics */
+	uint64_t nr_issued;
+	uint64_t nr_hits;
+	uint64_t nr_wasted;
+};
+
+
+/* it must be called with ra->lock */
+static void __hlm_rahead_drop (
+	h4h_hlm_rahead_t* ra, 
+	h4h_hlm_rahead_ent_t* e)
+{
+	HASH_DEL (ra->ents, e);
+	list_del (&e->list);
+	ra->nr_ents--;
+	/* the buffer of a pending page is freed when its read completes */
+	if (e->ready)
+		h4h_free_phy (e->data);
+	h4h_free (e);
+}
+
+/* it must be called with ra->lock; returns 1 if there is a room */
+static uint8_t __hlm_rahead_make_room (h4h_hlm_rahead_t* ra)
+{
+	struct list_head* pos = NULL;
+	struct list_head* tmp = NULL;
+
+	if (ra->nr_ents < ra->max_pgs)
+		return 1;
+
+	list_for_each_safe (pos, tmp, &ra->fifo) {
+		h4h_hlm_rahead_ent_t* e = list_entry (pos, h4h_hlm_rahead_ent_t, list);
+		h4h_hlm_rahead_stream_t* s = &ra->streams[e->stream];
+
+		if (!e->ready)
+			continue;
+
+		/* it was staged for nothing; the stream looks too far ahead */
+		s->win = (s->win / 2 > ra->init_win) ? s->win / 2 : ra->init_win;
+		ra->nr_wasted++;
+		__hlm_rahead_drop (ra, e);
+		return 1;
+	}
+
+	return 0;
+}
+
+static void __hlm_rahead_issue (
+	h4h_drv_info_t* bdi, 
+	h4h_hlm_rahead_t* ra, 
+	int32_t stream,
+	int64_t start, 
+	uint64_t len)
+{
+	h4h_ftl_inf_t* ftl = H4H_GET_FTL_INF(bdi);
+	h4h_device_params_t* np = H4H_GET_DEVICE_PARAMS(bdi);
+	int64_t lpa = start;
+	uint8_t full = 0;
+
+	while (lpa < start + len && !full) {
+		h4h_hlm_req_t* hr = NULL;
+		h4h_llm_req_t* lr = NULL;
+		uint64_t n = 0, i;
+
+		if ((hr = h4h_hlm_reqs_pool_get_item (ra->pool)) == NULL) {
+			h4h_error ("h4h_hlm_reqs_pool_get_item () failed");
+			return;
+		}
+		if (h4h_hlm_reqs_pool_alloc_llm_reqs (ra->pool, hr, 
+				(start + len - lpa < H4H_BLKIO_MAX_VECS) ? start + len - lpa : H4H_BLKIO_MAX_VECS) != 0) {
+			h4h_error ("h4h_hlm_reqs_pool_alloc_llm_reqs () failed");
+			h4h_hlm_reqs_pool_free_item (ra->pool, hr);
+			return;
+		}
+		h4h_sema_lock (&hr->done);
+
+		for (; lpa < start + len && n < H4H_BLKIO_MAX_VECS; lpa++) {
+			h4h_hlm_rahead_ent_t* e = NULL;
+			h4h_phyaddr_t phyaddr;
+			uint64_t sp_ofs;
+
+			/* skip the pages that were never written */
+			if (ftl->get_ppa (bdi, lpa, &phyaddr, &sp_ofs) != 0)
+				continue;
+
+			if ((e = (h4h_hlm_rahead_ent_t*)h4h_zmalloc 
+					(sizeof (h4h_hlm_rahead_ent_t))) == NULL) {
+				full = 1;
+				break;
+			}
+			if ((e->data = (uint8_t*)h4h_malloc_phy (np->page_main_size)) == NULL) {
+				h4h_free (e);
+				full = 1;
+				break;
+			}
+			e->lpa = lpa;
+			e->stream = stream;
+
+			h4h_spin_lock (&ra->lock);
+			{
+				h4h_hlm_rahead_ent_t* old = NULL;
+				HASH_FIND (hh, ra->ents, &lpa, sizeof (int64_t), old);
+				if (old) {
+					/* staged by another stream */
+					h4h_spin_unlock (&ra->lock);
+					h4h_free_phy (e->data);
+					h4h_free (e);
+					continue;
+				}
+				if (!__hlm_rahead_make_room (ra)) {
+					h4h_spin_unlock (&ra->lock);
+					h4h_free_phy (e->data);
+					h4h_free (e);
+					full = 1;
+					break;
+				}
+				HASH_ADD (hh, ra->ents, lpa, sizeof (int64_t), e);
+				list_add_tail (&e->list, &ra->fifo);
+				ra->nr_ents++;
+			}
+			h4h_spin_unlock (&ra->lock);
+
+			lr = &hr->llm_reqs[n++];
+			hlm_reqs_pool_reset_fmain (&lr->fmain);
+			hlm_reqs_pool_reset_logaddr (&lr->logaddr);
+			lr->req_type = REQTYPE_READ;
+			lr->ptr_hlm_req = (void*)hr;
+			lr->logaddr.lpa[0] = lpa;
+			lr->fmain.kp_stt[0] = KP_STT_DATA;
+			lr->fmain.kp_ptr[0] = e->data;
+			lr->phyaddr = phyaddr;
+			hlm_reqs_pool_relocate_kp (lr, sp_ofs);
+		}
+
+		if (n == 0) {
+			h4h_hlm_reqs_pool_free_item (ra->pool, hr);
+			continue;
+		}
+
+		hr->req_type = REQTYPE_READ;
+		h4h_stopwatch_start (&hr->sw);
+		hr->nr_llm_reqs = n;
+		atomic64_set (&hr->nr_llm_reqs_done, n);	/* counts down */
+		hr->blkio_req = NULL;	/* it tells read-ahead from host reqs */
+		hr->ret = 0;
+		atomic64_inc (&ra->nr_inflight);
+		ra->nr_issued += n;
+
+		/* hr can be done as soon as its last llm_req is sent */
+		if (bdi->ptr_llm_inf->make_reqs == NULL) {
+			h4h_llm_req_t* lrs = hr->llm_reqs;
+
+			for (i = 0; i < n; i++) {
+				if (bdi->ptr_llm_inf->make_req (bdi, &lrs[i]) != 0) {
+					h4h_error ("oops! make_req () failed");
+					h4h_bug_on (1);
+				}
+			}
+		} else {
+			if (bdi->ptr_llm_inf->make_reqs (bdi, hr) != 0) {
+				h4h_error ("oops! make_reqs () failed");
+				h4h_bug_on (1);
+			}
+		}
+	}
+}
+
+h4h_hlm_rahead_t* h4h_hlm_rahead_create (
+	h4h_drv_info_t* bdi, 
+	uint64_t nr_pgs)
+{
+	h4h_device_params_t* np = H4H_GET_DEVICE_PARAMS(bdi);
+	h4h_hlm_rahead_t* ra = NULL;
+
+	if ((ra = (h4h_hlm_rahead_t*)h4h_zmalloc (sizeof (h4h_hlm_rahead_t))) == NULL) {
+		h4h_error ("h4h_zmalloc failed");
+		return NULL;
+	}
+	ra->bdi = bdi;
+	h4h_spin_lock_init (&ra->lock);
+	ra->ents = NULL;
+	INIT_LIST_HEAD (&ra->fifo);
+	ra->max_pgs = nr_pgs;
+	ra->nr_lpas = np->device_capacity_in_byte / np->page_main_size;
+
+	/* by default, the first window covers every parallel unit once */
+	ra->init_win = (_param_ra_init_pgs > 0) ? 
+		_param_ra_init_pgs : np->nr_channels * np->nr_chips_per_channel;
+	ra->max_win = (_param_ra_max_pgs > ra->init_win) ? _param_ra_max_pgs : ra->init_win;
+	if (ra->max_win > ra->max_pgs)
+		ra->max_win = ra->max_pgs;
+	if (ra->init_win > ra->max_win)
+		ra->init_win = ra->max_win;
+	atomic64_set (&ra->nr_inflight, 0);
+
+	if ((ra->pool = h4h_hlm_reqs_pool_create (
+			np->page_main_size, np->page_main_size)) == NULL) {
+		h4h_error ("h4h_hlm_reqs_pool_create () failed");
+		h4h_free (ra);
+		return NULL;
+	}
+
+	h4h_msg ("rahead: %llu pages, window = %llu-%llu pages", 
+		ra->max_pgs, ra->init_win, ra->max_win);
+
+	return ra;
+}
+
+void h4h_hlm_rahead_destroy (h4h_hlm_rahead_t* ra)
+{
+	h4h_hlm_rahead_ent_t* e = NULL;
+	h4h_hlm_rahead_ent_t* tmp = NULL;
+
+	/* wait for read-ahead in progress */
+	while (atomic64_read (&ra->nr_inflight) > 0)
+		h4h_thread_yield ();
+
+	h4h_msg ("rahead: issued = %llu, hits = %llu, wasted = %llu", 
+		ra->nr_issued, ra->nr_hits, ra->nr_wasted);
+
+	HASH_ITER (hh, ra->ents, e, tmp) {
+		__hlm_rahead_drop (ra, e);
+	}
+	h4h_hlm_reqs_pool_destroy (ra->pool);
+	h4h_spin_lock_destory (&ra->lock);
+	h4h_free (ra);
+}
+
+/* copy a staged page to 'dst' and release it; returns 1 on a hit */
+uint8_t h4h_hlm_rahead_get (
+	h4h_hlm_rahead_t* ra, 
+	int64_t lpa, 
+	uint8_t* dst)
+{
+	h4h_hlm_rahead_ent_t* e = NULL;
+
+	for (;;) {
+		h4h_spin_lock (&ra->lock);
+		HASH_FIND (hh, ra->ents, &lpa, sizeof (int64_t), e);
+		if (e == NULL) {
+			h4h_spin_unlock (&ra->lock);
+			return 0;
+		}
+		if (e->ready) {
+			h4h_memcpy (dst, e->data, ra->bdi->parm_dev.page_main_size);
+			__hlm_rahead_drop (ra, e);
+			ra->nr_hits++;
+			h4h_spin_unlock (&ra->lock);
+			return 1;
+		}
+		h4h_spin_unlock (&ra->lock);
+
+		/* it is on the way; waiting is cheaper than reading it again */
+		h4h_thread_yield ();
+	}
+}
+
+void h4h_hlm_rahead_invalidate (
+	h4h_hlm_rahead_t* ra, 
+	int64_t lpa, 
+	uint64_t len)
+{
+	h4h_hlm_rahead_ent_t* e = NULL;
+	h4h_hlm_rahead_ent_t* tmp = NULL;
+	uint64_t i;
+
+	h4h_spin_lock (&ra->lock);
+	if (len <= ra->nr_ents) {
+		for (i = 0; i < len; i++) {
+			int64_t cur = lpa + i;
+			HASH_FIND (hh, ra->ents, &cur, sizeof (int64_t), e);
+			if (e)
+				__hlm_rahead_drop (ra, e);
+		}
+	} else {
+		HASH_ITER (hh, ra->ents, e, tmp) {
+			if (e->lpa >= lpa && e->lpa < lpa + len)
+				__hlm_rahead_drop (ra, e);
+		}
+	}
+	h4h_spin_unlock (&ra->lock);
+}
+
+/* a host read of [lpa, lpa+len) was sent; 'nr_hits' pages of it were staged */
+void h4h_hlm_rahead_update (
+	h4h_drv_info_t* bdi, 
+	int64_t lpa, 
+	uint64_t len, 
+	uint64_t nr_hits)
+{
+	h4h_hlm_rahead_t* ra = (h4h_hlm_rahead_t*)bdi->ptr_rahead;
+	h4h_hlm_rahead_stream_t* s = NULL;
+	int64_t end = lpa + len;
+	int64_t start;
+	uint64_t i, cnt;
+
+	if (len == 0)
+		return;
+
+	h4h_spin_lock (&ra->lock);
+	ra->tick++;
+
+	/* (1) find the stream it continues */
+	for (i = 0; i < RAHEAD_NR_STREAMS; i++) {
+		if (ra->streams[i].nr_seq > 0 && ra->streams[i].next_lpa == lpa) {
+			s = &ra->streams[i];
+			break;
+		}
+	}
+	if (s == NULL) {
+		/* start a new stream in place of the least recently used one */
+		s = &ra->streams[0];
+		for (i = 1; i < RAHEAD_NR_STREAMS; i++) {
+			if (ra->streams[i].last_use < s->last_use)
+				s = &ra->streams[i];
+		}
+		s->next_lpa = end;
+		s->ra_end = end;
+		s->win = ra->init_win;
+		s->nr_seq = 1;
+		s->last_use = ra->tick;
+		h4h_spin_unlock (&ra->lock);
+		return;
+	}
+	s->nr_seq++;
+	s->next_lpa = end;
+	s->last_use = ra->tick;
+
+	/* (2) adapt the window */
+	if (nr_hits == len && s->win < ra->max_win)
+		s->win = (s->win * 2 < ra->max_win) ? s->win * 2 : ra->max_win;
+	if (s->ra_end < end)
+		s->ra_end = end;
+
+	/* (3) look ahead when half of the window has been consumed */
+	if (s->nr_seq < _param_ra_trigger || 
+		(uint64_t)(s->ra_end - end) > s->win / 2 || 
+		s->ra_end >= (int64_t)ra->nr_lpas) {
+		h4h_spin_unlock (&ra->lock);
+		return;
+	}
+	start = s->ra_end;
+	cnt = end + s->win - start;
+	if (start + cnt > ra->nr_lpas)
+		cnt = ra->nr_lpas - start;
+	s->ra_end = start + cnt;
+	h4h_spin_unlock (&ra->lock);
+
+	__hlm_rahead_issue (bdi, ra, s - ra->streams, start, cnt);
+}
+
+/* returns 1 if 'lr' belongs to read-ahead */
+uint8_t h4h_hlm_rahead_end_req (
+	h4h_drv_info_t* bdi, 
+	h4h_llm_req_t* lr)
+{
+	h4h_hlm_rahead_t* ra = (h4h_hlm_rahead_t*)bdi->ptr_rahead;
+	h4h_hlm_req_t* hr = (h4h_hlm_req_t*)lr->ptr_hlm_req;
+	h4h_hlm_rahead_ent_t* e = NULL;
+	uint8_t* data = lr->fmain.kp_ptr[0];
+
+	if (ra == NULL || hr->blkio_req != NULL || !h4h_is_read (hr->req_type))
+		return 0;
+
+	/* the page is ready unless it was invalidated in the meantime */
+	h4h_spin_lock (&ra->lock);
+	HASH_FIND (hh, ra->ents, &lr->logaddr.lpa[0], sizeof (int64_t), e);
+	if (e && e->data == data)
+		e->ready = 1;
+	else
+		h4h_free_phy (data);
+	h4h_spin_unlock (&ra->lock);
+
+	lr->fmain.kp_ptr[0] = lr->fmain.kp_pad[0];
+	lr->req_type |= REQTYPE_DONE;
+
+	if (atomic64_dec_and_test (&hr->nr_llm_reqs_done)) {
+		h4h_hlm_reqs_pool_free_item (ra->pool, hr);
+		atomic64_dec (&ra->nr_inflight);
+	}
+
+	return 1;
+}
@@ -0,0 +1,39 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014-2015 CSAIL, MIT
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef _H4H_HLM_RAHEAD_H
+#define _H4H_HLM_RAHEAD_H
+
+/* a per-stream read-ahead engine; hlm_nobuf serves host reads from its
+ * staging buffer and lets it look ahead after each host read */
+typedef struct h4h_hlm_rahead h4h_hlm_rahead_t;
+
+h4h_hlm_rahead_t* h4h_hlm_rahead_create (h4h_drv_info_t* bdi, uint64_t nr_pgs);
+void h4h_hlm_rahead_destroy (h4h_hlm_rahead_t* ra);
+uint8_t h4h_hlm_rahead_get (h4h_hlm_rahead_t* ra, int64_t lpa, uint8_t* dst);
+void h4h_hlm_rahead_invalidate (h4h_hlm_rahead_t* ra, int64_t lpa, uint64_t len);
+void h4h_hlm_rahead_update (h4h_drv_info_t* bdi, int64_t lpa, uint64_t len, uint64_t nr_hits);
+uint8_t h4h_hlm_rahead_end_req (h4h_drv_info_t* bdi, h4h_llm_req_t* lr);
+
+#endif
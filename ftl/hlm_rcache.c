@@ -0,0 +1,370 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014-2015 CSAIL, MIT
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+/*
+ * hlm_rcache is a read-only page cache with S3-FIFO admission: a page is
+ * first kept in a small FIFO and is promoted to the main FIFO only if it
+ * is read again before it falls out, so one-time scans do not flush hot
+ * pages. Evicted pages of the small FIFO leave their lpas in a ghost FIFO;
+ * a page found there on a fill goes straight to the main FIFO.
+ */
+
+#if defined(KERNEL_MODE)
+#include <linux/module.h>
+#include <linux/blkdev.h>
+
+#elif defined(USER_MODE)
+#include <stdio.h>
+#include <stdint.h>
+
+#else
+#error Invalid Platform (KERNEL_MODE or USER_MODE)
+#endif
+
+#include "debug.h"
+#include "params.h"
+#include "h4h_drv.h"
+#include "hlm_rcache.h"
+#include "ftl_params.h"
+#include "umemory.h"
+#include "utime.h"
+#include "uthash.h"
+
+#define RCACHE_MAX_FREQ		3
+#define RCACHE_NR_BUCKETS	4096	/* invalidation stamps */
+
+enum {
+	RCACHE_SMALL = 0,
+	RCACHE_MAIN,
+	RCACHE_GHOST,
+};
+
+typedef struct {
+	int64_t lpa;
+	uint8_t* data;	/* NULL if it is a ghost */
+	uint8_t fifo;
+	uint8_t freq;
+	struct list_head list;	/* the head is the newest */
+	UT_hash_handle hh;
+} h4h_hlm_rcache_ent_t;
+
+struct h4h_hlm_rcache {
+	h4h_spinlock_t lock;
+	h4h_hlm_rcache_ent_t* ents;	/* hashed by lpa */
+	struct list_head fifos[3];
+	uint64_t nr_ents[3];
+	uint64_t max_pgs;
+	uint64_t max_small;
+	uint64_t max_ghost;
+	uint32_t pg_size;
+
+	/* a fill is dropped if its lpa was invalidated after the read was
+	 * issued; 'stamps' keeps the seq of the last invalidation per bucket */
+	uint64_t seq;
+	uint64_t stamps[RCACHE_NR_BUCKETS];
+
+	/* statistics */
+	h4h_stopwatch_t sw;
+	uint64_t nr_lookups;
+	uint64_t nr_hits;
+	uint64_t nr_total_lookups;
+	uint64_t nr_total_hits;
+};
+
+
+static void __hlm_rcache_move (
+	h4h_hlm_rcache_t* rc, 
+	h4h_hlm_rcache_ent_t* e, 
+	uint8_t fifo)
+{
+	list_del (&e->list);
+	rc->nr_ents[e->fifo]--;
+	list_add (&e->list, &rc->fifos[fifo]);
+	rc->nr_ents[fifo]++;
+	e->fifo = fifo;
+}
+
+static void __hlm_rcache_drop (
+	h4h_hlm_rcache_t* rc, 
+	h4h_hlm_rcache_ent_t* e)
+{
+	HASH_DEL (rc->ents, e);
+	list_del (&e->list);
+	rc->nr_ents[e->fifo]--;
+	if (e->data)
+		h4h_free (e->data);
+	h4h_free (e);
+}
+
+static h4h_hlm_rcache_ent_t* __hlm_rcache_tail (
+	h4h_hlm_rcache_t* rc, 
+	uint8_t fifo)
+{
+	return list_entry (rc->fifos[fifo].prev, h4h_hlm_rcache_ent_t, list);
+}
+
+static void __hlm_rcache_evict_small (h4h_hlm_rcache_t* rc)
+{
+	h4h_hlm_rcache_ent_t* e = __hlm_rcache_tail (rc, RCACHE_SMALL);
+
+	if (e->freq > 0) {
+		/* it was read again while in the small fifo */
+		e->freq = 0;
+		__hlm_rcache_move (rc, e, RCACHE_MAIN);
+		return;
+	}
+
+	/* keep only its lpa */
+	h4h_free (e->data);
+	e->data = NULL;
+	__hlm_rcache_move (rc, e, RCACHE_GHOST);
+	while (rc->nr_ents[RCACHE_GHOST] > rc->max_ghost)
+		__hlm_rcache_drop (rc, __hlm_rcache_tail (rc, RCACHE_GHOST));
+}
+
+static void __hlm_rcache_evict_main (h4h_hlm_rcache_t* rc)
+{
+	h4h_hlm_rcache_ent_t* e = __hlm_rcache_tail (rc, RCACHE_MAIN);
+
+	if (e->freq > 0) {
+		/* give it another round */
+		e->freq--;
+		list_del (&e->list);
+		list_add (&e->list, &rc->fifos[RCACHE_MAIN]);
+		return;
+	}
+	__hlm_rcache_drop (rc, e);
+}
+
+static void __hlm_rcache_report (h4h_hlm_rcache_t* rc)
+{
+	if (_param_rcache_report_sec <= 0 ||
+		h4h_stopwatch_get_elapsed_time_ms (&rc->sw) < _param_rcache_report_sec * 1000)
+		return;
+
+	if (rc->nr_lookups > 0) {
+		h4h_msg ("rcache: hit ratio = %llu%% (%llu/%llu) in the last %d sec", 
+			rc->nr_hits * 100 / rc->nr_lookups, rc->nr_hits, rc->nr_lookups, 
+			_param_rcache_report_sec);
+	}
+	rc->nr_lookups = 0;
+	rc->nr_hits = 0;
+	h4h_stopwatch_start (&rc->sw);
+}
+
+h4h_hlm_rcache_t* h4h_hlm_rcache_create (
+	uint64_t nr_pgs, 
+	uint32_t pg_size)
+{
+	h4h_hlm_rcache_t* rc = NULL;
+	int i;
+
+	if (nr_pgs < 2) {
+		h4h_error ("the read cache is too small (%llu pages)", nr_pgs);
+		return NULL;
+	}
+
+	if ((rc = (h4h_hlm_rcache_t*)h4h_zmalloc (sizeof (h4h_hlm_rcache_t))) == NULL) {
+		h4h_error ("h4h_zmalloc failed");
+		return NULL;
+	}
+	h4h_spin_lock_init (&rc->lock);
+	rc->ents = NULL;
+	for (i = 0; i < 3; i++)
+		INIT_LIST_HEAD (&rc->fifos[i]);
+	rc->max_pgs = nr_pgs;
+	rc->max_small = (nr_pgs / 10 > 0) ? nr_pgs / 10 : 1;
+	rc->max_ghost = nr_pgs - rc->max_small;
+	rc->pg_size = pg_size;
+	h4h_stopwatch_start (&rc->sw);
+
+	h4h_msg ("rcache: %llu pages (small = %llu, main = %llu)", 
+		rc->max_pgs, rc->max_small, rc->max_pgs - rc->max_small);
+
+	return rc;
+}
+
+void h4h_hlm_rcache_destroy (h4h_hlm_rcache_t* rc)
+{
+	h4h_hlm_rcache_ent_t* e = NULL;
+	h4h_hlm_rcache_ent_t* tmp = NULL;
+
+	if (rc->nr_total_lookups > 0) {
+		h4h_msg ("rcache: hit ratio = %llu%% (%llu/%llu)", 
+			rc->nr_total_hits * 100 / rc->nr_total_lookups, 
+			rc->nr_total_hits, rc->nr_total_lookups);
+	}
+
+	HASH_ITER (hh, rc->ents, e, tmp) {
+		__hlm_rcache_drop (rc, e);
+	}
+	h4h_spin_lock_destory (&rc->lock);
+	h4h_free (rc);
+}
+
+uint64_t h4h_hlm_rcache_get_seq (h4h_hlm_rcache_t* rc)
+{
+	uint64_t seq;
+
+	h4h_spin_lock (&rc->lock);
+	seq = rc->seq;
+	h4h_spin_unlock (&rc->lock);
+
+	return seq;
+}
+
+/* copy a cached page to 'dst'; returns 1 on a hit */
+uint8_t h4h_hlm_rcache_get (
+	h4h_hlm_rcache_t* rc, 
+	int64_t lpa, 
+	uint8_t* dst)
+{
+	h4h_hlm_rcache_ent_t* e = NULL;
+	uint8_t hit = 0;
+
+	h4h_spin_lock (&rc->lock);
+	HASH_FIND (hh, rc->ents, &lpa, sizeof (int64_t), e);
+	if (e && e->data) {
+		if (e->freq < RCACHE_MAX_FREQ)
+			e->freq++;
+		h4h_memcpy (dst, e->data, rc->pg_size);
+		rc->nr_hits++;
+		rc->nr_total_hits++;
+		hit = 1;
+	}
+	rc->nr_lookups++;
+	rc->nr_total_lookups++;
+	__hlm_rcache_report (rc);
+	h4h_spin_unlock (&rc->lock);
+
+	return hit;
+}
+
+/* admit a page read from the device at 'seq' */
+void h4h_hlm_rcache_put (
+	h4h_hlm_rcache_t* rc, 
+	int64_t lpa, 
+	uint8_t* src, 
+	uint64_t seq)
+{
+	h4h_hlm_rcache_ent_t* e = NULL;
+	uint8_t* data = NULL;
+
+	/* copy it outside the lock */
+	if ((data = (uint8_t*)h4h_malloc (rc->pg_size)) == NULL) {
+		return;
+	}
+	h4h_memcpy (data, src, rc->pg_size);
+
+	h4h_spin_lock (&rc->lock);
+	if (rc->stamps[(uint64_t)lpa % RCACHE_NR_BUCKETS] > seq) {
+		/* it might have been overwritten while being read */
+		goto out;
+	}
+
+	HASH_FIND (hh, rc->ents, &lpa, sizeof (int64_t), e);
+	if (e && e->data) {
+		/* filled by another read */
+		goto out;
+	} else if (e) {
+		/* it was evicted too early; keep it in the main fifo */
+		e->data = data;
+		e->freq = 0;
+		__hlm_rcache_move (rc, e, RCACHE_MAIN);
+	} else {
+		if ((e = (h4h_hlm_rcache_ent_t*)h4h_zmalloc 
+				(sizeof (h4h_hlm_rcache_ent_t))) == NULL) {
+			goto out;
+		}
+		e->lpa = lpa;
+		e->data = data;
+		e->fifo = RCACHE_SMALL;
+		HASH_ADD (hh, rc->ents, lpa, sizeof (int64_t), e);
+		list_add (&e->list, &rc->fifos[RCACHE_SMALL]);
+		rc->nr_ents[RCACHE_SMALL]++;
+	}
+	data = NULL;
+
+	while (rc->nr_ents[RCACHE_SMALL] + rc->nr_ents[RCACHE_MAIN] > rc->max_pgs) {
+		if (rc->nr_ents[RCACHE_SMALL] > rc->max_small || 
+			rc->nr_ents[RCACHE_MAIN] == 0)
+			__hlm_rcache_evict_small (rc);
+		else
+			__hlm_rcache_evict_main (rc);
+	}
+
+out:
+	h4h_spin_unlock (&rc->lock);
+	if (data)
+		h4h_free (data);
+}
+
+void h4h_hlm_rcache_invalidate (
+	h4h_hlm_rcache_t* rc, 
+	int64_t lpa, 
+	uint64_t len)
+{
+	h4h_hlm_rcache_ent_t* e = NULL;
+	h4h_hlm_rcache_ent_t* tmp = NULL;
+	uint64_t i;
+
+	h4h_spin_lock (&rc->lock);
+	rc->seq++;
+	if (len < RCACHE_NR_BUCKETS) {
+		for (i = 0; i < len; i++) {
+			int64_t cur = lpa + i;
+			rc->stamps[(uint64_t)cur % RCACHE_NR_BUCKETS] = rc->seq;
+			HASH_FIND (hh, rc->ents, &cur, sizeof (int64_t), e);
+			if (e)
+				__hlm_rcache_drop (rc, e);
+		}
+	} else {
+		/* a large trim */
+		for (i = 0; i < RCACHE_NR_BUCKETS; i++)
+			rc->stamps[i] = rc->seq;
+		HASH_ITER (hh, rc->ents, e, tmp) {
+			if (e->lpa >= lpa && e->lpa < lpa + len)
+				__hlm_rcache_drop (rc, e);
+		}
+	}
+	h4h_spin_unlock (&rc->lock);
+}
+
+/* reads that are internal, large (scans), or marked by the host skip it;
+ * note that writes and trims always invalidate it */
+uint8_t h4h_hlm_rcache_bypass (
+	h4h_drv_info_t* bdi, 
+	h4h_hlm_req_t* hr)
+{
+	h4h_blkio_req_t* br = (h4h_blkio_req_t*)hr->blkio_req;
+
+	if (bdi->ptr_rcache == NULL || br == NULL)
+		return 1;
+	if (h4h_is_nocache (br->bi_rw))
+		return 1;
+	if (h4h_is_read (hr->req_type) && 
+		_param_rcache_bypass_pgs > 0 && 
+		hr->nr_llm_reqs >= _param_rcache_bypass_pgs)
+		return 1;
+	return 0;
+}
@@ -0,0 +1,40 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014-2015 CSAIL, MIT
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef _H4H_HLM_RCACHE_H
+#define _H4H_HLM_RCACHE_H
+
+/* a read-only page cache for hot lpas; it sits on top of hlm_nobuf, which
+ * fills it on reads and invalidates it on writes and trims */
+typedef struct h4h_hlm_rcache h4h_hlm_rcache_t;
+
+h4h_hlm_rcache_t* h4h_hlm_rcache_create (uint64_t nr_pgs, uint32_t pg_size);
+void h4h_hlm_rcache_destroy (h4h_hlm_rcache_t* rc);
+uint64_t h4h_hlm_rcache_get_seq (h4h_hlm_rcache_t* rc);
+uint8_t h4h_hlm_rcache_get (h4h_hlm_rcache_t* rc, int64_t lpa, uint8_t* dst);
+void h4h_hlm_rcache_put (h4h_hlm_rcache_t* rc, int64_t lpa, uint8_t* src, uint64_t seq);
+void h4h_hlm_rcache_invalidate (h4h_hlm_rcache_t* rc, int64_t lpa, uint64_t len);
+uint8_t h4h_hlm_rcache_bypass (h4h_drv_info_t* bdi, h4h_hlm_req_t* hr);
+
+#endif
@@ -0,0 +1,196 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014-2015 CSAIL, MIT
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+/*
+ * hlm_reqs_plug merges adjacent host reqs of the same direction into a
+ * larger blkio_req before it becomes an hlm_req. A host interface plugs
+ * reqs only while others are in flight, and unplugs when one of them
+ * completes, when a req cannot be merged, or when the plugged req is full.
+ */
+
+#if defined(KERNEL_MODE)
+#include <linux/module.h>
+#include <linux/slab.h>
+
+#elif defined(USER_MODE)
+#include <stdio.h>
+#include <stdint.h>
+
+#else
+#error Invalid Platform (KERNEL_MODE or USER_MODE)
+#endif
+
+#include "debug.h"
+#include "h4h_drv.h"
+#include "umemory.h"
+#include "hlm_reqs_plug.h"
+
+
+h4h_hlm_reqs_plug_t* h4h_hlm_reqs_plug_create (uint64_t max_vecs)
+{
+	h4h_hlm_reqs_plug_t* plug = NULL;
+
+	if ((plug = (h4h_hlm_reqs_plug_t*)h4h_zmalloc (sizeof (h4h_hlm_reqs_plug_t))) == NULL) {
+		h4h_error ("h4h_zmalloc failed");
+		return NULL;
+	}
+	h4h_spin_lock_init (&plug->lock);
+	plug->plugged = NULL;
+	plug->max_vecs = (max_vecs < H4H_BLKIO_MAX_VECS) ? max_vecs : H4H_BLKIO_MAX_VECS;
+
+	return plug;
+}
+
+void h4h_hlm_reqs_plug_destroy (h4h_hlm_reqs_plug_t* plug)
+{
+	h4h_bug_on (plug->plugged != NULL);
+
+	if (plug->nr_merged_reqs > 0) {
+		h4h_msg ("hlm_reqs_plug: %llu host reqs were sent as %llu reqs", 
+			plug->nr_host_reqs, plug->nr_merged_reqs);
+	}
+	h4h_spin_lock_destory (&plug->lock);
+	h4h_free (plug);
+}
+
+/* only page-aligned reads and writes without ordering flags are merged */
+uint8_t h4h_hlm_reqs_plug_can_merge (
+	h4h_hlm_reqs_plug_t* plug, 
+	h4h_blkio_req_t* br)
+{
+	uint64_t type = br->bi_rw & ~REQTYPE_NOCACHE;
+
+	if (plug == NULL || plug->max_vecs < 2)
+		return 0;
+	if (type != REQTYPE_READ && type != REQTYPE_WRITE)
+		return 0;
+	if (br->bi_bvec_cnt == 0 || br->bi_bvec_cnt >= plug->max_vecs)
+		return 0;
+	if (br->bi_offset % NR_KSECTORS_IN(KPAGE_SIZE) != 0 || 
+		br->bi_size != br->bi_bvec_cnt * NR_KSECTORS_IN(KPAGE_SIZE))
+		return 0;
+	return 1;
+}
+
+/* plug 'br'; returns a req that must be sent now (or NULL) */
+h4h_blkio_req_t* h4h_hlm_reqs_plug_add (
+	h4h_hlm_reqs_plug_t* plug, 
+	h4h_blkio_req_t* br)
+{
+	h4h_hlm_reqs_plug_req_t* pr = NULL;
+	h4h_hlm_reqs_plug_req_t* out = NULL;
+	h4h_hlm_reqs_plug_req_t* np = NULL;
+
+	/* get a new one in advance; it is not allowed with the lock held */
+	if ((np = (h4h_hlm_reqs_plug_req_t*)h4h_malloc 
+			(sizeof (h4h_hlm_reqs_plug_req_t))) == NULL) {
+		h4h_error ("h4h_malloc failed");
+		return NULL;
+	}
+
+	h4h_spin_lock (&plug->lock);
+	plug->nr_host_reqs++;
+	pr = plug->plugged;
+	if (pr != NULL &&
+		pr->br.bi_rw == (br->bi_rw | REQTYPE_MERGED) &&
+		pr->br.bi_offset + pr->br.bi_size == br->bi_offset &&
+		pr->br.bi_bvec_cnt + br->bi_bvec_cnt <= plug->max_vecs) {
+		/* (1) merge it to the plugged one */
+		h4h_memcpy (&pr->br.bi_bvec_ptr[pr->br.bi_bvec_cnt], br->bi_bvec_ptr, 
+			sizeof (uint8_t*) * br->bi_bvec_cnt);
+		pr->br.bi_bvec_cnt += br->bi_bvec_cnt;
+		pr->br.bi_size += br->bi_size;
+		pr->children[pr->nr_children++] = br;
+		if (pr->br.bi_bvec_cnt == plug->max_vecs) {
+			plug->plugged = NULL;
+			out = pr;
+		}
+	} else {
+		/* (2) plug it instead of the old one, which goes out */
+		np->br.bi_rw = br->bi_rw | REQTYPE_MERGED;
+		np->br.bi_offset = br->bi_offset;
+		np->br.bi_size = br->bi_size;
+		np->br.bi_bvec_cnt = br->bi_bvec_cnt;
+		h4h_memcpy (np->br.bi_bvec_ptr, br->bi_bvec_ptr, 
+			sizeof (uint8_t*) * br->bi_bvec_cnt);
+		np->br.ret = 0;
+		np->br.bio = NULL;
+		np->br.user = NULL;
+		np->br.cb_done = NULL;
+		np->nr_children = 1;
+		np->children[0] = br;
+		plug->plugged = np;
+		plug->nr_merged_reqs++;
+		out = pr;
+		np = NULL;
+	}
+	h4h_spin_unlock (&plug->lock);
+
+	if (np)
+		h4h_free (np);
+
+	return (out) ? &out->br : NULL;
+}
+
+/* unplug; returns the plugged req (or NULL) */
+h4h_blkio_req_t* h4h_hlm_reqs_plug_flush (h4h_hlm_reqs_plug_t* plug)
+{
+	h4h_hlm_reqs_plug_req_t* pr = NULL;
+
+	h4h_spin_lock (&plug->lock);
+	pr = plug->plugged;
+	plug->plugged = NULL;
+	h4h_spin_unlock (&plug->lock);
+
+	return (pr) ? &pr->br : NULL;
+}
+
+uint8_t h4h_hlm_reqs_plug_is_empty (h4h_hlm_reqs_plug_t* plug)
+{
+	uint8_t empty;
+
+	h4h_spin_lock (&plug->lock);
+	empty = (plug->plugged == NULL) ? 1 : 0;
+	h4h_spin_unlock (&plug->lock);
+
+	return empty;
+}
+
+/* finish 'br'; a merged one is fanned out to the host reqs in it */
+void h4h_hlm_reqs_plug_end_req (
+	h4h_blkio_req_t* br, 
+	void (*end_req) (h4h_blkio_req_t* br, uint8_t ret), 
+	uint8_t ret)
+{
+	h4h_hlm_reqs_plug_req_t* pr = (h4h_hlm_reqs_plug_req_t*)br;
+	uint64_t i;
+
+	if (!h4h_is_merged (br->bi_rw)) {
+		end_req (br, ret);
+		return;
+	}
+
+	for (i = 0; i < pr->nr_children; i++)
+		end_req (pr->children[i], ret);
+	h4h_free (pr);
+}
@@ -0,0 +1,53 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014-2015 CSAIL, MIT
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef _H4H_HLM_REQS_PLUG_H
+#define _H4H_HLM_REQS_PLUG_H
+
+/* a merged request; 'br' must be on top of this structure */
+typedef struct {
+	h4h_blkio_req_t br;
+	uint64_t nr_children;
+	h4h_blkio_req_t* children[H4H_BLKIO_MAX_VECS];
+} h4h_hlm_reqs_plug_req_t;
+
+typedef struct {
+	h4h_spinlock_t lock;
+	h4h_hlm_reqs_plug_req_t* plugged;	/* NULL if nothing is held */
+	uint64_t max_vecs;
+
+	/* statistics */
+	uint64_t nr_host_reqs;
+	uint64_t nr_merged_reqs;
+} h4h_hlm_reqs_plug_t;
+
+h4h_hlm_reqs_plug_t* h4h_hlm_reqs_plug_create (uint64_t max_vecs);
+void h4h_hlm_reqs_plug_destroy (h4h_hlm_reqs_plug_t* plug);
+uint8_t h4h_hlm_reqs_plug_can_merge (h4h_hlm_reqs_plug_t* plug, h4h_blkio_req_t* br);
+h4h_blkio_req_t* h4h_hlm_reqs_plug_add (h4h_hlm_reqs_plug_t* plug, h4h_blkio_req_t* br);
+h4h_blkio_req_t* h4h_hlm_reqs_plug_flush (h4h_hlm_reqs_plug_t* plug);
+uint8_t h4h_hlm_reqs_plug_is_empty (h4h_hlm_reqs_plug_t* plug);
+void h4h_hlm_reqs_plug_end_req (h4h_blkio_req_t* br, void (*end_req) (h4h_blkio_req_t* br, uint8_t ret), uint8_t ret);
+
+#endif
@@ -29,6 +29,7 @@ THE SOFTWARE.
 #elif defined(USER_MODE)
 #include <stdio.h>
 #include <stdint.h>
+#include <sched.h>
 
 #else
 #error Invalid Platform (KERNEL_MODE or USER_MODE)
@@ -42,7 +43,180 @@ THE SOFTWARE.
 
 
 #define DEFAULT_POOL_SIZE		128
-#define DEFAULT_POOL_INC_SIZE	DEFAULT_POOL_SIZE / 5
+#define DEFAULT_POOL_INC_SIZE	DEFAULT_POOL_SIZE / 4
+#define DEFAULT_CACHE_BATCH		H4H_HLM_REQS_CACHE_SIZE / 2
+
+#if defined(KERNEL_MODE)
+#define __hlm_reqs_pool_cpu() raw_smp_processor_id()
+#elif defined(USER_MODE)
+#define __hlm_reqs_pool_cpu() sched_getcpu()
+#endif
+
+/* # of llm_reqs in a slab, and # of slabs allocated in advance */
+static const int32_t __slab_nr_llm_reqs[H4H_HLM_REQS_NR_SLAB_CLASSES] = { 1, 8, 32, 128, H4H_BLKIO_MAX_VECS };
+static const int32_t __slab_nr_init[H4H_HLM_REQS_NR_SLAB_CLASSES] = { 64, 16, 4, 2, 1 };
+
+static inline h4h_hlm_reqs_lfnode_t* __lfs_node (
+	h4h_hlm_reqs_lfstack_t* s, 
+	uint32_t idx)
+{
+	return &s->dir[idx / H4H_HLM_REQS_LFS_CHUNK][idx % H4H_HLM_REQS_LFS_CHUNK];
+}
+
+/* register a new object; it must be called with grow_lock */
+static int64_t __lfs_register (
+	h4h_hlm_reqs_lfstack_t* s, 
+	void* obj)
+{
+	uint32_t idx = s->nr_objs;
+	uint32_t ch = idx / H4H_HLM_REQS_LFS_CHUNK;
+
+	if (ch >= H4H_HLM_REQS_LFS_MAX_CHUNKS) {
+		h4h_error ("too many objects in a stack (%u)", idx);
+		return -1;
+	}
+	if (s->dir[ch] == NULL) {
+		if ((s->dir[ch] = (h4h_hlm_reqs_lfnode_t*)h4h_zmalloc (
+				sizeof (h4h_hlm_reqs_lfnode_t) * H4H_HLM_REQS_LFS_CHUNK)) == NULL) {
+			h4h_error ("h4h_zmalloc () failed");
+			return -1;
+		}
+	}
+	__lfs_node (s, idx)->obj = obj;
+	s->nr_objs++;
+
+	return idx;
+}
+
+static void __lfs_push (
+	h4h_hlm_reqs_lfstack_t* s, 
+	uint32_t idx)
+{
+	h4h_hlm_reqs_lfnode_t* node = __lfs_node (s, idx);
+	int64_t old, new;
+
+	do {
+		old = atomic64_read (&s->head);
+		node->next = (uint32_t)old;
+		new = ((((uint64_t)old >> 32) + 1) << 32) | (idx + 1);
+	} while (atomic64_cmpxchg (&s->head, old, new) != old);
+}
+
+static void* __lfs_pop (h4h_hlm_reqs_lfstack_t* s)
+{
+	h4h_hlm_reqs_lfnode_t* node = NULL;
+	int64_t old, new;
+
+	do {
+		old = atomic64_read (&s->head);
+		if ((uint32_t)old == 0)
+			return NULL;
+		/* 'next' might be stale, but then the tag tells it */
+		node = __lfs_node (s, (uint32_t)old - 1);
+		new = ((((uint64_t)old >> 32) + 1) << 32) | node->next;
+	} while (atomic64_cmpxchg (&s->head, old, new) != old);
+
+	return node->obj;
+}
+
+static void __lfs_free (h4h_hlm_reqs_lfstack_t* s)
+{
+	uint32_t ch;
+
+	for (ch = 0; ch < H4H_HLM_REQS_LFS_MAX_CHUNKS && s->dir[ch]; ch++) {
+		h4h_free (s->dir[ch]);
+		s->dir[ch] = NULL;
+	}
+}
+
+static h4h_hlm_reqs_slab_t* __hlm_reqs_pool_alloc_slab (int32_t class)
+{
+	h4h_hlm_reqs_slab_t* slab = NULL;
+	int32_t nr = __slab_nr_llm_reqs[class];
+
+	if ((slab = (h4h_hlm_reqs_slab_t*)h4h_malloc (
+			sizeof (h4h_hlm_reqs_slab_t) + sizeof (h4h_llm_req_t) * nr)) == NULL) {
+		h4h_error ("h4h_malloc () failed");
+		return NULL;
+	}
+	slab->class = class;
+	hlm_reqs_pool_allocate_llm_reqs (slab->llm_reqs, nr, RP_MEM_VIRT);
+
+	return slab;
+}
+
+static void __hlm_reqs_pool_free_slab (h4h_hlm_reqs_slab_t* slab)
+{
+	hlm_reqs_pool_release_llm_reqs (slab->llm_reqs, __slab_nr_llm_reqs[slab->class], RP_MEM_VIRT);
+	h4h_free (slab);
+}
+
+/* add a new slab, which is returned to the caller instead of the stack */
+static h4h_hlm_reqs_slab_t* __hlm_reqs_pool_grow_slabs (
+	h4h_hlm_reqs_pool_t* pool, 
+	int32_t class)
+{
+	h4h_hlm_reqs_slab_t* slab = NULL;
+	int64_t idx;
+
+	if ((slab = __hlm_reqs_pool_alloc_slab (class)) == NULL)
+		return NULL;
+
+	h4h_mutex_lock (&pool->grow_lock);
+	idx = __lfs_register (&pool->slabs[class], slab);
+	h4h_mutex_unlock (&pool->grow_lock);
+
+	if (idx < 0) {
+		__hlm_reqs_pool_free_slab (slab);
+		return NULL;
+	}
+	slab->idx = idx;
+
+	return slab;
+}
+
+/* add 'nr' new items to the global stack; h4h_malloc () is called outside
+ * grow_lock, which is never taken in the fast path anyway */
+static int __hlm_reqs_pool_grow_items (
+	h4h_hlm_reqs_pool_t* pool, 
+	int32_t nr)
+{
+	h4h_hlm_req_t* items[DEFAULT_POOL_SIZE];
+	int32_t i, n = 0;
+
+	h4h_bug_on (nr > DEFAULT_POOL_SIZE);
+
+	for (n = 0; n < nr; n++) {
+		if ((items[n] = (h4h_hlm_req_t*)h4h_malloc (sizeof (h4h_hlm_req_t))) == NULL) {
+			h4h_error ("h4h_malloc () failed");
+			break;
+		}
+		items[n]->llm_reqs = NULL;
+		items[n]->llm_slab = NULL;
+		h4h_sema_init (&items[n]->done);
+	}
+
+	h4h_mutex_lock (&pool->grow_lock);
+	for (i = 0; i < n; i++) {
+		int64_t idx = __lfs_register (&pool->items, items[i]);
+		if (idx < 0)
+			break;
+		items[i]->pool_idx = idx;
+		__lfs_push (&pool->items, idx);
+	}
+	pool->pool_size += i;
+	h4h_mutex_unlock (&pool->grow_lock);
+
+	if (i == nr)
+		return 0;
+
+	/* free what could not be registered */
+	for (; i < n; i++) {
+		h4h_sema_free (&items[i]->done);
+		h4h_free (items[i]);
+	}
+	return 1;
+}
 
 h4h_hlm_reqs_pool_t* h4h_hlm_reqs_pool_create (
 	int32_t mapping_unit_size, 
@@ -50,7 +224,7 @@ h4h_hlm_reqs_pool_t* h4h_hlm_reqs_pool_create (
 {
 	h4h_hlm_reqs_pool_t* pool = NULL;
 	int in_place_rmw = 0;
-	int i = 0;
+	int i = 0, c = 0;
 
 	/* check input arguments */
 	if (mapping_unit_size > io_unit_size) {
@@ -66,157 +240,186 @@ h4h_hlm_reqs_pool_t* h4h_hlm_reqs_pool_create (
 	}
 
 	/* create a pool structure */
-	if ((pool = h4h_malloc (sizeof (h4h_hlm_reqs_pool_t))) == NULL) {
-		h4h_error ("h4h_malloc () failed");
+	if ((pool = h4h_zmalloc (sizeof (h4h_hlm_reqs_pool_t))) == NULL) {
+		h4h_error ("h4h_zmalloc () failed");
 		return NULL;
 	}
 
 	/* initialize variables */
-	h4h_spin_lock_init (&pool->lock);
-	INIT_LIST_HEAD (&pool->used_list);
-	INIT_LIST_HEAD (&pool->free_list);
-	pool->pool_size = DEFAULT_POOL_SIZE;
+	for (i = 0; i < H4H_HLM_REQS_NR_CACHES; i++) {
+		h4h_spin_lock_init (&pool->caches[i].lock);
+		pool->caches[i].nr_items = 0;
+	}
+	atomic64_set (&pool->items.head, 0);
+	for (c = 0; c < H4H_HLM_REQS_NR_SLAB_CLASSES; c++)
+		atomic64_set (&pool->slabs[c].head, 0);
+	h4h_mutex_init (&pool->grow_lock);
+	pool->pool_size = 0;
 	pool->map_unit = mapping_unit_size;
 	pool->io_unit = io_unit_size;
 	pool->in_place_rmw = in_place_rmw;
 
-	/* add hlm_reqs to the free-list */
-	for (i = 0; i < DEFAULT_POOL_SIZE; i++) {
-		h4h_hlm_req_t* item = NULL;
-		if ((item = (h4h_hlm_req_t*)h4h_malloc (sizeof (h4h_hlm_req_t))) == NULL) {
-			h4h_error ("h4h_malloc () failed");
-			goto fail;
+	/* add hlm_reqs to the stack */
+	if (__hlm_reqs_pool_grow_items (pool, DEFAULT_POOL_SIZE) != 0)
+		goto fail;
+
+	/* add slabs to the slab stacks */
+	for (c = 0; c < H4H_HLM_REQS_NR_SLAB_CLASSES; c++) {
+		for (i = 0; i < __slab_nr_init[c]; i++) {
+			h4h_hlm_reqs_slab_t* slab = NULL;
+			if ((slab = __hlm_reqs_pool_grow_slabs (pool, c)) == NULL)
+				goto fail;
+			__lfs_push (&pool->slabs[c], slab->idx);
 		}
-		hlm_reqs_pool_allocate_llm_reqs (item->llm_reqs, H4H_BLKIO_MAX_VECS, RP_MEM_VIRT);
-		h4h_sema_init (&item->done);
-		list_add_tail (&item->list, &pool->free_list);
 	}
 
 	return pool;
 
 fail:
 	/* oops! it failed */
-	if (pool) {
-		struct list_head* next = NULL;
-		struct list_head* temp = NULL;
-		h4h_hlm_req_t* item = NULL;
-		list_for_each_safe (next, temp, &pool->free_list) {
-			item = list_entry (next, h4h_hlm_req_t, list);
-			list_del (&item->list);
-			hlm_reqs_pool_release_llm_reqs (item->llm_reqs, H4H_BLKIO_MAX_VECS, RP_MEM_VIRT);
-			h4h_sema_free (&item->done);
-			h4h_free (item);
-		}
-		h4h_spin_lock_destory (&pool->lock);
-		h4h_free (pool);
-		pool = NULL;
-	}
+	h4h_hlm_reqs_pool_destroy (pool);
 	return NULL;
 }
 
 void h4h_hlm_reqs_pool_destroy (
 	h4h_hlm_reqs_pool_t* pool)
 {
-	struct list_head* next = NULL;
-	struct list_head* temp = NULL;
-	h4h_hlm_req_t* item = NULL;
-	int32_t count = 0;
+	int32_t count = 0, i, c;
 
 	if (!pool) return;
 
-	/* free & remove items from the used_list */
-	list_for_each_safe (next, temp, &pool->used_list) {
-		item = list_entry (next, h4h_hlm_req_t, list);
-		list_del (&item->list);
-		hlm_reqs_pool_release_llm_reqs (item->llm_reqs, H4H_BLKIO_MAX_VECS, RP_MEM_VIRT);
-		h4h_sema_free (&item->done);
-		h4h_free (item);
+	/* count free items to see if all of them were returned */
+	for (i = 0; i < H4H_HLM_REQS_NR_CACHES; i++) {
+		count += pool->caches[i].nr_items;
+		h4h_spin_lock_destory (&pool->caches[i].lock);
+	}
+	while (__lfs_pop (&pool->items) != NULL)
 		count++;
+	if (count != pool->pool_size) {
+		h4h_warning ("oops! count != pool->pool_size (%d != %d)",
+			count, pool->pool_size);
 	}
 
-	/* free & remove items from the free_list */
-	list_for_each_safe (next, temp, &pool->free_list) {
-		item = list_entry (next, h4h_hlm_req_t, list);
-		list_del (&item->list);
-		hlm_reqs_pool_release_llm_reqs (item->llm_reqs, H4H_BLKIO_MAX_VECS, RP_MEM_VIRT);
+	/* free all items and slabs (registered ones are all in the stacks) */
+	for (i = 0; i < pool->items.nr_objs; i++) {
+		h4h_hlm_req_t* item = (h4h_hlm_req_t*)__lfs_node (&pool->items, i)->obj;
 		h4h_sema_free (&item->done);
 		h4h_free (item);
-		count++;
 	}
+	__lfs_free (&pool->items);
 
-	if (count != pool->pool_size) {
-		h4h_warning ("oops! count != pool->pool_size (%d != %d)",
-			count, pool->pool_size);
+	for (c = 0; c < H4H_HLM_REQS_NR_SLAB_CLASSES; c++) {
+		for (i = 0; i < pool->slabs[c].nr_objs; i++)
+			__hlm_reqs_pool_free_slab ((h4h_hlm_reqs_slab_t*)__lfs_node (&pool->slabs[c], i)->obj);
+		__lfs_free (&pool->slabs[c]);
 	}
 
 	/* free other stuff */
-	h4h_spin_lock_destory (&pool->lock);
+	h4h_mutex_free (&pool->grow_lock);
 	h4h_free (pool);
 }
 
+static inline h4h_hlm_reqs_cache_t* __hlm_reqs_pool_get_cache (
+	h4h_hlm_reqs_pool_t* pool)
+{
+	int cpu = __hlm_reqs_pool_cpu ();
+	return &pool->caches[(cpu < 0 ? 0 : cpu) % H4H_HLM_REQS_NR_CACHES];
+}
+
 h4h_hlm_req_t* h4h_hlm_reqs_pool_get_item (
 	h4h_hlm_reqs_pool_t* pool)
 {
-	struct list_head* pos = NULL;
 	h4h_hlm_req_t* item = NULL;
 
-	h4h_spin_lock (&pool->lock);
+	for (;;) {
+		h4h_hlm_reqs_cache_t* cache = __hlm_reqs_pool_get_cache (pool);
 
-again:
-	/* see if there are free items in the free_list */
-	list_for_each (pos, &pool->free_list) {
-		item = list_entry (pos, h4h_hlm_req_t, list);
-		break;
-	}
+		/* the cache is used by another thread on the same cpu; the global
+		 * stack is cheaper than waiting for it */
+		if (!h4h_spin_try_lock (&cache->lock)) {
+			if ((item = (h4h_hlm_req_t*)__lfs_pop (&pool->items)) != NULL)
+				return item;
+			h4h_spin_lock (&cache->lock);
+		}
 
-	/* oops! there are no free items in the free-list */
-	if (item == NULL) {
-		int i = 0;
-		h4h_msg ("size of pool: %u", pool->pool_size + DEFAULT_POOL_INC_SIZE);
-		/* add more items to the free-list */
-		for (i = 0; i < DEFAULT_POOL_INC_SIZE; i++) {
-			h4h_hlm_req_t* item = NULL;
-			if ((item = (h4h_hlm_req_t*)h4h_malloc (sizeof (h4h_hlm_req_t))) == NULL) {
-				h4h_error ("h4h_malloc () failed");
-				goto fail;
-			}
-			hlm_reqs_pool_allocate_llm_reqs (item->llm_reqs, H4H_BLKIO_MAX_VECS, RP_MEM_VIRT);
-			h4h_sema_init (&item->done);
-			list_add_tail (&item->list, &pool->free_list);
+		/* refill the cache from the global stack */
+		if (cache->nr_items == 0) {
+			while (cache->nr_items < DEFAULT_CACHE_BATCH &&
+					(item = (h4h_hlm_req_t*)__lfs_pop (&pool->items)) != NULL)
+				cache->items[cache->nr_items++] = item;
+		}
+		if (cache->nr_items > 0) {
+			item = cache->items[--cache->nr_items];
+			h4h_spin_unlock (&cache->lock);
+			return item;
 		}
-		/* increase the size of the pool */
-		pool->pool_size += DEFAULT_POOL_INC_SIZE;
 
-		/* try it again */
-		goto again;
-	}
+		h4h_spin_unlock (&cache->lock);
 
-	if (item == NULL)
-		goto fail;
+		/* oops! there are no free items; add more items to the pool */
+		h4h_msg ("size of pool: %u", pool->pool_size + DEFAULT_POOL_INC_SIZE);
+		if (__hlm_reqs_pool_grow_items (pool, DEFAULT_POOL_INC_SIZE) != 0)
+			return NULL;
+	}
+}
 
-	/* move it to the used_list */
-	list_del (&item->list);
-	list_add_tail (&item->list, &pool->used_list);
+void h4h_hlm_reqs_pool_free_item (
+	h4h_hlm_reqs_pool_t* pool, 
+	h4h_hlm_req_t* item)
+{
+	h4h_hlm_reqs_slab_t* slab = (h4h_hlm_reqs_slab_t*)item->llm_slab;
+	h4h_hlm_reqs_cache_t* cache = NULL;
 
-	h4h_spin_unlock (&pool->lock);
-	return item;
+	h4h_sema_unlock (&item->done);
 
-fail:
+	if (slab) {
+		__lfs_push (&pool->slabs[slab->class], slab->idx);
+		item->llm_slab = NULL;
+		item->llm_reqs = NULL;
+	}
 
-	h4h_spin_unlock (&pool->lock);
-	return NULL;
+	cache = __hlm_reqs_pool_get_cache (pool);
+	if (!h4h_spin_try_lock (&cache->lock)) {
+		__lfs_push (&pool->items, item->pool_idx);
+		return;
+	}
+	/* spill a half of the cache to the global stack if it is full */
+	if (cache->nr_items == H4H_HLM_REQS_CACHE_SIZE) {
+		while (cache->nr_items > H4H_HLM_REQS_CACHE_SIZE - DEFAULT_CACHE_BATCH)
+			__lfs_push (&pool->items, cache->items[--cache->nr_items]->pool_idx);
+	}
+	cache->items[cache->nr_items++] = item;
+	h4h_spin_unlock (&cache->lock);
 }
 
-void h4h_hlm_reqs_pool_free_item (
+/* attach 'nr_llm_reqs' llm_reqs to 'hr' (it must have none) */
+int h4h_hlm_reqs_pool_alloc_llm_reqs (
 	h4h_hlm_reqs_pool_t* pool, 
-	h4h_hlm_req_t* item)
+	h4h_hlm_req_t* hr, 
+	int32_t nr_llm_reqs)
 {
-	h4h_sema_unlock (&item->done);
+	h4h_hlm_reqs_slab_t* slab = NULL;
+	int32_t c = 0;
+
+	h4h_bug_on (hr->llm_slab != NULL);
+
+	/* choose the smallest class that fits */
+	while (c < H4H_HLM_REQS_NR_SLAB_CLASSES - 1 && __slab_nr_llm_reqs[c] < nr_llm_reqs)
+		c++;
+	if (nr_llm_reqs > __slab_nr_llm_reqs[c]) {
+		h4h_error ("too many llm_reqs (%d)", nr_llm_reqs);
+		return 1;
+	}
 
-	h4h_spin_lock (&pool->lock);
-	list_del (&item->list);
-	list_add_tail (&item->list, &pool->free_list);
-	h4h_spin_unlock (&pool->lock);
+	/* oops! there are no free slabs; make a new one */
+	if ((slab = (h4h_hlm_reqs_slab_t*)__lfs_pop (&pool->slabs[c])) == NULL &&
+		(slab = __hlm_reqs_pool_grow_slabs (pool, c)) == NULL)
+		return 1;
+
+	hr->llm_slab = (void*)slab;
+	hr->llm_reqs = slab->llm_reqs;
+
+	return 0;
 }
 
 static int __hlm_reqs_pool_create_trim_req  (
@@ -231,7 +434,7 @@ static int __hlm_reqs_pool_create_trim_req  (
 	sec_end = H4H_ALIGN_DOWN (br->bi_offset + br->bi_size, NR_KSECTORS_IN(pool->map_unit));
 
 	/* initialize variables */
-	hr->req_type = br->bi_rw;
+	hr->req_type = h4h_strip_host_flags (br->bi_rw);
 	h4h_stopwatch_start (&hr->sw);
 	if (sec_start < sec_end) {
 		hr->lpa = (sec_start) / NR_KSECTORS_IN(pool->map_unit);
@@ -246,6 +449,22 @@ static int __hlm_reqs_pool_create_trim_req  (
 	return 0;
 }
 
+static int __hlm_reqs_pool_create_flush_req  (
+	h4h_hlm_reqs_pool_t* pool, 
+	h4h_hlm_req_t* hr,
+	h4h_blkio_req_t* br)
+{
+	/* a flush carries no data; the hlm decides what must be written out */
+	hr->req_type = REQTYPE_FLUSH;
+	h4h_stopwatch_start (&hr->sw);
+	hr->lpa = 0;
+	hr->len = 0;
+	hr->blkio_req = (void*)br;
+	hr->ret = 0;
+
+	return 0;
+}
+
 void hlm_reqs_pool_allocate_llm_reqs (
 	h4h_llm_req_t* llm_reqs, 
 	int32_t nr_llm_reqs,
@@ -363,6 +582,8 @@ static int __hlm_reqs_pool_create_write_req (
 	/* build llm_reqs */
 	nr_llm_reqs = H4H_ALIGN_UP ((sec_end - sec_start), NR_KSECTORS_IN(pool->io_unit)) / NR_KSECTORS_IN(pool->io_unit);
 	h4h_bug_on (nr_llm_reqs > H4H_BLKIO_MAX_VECS);
+	if (h4h_hlm_reqs_pool_alloc_llm_reqs (pool, hr, nr_llm_reqs) != 0)
+		return 1;
 
 	ptr_lr = &hr->llm_reqs[0];
 	for (i = 0; i < nr_llm_reqs; i++) {
@@ -403,8 +624,8 @@ static int __hlm_reqs_pool_create_write_req (
 		hlm_reqs_pool_alloc_fmain_pad (ptr_fm);
 
 		/* decide the reqtype for llm_req */
-		ptr_lr->req_type = br->bi_rw;
-		if (hole == 1 && pool->in_place_rmw && br->bi_rw == REQTYPE_WRITE) {
+		ptr_lr->req_type = h4h_strip_host_flags (br->bi_rw);
+		if (hole == 1 && pool->in_place_rmw && ptr_lr->req_type == REQTYPE_WRITE) {
 			/* NOTE: if there are holes and map-unit is equal to io-unit, we
 			 * should perform old-fashioned RMW operations */
 			ptr_lr->req_type = REQTYPE_RMW_READ;
@@ -418,7 +639,7 @@ static int __hlm_reqs_pool_create_write_req (
 	h4h_bug_on (bvec_cnt != br->bi_bvec_cnt);
 
 	/* intialize hlm_req */
-	hr->req_type = br->bi_rw;
+	hr->req_type = h4h_strip_host_flags (br->bi_rw);
 	h4h_stopwatch_start (&hr->sw);
 	hr->nr_llm_reqs = nr_llm_reqs;
 	atomic64_set (&hr->nr_llm_reqs_done, 0);
@@ -444,6 +665,8 @@ static int __hlm_reqs_pool_create_read_req (
 
 	/* build llm_reqs */
 	nr_llm_reqs = pg_end - pg_start;
+	if (h4h_hlm_reqs_pool_alloc_llm_reqs (pool, hr, nr_llm_reqs) != 0)
+		return 1;
 
 	ptr_lr = &hr->llm_reqs[0];
 	for (i = 0; i < nr_llm_reqs; i++) {
@@ -458,7 +681,7 @@ static int __hlm_reqs_pool_create_read_req (
 		hlm_reqs_pool_alloc_fmain_pad (&ptr_lr->fmain);
 
 		hlm_reqs_pool_reset_logaddr (&ptr_lr->logaddr);
-		ptr_lr->req_type = br->bi_rw;
+		ptr_lr->req_type = h4h_strip_host_flags (br->bi_rw);
 		ptr_lr->logaddr.lpa[0] = pg_start / NR_KPAGES_IN(pool->map_unit);
 		if (pool->in_place_rmw == 1) 
 			ptr_lr->logaddr.ofs = 0;		/* offset in llm is already decided */
@@ -474,7 +697,7 @@ static int __hlm_reqs_pool_create_read_req (
 	h4h_bug_on (bvec_cnt != br->bi_bvec_cnt);
 
 	/* intialize hlm_req */
-	hr->req_type = br->bi_rw;
+	hr->req_type = h4h_strip_host_flags (br->bi_rw);
 	h4h_stopwatch_start (&hr->sw);
 	hr->nr_llm_reqs = nr_llm_reqs;
 	atomic64_set (&hr->nr_llm_reqs_done, 0);
@@ -490,20 +713,24 @@ int h4h_hlm_reqs_pool_build_req (
 	h4h_hlm_req_t* hr,
 	h4h_blkio_req_t* br)
 {
+	uint64_t rw = h4h_strip_host_flags (br->bi_rw);
 	int ret = 1;
 
-	/* create a hlm_req using a bio */
-	if (br->bi_rw == REQTYPE_TRIM) {
+	/* create a hlm_req using a bio; host flags (e.g., FUA) are kept in the
+	 * blkio_req so that the hlm can see them */
+	if (rw == REQTYPE_TRIM) {
 		ret = __hlm_reqs_pool_create_trim_req (pool, hr, br);
-	} else if (br->bi_rw == REQTYPE_WRITE) {
+	} else if (rw == REQTYPE_FLUSH) {
+		ret = __hlm_reqs_pool_create_flush_req (pool, hr, br);
+	} else if (rw == REQTYPE_WRITE) {
 		ret = __hlm_reqs_pool_create_write_req (pool, hr, br);
-	} else if (br->bi_rw == REQTYPE_READ) {
+	} else if (rw == REQTYPE_READ) {
 		ret = __hlm_reqs_pool_create_read_req (pool, hr, br);
 	}
 
 	/* are there any errors? */
 	if (ret != 0) {
-		h4h_error ("oops! invalid request type: (%llx)", br->bi_rw);
+		h4h_error ("oops! failed to build a hlm_req: (%llx)", br->bi_rw);
 		return 1;
 	}
 
@@ -520,49 +747,136 @@ void hlm_reqs_pool_relocate_kp (h4h_llm_req_t* lr, uint64_t new_sp_ofs)
 	}
 }
 
+h4h_hlm_reqs_gc_pads_t* hlm_reqs_pool_create_gc_pads (
+	h4h_llm_req_t* lrs, 
+	uint64_t nr_lrs, 
+	uint64_t nr_kps)
+{
+	h4h_hlm_reqs_gc_pads_t* pads = NULL;
+	uint64_t i, k;
+
+	if ((pads = (h4h_hlm_reqs_gc_pads_t*)h4h_zmalloc (sizeof (h4h_hlm_reqs_gc_pads_t))) == NULL ||
+		(pads->bufs = (uint8_t**)h4h_zmalloc (sizeof (uint8_t*) * nr_lrs * nr_kps)) == NULL) {
+		h4h_error ("h4h_zmalloc () failed");
+		goto fail;
+	}
+	pads->nr_lrs = nr_lrs;
+	pads->nr_kps = nr_kps;
+
+	for (i = 0; i < nr_lrs; i++) {
+		for (k = 0; k < nr_kps; k++) {
+			if ((pads->bufs[i * nr_kps + k] = (uint8_t*)h4h_malloc_phy (KPAGE_SIZE)) == NULL) {
+				h4h_error ("h4h_malloc_phy () failed");
+				goto fail;
+			}
+			lrs[i].fmain.kp_pad[k] = pads->bufs[i * nr_kps + k];
+		}
+	}
+
+	return pads;
+
+fail:
+	hlm_reqs_pool_destroy_gc_pads (pads, lrs);
+	return NULL;
+}
+
+void hlm_reqs_pool_destroy_gc_pads (
+	h4h_hlm_reqs_gc_pads_t* pads, 
+	h4h_llm_req_t* lrs)
+{
+	uint64_t i, k;
+
+	if (pads == NULL)
+		return;
+
+	if (pads->bufs) {
+		for (i = 0; i < pads->nr_lrs; i++) {
+			for (k = 0; k < pads->nr_kps; k++) {
+				if (pads->bufs[i * pads->nr_kps + k] == NULL)
+					continue;
+				lrs[i].fmain.kp_pad[k] = NULL;
+				h4h_free_phy (pads->bufs[i * pads->nr_kps + k]);
+			}
+		}
+		h4h_free (pads->bufs);
+	}
+	h4h_free (pads);
+}
+
+/* pack the valid kernel pages of 'src' into 'dst'; only the llm_reqs of
+ * 'src' that were read and the llm_reqs of 'dst' that are filled are
+ * touched, and the kernel pages are handed over by pointer. 'ppas' are the
+ * 'nr_ppas' pages to be written (in the order they were allocated); the
+ * llm_reqs of 'dst' come out with them, grouped by punit, and ready to be
+ * written: lpas are taken from the oob of 'src' and holes are padded.
+ * 'punit_ofs' is a scratch array of nr_punits entries */
 void hlm_reqs_pool_write_compaction (
 	h4h_hlm_req_gc_t* dst, 
 	h4h_hlm_req_gc_t* src, 
+	h4h_phyaddr_t* ppas,
+	uint64_t nr_ppas,
+	uint64_t* punit_ofs,
 	h4h_device_params_t* np)
 {
-	uint64_t dst_loop = 0, dst_kp = 0, src_kp = 0, i = 0;
-	uint64_t nr_punits = np->nr_chips_per_channel * np->nr_channels;
+	uint64_t nr_punits = np->nr_channels * np->nr_chips_per_channel;
+	uint64_t dst_kp = 0, src_kp = 0, nr_dst = 0, i = 0, ofs = 0;
 
 	h4h_llm_req_t* dst_r = NULL;
 	h4h_llm_req_t* src_r = NULL;
 
-	dst->nr_llm_reqs = 0;
-	for (i = 0; i < nr_punits * np->nr_pages_per_block; i++)
-		hlm_reqs_pool_reset_fmain (&dst->llm_reqs[i].fmain);
+	/* the first dst llm_req of each punit; pages of a punit keep their
+	 * order, so they are still programmed in sequence */
+	for (i = 0; i < nr_punits; i++)
+		punit_ofs[i] = 0;
+	for (i = 0; i < nr_ppas; i++)
+		punit_ofs[ppas[i].punit_id]++;
+	for (i = 0; i < nr_punits; i++) {
+		uint64_t n = punit_ofs[i];
+		punit_ofs[i] = ofs;
+		ofs += n;
+	}
 
-	dst_r = &dst->llm_reqs[0];
-	dst->nr_llm_reqs = 1;
-	for (i = 0; i < nr_punits * np->nr_pages_per_block; i++) {
+	for (i = 0; i < src->nr_llm_reqs; i++) {
 		src_r = &src->llm_reqs[i];
 
 		for (src_kp = 0; src_kp < np->nr_subpages_per_page; src_kp++) {
-			if (src_r->fmain.kp_stt[src_kp] == KP_STT_DATA) {
-				/* if src has data, copy it to dst */
-				dst_r->fmain.kp_stt[dst_kp] = src_r->fmain.kp_stt[src_kp];
-				dst_r->fmain.kp_ptr[dst_kp] = src_r->fmain.kp_ptr[src_kp];
-				dst_r->logaddr.lpa[dst_kp] = src_r->logaddr.lpa[src_kp];
-				((int64_t*)dst_r->foob.data)[dst_kp] = ((int64_t*)src_r->foob.data)[src_kp];
-			} else {
-				/* otherwise, skip it */
+			int64_t lpa;
+
+			if (src_r->fmain.kp_stt[src_kp] != KP_STT_DATA)
 				continue;
+
+			/* start a new dst llm_req in the slot of its punit */
+			if (dst_kp == 0) {
+				h4h_bug_on (nr_dst >= nr_ppas);
+				dst_r = &dst->llm_reqs[punit_ofs[ppas[nr_dst].punit_id]++];
+				hlm_reqs_pool_reset_fmain (&dst_r->fmain);
+				hlm_reqs_pool_reset_logaddr (&dst_r->logaddr);
+				dst_r->req_type = REQTYPE_GC_WRITE;
+				dst_r->phyaddr = ppas[nr_dst];
+				dst_r->ptr_hlm_req = (void*)dst;
+				dst_r->ret = 0;
+				nr_dst++;
 			}
 
+			/* hand the data over to dst; its lpa is kept in the oob */
+			lpa = ((int64_t*)src_r->foob.data)[src_kp];
+			dst_r->fmain.kp_stt[dst_kp] = KP_STT_DATA;
+			dst_r->fmain.kp_ptr[dst_kp] = src_r->fmain.kp_ptr[src_kp];
+			dst_r->logaddr.lpa[dst_kp] = lpa;
+			((int64_t*)dst_r->foob.data)[dst_kp] = lpa;
+
 			/* goto the next llm if all kps are full */
-			dst_kp++;
-			if (dst_kp == np->nr_subpages_per_page) {
+			if (++dst_kp == np->nr_subpages_per_page)
 				dst_kp = 0;
-				dst_loop++;
-				dst_r++;
-				dst->nr_llm_reqs++;
-			}
 		}
 	}
-
-	for (i = 0; i < nr_punits * np->nr_pages_per_block; i++)
-		hlm_reqs_pool_alloc_fmain_pad (&dst->llm_reqs[i].fmain);
+	h4h_bug_on (nr_dst != nr_ppas);
+	dst->nr_llm_reqs = nr_dst;
+
+	/* only the last one can have holes */
+	if (dst_kp != 0) {
+		for (src_kp = dst_kp; src_kp < np->nr_subpages_per_page; src_kp++)
+			((int64_t*)dst_r->foob.data)[src_kp] = -1;
+		hlm_reqs_pool_alloc_fmain_pad (&dst_r->fmain);
+	}
 }
@@ -25,10 +25,48 @@ THE SOFTWARE.
 #ifndef _H4H_HLM_REQ_POOL_H
 #define _H4H_HLM_REQ_POOL_H
 
+/* llm_reqs are kept in slabs of a few size classes (1, 8, 32, 128, and 512),
+ * so that a small request does not hold H4H_BLKIO_MAX_VECS llm_reqs */
+#define H4H_HLM_REQS_NR_SLAB_CLASSES 5
+
+typedef struct {
+	uint32_t idx;	/* in the slab stack of its class */
+	int32_t class;
+	h4h_llm_req_t llm_reqs[0];
+} h4h_hlm_reqs_slab_t;
+
+/* a lock-free stack of objects. an object is named by its index, so that the
+ * head keeps an ABA tag together with the index of the top in 64 bits. nodes
+ * are never freed until the stack is destroyed. */
+#define H4H_HLM_REQS_LFS_CHUNK		256
+#define H4H_HLM_REQS_LFS_MAX_CHUNKS	1024
+
+typedef struct {
+	void* obj;
+	volatile uint32_t next;	/* idx + 1 of the next node (0: none) */
+} h4h_hlm_reqs_lfnode_t;
+
+typedef struct {
+	atomic64_t head;	/* (tag << 32) | (idx + 1) */
+	uint32_t nr_objs;	/* it only grows (with grow_lock) */
+	h4h_hlm_reqs_lfnode_t* dir[H4H_HLM_REQS_LFS_MAX_CHUNKS];
+} h4h_hlm_reqs_lfstack_t;
+
+/* a per-cpu cache of free items in front of the global stack */
+#define H4H_HLM_REQS_NR_CACHES		64
+#define H4H_HLM_REQS_CACHE_SIZE		32
+
 typedef struct {
 	h4h_spinlock_t lock;
-	struct list_head used_list;
-	struct list_head free_list;
+	uint32_t nr_items;
+	h4h_hlm_req_t* items[H4H_HLM_REQS_CACHE_SIZE];
+} __attribute__ ((aligned (64))) h4h_hlm_reqs_cache_t;
+
+typedef struct {
+	h4h_hlm_reqs_cache_t caches[H4H_HLM_REQS_NR_CACHES];
+	h4h_hlm_reqs_lfstack_t items;	/* free items */
+	h4h_hlm_reqs_lfstack_t slabs[H4H_HLM_REQS_NR_SLAB_CLASSES];	/* free slabs */
+	h4h_mutex_t grow_lock;	/* only taken to add new items and slabs */
 	int32_t pool_size; 	/* # of items */
 	int32_t map_unit;	/* bytes */
 	int32_t io_unit;	/* bytes */
@@ -40,6 +78,7 @@ void h4h_hlm_reqs_pool_destroy (h4h_hlm_reqs_pool_t* pool);
 h4h_hlm_req_t* h4h_hlm_reqs_pool_get_item (h4h_hlm_reqs_pool_t* pool);
 void h4h_hlm_reqs_pool_free_item (h4h_hlm_reqs_pool_t* pool, h4h_hlm_req_t* req);
 int h4h_hlm_reqs_pool_build_req (h4h_hlm_reqs_pool_t* pool, h4h_hlm_req_t* hr, h4h_blkio_req_t* br);
+int h4h_hlm_reqs_pool_alloc_llm_reqs (h4h_hlm_reqs_pool_t* pool, h4h_hlm_req_t* hr, int32_t nr_llm_reqs);
 
 typedef enum {
 	RP_MEM_VIRT = 0,
@@ -49,10 +88,22 @@ typedef enum {
 void hlm_reqs_pool_allocate_llm_reqs (h4h_llm_req_t* llm_reqs, int32_t nr_llm_reqs, h4h_rp_mem flag);
 void hlm_reqs_pool_release_llm_reqs (h4h_llm_req_t* llm_reqs, int32_t nr_llm_reqs, h4h_rp_mem flag);
 
+/* pads for GC; they are bound to GC read llm_reqs once and reused across GC
+ * cycles. GC is synchronous, so the pads of a cycle are free again once its
+ * GC writes are done */
+typedef struct {
+	uint64_t nr_lrs;
+	uint64_t nr_kps;	/* # of kernel pages per llm_req */
+	uint8_t** bufs;		/* nr_lrs * nr_kps pads */
+} h4h_hlm_reqs_gc_pads_t;
+
+h4h_hlm_reqs_gc_pads_t* hlm_reqs_pool_create_gc_pads (h4h_llm_req_t* lrs, uint64_t nr_lrs, uint64_t nr_kps);
+void hlm_reqs_pool_destroy_gc_pads (h4h_hlm_reqs_gc_pads_t* pads, h4h_llm_req_t* lrs);
+
 void hlm_reqs_pool_reset_fmain (h4h_flash_page_main_t* fmain);
 void hlm_reqs_pool_alloc_fmain_pad (h4h_flash_page_main_t* fmain);
 void hlm_reqs_pool_reset_logaddr (h4h_logaddr_t* logaddr);
 void hlm_reqs_pool_relocate_kp (h4h_llm_req_t* lr, uint64_t new_sp_ofs);
-void hlm_reqs_pool_write_compaction (h4h_hlm_req_gc_t* dst, h4h_hlm_req_gc_t* src, h4h_device_params_t* np);
+void hlm_reqs_pool_write_compaction (h4h_hlm_req_gc_t* dst, h4h_hlm_req_gc_t* src, h4h_phyaddr_t* ppas, uint64_t nr_ppas, uint64_t* punit_ofs, h4h_device_params_t* np);
 
 #endif
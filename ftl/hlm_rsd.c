@@ -22,12 +22,16 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 THE SOFTWARE.
 */
 
+/*
+ * hlm_rsd keeps a write-combining buffer per segment on top of hlm_nobuf.
+ * Host writes are staged in page-sized memory and acknowledged at once;
+ * a segment is written out in the order of its pages when it becomes full,
+ * when it is the LRU victim, or when the host asks for flush/FUA.
+ */
+
 #if defined (KERNEL_MODE)
 #include <linux/module.h>
 #include <linux/blkdev.h>
-#include <linux/delay.h>
-#include <linux/kthread.h>
-#include <linux/sched.h>
 
 #elif defined (USER_MODE)
 #include <stdio.h>
@@ -42,13 +46,12 @@ THE SOFTWARE.
 #include "h4h_drv.h"
 #include "hlm_nobuf.h"
 #include "hlm_rsd.h"
+#include "hlm_reqs_pool.h"
+#include "ftl_params.h"
+#include "umemory.h"
+#include "uthread.h"
 #include "uthash.h"
 
-#include "algo/no_ftl.h"
-#include "algo/block_ftl.h"
-#include "algo/page_ftl.h"
-#include "queue/queue.h"
-
 
 /* interface for hlm_rsd */
 h4h_hlm_inf_t _hlm_rsd_inf = {
@@ -59,47 +62,88 @@ h4h_hlm_inf_t _hlm_rsd_inf = {
 	.end_req = hlm_rsd_end_req,
 };
 
+/* a staged flash page; kp_ptr[i] is NULL if the i-th kernel page is not staged */
 typedef struct {
-	uint32_t seg_no;
-	h4h_hlm_req_t* hlm_req;
-	UT_hash_handle hh;	/* hash header */
-} segment_buf_t;
+	uint8_t* kp_ptr[H4H_MAX_PAGES];
+} h4h_hlm_rsd_page_t;
+
+/* a write-combining buffer for a segment */
+typedef struct {
+	uint64_t seg_no;
+	uint64_t nr_pgs;			/* # of staged pages */
+	h4h_hlm_rsd_page_t* pgs;	/* indexed by the page offset in a segment */
+	struct list_head lru;
+	UT_hash_handle hh;			/* hash header */
+} h4h_hlm_rsd_seg_t;
 
 /* data structures for hlm_rsd */
 typedef struct {
-#if 0
-	h4h_ftl_inf_t* ptr_ftl_inf;	/* for hlm_nobuff (it must be on top of this structure) */
-#endif
+	h4h_hlm_reqs_pool_t* pool;	/* hlm_reqs for write-outs */
+	h4h_hlm_rsd_seg_t* segs;	/* segment buffers hashed by seg_no */
+	struct list_head lru;		/* the head is the most recently written */
+	uint64_t nr_pgs_per_seg;
+	uint64_t nr_kps_per_pg;
+	uint64_t nr_buf_pgs;		/* # of staged pages */
+	uint64_t max_buf_pgs;		/* capacity of the buffer */
+	atomic64_t nr_wouts;		/* # of write-outs in progress */
+
+	/* statistics */
+	uint64_t nr_read_hits;
+	uint64_t nr_full_wouts;
+	uint64_t nr_lru_wouts;
+	uint64_t nr_flush_wouts;
+} h4h_hlm_rsd_private_t;
 
-	/* buffers for segments; NOTE: the contents of buffers must be materialized
-	 * to NAND flash when a flush command arrives. */
-	segment_buf_t* seg_buf;
-}h4h_hlm_rsd_private_t;
 
 /* interface functions for hlm_rsd */
 uint32_t hlm_rsd_create (h4h_drv_info_t* bdi)
 {
 	h4h_hlm_rsd_private_t* p = NULL;
-	h4h_ftl_params* parms = H4H_GET_DRIVER_PARAMS(bdi);
+	h4h_ftl_params* parms = H4H_GET_DRIVER_PARAMS (bdi);
+	h4h_device_params_t* np = H4H_GET_DEVICE_PARAMS (bdi);
+
+	/* check the type of the FTL */
+	if (parms->mapping_type != MAPPING_POLICY_RSD &&
+		parms->mapping_type != MAPPING_POLICY_BLOCK &&
+		parms->mapping_type != MAPPING_POLICY_HYBRID)
+		h4h_warning ("ftl is not for RSD!!!");
+
+	/* a buffered page must be mapped by a single lpa */
+	if (np->nr_subpages_per_page != 1 ||
+		np->page_main_size / KPAGE_SIZE > H4H_MAX_PAGES) {
+		h4h_error ("hlm_rsd requires a page-level mapping unit");
+		return 1;
+	}
 
 	/* create private */
-	if ((p = (h4h_hlm_rsd_private_t*)h4h_malloc
-			(sizeof(h4h_hlm_rsd_private_t))) == NULL) {
-		h4h_error ("h4h_malloc failed");
+	if ((p = (h4h_hlm_rsd_private_t*)h4h_zmalloc
+			(sizeof (h4h_hlm_rsd_private_t))) == NULL) {
+		h4h_error ("h4h_zmalloc failed");
 		return 1;
 	}
 
-#if 0
-	/* setup FTL function pointers */
-	if ((p->ptr_ftl_inf = H4H_GET_FTL_INF (bdi)) == NULL) {
-		h4h_error ("ftl is not valid");
+	/* a segment spans a block of every punit (same as block_ftl) */
+	p->nr_pgs_per_seg = np->nr_pages_per_block * 
+		np->nr_chips_per_channel * np->nr_channels;
+	p->nr_kps_per_pg = np->page_main_size / KPAGE_SIZE;
+	p->max_buf_pgs = (_param_rsd_nr_buf_segs > 0) ? 
+		_param_rsd_nr_buf_segs * p->nr_pgs_per_seg : p->nr_pgs_per_seg;
+	p->segs = NULL;
+	INIT_LIST_HEAD (&p->lru);
+	atomic64_set (&p->nr_wouts, 0);
+
+	/* hlm_reqs used to write out buffers */
+	if ((p->pool = h4h_hlm_reqs_pool_create (
+			np->page_main_size,	/* mapping unit */
+			np->page_main_size	/* io unit */
+			)) == NULL) {
+		h4h_error ("h4h_hlm_reqs_pool_create () failed");
+		h4h_free (p);
 		return 1;
 	}
-#endif
 
-	/* check the type of the FTL */
-	if (parms->mapping_type != MAPPING_POLICY_SEGMENT)
-		h4h_warning ("ftl is not for RSD!!!");
+	h4h_msg ("hlm_rsd: nr_pgs_per_seg = %llu, max_buf_pgs = %llu",
+		p->nr_pgs_per_seg, p->max_buf_pgs);
 
 	/* keep the private structure */
 	bdi->ptr_hlm_inf->ptr_private = (void*)p;
@@ -107,391 +151,406 @@ uint32_t hlm_rsd_create (h4h_drv_info_t* bdi)
 	return 0;
 }
 
+static void __hlm_rsd_flush (h4h_drv_info_t* bdi);
+
 void hlm_rsd_destroy (h4h_drv_info_t* bdi)
 {
 	h4h_hlm_rsd_private_t* p = (h4h_hlm_rsd_private_t*)H4H_HLM_PRIV(bdi);
 
+	/* materialize the buffer before the ftl goes away */
+	__hlm_rsd_flush (bdi);
+
+	h4h_msg ("hlm_rsd: read hits = %llu, write-outs (full/lru/flush) = %llu/%llu/%llu",
+		p->nr_read_hits, p->nr_full_wouts, p->nr_lru_wouts, p->nr_flush_wouts);
+
 	/* free priv */
+	h4h_hlm_reqs_pool_destroy (p->pool);
 	h4h_free (p);
 }
 
-h4h_hlm_req_t* __hlm_rsd_duplicate_hlm_req (
-	h4h_drv_info_t* bdi, 
-	h4h_hlm_req_t* hlm_req)
+static h4h_hlm_rsd_seg_t* __hlm_rsd_find_seg (
+	h4h_hlm_rsd_private_t* p, 
+	uint64_t seg_no)
 {
-	h4h_hlm_req_t* new_hlm_req = NULL;
-	h4h_device_params_t* np = H4H_GET_DEVICE_PARAMS (bdi);
-	uint32_t nr_kp_per_fp = np->page_main_size / KERNEL_PAGE_SIZE;
-	uint32_t i = 0;
+	h4h_hlm_rsd_seg_t* seg = NULL;
+	HASH_FIND (hh, p->segs, &seg_no, sizeof (uint64_t), seg);
+	return seg;
+}
 
-	if (hlm_req->req_type != REQTYPE_WRITE) {
-		h4h_bug_on (1);
-	}
+static h4h_hlm_rsd_seg_t* __hlm_rsd_get_seg (
+	h4h_hlm_rsd_private_t* p, 
+	uint64_t seg_no)
+{
+	h4h_hlm_rsd_seg_t* seg = NULL;
 
-	if ((new_hlm_req = (h4h_hlm_req_t*)h4h_malloc (sizeof (h4h_hlm_req_t))) == NULL) {
-		h4h_bug_on (1);
+	if ((seg = __hlm_rsd_find_seg (p, seg_no)) != NULL) {
+		/* make it the most recently used one */
+		list_del (&seg->lru);
+		list_add (&seg->lru, &p->lru);
+		return seg;
 	}
 
-	new_hlm_req->req_type = hlm_req->req_type;
-	new_hlm_req->lpa = hlm_req->lpa;
-	new_hlm_req->len = hlm_req->len;
-	new_hlm_req->nr_done_reqs = 0;
-	new_hlm_req->ptr_host_req = NULL;
-	new_hlm_req->ret = 0;
-	new_hlm_req->queued = 1;	/* mark it queued */
-	new_hlm_req->sw = hlm_req->sw;
-
-	if ((new_hlm_req->pptr_kpgs = (uint8_t**)h4h_malloc
-			(sizeof(uint8_t*) * new_hlm_req->len * nr_kp_per_fp)) == NULL) {
-		h4h_bug_on (1);
+	/* create a new buffer for the segment */
+	if ((seg = (h4h_hlm_rsd_seg_t*)h4h_zmalloc 
+			(sizeof (h4h_hlm_rsd_seg_t))) == NULL) {
+		h4h_error ("h4h_zmalloc failed");
+		return NULL;
 	}
-	if ((new_hlm_req->kpg_flags = (uint8_t*)h4h_malloc
-			(sizeof(uint8_t) * new_hlm_req->len * nr_kp_per_fp)) == NULL) {
-		h4h_bug_on (1);
-	}
-	for (i = 0; i < new_hlm_req->len * nr_kp_per_fp; i++) {
-		new_hlm_req->kpg_flags[i] = hlm_req->kpg_flags[i];
-		if ((new_hlm_req->pptr_kpgs[i] = (uint8_t*)h4h_malloc (KERNEL_PAGE_SIZE)) == NULL) {
-			h4h_bug_on (1);
-		}
-		h4h_memcpy (
-			new_hlm_req->pptr_kpgs[i], 
-			hlm_req->pptr_kpgs[i], 
-			KERNEL_PAGE_SIZE);
+	if ((seg->pgs = (h4h_hlm_rsd_page_t*)h4h_zmalloc 
+			(sizeof (h4h_hlm_rsd_page_t) * p->nr_pgs_per_seg)) == NULL) {
+		h4h_error ("h4h_zmalloc failed");
+		h4h_free (seg);
+		return NULL;
 	}
+	seg->seg_no = seg_no;
+	seg->nr_pgs = 0;
+	HASH_ADD (hh, p->segs, seg_no, sizeof (uint64_t), seg);
+	list_add (&seg->lru, &p->lru);
 
-	return new_hlm_req;
+	return seg;
 }
 
-void __hlm_rsd_delete_hlm_req (
-	h4h_drv_info_t* bdi, 
-	h4h_hlm_req_t* hlm_req)
+static void __hlm_rsd_put_seg (
+	h4h_hlm_rsd_private_t* p, 
+	h4h_hlm_rsd_seg_t* seg)
 {
-	h4h_device_params_t* np = H4H_GET_DEVICE_PARAMS (bdi);
-	uint32_t nr_kp_per_fp = np->page_main_size / KERNEL_PAGE_SIZE;
-	uint32_t i = 0;
+	h4h_bug_on (seg->nr_pgs != 0);
 
-	for (i = 0; i < hlm_req->len * nr_kp_per_fp; i++) {
-		h4h_free (hlm_req->pptr_kpgs[i]);
-	}
-	h4h_free (hlm_req->pptr_kpgs);
-	h4h_free (hlm_req->kpg_flags);
-	h4h_free (hlm_req);
+	HASH_DEL (p->segs, seg);
+	list_del (&seg->lru);
+	h4h_free (seg->pgs);
+	h4h_free (seg);
 }
 
-uint32_t __hlm_rsd_make_rm_seg (
-	h4h_drv_info_t* bdi, 
-	uint32_t seg_no)
+static uint8_t __hlm_rsd_is_staged (
+	h4h_hlm_rsd_private_t* p, 
+	h4h_hlm_rsd_page_t* pg)
 {
-	h4h_hlm_rsd_private_t* p = (h4h_hlm_rsd_private_t*)H4H_HLM_PRIV(bdi);
-	segment_buf_t* b = NULL;
-
-	HASH_FIND_INT (p->seg_buf, &seg_no, b);
-	if (b != NULL) {
-		HASH_DEL (p->seg_buf, b);
-		__hlm_rsd_delete_hlm_req (bdi, b->hlm_req);
-		h4h_free (b);
-	}
-
+	uint64_t i;
+	for (i = 0; i < p->nr_kps_per_pg; i++)
+		if (pg->kp_ptr[i] != NULL)
+			return 1;
 	return 0;
 }
 
-uint32_t __hlm_rsd_make_req_r (
-	h4h_drv_info_t* bdi, 
-	h4h_hlm_req_t* new_hlm_req)
+static void __hlm_rsd_drop_page (
+	h4h_hlm_rsd_private_t* p, 
+	h4h_hlm_rsd_seg_t* seg,
+	uint64_t ofs)
 {
-	h4h_hlm_rsd_private_t* p = (h4h_hlm_rsd_private_t*)H4H_HLM_PRIV(bdi);
-	h4h_ftl_inf_t* ftl = H4H_GET_FTL_INF(bdi);
-	h4h_device_params_t* np = H4H_GET_DEVICE_PARAMS(bdi);
-	h4h_hlm_req_t* old_hlm_req = NULL;
-	segment_buf_t* b = NULL;
-	uint64_t nr_kp_per_fp = np->page_main_size / KERNEL_PAGE_SIZE;
-	uint32_t seg_no;
-
-	/* if get_segno is not available, handle reqs normally */
-	if (ftl->get_segno == NULL) {
-		goto done;
-	}
-
-	/* [step1] is there a req in seg buff? */
-	seg_no = ftl->get_segno (bdi, new_hlm_req->lpa);
-
-	HASH_FIND_INT (p->seg_buf, &seg_no, b);
-
-	if (b != NULL) {
-		uint64_t lpa_new, lpa_old, new_ofs, old_ofs, i;
-
-		/* see if 'old_hlm_req' is valid or not */
-		if (b->hlm_req == NULL) {
-			h4h_warning ("old_hlm_req is NULL");
-			h4h_bug_on (1);
-		}
-		if (b->seg_no != seg_no) {
-			h4h_warning ("seg_no is different (%u %u)", b->seg_no, seg_no);
-			h4h_bug_on (1);
-		}
-		old_hlm_req = b->hlm_req;
+	h4h_hlm_rsd_page_t* pg = &seg->pgs[ofs];
+	uint64_t i;
 
-		if ((new_hlm_req->lpa + new_hlm_req->len - 1) < old_hlm_req->lpa) {
-			goto done;
-		}
+	if (__hlm_rsd_is_staged (p, pg) == 0)
+		return;
 
-		if (new_hlm_req->lpa > (old_hlm_req->lpa + old_hlm_req->len - 1)) {
-			goto done;
+	for (i = 0; i < p->nr_kps_per_pg; i++) {
+		if (pg->kp_ptr[i] != NULL) {
+			h4h_free_phy (pg->kp_ptr[i]);
+			pg->kp_ptr[i] = NULL;
 		}
+	}
+	seg->nr_pgs--;
+	p->nr_buf_pgs--;
+}
 
-		/* copy the contents of the buffer to new hlm */
-		for (lpa_new = new_hlm_req->lpa; lpa_new < new_hlm_req->lpa + new_hlm_req->len; lpa_new++) {
-			for (lpa_old = old_hlm_req->lpa; lpa_old < old_hlm_req->lpa + old_hlm_req->len; lpa_old++) {
-				if (lpa_new != lpa_old)
-					continue;
-
-#if 0
-				h4h_msg ("\t[%u] CACHE-READ-HIT: %llu(%llu)", seg_no, new_hlm_req->lpa, new_hlm_req->len);
-#endif
-
-				new_ofs = (lpa_new - new_hlm_req->lpa) * nr_kp_per_fp;
-				old_ofs = (lpa_old - old_hlm_req->lpa) * nr_kp_per_fp;
-
-				for (i = 0; i < nr_kp_per_fp; i++) {
-					if (old_hlm_req->kpg_flags[old_ofs + i] == MEMFLAG_KMAP_PAGE) {
-						h4h_memcpy (
-							new_hlm_req->pptr_kpgs[new_ofs + i],
-							old_hlm_req->pptr_kpgs[old_ofs + i],
-							KERNEL_PAGE_SIZE);
-
-						new_hlm_req->kpg_flags[new_ofs + i] |= MEMFLAG_DONE;
-					}
-				}
-
-#if 0
-				for (i = 0; i < nr_kp_per_fp; i++) {
-					if (old_hlm_req->kpg_flags[(lpa_old - old_hlm_req->lpa) * nr_kp_per_fp + i] == MEMFLAG_KMAP_PAGE) {
-						h4h_memcpy (
-							new_hlm_req->pptr_kpgs[(lpa_new - new_hlm_req->lpa) * nr_kp_per_fp + i],
-							old_hlm_req->pptr_kpgs[(lpa_old - old_hlm_req->lpa) * nr_kp_per_fp + i],
-							KERNEL_PAGE_SIZE);
-
-						new_hlm_req->kpg_flags[(lpa_new - new_hlm_req->lpa) * nr_kp_per_fp + i] |= MEMFLAG_DONE;
-					}
-				}
-#endif
-			}
+/* a write-out is done; the staged memory it owns goes away with it */
+static void __hlm_rsd_release_wout (
+	h4h_hlm_rsd_private_t* p, 
+	h4h_hlm_req_t* hr)
+{
+	h4h_llm_req_t* lr = NULL;
+	uint64_t i, j;
+
+	h4h_hlm_for_each_llm_req (lr, hr, i) {
+		for (j = 0; j < H4H_MAX_PAGES; j++) {
+			if (lr->fmain.kp_ptr[j] != NULL && 
+				lr->fmain.kp_ptr[j] != lr->fmain.kp_pad[j])
+				h4h_free_phy (lr->fmain.kp_ptr[j]);
+			lr->fmain.kp_ptr[j] = lr->fmain.kp_pad[j];
 		}
 	}
-
-done:
-	return hlm_nobuf_make_req (bdi, new_hlm_req);
+	h4h_hlm_reqs_pool_free_item (p->pool, hr);
+	atomic64_dec (&p->nr_wouts);
 }
 
-uint32_t __hlm_rsd_make_req_w (
+static void __hlm_rsd_issue_wout (
 	h4h_drv_info_t* bdi, 
-	h4h_hlm_req_t* new_hlm_req)
+	h4h_hlm_req_t* hr)
 {
 	h4h_hlm_rsd_private_t* p = (h4h_hlm_rsd_private_t*)H4H_HLM_PRIV(bdi);
-	h4h_ftl_inf_t* ftl = H4H_GET_FTL_INF(bdi);
-	h4h_device_params_t* np = H4H_GET_DEVICE_PARAMS(bdi);
-	h4h_hlm_req_t* old_hlm_req = NULL;
-	segment_buf_t* b = NULL;
-	uint32_t ret = 0;
-
-	uint64_t nr_kp_per_fp = np->page_main_size / KERNEL_PAGE_SIZE;
-	uint32_t seg_no;
-
-	/* if get_segno is not available, handle reqs normally */
-	if (ftl->get_segno == NULL) {
-		ret = hlm_nobuf_make_req (bdi, new_hlm_req);
-		goto done;
-	}
 
-	/* [step1] is there a req in seg buff? */
-	seg_no = ftl->get_segno (bdi, new_hlm_req->lpa);
+	/* write-outs count down so that only the last completion releases it */
+	atomic64_set (&hr->nr_llm_reqs_done, hr->nr_llm_reqs);
+	if (hlm_nobuf_make_req (bdi, hr) != 0) {
+		h4h_error ("oops! hlm_nobuf_make_req () failed");
+		__hlm_rsd_release_wout (p, hr);
+	}
+}
 
-	HASH_FIND_INT (p->seg_buf, &seg_no, b);
+/* write out the staged pages of a segment in the order of their offsets */
+static void __hlm_rsd_write_out_seg (
+	h4h_drv_info_t* bdi, 
+	h4h_hlm_rsd_seg_t* seg)
+{
+	h4h_hlm_rsd_private_t* p = (h4h_hlm_rsd_private_t*)H4H_HLM_PRIV(bdi);
+	h4h_hlm_req_t* hr = NULL;
+	h4h_llm_req_t* lr = NULL;
+	uint64_t ofs, i;
+
+	for (ofs = 0; ofs < p->nr_pgs_per_seg && seg->nr_pgs > 0; ofs++) {
+		h4h_hlm_rsd_page_t* pg = &seg->pgs[ofs];
+		uint8_t hole = 0;
+
+		if (__hlm_rsd_is_staged (p, pg) == 0)
+			continue;
+
+		/* get a new hlm_req for write-out */
+		if (hr == NULL) {
+			/* the remaining pages of the segment fit in it */
+			if ((hr = h4h_hlm_reqs_pool_get_item (p->pool)) == NULL ||
+				h4h_hlm_reqs_pool_alloc_llm_reqs (p->pool, hr, (seg->nr_pgs < H4H_BLKIO_MAX_VECS) ? 
+					seg->nr_pgs : H4H_BLKIO_MAX_VECS) != 0) {
+				h4h_error ("h4h_hlm_reqs_pool_get_item () failed");
+				h4h_bug_on (1);
+				return;
+			}
+			hr->req_type = REQTYPE_WRITE;
+			h4h_stopwatch_start (&hr->sw);
+			hr->nr_llm_reqs = 0;
+			h4h_sema_lock (&hr->done);
+			hr->blkio_req = NULL;	/* it tells a write-out from host reqs */
+			hr->ret = 0;
+			atomic64_inc (&p->nr_wouts);
+		}
 
-	if (b != NULL) {
-		/* see if 'old_hlm_req' is valid or not */
-		if (b->hlm_req == NULL) {
-			h4h_warning ("old_hlm_req is NULL");
-			h4h_bug_on (1);
+		/* move the staged page to llm_req */
+		lr = &hr->llm_reqs[hr->nr_llm_reqs++];
+		hlm_reqs_pool_reset_fmain (&lr->fmain);
+		hlm_reqs_pool_reset_logaddr (&lr->logaddr);
+		lr->logaddr.lpa[0] = seg->seg_no * p->nr_pgs_per_seg + ofs;
+		for (i = 0; i < p->nr_kps_per_pg; i++) {
+			if (pg->kp_ptr[i] != NULL) {
+				lr->fmain.kp_stt[i] = KP_STT_DATA;
+				lr->fmain.kp_ptr[i] = pg->kp_ptr[i];
+				pg->kp_ptr[i] = NULL;
+			} else {
+				hole = 1;
+			}
 		}
-		if (b->seg_no != seg_no) {
-			h4h_warning ("seg_no is different (%u %u)", b->seg_no, seg_no);
-			h4h_bug_on (1);
+		hlm_reqs_pool_alloc_fmain_pad (&lr->fmain);
+		lr->req_type = (hole == 1 && p->pool->in_place_rmw) ? 
+			REQTYPE_RMW_READ : REQTYPE_WRITE;
+		lr->ptr_hlm_req = (void*)hr;
+		seg->nr_pgs--;
+		p->nr_buf_pgs--;
+
+		if (hr->nr_llm_reqs == H4H_BLKIO_MAX_VECS) {
+			__hlm_rsd_issue_wout (bdi, hr);
+			hr = NULL;
 		}
-		old_hlm_req = b->hlm_req;
+	}
 
-		/* see if new and old ones can be merged or not */
-		if ((old_hlm_req->lpa + old_hlm_req->len - 1) == new_hlm_req->lpa) {
-			uint32_t i = 0;
-			uint32_t ofs = (old_hlm_req->len - 1) * nr_kp_per_fp;
+	if (hr != NULL)
+		__hlm_rsd_issue_wout (bdi, hr);
 
-#if 0
-			h4h_msg ("\t[%u] CACHE-WRITE-HIT: %llu(%llu)", seg_no, new_hlm_req->lpa, new_hlm_req->len);
-#endif
+	__hlm_rsd_put_seg (p, seg);
+}
 
-			/* merge old and new requests */
-			for (i = 0; i < nr_kp_per_fp; i++) {
-				if (old_hlm_req->kpg_flags[ofs+i] == MEMFLAG_FRAG_PAGE &&
-					new_hlm_req->kpg_flags[i] == MEMFLAG_KMAP_PAGE) {
-					h4h_memcpy (
-						old_hlm_req->pptr_kpgs[ofs+i],
-						new_hlm_req->pptr_kpgs[i],
-						KERNEL_PAGE_SIZE);
-
-#if 0
-					h4h_msg ("\t\tmemcpy: new (%u) => old (%u)", ofs+i, i);
-#endif
-				}
-				new_hlm_req->kpg_flags[i] |= MEMFLAG_DONE;
-			}
+static void __hlm_rsd_wait_wouts (h4h_hlm_rsd_private_t* p)
+{
+	while (atomic64_read (&p->nr_wouts) > 0)
+		h4h_thread_yield ();
+}
 
-			/* finish the new req if its length is 1 */
-			if (new_hlm_req->len == 1) {
-#if 0
-				h4h_msg ("\t[%u] DIRECT-WRITE-IGNORE: %llu(%llu)", seg_no, new_hlm_req->lpa, new_hlm_req->len);
-#endif
-				bdi->ptr_host_inf->end_req (bdi, new_hlm_req);
-				new_hlm_req = NULL;
-			} else {
-				/* otherwise, reduce its length by 1 */
-				new_hlm_req->lpa++;
-				new_hlm_req->len--;
+static int __hlm_rsd_cmp_seg (h4h_hlm_rsd_seg_t* a, h4h_hlm_rsd_seg_t* b)
+{
+	if (a->seg_no < b->seg_no) return -1;
+	if (a->seg_no > b->seg_no) return 1;
+	return 0;
+}
+
+/* write out all the buffers in lpa order and wait for them */
+static void __hlm_rsd_flush (h4h_drv_info_t* bdi)
+{
+	h4h_hlm_rsd_private_t* p = (h4h_hlm_rsd_private_t*)H4H_HLM_PRIV(bdi);
+	h4h_hlm_rsd_seg_t* seg = NULL;
+	h4h_hlm_rsd_seg_t* tmp = NULL;
 
-				new_hlm_req->org_kpg_flags = new_hlm_req->kpg_flags;
-				new_hlm_req->org_pptr_kpgs = new_hlm_req->pptr_kpgs;
+	HASH_SRT (hh, p->segs, __hlm_rsd_cmp_seg);
+	HASH_ITER (hh, p->segs, seg, tmp) {
+		__hlm_rsd_write_out_seg (bdi, seg);
+		p->nr_flush_wouts++;
+	}
+	__hlm_rsd_wait_wouts (p);
+}
 
-				new_hlm_req->pptr_kpgs+=nr_kp_per_fp;
-				new_hlm_req->kpg_flags+=nr_kp_per_fp;
+static uint32_t __hlm_rsd_make_write_req (
+	h4h_drv_info_t* bdi, 
+	h4h_hlm_req_t* hr)
+{
+	h4h_hlm_rsd_private_t* p = (h4h_hlm_rsd_private_t*)H4H_HLM_PRIV(bdi);
+	h4h_blkio_req_t* br = (h4h_blkio_req_t*)hr->blkio_req;
+	h4h_hlm_rsd_seg_t* seg = NULL;
+	h4h_llm_req_t* lr = NULL;
+	uint64_t i, j;
+
+	/* (1) stage the data of the host */
+	h4h_hlm_for_each_llm_req (lr, hr, i) {
+		uint64_t lpa = lr->logaddr.lpa[0];
+		h4h_hlm_rsd_page_t* pg = NULL;
+
+		if ((seg = __hlm_rsd_get_seg (p, lpa / p->nr_pgs_per_seg)) == NULL)
+			return 1;
+		pg = &seg->pgs[lpa % p->nr_pgs_per_seg];
+
+		if (__hlm_rsd_is_staged (p, pg) == 0) {
+			seg->nr_pgs++;
+			p->nr_buf_pgs++;
+		}
+		for (j = 0; j < p->nr_kps_per_pg; j++) {
+			if (lr->fmain.kp_stt[j] != KP_STT_DATA)
+				continue;
+			if (pg->kp_ptr[j] == NULL && 
+				(pg->kp_ptr[j] = (uint8_t*)h4h_malloc_phy (KPAGE_SIZE)) == NULL) {
+				h4h_error ("h4h_malloc_phy failed");
+				return 1;
 			}
-		} else {
-			/* This is not a common case, but this is not error as well.
-			 * For RISA, we submit it before writing new req */
+			h4h_memcpy (pg->kp_ptr[j], lr->fmain.kp_ptr[j], KPAGE_SIZE);
 		}
-
-		/* remove it from the hash table */
-		HASH_DEL (p->seg_buf, b);
-		h4h_free (b);
 	}
 
-	/* [step2] submit a prev req if it is available */
-	if (old_hlm_req) {
-#if 0
-		h4h_msg ("\t[%u] CACHE-WRITE: %llu(%llu) [%x %x %x ... %x]", 
-			seg_no,
-			old_hlm_req->lpa, 
-			old_hlm_req->len,
-			old_hlm_req->pptr_kpgs[1][0],
-			old_hlm_req->pptr_kpgs[1][1],
-			old_hlm_req->pptr_kpgs[1][2],
-			old_hlm_req->pptr_kpgs[1][511]);
-#endif
-
-		if ((ret = hlm_nobuf_make_req (bdi, old_hlm_req)) != 0) {
-			h4h_error ("hlm_nobuf_make_req failed");
-			__hlm_rsd_delete_hlm_req (bdi, old_hlm_req);
-			goto done;
+	/* (2) write out segments that are full or written with FUA */
+	h4h_hlm_for_each_llm_req (lr, hr, i) {
+		uint64_t seg_no = lr->logaddr.lpa[0] / p->nr_pgs_per_seg;
+
+		if ((seg = __hlm_rsd_find_seg (p, seg_no)) == NULL)
+			continue;
+		if (seg->nr_pgs == p->nr_pgs_per_seg) {
+			__hlm_rsd_write_out_seg (bdi, seg);
+			p->nr_full_wouts++;
+		} else if (h4h_is_fua (br->bi_rw)) {
+			__hlm_rsd_write_out_seg (bdi, seg);
+			p->nr_flush_wouts++;
 		}
 	}
 
-	/* [step3] submit or keep the req */
-	if (new_hlm_req) {
-		if (new_hlm_req->kpg_flags[new_hlm_req->len * nr_kp_per_fp - 1] == MEMFLAG_FRAG_PAGE) {
-			uint32_t i = 0;
-#if 0
-			h4h_msg ("\t[%u] CACHE: %llu(%llu) [%x %x %x ... %x]", 
-				seg_no,
-				new_hlm_req->lpa, 
-				new_hlm_req->len, 
-				new_hlm_req->pptr_kpgs[1][0],
-				new_hlm_req->pptr_kpgs[1][1],
-				new_hlm_req->pptr_kpgs[1][2],
-				new_hlm_req->pptr_kpgs[1][511]);
-#endif
-			/* put the req into the buffer */
-			if ((b = (segment_buf_t*)h4h_malloc (sizeof (segment_buf_t))) == NULL) {
-				h4h_bug_on (1);
-			}
-			b->seg_no = seg_no;
-			b->hlm_req = __hlm_rsd_duplicate_hlm_req (bdi, new_hlm_req);
-			HASH_ADD_INT (p->seg_buf, seg_no, b);
-
-			/* finish the req */
-			for (i = 0; i < new_hlm_req->len * nr_kp_per_fp; i++)
-				new_hlm_req->kpg_flags[i] |= MEMFLAG_DONE;
-			bdi->ptr_host_inf->end_req (bdi, new_hlm_req);
-		} else {
-			/* submit the req to NAND flash */
-			ret = hlm_nobuf_make_req (bdi, new_hlm_req);
-		}
+	/* (3) bound the memory by writing out LRU segments */
+	while (p->nr_buf_pgs > p->max_buf_pgs) {
+		seg = list_entry (p->lru.prev, h4h_hlm_rsd_seg_t, lru);
+		__hlm_rsd_write_out_seg (bdi, seg);
+		p->nr_lru_wouts++;
 	}
 
-done:
-	return ret;
+	/* (4) FUA data must be on NAND before the ack */
+	if (h4h_is_fua (br->bi_rw))
+		__hlm_rsd_wait_wouts (p);
+
+	bdi->ptr_host_inf->end_req (bdi, hr);
+
+	return 0;
 }
 
-uint32_t hlm_rsd_make_req (
+static void __hlm_rsd_serve_reads (
 	h4h_drv_info_t* bdi, 
-	h4h_hlm_req_t* hlm_req)
+	h4h_hlm_req_t* hr)
 {
-	uint32_t ret = 1;
-
-	switch (hlm_req->req_type) {
-	case REQTYPE_READ:
-		ret = __hlm_rsd_make_req_r (bdi, hlm_req);
-		break;
-	case REQTYPE_WRITE:
-		ret = __hlm_rsd_make_req_w (bdi, hlm_req);
-		break;
-	case REQTYPE_TRIM:
-		ret = hlm_nobuf_make_req (bdi, hlm_req);
-		break;
-	default:
-		h4h_warning ("unknown req_type (%u)", hlm_req->req_type);
-		break;
-	}
+	h4h_hlm_rsd_private_t* p = (h4h_hlm_rsd_private_t*)H4H_HLM_PRIV(bdi);
+	h4h_hlm_rsd_seg_t* seg = NULL;
+	h4h_llm_req_t* lr = NULL;
+	uint64_t i;
+
+	h4h_hlm_for_each_llm_req (lr, hr, i) {
+		uint64_t lpa = lr->logaddr.lpa[0];
+		int32_t ofs = lr->logaddr.ofs;
+		h4h_hlm_rsd_page_t* pg = NULL;
+
+		if ((seg = __hlm_rsd_find_seg (p, lpa / p->nr_pgs_per_seg)) == NULL)
+			continue;
+		pg = &seg->pgs[lpa % p->nr_pgs_per_seg];
+		if (__hlm_rsd_is_staged (p, pg) == 0)
+			continue;
+
+		if (pg->kp_ptr[ofs] == NULL) {
+			/* the rest of the page is on NAND; let nobuf merge them */
+			__hlm_rsd_write_out_seg (bdi, seg);
+			p->nr_flush_wouts++;
+			__hlm_rsd_wait_wouts (p);
+			continue;
+		}
 
-	return ret;
+		/* serve it from the buffer; llm sees a dummy read */
+		h4h_memcpy (lr->fmain.kp_ptr[ofs], pg->kp_ptr[ofs], KPAGE_SIZE);
+		h4h_memset (&lr->phyaddr, 0x00, sizeof (h4h_phyaddr_t));
+		lr->req_type = REQTYPE_READ_DUMMY;
+		p->nr_read_hits++;
+	}
 }
 
-void __hlm_rsd_end_req (
+static void __hlm_rsd_drop_trim (
 	h4h_drv_info_t* bdi, 
-	h4h_llm_req_t* ptr_llm_req)
+	h4h_hlm_req_t* hr)
 {
-	h4h_hlm_req_t* ptr_hlm_req = (h4h_hlm_req_t* )ptr_llm_req->ptr_hlm_req;
-
-	/* free oob space & ptr_llm_req */
-	if (ptr_llm_req->ptr_oob != NULL) {
-#if 0
-		/* LPA stored on OOB must be the same as  */
-		if (ptr_llm_req->req_type == REQTYPE_READ) {
-			uint64_t lpa = ((uint64_t*)ptr_llm_req->ptr_oob)[0];
-			if (lpa != ptr_llm_req->lpa) {
-				h4h_warning ("%llu != %llu (%llX)", ptr_llm_req->lpa, lpa, lpa);
-			}	
-		}
-#endif
-		h4h_free (ptr_llm_req->ptr_oob);
+	h4h_hlm_rsd_private_t* p = (h4h_hlm_rsd_private_t*)H4H_HLM_PRIV(bdi);
+	h4h_hlm_rsd_seg_t* seg = NULL;
+	h4h_hlm_rsd_seg_t* tmp = NULL;
+
+	/* trimmed pages must not be written out later */
+	HASH_ITER (hh, p->segs, seg, tmp) {
+		uint64_t seg_start = seg->seg_no * p->nr_pgs_per_seg;
+		uint64_t start = (hr->lpa > seg_start) ? hr->lpa : seg_start;
+		uint64_t end = ((hr->lpa + hr->len) < (seg_start + p->nr_pgs_per_seg)) ?
+			(hr->lpa + hr->len) : (seg_start + p->nr_pgs_per_seg);
+
+		for (; start < end; start++)
+			__hlm_rsd_drop_page (p, seg, start - seg_start);
+		if (seg->nr_pgs == 0)
+			__hlm_rsd_put_seg (p, seg);
 	}
-	h4h_free (ptr_llm_req);
+}
 
-	/* increase # of reqs finished */
-	ptr_hlm_req->nr_done_reqs++; 
-	if (ptr_hlm_req->nr_done_reqs == ptr_hlm_req->len) {
-		__hlm_rsd_delete_hlm_req (bdi, ptr_hlm_req);
+uint32_t hlm_rsd_make_req (
+	h4h_drv_info_t* bdi, 
+	h4h_hlm_req_t* hr)
+{
+	h4h_blkio_req_t* br = (h4h_blkio_req_t*)hr->blkio_req;
+
+	/* is req_type correct? */
+	h4h_bug_on (!h4h_is_normal (hr->req_type));
+
+	if (h4h_is_preflush (br->bi_rw))
+		__hlm_rsd_flush (bdi);
+
+	if (h4h_is_flush (hr->req_type)) {
+		__hlm_rsd_flush (bdi);
+		bdi->ptr_host_inf->end_req (bdi, hr);
+		return 0;
+	} else if (h4h_is_trim (hr->req_type)) {
+		__hlm_rsd_drop_trim (bdi, hr);
+	} else if (h4h_is_write (hr->req_type)) {
+		return __hlm_rsd_make_write_req (bdi, hr);
+	} else if (h4h_is_read (hr->req_type)) {
+		__hlm_rsd_serve_reads (bdi, hr);
 	}
+
+	return hlm_nobuf_make_req (bdi, hr);
 }
 
 void hlm_rsd_end_req (
 	h4h_drv_info_t* bdi, 
-	h4h_llm_req_t* ptr_llm_req)
+	h4h_llm_req_t* lr)
 {
-	h4h_hlm_req_t* hlm_req = (h4h_hlm_req_t* )ptr_llm_req->ptr_hlm_req;
+	h4h_hlm_rsd_private_t* p = (h4h_hlm_rsd_private_t*)H4H_HLM_PRIV(bdi);
+	h4h_hlm_req_t* hr = (h4h_hlm_req_t*)lr->ptr_hlm_req;
 
-	if (hlm_req->queued == 1) {
-		__hlm_rsd_end_req (bdi, ptr_llm_req);
-	} else {
-		hlm_nobuf_end_req (bdi, ptr_llm_req);
+	/* gc, host reqs, and read-ahead are handled by hlm_nobuf */
+	if (h4h_is_gc (lr->req_type) || hr->blkio_req != NULL || !h4h_is_write (hr->req_type)) {
+		hlm_nobuf_end_req (bdi, lr);
+		return;
 	}
-}
 
+	/* a write-out of the buffer */
+	lr->req_type |= REQTYPE_DONE;
+	if (atomic64_dec_and_test (&hr->nr_llm_reqs_done))
+		__hlm_rsd_release_wout (p, hr);
+}
@@ -37,14 +37,16 @@ THE SOFTWARE.
 #include "debug.h"
 #include "umemory.h"
 #include "params.h"
+#include "ftl_params.h"
 #include "h4h_drv.h"
 #include "uthread.h"
 #include "pmu.h"
 #include "utime.h"
 
 #include "queue/queue.h"
-#include "queue/prior_queue.h"
+#include "queue/pu_queue.h"
 
+#include "llm_sched.h"
 #include "llm_mq.h"
 
 /* NOTE: This serializes all of the requests from the host file system; 
@@ -60,13 +62,76 @@ h4h_llm_inf_t _llm_mq_inf = {
 	.make_req = llm_mq_make_req,
 	.flush = llm_mq_flush,
 	.end_req = llm_mq_end_req,
+	.barrier = llm_mq_barrier,
+};
+
+/* a dispatcher sends the reqs of a disjoint range of punits; only the
+ * owner of a punit is woken up for it */
+struct h4h_llm_mq_dispatcher {
+	h4h_drv_info_t* bdi;
+	uint64_t punit_start;
+	uint64_t punit_end;	/* exclusive */
+	atomic64_t nr_items;	/* queued + being served in its punits */
+	int64_t poll_us;	/* how long it polls before it parks */
+	uint64_t* order;	/* its punits in the order they are visited */
+	uint64_t first;		/* in 'order'; it moves by one every pass */
+	h4h_thread_t* thread;
+};
+
+/* a barrier is done when all the punits it waits for are drained up to
+ * the items issued before it */
+struct h4h_llm_mq_barrier {
+	atomic64_t nr_pending;	/* # of punits not drained yet */
+	h4h_sema_t done;
+};
+
+struct h4h_llm_mq_waiter {
+	struct list_head list;
+	uint64_t target;	/* # of items of a queue to be done */
+	struct h4h_llm_mq_barrier* b;
+};
+
+/* items of a queue are served in their order, so the first 'n' items done
+ * are the first 'n' issued ones; a barrier waits for all the queues (i.e.,
+ * classes) of a punit */
+struct h4h_llm_mq_queue {
+	atomic64_t nr_issued;
+	atomic64_t nr_done;
+	atomic64_t nr_waiters;
+	h4h_spinlock_t lock;
+	struct list_head waiters;	/* in the order of 'target' */
+};
+
+/* a punit serves a req at a time, but a host read can suspend the program
+ * or erase it serves if the device allows it. the lock of a punit is
+ * released once both of them are done */
+struct h4h_llm_mq_unit {
+	h4h_spinlock_t lock;
+	h4h_llm_req_t* busy;	/* being served */
+	h4h_llm_req_t* read;	/* a read served while 'busy' is suspended */
+	uint64_t nr_suspends;	/* of 'busy' */
 };
 
 /* private */
 struct h4h_llm_mq_private {
 	uint64_t nr_punits;
 	h4h_sema_t* punit_locks;
-	h4h_prior_queue_t* q;
+	struct h4h_llm_mq_unit* units;
+	uint64_t max_suspends;	/* per op (0: no suspends) */
+	h4h_pu_queue_t* q;
+
+	/* a punit has a queue per class of the scheduler */
+	h4h_llm_sched_t* sched;
+	uint64_t nr_classes;
+
+	/* credits for admission; a req takes a global one, and a queue item
+	 * takes one of its punit. they are returned by completions */
+	h4h_sema_t credits;
+	h4h_sema_t* punit_credits;
+	h4h_sema_t rmw_credits_lock;	/* an RMW takes its two credits under it */
+
+	/* for barriers */
+	struct h4h_llm_mq_queue* queues;
 
 	/* for debugging */
 #if defined(ENABLE_SEQ_DBG)
@@ -74,77 +139,384 @@ struct h4h_llm_mq_private {
 #endif	
 
 	/* for thread management */
-	h4h_thread_t* llm_thread;
+	uint64_t nr_dispatchers;
+	uint64_t nr_punits_per_dispatcher;
+	struct h4h_llm_mq_dispatcher* dispatchers;
+	uint64_t* punit_order;	/* 'order' of all the dispatchers */
 };
 
+static inline struct h4h_llm_mq_dispatcher* __llm_mq_owner (
+	struct h4h_llm_mq_private* p,
+	uint64_t punit_id)
+{
+	return &p->dispatchers[punit_id / p->nr_punits_per_dispatcher];
+}
+
+static inline uint64_t __llm_mq_qid (
+	struct h4h_llm_mq_private* p,
+	uint64_t punit_id,
+	h4h_llm_req_t* r)
+{
+	return punit_id * p->nr_classes + p->sched->inf->get_class (r);
+}
+
+/* it sleeps until the punit has a credit; it must not be called in the
+ * completion path, which returns credits */
+static void __llm_mq_get_item (
+	struct h4h_llm_mq_private* p,
+	uint64_t qid)
+{
+	uint64_t punit_id = qid / p->nr_classes;
+
+	h4h_sema_lock (&p->punit_credits[punit_id]);
+	atomic64_inc (&p->queues[qid].nr_issued);
+	atomic64_inc (&__llm_mq_owner (p, punit_id)->nr_items);
+}
+
+/* it completes the barriers that wait for the items done so far */
+static void __llm_mq_end_waiters (struct h4h_llm_mq_queue* pu)
+{
+	struct h4h_llm_mq_waiter* w;
+	unsigned long flags;
+
+	h4h_spin_lock_irqsave (&pu->lock, flags);
+	while (!list_empty (&pu->waiters)) {
+		w = list_entry (pu->waiters.next, struct h4h_llm_mq_waiter, list);
+		if ((uint64_t)atomic64_read (&pu->nr_done) < w->target)
+			break;
+		list_del (&w->list);
+		atomic64_dec (&pu->nr_waiters);
+		if (atomic64_dec_and_test (&w->b->nr_pending))
+			h4h_sema_unlock (&w->b->done);
+	}
+	h4h_spin_unlock_irqrestore (&pu->lock, flags);
+}
+
+static void __llm_mq_put_item (
+	struct h4h_llm_mq_private* p,
+	uint64_t qid)
+{
+	struct h4h_llm_mq_queue* pu = &p->queues[qid];
+	uint64_t punit_id = qid / p->nr_classes;
+
+	atomic64_dec (&__llm_mq_owner (p, punit_id)->nr_items);
+	atomic64_inc (&pu->nr_done);
+	if (atomic64_read (&pu->nr_waiters) > 0)
+		__llm_mq_end_waiters (pu);
+	h4h_sema_unlock (&p->punit_credits[punit_id]);
+}
+
+static void __llm_mq_set_busy (
+	struct h4h_llm_mq_private* p,
+	uint64_t punit_id,
+	h4h_llm_req_t* r)
+{
+	struct h4h_llm_mq_unit* u = &p->units[punit_id];
+	unsigned long flags;
+
+	h4h_spin_lock_irqsave (&u->lock, flags);
+	u->busy = r;
+	u->nr_suspends = 0;
+	h4h_spin_unlock_irqrestore (&u->lock, flags);
+}
+
+/* it unlocks a punit when neither its req nor the read that suspended it
+ * is being served; they can be done in either order */
+static void __llm_mq_release_unit (
+	struct h4h_llm_mq_private* p,
+	uint64_t punit_id,
+	h4h_llm_req_t* r)
+{
+	struct h4h_llm_mq_unit* u = &p->units[punit_id];
+	unsigned long flags;
+	int release;
+
+	h4h_spin_lock_irqsave (&u->lock, flags);
+	if (u->read == r)
+		u->read = NULL;
+	else
+		u->busy = NULL;
+	release = (u->busy == NULL && u->read == NULL);
+	h4h_spin_unlock_irqrestore (&u->lock, flags);
+
+	if (release)
+		h4h_sema_unlock (&p->punit_locks[punit_id]);
+}
+
+static int __llm_mq_can_suspend (
+	struct h4h_llm_mq_private* p,
+	struct h4h_llm_mq_unit* u)
+{
+	if (u->busy == NULL || u->read != NULL || u->nr_suspends >= p->max_suspends)
+		return 0;
+	if (h4h_is_erase (u->busy->req_type))
+		return 1;
+	return (_param_llm_suspend == LLM_SUSPEND_ALL && 
+		h4h_is_write (u->busy->req_type)) ? 1 : 0;
+}
+
+/* it takes a host read ready at the head of a queue of a busy punit if the
+ * read can suspend the op being served; the scheduler is charged for it */
+static h4h_pu_queue_item_t* __llm_mq_pick_suspend (
+	struct h4h_llm_mq_private* p,
+	uint64_t punit_id,
+	uint32_t now_us)
+{
+	struct h4h_llm_mq_unit* u = &p->units[punit_id];
+	h4h_pu_queue_item_t* cands[LLM_NR_CLASSES];
+	h4h_pu_queue_item_t* q = NULL;
+	h4h_llm_req_t* busy = NULL;
+	uint64_t qid = punit_id * p->nr_classes;
+	uint64_t c;
+	unsigned long flags;
+	uint8_t ready = 0;
+
+	/* only the owner of a punit suspends it, and completions only clear
+	 * 'busy'; so it can still be suspended if 'busy' is not changed */
+	h4h_spin_lock_irqsave (&u->lock, flags);
+	if (__llm_mq_can_suspend (p, u))
+		busy = u->busy;
+	h4h_spin_unlock_irqrestore (&u->lock, flags);
+	if (busy == NULL)
+		return NULL;
+
+	for (c = 0; c < p->nr_classes; c++) {
+		cands[c] = NULL;
+		if (q == NULL && 
+			(cands[c] = h4h_pu_queue_peek (p->q, qid + c, &ready)) != NULL && ready &&
+			h4h_get_llm_class (((h4h_llm_req_t*)cands[c]->ptr_req)->req_type) == LLM_CLASS_HOST_READ)
+			q = cands[c];
+		else
+			cands[c] = NULL;
+	}
+	if (q == NULL)
+		return NULL;
+
+	h4h_spin_lock_irqsave (&u->lock, flags);
+	if (u->busy == busy) {
+		u->read = (h4h_llm_req_t*)q->ptr_req;
+		u->nr_suspends++;
+	} else
+		q = NULL;
+	h4h_spin_unlock_irqrestore (&u->lock, flags);
+	if (q == NULL)
+		return NULL;
+
+	c = p->sched->inf->pick (p->sched, punit_id, cands, now_us);
+	h4h_pu_queue_pop (p->q, qid + c);
+
+	return q;
+}
+
+/* it polls its punits for up to 'poll_us' once they get idle, and then it
+ * parks. the window is set to cover the last idle gap if it was up to
+ * _param_llm_poll_max_us long; otherwise, it is halved */
+static int __llm_mq_wait (struct h4h_llm_mq_dispatcher* d)
+{
+	h4h_stopwatch_t sw;
+	int64_t idle_us;
+
+	h4h_stopwatch_start (&sw);
+	while (d->poll_us > 0 && atomic64_read (&d->nr_items) == 0) {
+		if (h4h_stopwatch_get_elapsed_time_us (&sw) >= d->poll_us)
+			break;
+		h4h_thread_yield ();
+	}
+	if (atomic64_read (&d->nr_items) != 0)
+		return 0;
+
+	h4h_thread_schedule_setup (d->thread);
+	if (atomic64_read (&d->nr_items) == 0) {
+		/* ok... go to sleep */
+		if (h4h_thread_schedule_sleep (d->thread) == SIGKILL)
+			return SIGKILL;
+	} else {
+		/* there are items in Q; wake up */
+		h4h_thread_schedule_cancel (d->thread);
+	}
+
+	idle_us = h4h_stopwatch_get_elapsed_time_us (&sw);
+	if (idle_us <= _param_llm_poll_max_us)
+		d->poll_us = idle_us + 1;
+	else
+		d->poll_us /= 2;
+
+	return 0;
+}
+
+/* it takes the head of the queue of a punit the scheduler picks. an erase
+ * fences its punit; it waits for the items queued before it in the other
+ * queues, since they might be reading the block */
+static h4h_pu_queue_item_t* __llm_mq_pick (
+	struct h4h_llm_mq_private* p,
+	uint64_t punit_id,
+	uint32_t now_us)
+{
+	h4h_pu_queue_item_t* heads[LLM_NR_CLASSES];
+	h4h_pu_queue_item_t* cands[LLM_NR_CLASSES];
+	uint8_t ready[LLM_NR_CLASSES];
+	uint64_t qid = punit_id * p->nr_classes;
+	uint64_t c, k;
+	int64_t cls;
+
+	for (c = 0; c < p->nr_classes; c++) {
+		ready[c] = 0;
+		heads[c] = h4h_pu_queue_peek (p->q, qid + c, &ready[c]);
+	}
+	for (c = 0; c < p->nr_classes; c++) {
+		cands[c] = (heads[c] && ready[c]) ? heads[c] : NULL;
+		if (cands[c] == NULL || 
+			!h4h_is_erase (((h4h_llm_req_t*)cands[c]->ptr_req)->req_type))
+			continue;
+		for (k = 0; k < p->nr_classes; k++) {
+			if (k != c && heads[k] && 
+				(int32_t)(heads[k]->stamp - heads[c]->stamp) <= 0)
+				cands[c] = NULL;
+		}
+	}
+
+	if ((cls = p->sched->inf->pick (p->sched, punit_id, cands, now_us)) < 0)
+		return NULL;
+	h4h_pu_queue_pop (p->q, qid + cls);
+
+	return cands[cls];
+}
+
 int __llm_mq_thread (void* arg)
 {
-	h4h_drv_info_t* bdi = (h4h_drv_info_t*)arg;
+	struct h4h_llm_mq_dispatcher* d = (struct h4h_llm_mq_dispatcher*)arg;
+	h4h_drv_info_t* bdi = d->bdi;
 	struct h4h_llm_mq_private* p = (struct h4h_llm_mq_private*)H4H_LLM_PRIV(bdi);
-	uint64_t loop;
+	uint64_t nr_punits = d->punit_end - d->punit_start;
+	uint64_t loop, punit_id;
 	uint64_t cnt = 0;
+	uint32_t now_us;
 
-	if (p == NULL || p->q == NULL || p->llm_thread == NULL) {
-		h4h_msg ("invalid parameters (p=%p, p->q=%p, p->llm_thread=%p",
-			p, p->q, p->llm_thread);
+	if (p == NULL || p->q == NULL || d->thread == NULL) {
+		h4h_msg ("invalid parameters (p=%p, p->q=%p, d->thread=%p",
+			p, p->q, d->thread);
 		return 0;
 	}
 
 	for (;;) {
-		/* give a chance to other processes if Q is empty */
-		if (h4h_prior_queue_is_all_empty (p->q)) {
-			h4h_thread_schedule_setup (p->llm_thread);
-			if (h4h_prior_queue_is_all_empty (p->q)) {
-				/* ok... go to sleep */
-				if (h4h_thread_schedule_sleep (p->llm_thread) == SIGKILL)
-					break;
-			} else {
-				/* there are items in Q; wake up */
-				h4h_thread_schedule_cancel (p->llm_thread);
-			}
+		/* give a chance to other processes if its punits are idle; it keeps
+		 * polling while reqs are being served, since they are likely to be
+		 * followed by more reqs */
+		if (atomic64_read (&d->nr_items) == 0) {
+			if (__llm_mq_wait (d) == SIGKILL)
+				break;
 		}
 
-		/* send reqs until Q becomes empty */
-		for (loop = 0; loop < p->nr_punits; loop++) {
-			h4h_prior_queue_item_t* qitem = NULL;
+		/* send reqs to its units that have queued items; the units are
+		 * visited a chip of each channel at a time, so that the pages sent
+		 * in a pass are spread over the channel buses */
+		for (loop = 0; loop < nr_punits; loop++) {
+			h4h_pu_queue_item_t* qitem = NULL;
 			h4h_llm_req_t* r = NULL;
 
-			/* if pu is busy, then go to the next pnit */
-			if (!h4h_sema_try_lock (&p->punit_locks[loop]))
-				continue;
-			
-			if ((r = (h4h_llm_req_t*)h4h_prior_queue_dequeue (p->q, loop, &qitem)) == NULL) {
-				h4h_sema_unlock (&p->punit_locks[loop]);
+			punit_id = d->order[(d->first + loop) % nr_punits];
+			if (h4h_pu_queue_next_work (p->q, punit_id * p->nr_classes) >= 
+					(punit_id + 1) * p->nr_classes)
 				continue;
+
+			if (h4h_sema_try_lock (&p->punit_locks[punit_id])) {
+				now_us = time_get_timestamp_in_us ();
+				if ((qitem = __llm_mq_pick (p, punit_id, now_us)) == NULL) {
+					h4h_sema_unlock (&p->punit_locks[punit_id]);
+					continue;
+				}
+				__llm_mq_set_busy (p, punit_id, (h4h_llm_req_t*)qitem->ptr_req);
+			} else {
+				/* if pu is busy, then go to the next pnit unless a read
+				 * can suspend it */
+				if (p->max_suspends == 0)
+					continue;
+				now_us = time_get_timestamp_in_us ();
+				if ((qitem = __llm_mq_pick_suspend (p, punit_id, now_us)) == NULL)
+					continue;
 			}
 
+			r = (h4h_llm_req_t*)qitem->ptr_req;
 			r->ptr_qitem = qitem;
 
 			pmu_update_q (bdi, r);
+			pmu_update_class_q (bdi, h4h_get_llm_class (r->req_type), 
+				(uint32_t)(now_us - qitem->stamp));
 
 			//if (cnt % 50000 == 0) {
-				//h4h_msg ("llm_make_req: %llu, %llu", cnt, h4h_prior_queue_get_nr_items (p->q));
+				//h4h_msg ("llm_make_req: %llu, %llu", cnt, h4h_pu_queue_get_nr_items (p->q));
 			//}
 
 			if (bdi->ptr_dm_inf->make_req (bdi, r)) {
-				h4h_sema_unlock (&p->punit_locks[loop]);
-
-				/* TODO: I do not check whether it works well or not */
+				/* TODO: I do not check whether it works well or not; the
+				 * punit is released by end_req () */
 				bdi->ptr_llm_inf->end_req (bdi, r);
 				h4h_warning ("oops! make_req failed");
 			}
 
 			cnt++;
 		}
+		d->first = (d->first + 1) % nr_punits;
 	}
 
 	return 0;
 }
 
+/* it splits punits into contiguous ranges; a range has whole channels
+ * unless there are more dispatchers than channels */
+static void __llm_mq_split_punits (
+	h4h_drv_info_t* bdi,
+	struct h4h_llm_mq_private* p)
+{
+	uint64_t nr_chips = bdi->parm_dev.nr_chips_per_channel;
+	uint64_t nr_disps = (_param_llm_nr_dispatchers > 0) ? _param_llm_nr_dispatchers : 1;
+	uint64_t per;
+
+	if (nr_disps > p->nr_punits)
+		nr_disps = p->nr_punits;
+	per = (p->nr_punits + nr_disps - 1) / nr_disps;
+	if (nr_disps <= bdi->parm_dev.nr_channels)
+		per = (per + nr_chips - 1) / nr_chips * nr_chips;
+
+	p->nr_punits_per_dispatcher = per;
+	p->nr_dispatchers = (p->nr_punits + per - 1) / per;
+}
+
+/* it lists the punits of a dispatcher by chips; i.e., the first chip of
+ * each of its channels, then the second ones, and so on */
+static void __llm_mq_order_punits (
+	h4h_drv_info_t* bdi,
+	struct h4h_llm_mq_dispatcher* d)
+{
+	uint64_t nr_chips = bdi->parm_dev.nr_chips_per_channel;
+	uint64_t chip, punit_id, n = 0;
+
+	for (chip = 0; chip < nr_chips; chip++) {
+		for (punit_id = d->punit_start; punit_id < d->punit_end; punit_id++) {
+			if (punit_id % nr_chips == chip)
+				d->order[n++] = punit_id;
+		}
+	}
+	d->first = 0;
+}
+
+static void __llm_mq_stop_dispatchers (struct h4h_llm_mq_private* p)
+{
+	uint64_t loop;
+
+	for (loop = 0; loop < p->nr_dispatchers; loop++) {
+		if (p->dispatchers[loop].thread) {
+			h4h_thread_stop (p->dispatchers[loop].thread);
+			p->dispatchers[loop].thread = NULL;
+		}
+	}
+}
+
 uint32_t llm_mq_create (h4h_drv_info_t* bdi)
 {
 	struct h4h_llm_mq_private* p;
 	uint64_t loop;
+	int nr_credits;
 
 	/* create a private info for llm_nt */
 	if ((p = (struct h4h_llm_mq_private*)h4h_malloc_atomic
@@ -156,9 +528,16 @@ uint32_t llm_mq_create (h4h_drv_info_t* bdi)
 	/* get the total number of parallel units */
 	p->nr_punits = H4H_GET_NR_PUNITS (bdi->parm_dev);
 
+	/* create a scheduler */
+	if ((p->sched = h4h_llm_sched_create (bdi, p->nr_punits, _param_llm_sched)) == NULL) {
+		h4h_error ("h4h_llm_sched_create failed");
+		goto fail;
+	}
+	p->nr_classes = p->sched->inf->nr_classes;
+
 	/* create queue */
-	if ((p->q = h4h_prior_queue_create (p->nr_punits, INFINITE_QUEUE)) == NULL) {
-		h4h_error ("h4h_prior_queue_create failed");
+	if ((p->q = h4h_pu_queue_create (p->nr_punits * p->nr_classes, H4H_PU_QUEUE_RING_SIZE)) == NULL) {
+		h4h_error ("h4h_pu_queue_create failed");
 		goto fail;
 	}
 
@@ -171,17 +550,95 @@ uint32_t llm_mq_create (h4h_drv_info_t* bdi)
 	for (loop = 0; loop < p->nr_punits; loop++) {
 		h4h_sema_init (&p->punit_locks[loop]);
 	}
+	if ((p->units = (struct h4h_llm_mq_unit*)h4h_malloc_atomic
+			(sizeof (struct h4h_llm_mq_unit) * p->nr_punits)) == NULL) {
+		h4h_error ("h4h_malloc_atomic failed");
+		goto fail;
+	}
+	for (loop = 0; loop < p->nr_punits; loop++) {
+		h4h_spin_lock_init (&p->units[loop].lock);
+		p->units[loop].busy = NULL;
+		p->units[loop].read = NULL;
+		p->units[loop].nr_suspends = 0;
+	}
+	p->max_suspends = (_param_llm_suspend != LLM_SUSPEND_NONE) ? 
+		bdi->parm_dev.max_suspends : 0;
+
+	/* create credits; a ring never gets full, since a punit has no more
+	 * credits than the slots of a ring, and an RMW takes two credits at most */
+	if ((p->punit_credits = (h4h_sema_t*)h4h_malloc_atomic
+			(sizeof (h4h_sema_t) * p->nr_punits)) == NULL) {
+		h4h_error ("h4h_malloc_atomic failed");
+		goto fail;
+	}
+	nr_credits = _param_llm_punit_max_inflight;
+	if (nr_credits <= 0 || nr_credits > H4H_PU_QUEUE_RING_SIZE)
+		nr_credits = H4H_PU_QUEUE_RING_SIZE;
+	if (nr_credits < 2)
+		nr_credits = 2;
+	for (loop = 0; loop < p->nr_punits; loop++) {
+		h4h_sema_init_count (&p->punit_credits[loop], nr_credits);
+	}
+	h4h_sema_init_count (&p->credits, 
+		(_param_llm_max_inflight > 0) ? _param_llm_max_inflight : 1);
+	h4h_sema_init (&p->rmw_credits_lock);
+
+	/* create queues for barriers */
+	if ((p->queues = (struct h4h_llm_mq_queue*)h4h_malloc_atomic
+			(sizeof (struct h4h_llm_mq_queue) * p->nr_punits * p->nr_classes)) == NULL) {
+		h4h_error ("h4h_malloc_atomic failed");
+		goto fail;
+	}
+	for (loop = 0; loop < p->nr_punits * p->nr_classes; loop++) {
+		atomic64_set (&p->queues[loop].nr_issued, 0);
+		atomic64_set (&p->queues[loop].nr_done, 0);
+		atomic64_set (&p->queues[loop].nr_waiters, 0);
+		h4h_spin_lock_init (&p->queues[loop].lock);
+		INIT_LIST_HEAD (&p->queues[loop].waiters);
+	}
+
+	/* assign punits to dispatchers */
+	__llm_mq_split_punits (bdi, p);
+	if ((p->dispatchers = (struct h4h_llm_mq_dispatcher*)h4h_malloc_atomic
+			(sizeof (struct h4h_llm_mq_dispatcher) * p->nr_dispatchers)) == NULL) {
+		h4h_error ("h4h_malloc_atomic failed");
+		goto fail;
+	}
+	if ((p->punit_order = (uint64_t*)h4h_malloc_atomic
+			(sizeof (uint64_t) * p->nr_punits)) == NULL) {
+		h4h_error ("h4h_malloc_atomic failed");
+		goto fail;
+	}
+	for (loop = 0; loop < p->nr_dispatchers; loop++) {
+		struct h4h_llm_mq_dispatcher* d = &p->dispatchers[loop];
+		d->bdi = bdi;
+		d->punit_start = loop * p->nr_punits_per_dispatcher;
+		d->punit_end = d->punit_start + p->nr_punits_per_dispatcher;
+		if (d->punit_end > p->nr_punits)
+			d->punit_end = p->nr_punits;
+		atomic64_set (&d->nr_items, 0);
+		d->poll_us = _param_llm_poll_max_us;
+		d->order = &p->punit_order[d->punit_start];
+		__llm_mq_order_punits (bdi, d);
+	}
 
 	/* keep the private structures for llm_nt */
 	bdi->ptr_llm_inf->ptr_private = (void*)p;
 
-	/* create & run a thread */
-	if ((p->llm_thread = h4h_thread_create (
-			__llm_mq_thread, bdi, "__llm_mq_thread")) == NULL) {
-		h4h_error ("kthread_create failed");
-		goto fail;
+	/* create & run threads */
+	for (loop = 0; loop < p->nr_dispatchers; loop++) {
+		struct h4h_llm_mq_dispatcher* d = &p->dispatchers[loop];
+		if ((d->thread = h4h_thread_create (
+				__llm_mq_thread, d, "__llm_mq_thread")) == NULL) {
+			h4h_error ("kthread_create failed");
+			goto fail_threads;
+		}
+		h4h_thread_run (d->thread);
+		if (_param_llm_pin_dispatchers && h4h_thread_bind (d->thread, loop) != 0)
+			h4h_warning ("failed to pin a dispatcher to cpu %llu", loop);
 	}
-	h4h_thread_run (p->llm_thread);
+	h4h_msg ("llm_mq: %llu dispatchers, %llu punits each, %llu queues per punit", 
+		p->nr_dispatchers, p->nr_punits_per_dispatcher, p->nr_classes);
 
 #if defined(ENABLE_SEQ_DBG)
 	h4h_sema_init (&p->dbg_seq);
@@ -189,11 +646,26 @@ uint32_t llm_mq_create (h4h_drv_info_t* bdi)
 
 	return 0;
 
+fail_threads:
+	__llm_mq_stop_dispatchers (p);
+	bdi->ptr_llm_inf->ptr_private = NULL;
 fail:
+	if (p->punit_order)
+		h4h_free_atomic (p->punit_order);
+	if (p->dispatchers)
+		h4h_free_atomic (p->dispatchers);
+	if (p->queues)
+		h4h_free_atomic (p->queues);
+	if (p->punit_credits)
+		h4h_free_atomic (p->punit_credits);
 	if (p->punit_locks)
 		h4h_free_atomic (p->punit_locks);
+	if (p->units)
+		h4h_free_atomic (p->units);
 	if (p->q)
-		h4h_prior_queue_destroy (p->q);
+		h4h_pu_queue_destroy (p->q);
+	if (p->sched)
+		h4h_llm_sched_destroy (p->sched);
 	if (p)
 		h4h_free_atomic (p);
 	return -1;
@@ -211,21 +683,38 @@ void llm_mq_destroy (h4h_drv_info_t* bdi)
 		return;
 
 	/* wait until Q becomes empty */
-	while (!h4h_prior_queue_is_all_empty (p->q)) {
-		h4h_msg ("llm items = %llu", h4h_prior_queue_get_nr_items (p->q));
+	while (!h4h_pu_queue_is_all_empty (p->q)) {
+		h4h_msg ("llm items = %llu", h4h_pu_queue_get_nr_items (p->q));
 		h4h_thread_msleep (1);
 	}
 
-	/* kill kthread */
-	h4h_thread_stop (p->llm_thread);
+	/* kill kthreads */
+	__llm_mq_stop_dispatchers (p);
 
 	for (loop = 0; loop < p->nr_punits; loop++) {
 		h4h_sema_lock (&p->punit_locks[loop]);
 	}
 
 	/* release all the relevant data structures */
+	for (loop = 0; loop < p->nr_punits; loop++) {
+		h4h_sema_free (&p->punit_credits[loop]);
+	}
+	h4h_sema_free (&p->credits);
+	h4h_sema_free (&p->rmw_credits_lock);
+	if (p->queues)
+		h4h_free_atomic (p->queues);
+	if (p->punit_credits)
+		h4h_free_atomic (p->punit_credits);
+	if (p->punit_order)
+		h4h_free_atomic (p->punit_order);
+	if (p->dispatchers)
+		h4h_free_atomic (p->dispatchers);
+	if (p->units)
+		h4h_free_atomic (p->units);
 	if (p->q)
-		h4h_prior_queue_destroy (p->q);
+		h4h_pu_queue_destroy (p->q);
+	if (p->sched)
+		h4h_llm_sched_destroy (p->sched);
 	if (p) 
 		h4h_free_atomic (p);
 	h4h_msg ("done");
@@ -235,6 +724,10 @@ uint32_t llm_mq_make_req (h4h_drv_info_t* bdi, h4h_llm_req_t* r)
 {
 	uint32_t ret;
 	struct h4h_llm_mq_private* p = (struct h4h_llm_mq_private*)H4H_LLM_PRIV(bdi);
+	/* owners are taken before 'r' is queued, since 'r' can be completed as
+	 * soon as it is queued */
+	struct h4h_llm_mq_dispatcher *d = NULL, *d_dst = NULL;
+	uint64_t qid, qid_dst;
 
 #if defined(ENABLE_SEQ_DBG)
 	h4h_sema_lock (&p->dbg_seq);
@@ -243,34 +736,47 @@ uint32_t llm_mq_make_req (h4h_drv_info_t* bdi, h4h_llm_req_t* r)
 	/* obtain the elapsed time taken by FTL algorithms */
 	pmu_update_sw (bdi, r);
 
-	/* wait until there are enough free slots in Q */
-	//while (h4h_prior_queue_get_nr_items (p->q) >= 96) {
-	/*while (h4h_prior_queue_get_nr_items (p->q) >= 262144) {*/
-	while (h4h_prior_queue_get_nr_items (p->q) >= 20480) {
-		h4h_thread_yield ();
-	}
+	/* sleep until a completion returns a credit if too many reqs are in
+	 * flight; the punit credits are taken below */
+	h4h_sema_lock (&p->credits);
 
 	/* put a request into Q */
 	if (h4h_is_rmw (r->req_type) && h4h_is_read (r->req_type)) {
 		/* step 1: put READ first */
 		r->phyaddr = r->phyaddr_src;
-		if ((ret = h4h_prior_queue_enqueue (p->q, r->phyaddr_src.punit_id, r->logaddr.lpa[0], (void*)r))) {
-			h4h_msg ("h4h_prior_queue_enqueue failed");
+		d = __llm_mq_owner (p, r->phyaddr_src.punit_id);
+		d_dst = __llm_mq_owner (p, r->phyaddr_dst.punit_id);
+		qid = __llm_mq_qid (p, r->phyaddr_src.punit_id, r);
+		qid_dst = __llm_mq_qid (p, r->phyaddr_dst.punit_id, r);
+		/* two RMWs taking their credits at once can wait for each other */
+		h4h_sema_lock (&p->rmw_credits_lock);
+		__llm_mq_get_item (p, qid);
+		__llm_mq_get_item (p, qid_dst);
+		h4h_sema_unlock (&p->rmw_credits_lock);
+		r->qitems[0].stamp = r->qitems[1].stamp = time_get_timestamp_in_us ();
+		if ((ret = h4h_pu_queue_enqueue (p->q, qid, r->logaddr.lpa[0], (void*)r, &r->qitems[0]))) {
+			h4h_msg ("h4h_pu_queue_enqueue failed");
 		}
 		/* step 2: put WRITE second with the same LPA */
-		if ((ret = h4h_prior_queue_enqueue (p->q, r->phyaddr_dst.punit_id, r->logaddr.lpa[0], (void*)r))) {
-			h4h_msg ("h4h_prior_queue_enqueue failed");
+		if ((ret = h4h_pu_queue_enqueue (p->q, qid_dst, r->logaddr.lpa[0], (void*)r, &r->qitems[1]))) {
+			h4h_msg ("h4h_pu_queue_enqueue failed");
 		}
 	} else if (h4h_is_rmw (r->req_type) && h4h_is_read (r->req_type)) {
 		h4h_bug_on (1);
 	} else {
-		if ((ret = h4h_prior_queue_enqueue (p->q, r->phyaddr.punit_id, r->logaddr.lpa[0], (void*)r))) {
-			h4h_msg ("h4h_prior_queue_enqueue failed");
+		d = __llm_mq_owner (p, r->phyaddr.punit_id);
+		qid = __llm_mq_qid (p, r->phyaddr.punit_id, r);
+		__llm_mq_get_item (p, qid);
+		r->qitems[0].stamp = time_get_timestamp_in_us ();
+		if ((ret = h4h_pu_queue_enqueue (p->q, qid, r->logaddr.lpa[0], (void*)r, &r->qitems[0]))) {
+			h4h_msg ("h4h_pu_queue_enqueue failed");
 		}
 	}
 
-	/* wake up thread if it sleeps */
-	h4h_thread_wakeup (p->llm_thread);
+	/* wake up the owners if they sleep; it is skipped if they are not parked */
+	h4h_thread_wakeup (d->thread);
+	if (d_dst != NULL && d_dst != d)
+		h4h_thread_wakeup (d_dst->thread);
 
 	return ret;
 }
@@ -279,21 +785,78 @@ void llm_mq_flush (h4h_drv_info_t* bdi)
 {
 	struct h4h_llm_mq_private* p = (struct h4h_llm_mq_private*)H4H_LLM_PRIV(bdi);
 
-	while (h4h_prior_queue_is_all_empty (p->q) != 1) {
+	while (h4h_pu_queue_is_all_empty (p->q) != 1) {
 		/*cond_resched ();*/
 		h4h_thread_yield ();
 	}
 }
 
+/* it waits for the items issued to 'punit_ids' before it; the other punits
+ * keep serving reqs, and the reqs issued after it are not waited for */
+void llm_mq_barrier (
+	h4h_drv_info_t* bdi, 
+	uint64_t* punit_ids, 
+	uint64_t nr_punit_ids)
+{
+	struct h4h_llm_mq_private* p = (struct h4h_llm_mq_private*)H4H_LLM_PRIV(bdi);
+	struct h4h_llm_mq_barrier b;
+	struct h4h_llm_mq_waiter* w = NULL;
+	unsigned long flags;
+	uint64_t i, nr_waiters = nr_punit_ids * p->nr_classes;
+
+	if (nr_punit_ids == 0)
+		return;
+
+	if ((w = (struct h4h_llm_mq_waiter*)h4h_malloc_atomic
+			(sizeof (struct h4h_llm_mq_waiter) * nr_waiters)) == NULL) {
+		h4h_warning ("h4h_malloc_atomic failed; flush all the punits");
+		llm_mq_flush (bdi);
+		return;
+	}
+
+	/* it is held until all the waiters are queued */
+	atomic64_set (&b.nr_pending, 1);
+	h4h_sema_init (&b.done);
+	h4h_sema_lock (&b.done);
+
+	for (i = 0; i < nr_waiters; i++) {
+		struct h4h_llm_mq_queue* pu = &p->queues[
+			punit_ids[i / p->nr_classes] * p->nr_classes + i % p->nr_classes];
+
+		h4h_spin_lock_irqsave (&pu->lock, flags);
+		w[i].target = atomic64_read (&pu->nr_issued);
+		w[i].b = &b;
+		/* a completion sees either this waiter or a new 'nr_done' */
+		atomic64_inc (&pu->nr_waiters);
+		if ((uint64_t)atomic64_read (&pu->nr_done) >= w[i].target) {
+			atomic64_dec (&pu->nr_waiters);
+		} else {
+			atomic64_inc (&b.nr_pending);
+			list_add_tail (&w[i].list, &pu->waiters);
+		}
+		h4h_spin_unlock_irqrestore (&pu->lock, flags);
+	}
+
+	if (atomic64_dec_and_test (&b.nr_pending))
+		h4h_sema_unlock (&b.done);
+
+	/* wait until the last punit is drained */
+	h4h_sema_lock (&b.done);
+	h4h_sema_unlock (&b.done);
+	h4h_sema_free (&b.done);
+
+	h4h_free_atomic (w);
+}
+
 void llm_mq_end_req (h4h_drv_info_t* bdi, h4h_llm_req_t* r)
 {
 	struct h4h_llm_mq_private* p = (struct h4h_llm_mq_private*)H4H_LLM_PRIV(bdi);
-	h4h_prior_queue_item_t* qitem = (h4h_prior_queue_item_t*)r->ptr_qitem;
+	h4h_pu_queue_item_t* qitem = (h4h_pu_queue_item_t*)r->ptr_qitem;
 
 	if (h4h_is_rmw (r->req_type) && h4h_is_read(r->req_type)) {
 		/* get a parallel unit ID */
 		/*h4h_msg ("unlock: %lld", r->phyaddr.punit_id);*/
-		h4h_sema_unlock (&p->punit_locks[r->phyaddr.punit_id]);
+		__llm_mq_release_unit (p, r->phyaddr.punit_id, r);
 
 		/*h4h_msg ("LLM Done: lpa=%llu", r->logaddr.lpa[0]);*/
 
@@ -304,22 +867,27 @@ void llm_mq_end_req (h4h_drv_info_t* bdi, h4h_llm_req_t* r)
 		r->phyaddr = r->phyaddr_dst;
 
 		/* remove it from the Q; this automatically triggers another request to be sent to NAND flash */
-		h4h_prior_queue_remove (p->q, qitem);
+		h4h_pu_queue_remove (p->q, qitem);
+		__llm_mq_put_item (p, qitem->qid);
 
-		/* wake up thread if it sleeps */
-		h4h_thread_wakeup (p->llm_thread);
+		/* wake up the owner of the WRITE if it sleeps */
+		h4h_thread_wakeup (__llm_mq_owner (p, r->phyaddr.punit_id)->thread);
 	} else {
 		/* get a parallel unit ID */
-		h4h_prior_queue_remove (p->q, qitem);
+		h4h_pu_queue_remove (p->q, qitem);
+		__llm_mq_put_item (p, qitem->qid);
 
 		/* complete a lock */
 		/*h4h_msg ("unlock: %lld", r->phyaddr.punit_id);*/
-		h4h_sema_unlock (&p->punit_locks[r->phyaddr.punit_id]);
+		__llm_mq_release_unit (p, r->phyaddr.punit_id, r);
 
 		/* update the elapsed time taken by NAND devices */
 		pmu_update_tot (bdi, r);
 		pmu_inc (bdi, r);
 
+		/* return its credit; a submitter sleeping for it can go */
+		h4h_sema_unlock (&p->credits);
+
 		/* finish a request */
 		bdi->ptr_hlm_inf->end_req (bdi, r);
 
@@ -32,5 +32,6 @@ void llm_mq_destroy (h4h_drv_info_t* bdi);
 uint32_t llm_mq_make_req (h4h_drv_info_t* bdi, h4h_llm_req_t* req);
 void llm_mq_flush (h4h_drv_info_t* bdi);
 void llm_mq_end_req (h4h_drv_info_t* bdi, h4h_llm_req_t* req);
+void llm_mq_barrier (h4h_drv_info_t* bdi, uint64_t* punit_ids, uint64_t nr_punit_ids);
 
 #endif
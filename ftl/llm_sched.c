@@ -0,0 +1,206 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014-2015 CSAIL, MIT
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+#if defined (KERNEL_MODE)
+#include <linux/module.h>
+#include <linux/slab.h>
+
+#elif defined (USER_MODE)
+#include <stdio.h>
+#include <stdint.h>
+
+#else
+#error Invalid Platform (KERNEL_MODE or USER_MODE)
+#endif
+
+#include "debug.h"
+#include "umemory.h"
+#include "params.h"
+#include "ftl_params.h"
+#include "h4h_drv.h"
+
+#include "llm_sched.h"
+
+
+/* fifo: a single queue per punit */
+static uint64_t __fifo_get_class (h4h_llm_req_t* r)
+{
+	return 0;
+}
+
+static int64_t __fifo_pick (
+	h4h_llm_sched_t* s, 
+	uint64_t punit_id, 
+	h4h_llm_qitem_t** heads, 
+	uint32_t now_us)
+{
+	return heads[0] ? 0 : -1;
+}
+
+static h4h_llm_sched_inf_t _llm_sched_fifo = {
+	.nr_classes = 1,
+	.get_class = __fifo_get_class,
+	.pick = __fifo_pick,
+};
+
+
+/* qos: a queue per class. a head that has waited past the deadline of its
+ * class goes first (the earliest deadline first); otherwise, the classes
+ * share the time of a punit by their weights, as start-time fair queueing
+ * does. the virtual times are in 1/1024 us of a punit per unit weight */
+struct h4h_llm_qos_punit {
+	uint64_t vclock;	/* the start of the last item served */
+	uint64_t vtime[LLM_NR_CLASSES];	/* the finish of the last item of a class */
+};
+
+/* every program of a punit goes to the write queue. host, gc and meta
+ * writes can fill the same active block, and its pages must be programmed
+ * in the order they were allocated */
+static uint64_t __qos_get_class (h4h_llm_req_t* r)
+{
+	if (h4h_is_write (r->req_type))
+		return LLM_CLASS_HOST_WRITE;
+	return h4h_get_llm_class (r->req_type);
+}
+
+/* how long a req keeps its punit busy (in us) */
+static uint64_t __qos_get_cost (
+	h4h_device_params_t* np, 
+	h4h_llm_req_t* r)
+{
+	if (h4h_is_erase (r->req_type))
+		return np->block_erase_time_us;
+	if (h4h_is_write (r->req_type))
+		return np->page_prog_time_us;
+	return np->page_read_time_us;
+}
+
+static int64_t __qos_pick (
+	h4h_llm_sched_t* s, 
+	uint64_t punit_id, 
+	h4h_llm_qitem_t** heads, 
+	uint32_t now_us)
+{
+	struct h4h_llm_qos_punit* pu = 
+		&((struct h4h_llm_qos_punit*)s->ptr_private)[punit_id];
+	uint64_t start, best_start = 0;
+	int64_t c, best = -1;
+
+	/* the overdue head with the earliest deadline */
+	for (c = 0; c < LLM_NR_CLASSES; c++) {
+		if (heads[c] == NULL || s->deadlines_us[c] == 0)
+			continue;
+		if ((uint32_t)(now_us - heads[c]->stamp) < s->deadlines_us[c])
+			continue;
+		if (best == -1 || 
+			(int32_t)((heads[c]->stamp + s->deadlines_us[c]) - 
+				(heads[best]->stamp + s->deadlines_us[best])) < 0)
+			best = c;
+	}
+
+	/* otherwise, the class with the least virtual start; a class back from
+	 * idle starts at the clock, so it cannot claim the time it did not use */
+	if (best == -1) {
+		for (c = 0; c < LLM_NR_CLASSES; c++) {
+			if (heads[c] == NULL)
+				continue;
+			start = (pu->vtime[c] > pu->vclock) ? pu->vtime[c] : pu->vclock;
+			if (best == -1 || start < best_start) {
+				best = c;
+				best_start = start;
+			}
+		}
+		if (best == -1)
+			return -1;
+	}
+
+	/* charge the class for the time of its punit */
+	start = (pu->vtime[best] > pu->vclock) ? pu->vtime[best] : pu->vclock;
+	pu->vclock = start;
+	pu->vtime[best] = start + __qos_get_cost 
+		(s->np, (h4h_llm_req_t*)heads[best]->ptr_req) * 1024 / s->weights[best];
+
+	return best;
+}
+
+static h4h_llm_sched_inf_t _llm_sched_qos = {
+	.nr_classes = LLM_NR_CLASSES,
+	.get_class = __qos_get_class,
+	.pick = __qos_pick,
+};
+
+
+h4h_llm_sched_t* h4h_llm_sched_create (
+	h4h_drv_info_t* bdi, 
+	uint64_t nr_punits, 
+	int type)
+{
+	h4h_llm_sched_t* s = NULL;
+	int weights[LLM_NR_CLASSES] = {
+		_param_llm_weight_read, _param_llm_weight_write, 
+		_param_llm_weight_gc, _param_llm_weight_meta };
+	int deadlines[LLM_NR_CLASSES] = {
+		_param_llm_deadline_read_us, _param_llm_deadline_write_us, 
+		_param_llm_deadline_gc_us, _param_llm_deadline_meta_us };
+	uint64_t c;
+
+	if ((s = (h4h_llm_sched_t*)h4h_zmalloc (sizeof (h4h_llm_sched_t))) == NULL) {
+		h4h_error ("h4h_zmalloc failed");
+		return NULL;
+	}
+	s->np = &bdi->parm_dev;
+	s->nr_punits = nr_punits;
+	for (c = 0; c < LLM_NR_CLASSES; c++) {
+		s->weights[c] = (weights[c] > 0) ? weights[c] : 1;
+		s->deadlines_us[c] = (deadlines[c] > 0) ? deadlines[c] : 0;
+	}
+
+	switch (type) {
+	case LLM_SCHED_QOS:
+		if ((s->ptr_private = h4h_zmalloc 
+				(sizeof (struct h4h_llm_qos_punit) * nr_punits)) == NULL) {
+			h4h_error ("h4h_zmalloc failed");
+			h4h_free (s);
+			return NULL;
+		}
+		s->inf = &_llm_sched_qos;
+		break;
+	case LLM_SCHED_FIFO:
+	default:
+		s->inf = &_llm_sched_fifo;
+		break;
+	}
+
+	return s;
+}
+
+void h4h_llm_sched_destroy (h4h_llm_sched_t* s)
+{
+	if (s == NULL)
+		return;
+	if (s->ptr_private)
+		h4h_free (s->ptr_private);
+	h4h_free (s);
+}
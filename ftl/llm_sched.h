@@ -0,0 +1,56 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014-2015 CSAIL, MIT
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+#ifndef _H4H_LLM_SCHED_H
+#define _H4H_LLM_SCHED_H
+
+/* a scheduler picks the queue of a punit to be served next. a punit has a
+ * queue per class of the scheduler, and the items of a queue are served in
+ * their order. 'heads' has the head of each queue (NULL if it is empty),
+ * and it is only given the ones that can be served now; it returns the
+ * class to serve, or -1 if none. it is called by the owner of a punit, so
+ * the state of a punit needs no lock */
+typedef struct h4h_llm_sched h4h_llm_sched_t;
+
+typedef struct {
+	uint64_t nr_classes;
+	uint64_t (*get_class) (h4h_llm_req_t* r);
+	int64_t (*pick) (h4h_llm_sched_t* s, uint64_t punit_id, 
+		h4h_llm_qitem_t** heads, uint32_t now_us);
+} h4h_llm_sched_inf_t;
+
+struct h4h_llm_sched {
+	h4h_llm_sched_inf_t* inf;
+	h4h_device_params_t* np;
+	uint64_t nr_punits;
+	uint64_t weights[LLM_NR_CLASSES];
+	uint64_t deadlines_us[LLM_NR_CLASSES];	/* 0: none */
+	void* ptr_private;
+};
+
+h4h_llm_sched_t* h4h_llm_sched_create (h4h_drv_info_t* bdi, uint64_t nr_punits, int type);
+void h4h_llm_sched_destroy (h4h_llm_sched_t* s);
+
+#endif
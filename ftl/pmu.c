@@ -83,6 +83,13 @@ void pmu_create (h4h_drv_info_t* bdi)
 	bdi->pm.time_gc_q = 0;
 	bdi->pm.time_gc_tot = 0;
 
+	/* queueing delays in llm per class */
+	for (i = 0; i < LLM_NR_CLASSES; i++) {
+		bdi->pm.class_q_sum[i] = 0;
+		bdi->pm.class_q_max[i] = 0;
+		bdi->pm.class_q_cnt[i] = 0;
+	}
+
 	/* channel / chip utilization */
 	punit = np->nr_chips_per_channel * np->nr_channels;
 	bdi->pm.util_r = h4h_malloc_atomic (punit * sizeof (atomic64_t));
@@ -355,6 +362,18 @@ void pmu_update_gc_q (h4h_drv_info_t* bdi, h4h_stopwatch_t* sw)
 	h4h_spin_unlock_irqrestore (&bdi->pm.pmu_lock, flags);
 }
 
+/* the time a req of a class waits in the llm queue of its punit */
+void pmu_update_class_q (h4h_drv_info_t* bdi, uint64_t cls, uint64_t delay_us)
+{
+	unsigned long flags;
+	h4h_spin_lock_irqsave (&bdi->pm.pmu_lock, flags);
+	bdi->pm.class_q_sum[cls] += delay_us;
+	bdi->pm.class_q_cnt[cls]++;
+	if (bdi->pm.class_q_max[cls] < delay_us)
+		bdi->pm.class_q_max[cls] = delay_us;
+	h4h_spin_unlock_irqrestore (&bdi->pm.pmu_lock, flags);
+}
+
 
 /* 
  * update the time taken for NAND devices to handle reqs 
@@ -429,6 +448,8 @@ void pmu_update_gc_tot (h4h_drv_info_t* bdi, h4h_stopwatch_t* sw)
 /* display performance results */
 char format[1024];
 char str[1024];
+static const char* llm_class_names[LLM_NR_CLASSES] = {
+	"host read", "host write", "gc", "meta" };
 
 void pmu_display (h4h_drv_info_t* bdi) 
 {
@@ -510,6 +531,15 @@ void pmu_display (h4h_drv_info_t* bdi)
 		bdi->pm.time_rmw_tot - bdi->pm.time_rmw_q);
 	h4h_msg ("");
 
+	h4h_msg ("[5-1] LLM Queueing Delay (us)");
+	for (i = 0; i < LLM_NR_CLASSES; i++) {
+		h4h_msg ("%s: avg %llu, max %llu (%llu reqs)", llm_class_names[i],
+			bdi->pm.class_q_cnt[i] ? 
+				bdi->pm.class_q_sum[i] / bdi->pm.class_q_cnt[i] : 0,
+			bdi->pm.class_q_max[i], bdi->pm.class_q_cnt[i]);
+	}
+	h4h_msg ("");
+
 	h4h_msg ("[6] Utilization (R)");
 	for (i = 0; i < np->nr_chips_per_channel; i++) {
 		for (j = 0; j < np->nr_channels; j++) {
@@ -565,6 +595,7 @@ void pmu_update_q (h4h_drv_info_t* bdi, h4h_llm_req_t* req) {}
 void pmu_update_r_q (h4h_drv_info_t* bdi, h4h_stopwatch_t* sw) {}
 void pmu_update_w_q (h4h_drv_info_t* bdi, h4h_stopwatch_t* sw) {}
 void pmu_update_rmw_q (h4h_drv_info_t* bdi, h4h_stopwatch_t* sw) {}
+void pmu_update_class_q (h4h_drv_info_t* bdi, uint64_t cls, uint64_t delay_us) {}
 
 void pmu_update_tot (h4h_drv_info_t* bdi, h4h_llm_req_t* req) {}
 void pmu_update_r_tot (h4h_drv_info_t* bdi, h4h_stopwatch_t* sw) {}
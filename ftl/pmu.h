@@ -33,6 +33,7 @@ void pmu_update_q (h4h_drv_info_t* bdi, h4h_llm_req_t* req);
 void pmu_update_r_q (h4h_drv_info_t* bdi, h4h_stopwatch_t* req);
 void pmu_update_w_q (h4h_drv_info_t* bdi, h4h_stopwatch_t* req);
 void pmu_update_rmw_q (h4h_drv_info_t* bdi, h4h_stopwatch_t* req);
+void pmu_update_class_q (h4h_drv_info_t* bdi, uint64_t cls, uint64_t delay_us);
 
 void pmu_update_tot (h4h_drv_info_t* bdi, h4h_llm_req_t* req);
 void pmu_update_r_tot (h4h_drv_info_t* bdi, h4h_stopwatch_t* req);
@@ -0,0 +1,196 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014-2015 CSAIL, MIT
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+#if defined (KERNEL_MODE)
+#include <linux/module.h>
+#include <linux/slab.h>
+
+#elif defined (USER_MODE)
+#include <stdio.h>
+#include <stdint.h>
+
+#else
+#error Invalid Platform (KERNEL_MODE or USER_MODE)
+#endif
+
+#include "h4h_drv.h"
+#include "debug.h"
+#include "umemory.h"
+#include "lpa_tags.h"
+
+
+static inline uint64_t __lpa_tags_home (
+	h4h_lpa_tags_t* t, 
+	uint64_t lpa)
+{
+	return (lpa * 0x9E3779B97F4A7C15ULL) >> (64 - t->bits);
+}
+
+static inline uint64_t __lpa_tags_mask (h4h_lpa_tags_t* t)
+{
+	return (1ULL << t->bits) - 1;
+}
+
+/* returns the slot of 'lpa', or the empty slot where it would be put */
+static h4h_lpa_tag_t* __lpa_tags_find (
+	h4h_lpa_tags_t* t, 
+	uint64_t lpa)
+{
+	uint64_t i = __lpa_tags_home (t, lpa);
+
+	while (t->slots[i].max_tag != 0 && t->slots[i].lpa != lpa)
+		i = (i + 1) & __lpa_tags_mask (t);
+
+	return &t->slots[i];
+}
+
+static int __lpa_tags_alloc (
+	h4h_lpa_tags_t* t, 
+	uint32_t bits)
+{
+	/* slots are zeroed, so that they are empty */
+	if ((t->slots = (h4h_lpa_tag_t*)h4h_malloc_atomic 
+			(sizeof (h4h_lpa_tag_t) << bits)) == NULL) {
+		h4h_error ("h4h_malloc_atomic failed");
+		return 1;
+	}
+	t->bits = bits;
+	t->nr_lpas = 0;
+
+	return 0;
+}
+
+/* it doubles the table; it is only done when the window is exceeded */
+static int __lpa_tags_grow (h4h_lpa_tags_t* t)
+{
+	h4h_lpa_tags_t old = *t;
+	uint64_t i;
+
+	if (__lpa_tags_alloc (t, old.bits + 1) != 0) {
+		*t = old;
+		return 1;
+	}
+	for (i = 0; i <= __lpa_tags_mask (&old); i++) {
+		if (old.slots[i].max_tag != 0) {
+			*__lpa_tags_find (t, old.slots[i].lpa) = old.slots[i];
+			t->nr_lpas++;
+		}
+	}
+	h4h_free_atomic (old.slots);
+
+	return 0;
+}
+
+int h4h_lpa_tags_init (
+	h4h_lpa_tags_t* t, 
+	uint64_t window)
+{
+	uint32_t bits = 0;
+
+	/* keep the load under a half */
+	while ((1ULL << bits) < H4H_LPA_TAGS_MIN_SIZE || (1ULL << bits) < window * 2)
+		bits++;
+
+	return __lpa_tags_alloc (t, bits);
+}
+
+void h4h_lpa_tags_free (h4h_lpa_tags_t* t)
+{
+	if (t->slots) {
+		h4h_free_atomic (t->slots);
+		t->slots = NULL;
+	}
+}
+
+/* returns a new tag of 'lpa', or 0 if the table cannot grow */
+uint64_t h4h_lpa_tags_get_new (
+	h4h_lpa_tags_t* t, 
+	uint64_t lpa)
+{
+	h4h_lpa_tag_t* e = __lpa_tags_find (t, lpa);
+
+	if (e->max_tag != 0)
+		return ++e->max_tag;
+
+	if ((t->nr_lpas + 1) * 2 > (1ULL << t->bits)) {
+		if (__lpa_tags_grow (t) != 0)
+			return 0;
+		e = __lpa_tags_find (t, lpa);
+	}
+	e->lpa = lpa;
+	e->cur_tag = 1;
+	e->max_tag = 1;
+	t->nr_lpas++;
+
+	return 1;
+}
+
+/* returns the tag of 'lpa' to be served, or -1 if there is none */
+uint64_t h4h_lpa_tags_get_cur (
+	h4h_lpa_tags_t* t, 
+	uint64_t lpa)
+{
+	h4h_lpa_tag_t* e = __lpa_tags_find (t, lpa);
+
+	return (e->max_tag != 0) ? e->cur_tag : -1;
+}
+
+/* the req with the current tag is done; the next one can be served */
+int h4h_lpa_tags_put (
+	h4h_lpa_tags_t* t, 
+	uint64_t lpa)
+{
+	h4h_lpa_tag_t* e = __lpa_tags_find (t, lpa);
+	uint64_t mask = __lpa_tags_mask (t);
+	uint64_t i, j, k;
+
+	if (e->max_tag == 0 || e->cur_tag > e->max_tag)
+		return 1;
+	if (e->cur_tag < e->max_tag) {
+		e->cur_tag++;
+		return 0;
+	}
+
+	/* the last req of 'lpa' is done; remove it and shift back the entries
+	 * after it, so that no probe sequence is broken */
+	i = e - t->slots;
+	for (j = (i + 1) & mask; t->slots[j].max_tag != 0; j = (j + 1) & mask) {
+		k = __lpa_tags_home (t, t->slots[j].lpa);
+		/* the entry at 'j' stays if its home is cyclically in (i, j] */
+		if ((i <= j) ? (i < k && k <= j) : (i < k || k <= j))
+			continue;
+		t->slots[i] = t->slots[j];
+		i = j;
+	}
+	t->slots[i].max_tag = 0;
+	t->nr_lpas--;
+
+	return 0;
+}
+
+uint64_t h4h_lpa_tags_get_nr_lpas (h4h_lpa_tags_t* t)
+{
+	return t->nr_lpas;
+}
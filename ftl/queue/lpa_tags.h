@@ -0,0 +1,56 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014-2015 CSAIL, MIT
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+#ifndef _H4H_LPA_TAGS_H
+#define _H4H_LPA_TAGS_H
+
+/* ordering tags of the lpas that have reqs in an llm queue. a req gets a new
+ * tag of its lpa when it is queued, and it can be served only when its tag is
+ * the current one, so that reads and writes to an lpa are served in their
+ * order. the tags are kept in an open-addressing table keyed by the full lpa;
+ * it is sized to the window of queued reqs, and it only grows if more lpas
+ * than that are queued. it is not thread-safe; the callers lock it. */
+#define H4H_LPA_TAGS_MIN_SIZE	64
+
+typedef struct {
+	uint64_t lpa;
+	uint64_t cur_tag;
+	uint64_t max_tag;	/* 0 if the slot is empty */
+} h4h_lpa_tag_t;
+
+typedef struct {
+	uint32_t bits;	/* log2 (# of slots) */
+	uint64_t nr_lpas;
+	h4h_lpa_tag_t* slots;
+} h4h_lpa_tags_t;
+
+int h4h_lpa_tags_init (h4h_lpa_tags_t* t, uint64_t window);
+void h4h_lpa_tags_free (h4h_lpa_tags_t* t);
+uint64_t h4h_lpa_tags_get_new (h4h_lpa_tags_t* t, uint64_t lpa);
+uint64_t h4h_lpa_tags_get_cur (h4h_lpa_tags_t* t, uint64_t lpa);
+int h4h_lpa_tags_put (h4h_lpa_tags_t* t, uint64_t lpa);
+uint64_t h4h_lpa_tags_get_nr_lpas (h4h_lpa_tags_t* t);
+
+#endif
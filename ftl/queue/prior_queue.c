@@ -43,36 +43,38 @@ THE SOFTWARE.
 
 /*static uint64_t max_queue_items = 0;*/
 
+/* it must be called with the queue lock */
+static int __prior_queue_grow (h4h_prior_queue_t* mq)
+{
+	h4h_prior_queue_chunk_t* c = NULL;
+	int i;
+
+	if ((c = (h4h_prior_queue_chunk_t*)h4h_malloc 
+			(sizeof (h4h_prior_queue_chunk_t))) == NULL) {
+		h4h_error ("h4h_malloc failed");
+		return 1;
+	}
+	for (i = 0; i < H4H_PRIOR_QUEUE_ITEMS_PER_CHUNK; i++)
+		list_add (&c->items[i].list, &mq->free_items);
+	list_add (&c->list, &mq->chunks);
+
+	return 0;
+}
+
 static uint64_t get_highest_priority_tag (
 	h4h_prior_queue_t* mq, 
 	uint64_t lpa)
 {
-	h4h_prior_lpa_item_t* q = NULL;
-
-	HASH_FIND_INT (mq->hash_lpa, &lpa, q);
-	if (q)
-		return q->cur_tag;
-	return -1;
+	return h4h_lpa_tags_get_cur (&mq->tags, lpa);
 }
 
 static void remove_highest_priority_tag (
 	h4h_prior_queue_t* mq, 
 	uint64_t lpa)
 {
-	h4h_prior_lpa_item_t* q = NULL;
-
-	HASH_FIND_INT (mq->hash_lpa, &lpa, q);
-	if (q && q->lpa == lpa) {
-		if (q->max_tag == q->cur_tag) {
-			HASH_DEL (mq->hash_lpa, q);
-			h4h_free (q);
-			q = NULL;
-		} else if (q->max_tag > q->cur_tag)
-			q->cur_tag++;
-		else {
-			h4h_error ("oops!!!");
-			h4h_bug_on (1);
-		}
+	if (h4h_lpa_tags_put (&mq->tags, lpa) != 0) {
+		h4h_error ("oops!!!");
+		h4h_bug_on (1);
 	}
 }
 
@@ -80,23 +82,11 @@ static uint64_t get_new_priority_tag (
 	h4h_prior_queue_t* mq, 
 	uint64_t lpa)
 {
-	h4h_prior_lpa_item_t* q = NULL;
+	uint64_t tag = h4h_lpa_tags_get_new (&mq->tags, lpa);
 
-	HASH_FIND_INT (mq->hash_lpa, &lpa, q);
-	if (q == NULL) {
-		if ((q = (h4h_prior_lpa_item_t*)h4h_malloc
-				(sizeof (h4h_prior_lpa_item_t))) == NULL) {
-			h4h_error ("h4h_malloc failed");
-			h4h_bug_on (1);
-		}
-		q->lpa = lpa;
-		q->max_tag = 1;
-		q->cur_tag = 1;
-		HASH_ADD_INT (mq->hash_lpa, lpa, q);
-	} else
-		q->max_tag++;
-
-	return q->max_tag;
+	/* 0 means that the lpa table could not be grown */
+	h4h_bug_on (tag == 0);
+	return tag;
 }
 
 h4h_prior_queue_t* h4h_prior_queue_create (
@@ -125,8 +115,26 @@ h4h_prior_queue_t* h4h_prior_queue_create (
 	for (loop = 0; loop < mq->nr_queues; loop++)
 		INIT_LIST_HEAD (&mq->qlh[loop]);
 
-	/* create hash */
-	mq->hash_lpa = NULL;
+	/* create an lpa table */
+	if (h4h_lpa_tags_init (&mq->tags, (mq->max_size > 0) ? 
+			mq->max_size : H4H_PRIOR_QUEUE_LPA_WINDOW) != 0) {
+		h4h_msg ("h4h_lpa_tags_init failed");
+		h4h_free (mq->qlh);
+		h4h_free (mq);
+		return NULL;
+	}
+
+	/* keep enough items for a bounded queue */
+	INIT_LIST_HEAD (&mq->free_items);
+	INIT_LIST_HEAD (&mq->chunks);
+	loop = 0;
+	do {
+		if (__prior_queue_grow (mq) != 0) {
+			h4h_prior_queue_destroy (mq);
+			return NULL;
+		}
+		loop += H4H_PRIOR_QUEUE_ITEMS_PER_CHUNK;
+	} while ((int64_t)loop < mq->max_size);
 
 	return mq;
 }
@@ -134,15 +142,17 @@ h4h_prior_queue_t* h4h_prior_queue_create (
 /* NOTE: it must be called when mq is empty. */
 void h4h_prior_queue_destroy (h4h_prior_queue_t* mq)
 {
-	h4h_prior_lpa_item_t *c, *tmp;
+	h4h_prior_queue_chunk_t *ch, *ch_tmp;
 
 	if (mq == NULL)
 		return;
 
-	HASH_ITER (hh, mq->hash_lpa, c, tmp) {
-		h4h_warning ("hmm.. there are still some items in the hash table");
-		HASH_DEL (mq->hash_lpa, c);
-		h4h_free (c);
+	if (h4h_lpa_tags_get_nr_lpas (&mq->tags) != 0)
+		h4h_warning ("hmm.. there are still some items in the lpa table");
+	h4h_lpa_tags_free (&mq->tags);
+	list_for_each_entry_safe (ch, ch_tmp, &mq->chunks, list) {
+		list_del (&ch->list);
+		h4h_free (ch);
 	}
 	h4h_free (mq->qlh);
 	h4h_free (mq);
@@ -164,10 +174,13 @@ uint8_t h4h_prior_queue_enqueue (
 	h4h_spin_lock (&mq->lock);
 	if (mq->max_size == INFINITE_PRIOR_QUEUE || mq->qic < mq->max_size) {
 		h4h_prior_queue_item_t* q = NULL;
-		if ((q = h4h_malloc (sizeof (h4h_prior_queue_item_t))) == NULL) {
-			h4h_error ("h4h_malloc failed");
+		/* the allocator is only called if all the items are in use */
+		if (list_empty (&mq->free_items) && __prior_queue_grow (mq) != 0) {
+			h4h_error ("__prior_queue_grow failed");
 			h4h_bug_on (1);
 		} else {
+			q = list_entry (mq->free_items.next, h4h_prior_queue_item_t, list);
+			list_del (&q->list);
 			q->tag = get_new_priority_tag (mq, lpa);;
 			q->lpa = lpa;
 			q->lock = 0;
@@ -255,7 +268,7 @@ uint8_t h4h_prior_queue_remove (
 	if (q) {
 		remove_highest_priority_tag (mq, q->lpa);
 		list_del (&q->list);
-		h4h_free (q);
+		list_add (&q->list, &mq->free_items);
 		mq->qic--;
 		/*h4h_msg ("[QUEUE] # of items in queue = %llu", mq->qic);*/
 	}
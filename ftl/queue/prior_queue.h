@@ -25,7 +25,7 @@ THE SOFTWARE.
 #ifndef _H4H_PRIOR_QUEUE_MQ_H
 #define _H4H_PRIOR_QUEUE_MQ_H
 
-#include "../3rd/uthash.h"
+#include "lpa_tags.h"
 
 enum H4H_PRIOR_QUEUE_SIZE {
 	INFINITE_PRIOR_QUEUE = -1,
@@ -39,13 +39,17 @@ typedef struct {
 	uint8_t lock;
 } h4h_prior_queue_item_t;
 
+/* queue items are recycled through a free list; they are taken from chunks
+ * that are only freed when the queue is destroyed */
+#define H4H_PRIOR_QUEUE_ITEMS_PER_CHUNK 64
+
+/* the lpa table of an unbounded queue is sized to this many lpas first */
+#define H4H_PRIOR_QUEUE_LPA_WINDOW 1024
+
 typedef struct {
-	struct list_head list;	/* list header */
-	uint64_t lpa;
-	uint64_t cur_tag;
-	uint64_t max_tag;
-	UT_hash_handle hh;	/* hash header */
-} h4h_prior_lpa_item_t;
+	struct list_head list;
+	h4h_prior_queue_item_t items[H4H_PRIOR_QUEUE_ITEMS_PER_CHUNK];
+} h4h_prior_queue_chunk_t;
 
 typedef struct {
 	uint64_t nr_queues;
@@ -53,7 +57,9 @@ typedef struct {
 	int64_t qic; /* queue item count */
 	h4h_spinlock_t lock; /* queue lock */
 	struct list_head* qlh; /* queue list header */
- 	h4h_prior_lpa_item_t* hash_lpa;	/* lpa hash */
+ 	h4h_lpa_tags_t tags;	/* ordering tags of lpas */
+	struct list_head free_items;
+	struct list_head chunks;
 } h4h_prior_queue_t;
 
 h4h_prior_queue_t* h4h_prior_queue_create (uint64_t nr_queues, int64_t size);
@@ -0,0 +1,489 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014-2015 CSAIL, MIT
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+#if defined (KERNEL_MODE)
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/bitops.h>
+
+#define __pu_mb() smp_mb ()
+#define __pu_ffs(w) __ffs (w)
+
+#elif defined (USER_MODE)
+#include <stdio.h>
+#include <stdint.h>
+
+#define __pu_mb() __sync_synchronize ()
+#define __pu_ffs(w) __builtin_ctzll (w)
+
+#else
+#error Invalid Platform (KERNEL_MODE or USER_MODE)
+#endif
+
+#include "h4h_drv.h"
+#include "debug.h"
+#include "umemory.h"
+#include "uthread.h"
+#include "pu_queue.h"
+
+
+/* lpa -1 is used by the requests that have no logical address (e.g., erase
+ * and gc reads); they are not ordered against each other */
+#define NO_LPA ((uint64_t)-1)
+
+static inline uint64_t __hash_lpa (uint64_t lpa)
+{
+	return lpa * 0x9E3779B97F4A7C15ULL;
+}
+
+/* the top bits of the hash pick a stripe, and the next ones pick a bucket */
+static inline h4h_pu_lpa_stripe_t* __get_stripe (
+	h4h_pu_queue_t* mq,
+	uint64_t lpa)
+{
+	return &mq->stripes[__hash_lpa (lpa) >> 58];
+}
+
+/* all of the lpa functions must be called with the lock of the stripe */
+static inline h4h_pu_lpa_item_t** __get_bucket (
+	h4h_pu_lpa_stripe_t* s, 
+	uint64_t lpa)
+{
+	return &s->buckets[(__hash_lpa (lpa) >> 52) & (H4H_PU_QUEUE_NR_BUCKETS - 1)];
+}
+
+static int __grow_lpas (h4h_pu_lpa_stripe_t* s)
+{
+	h4h_pu_lpa_chunk_t* c = NULL;
+	int i;
+
+	if ((c = (h4h_pu_lpa_chunk_t*)h4h_malloc_atomic
+			(sizeof (h4h_pu_lpa_chunk_t))) == NULL) {
+		h4h_error ("h4h_malloc_atomic failed");
+		return 1;
+	}
+	for (i = 0; i < H4H_PU_QUEUE_LPAS_PER_CHUNK; i++) {
+		c->items[i].next = s->free_lpas;
+		s->free_lpas = &c->items[i];
+	}
+	c->next = s->chunks;
+	s->chunks = c;
+
+	return 0;
+}
+
+static uint64_t get_highest_priority_tag (
+	h4h_pu_lpa_stripe_t* s, 
+	uint64_t lpa)
+{
+	h4h_pu_lpa_item_t* q = *__get_bucket (s, lpa);
+
+	while (q && q->lpa != lpa)
+		q = q->next;
+	if (q)
+		return q->cur_tag;
+	return -1;
+}
+
+static void remove_highest_priority_tag (
+	h4h_pu_lpa_stripe_t* s, 
+	uint64_t lpa)
+{
+	h4h_pu_lpa_item_t** pq = __get_bucket (s, lpa);
+	h4h_pu_lpa_item_t* q = NULL;
+
+	while ((q = *pq) && q->lpa != lpa)
+		pq = &q->next;
+	if (q == NULL) {
+		h4h_error ("oops!!! no tag for lpa %llu", lpa);
+		h4h_bug_on (1);
+	} else if (q->max_tag == q->cur_tag) {
+		*pq = q->next;
+		q->next = s->free_lpas;
+		s->free_lpas = q;
+	} else if (q->max_tag > q->cur_tag) {
+		q->cur_tag++;
+	} else {
+		h4h_error ("oops!!!");
+		h4h_bug_on (1);
+	}
+}
+
+static uint64_t get_new_priority_tag (
+	h4h_pu_lpa_stripe_t* s, 
+	uint64_t lpa)
+{
+	h4h_pu_lpa_item_t** b = __get_bucket (s, lpa);
+	h4h_pu_lpa_item_t* q = *b;
+
+	while (q && q->lpa != lpa)
+		q = q->next;
+	if (q == NULL) {
+		/* the allocator is only called if all the lpa items are in use */
+		if (s->free_lpas == NULL && __grow_lpas (s) != 0)
+			h4h_bug_on (1);
+		q = s->free_lpas;
+		s->free_lpas = q->next;
+		q->lpa = lpa;
+		q->max_tag = 1;
+		q->cur_tag = 1;
+		q->next = *b;
+		*b = q;
+	} else
+		q->max_tag++;
+
+	return q->max_tag;
+}
+
+static inline void __set_work (h4h_pu_queue_t* mq, uint64_t qid)
+{
+	atomic64_or (1ULL << (qid % 64), &mq->work[qid / 64]);
+}
+
+static inline void __clear_work (h4h_pu_queue_t* mq, uint64_t qid)
+{
+	atomic64_and (~(1ULL << (qid % 64)), &mq->work[qid / 64]);
+}
+
+/* is the head of a ring published? it is only called by the consumer */
+static inline int __ring_ready (
+	h4h_pu_queue_t* mq, 
+	h4h_pu_queue_ring_t* ring)
+{
+	h4h_pu_queue_slot_t* s = &ring->slots[ring->head & (mq->ring_size - 1)];
+	return atomic64_read (&s->seq) == (int64_t)(ring->head + 1);
+}
+
+static void __ring_push (
+	h4h_pu_queue_t* mq, 
+	h4h_pu_queue_ring_t* ring, 
+	h4h_pu_queue_item_t* item)
+{
+	h4h_pu_queue_slot_t* s = NULL;
+	int64_t pos;
+
+	/* a slot is always free for a producer that reserved it, but it might
+	 * not be released by the consumer yet */
+	for (;;) {
+		pos = atomic64_read (&ring->tail);
+		s = &ring->slots[pos & (mq->ring_size - 1)];
+		if (atomic64_read (&s->seq) == pos &&
+			atomic64_cmpxchg (&ring->tail, pos, pos + 1) == pos)
+			break;
+	}
+	s->item = item;
+	__pu_mb ();
+	atomic64_set (&s->seq, pos + 1);
+}
+
+h4h_pu_queue_t* h4h_pu_queue_create (
+	uint64_t nr_queues, 
+	int64_t ring_size)
+{
+	h4h_pu_queue_t* mq;
+	uint64_t loop, i;
+
+	/* create a private structure */
+	if ((mq = h4h_zmalloc (sizeof (h4h_pu_queue_t))) == NULL) {
+		h4h_msg ("h4h_zmalloc failed");
+		return NULL;
+	}
+	mq->nr_queues = nr_queues;
+	mq->ring_size = 1;
+	if (ring_size <= 0)
+		ring_size = H4H_PU_QUEUE_RING_SIZE;
+	while (mq->ring_size < ring_size)
+		mq->ring_size <<= 1;
+	atomic64_set (&mq->qic, 0);
+	for (loop = 0; loop < H4H_PU_QUEUE_NR_STRIPES; loop++) {
+		h4h_spin_lock_init (&mq->stripes[loop].lock);
+		if (__grow_lpas (&mq->stripes[loop]) != 0)
+			goto fail;
+	}
+
+	/* create rings */
+	if ((mq->rings = h4h_zmalloc (sizeof (h4h_pu_queue_ring_t) * mq->nr_queues)) == NULL) {
+		h4h_msg ("h4h_zmalloc failed");
+		goto fail;
+	}
+	for (loop = 0; loop < mq->nr_queues; loop++) {
+		h4h_pu_queue_ring_t* ring = &mq->rings[loop];
+		if ((ring->slots = h4h_malloc (sizeof (h4h_pu_queue_slot_t) * mq->ring_size)) == NULL) {
+			h4h_msg ("h4h_malloc failed");
+			goto fail;
+		}
+		for (i = 0; i < mq->ring_size; i++) {
+			atomic64_set (&ring->slots[i].seq, i);
+			ring->slots[i].item = NULL;
+		}
+		atomic64_set (&ring->tail, 0);
+		atomic64_set (&ring->nr_items, 0);
+		ring->head = 0;
+	}
+
+	/* create the work bitmap */
+	mq->nr_words = (mq->nr_queues + 63) / 64;
+	if ((mq->work = h4h_zmalloc (sizeof (atomic64_t) * mq->nr_words)) == NULL) {
+		h4h_msg ("h4h_zmalloc failed");
+		goto fail;
+	}
+
+	return mq;
+
+fail:
+	h4h_pu_queue_destroy (mq);
+	return NULL;
+}
+
+/* NOTE: it must be called when mq is empty. */
+void h4h_pu_queue_destroy (h4h_pu_queue_t* mq)
+{
+	h4h_pu_lpa_chunk_t* ch;
+	uint64_t loop, i;
+
+	if (mq == NULL)
+		return;
+
+	for (loop = 0; loop < H4H_PU_QUEUE_NR_STRIPES; loop++) {
+		h4h_pu_lpa_stripe_t* s = &mq->stripes[loop];
+		for (i = 0; i < H4H_PU_QUEUE_NR_BUCKETS; i++) {
+			if (s->buckets[i])
+				h4h_warning ("hmm.. there are still some items in the lpa table");
+		}
+		while ((ch = s->chunks) != NULL) {
+			s->chunks = ch->next;
+			h4h_free_atomic (ch);
+		}
+	}
+	if (mq->rings) {
+		for (loop = 0; loop < mq->nr_queues; loop++) {
+			if (mq->rings[loop].slots)
+				h4h_free (mq->rings[loop].slots);
+		}
+		h4h_free (mq->rings);
+	}
+	if (mq->work)
+		h4h_free (mq->work);
+	h4h_free (mq);
+}
+
+uint8_t h4h_pu_queue_enqueue (
+	h4h_pu_queue_t* mq, 
+	uint64_t qid, 
+	uint64_t lpa, 
+	void* req,
+	h4h_pu_queue_item_t* q)
+{
+	h4h_pu_queue_ring_t* ring = NULL;
+
+	if (qid >= mq->nr_queues) {
+		h4h_error ("qid is invalid (%llu)", qid);
+		return 1;
+	}
+	ring = &mq->rings[qid];
+
+	q->lpa = lpa;
+	q->qid = qid;
+	q->ptr_req = req;
+
+	/* reserve a slot of the ring; nr_items also counts the items being
+	 * served, so the ring always has room for the reserved ones. it must be
+	 * done before taking a tag; otherwise, a producer waiting for room
+	 * could hold back the request the consumer needs to serve first. */
+	while (atomic64_inc_return (&ring->nr_items) > (int64_t)mq->ring_size) {
+		atomic64_dec (&ring->nr_items);
+		h4h_thread_yield ();
+	}
+	atomic64_inc (&mq->qic);
+
+	if (lpa == NO_LPA) {
+		q->tag = 0;
+		__ring_push (mq, ring, q);
+	} else {
+		/* the tag is taken and the item is put into the ring at once, so
+		 * that the items to an lpa are in the order of their tags */
+		h4h_pu_lpa_stripe_t* s = __get_stripe (mq, lpa);
+		h4h_spin_lock (&s->lock);
+		q->tag = get_new_priority_tag (s, lpa);
+		__ring_push (mq, ring, q);
+		h4h_spin_unlock (&s->lock);
+	}
+
+	/* let the consumer know there are items */
+	__set_work (mq, qid);
+
+	return 0;
+}
+
+/* the bit is cleared only when the ring looks empty; a producer sets it
+ * again after it publishes an item, so checking again closes the race */
+static inline void __check_empty (h4h_pu_queue_t* mq, uint64_t qid)
+{
+	h4h_pu_queue_ring_t* ring = &mq->rings[qid];
+
+	if (!__ring_ready (mq, ring)) {
+		__clear_work (mq, qid);
+		if (__ring_ready (mq, ring))
+			__set_work (mq, qid);
+	}
+}
+
+/* it returns the head of a ring without taking it; 'ready' tells whether
+ * the head holds the current tag of its lpa. only the consumer calls it */
+h4h_pu_queue_item_t* h4h_pu_queue_peek (
+	h4h_pu_queue_t* mq, 
+	uint64_t qid,
+	uint8_t* ready)
+{
+	h4h_pu_queue_ring_t* ring = &mq->rings[qid];
+	h4h_pu_queue_item_t* q = NULL;
+
+	if (!__ring_ready (mq, ring)) {
+		__check_empty (mq, qid);
+		return NULL;
+	}
+	__pu_mb ();
+	q = ring->slots[ring->head & (mq->ring_size - 1)].item;
+
+	/* [CAUSION] only the head is checked as prior_queue does */
+	*ready = 1;
+	if (q->lpa != NO_LPA) {
+		h4h_pu_lpa_stripe_t* st = __get_stripe (mq, q->lpa);
+		uint64_t highest_tag;
+		h4h_spin_lock (&st->lock);
+		highest_tag = get_highest_priority_tag (st, q->lpa);
+		h4h_spin_unlock (&st->lock);
+		if (highest_tag != q->tag)
+			*ready = 0;
+	}
+
+	return q;
+}
+
+/* it takes the head returned by h4h_pu_queue_peek () */
+void h4h_pu_queue_pop (
+	h4h_pu_queue_t* mq, 
+	uint64_t qid)
+{
+	h4h_pu_queue_ring_t* ring = &mq->rings[qid];
+	h4h_pu_queue_slot_t* s = &ring->slots[ring->head & (mq->ring_size - 1)];
+
+	/* release the slot */
+	s->item = NULL;
+	atomic64_set (&s->seq, ring->head + mq->ring_size);
+	ring->head++;
+
+	__check_empty (mq, qid);
+}
+
+/* only a single consumer can call it */
+void* h4h_pu_queue_dequeue (
+	h4h_pu_queue_t* mq, 
+	uint64_t qid,
+	h4h_pu_queue_item_t** oq)
+{
+	h4h_pu_queue_item_t* q = NULL;
+	uint8_t ready = 0;
+
+	if ((q = h4h_pu_queue_peek (mq, qid, &ready)) == NULL || !ready)
+		return NULL;
+	h4h_pu_queue_pop (mq, qid);
+	*oq = q;
+
+	return q->ptr_req;
+}
+
+uint8_t h4h_pu_queue_remove (
+	h4h_pu_queue_t* mq, 
+	h4h_pu_queue_item_t* q)
+{
+	if (q == NULL)
+		return 0;
+
+	if (q->lpa != NO_LPA) {
+		h4h_pu_lpa_stripe_t* s = __get_stripe (mq, q->lpa);
+		h4h_spin_lock (&s->lock);
+		remove_highest_priority_tag (s, q->lpa);
+		h4h_spin_unlock (&s->lock);
+	}
+	atomic64_dec (&mq->rings[q->qid].nr_items);
+	atomic64_dec (&mq->qic);
+
+	return 0;
+}
+
+/* returns the first unit from 'qid' that has queued items, or nr_queues */
+uint64_t h4h_pu_queue_next_work (
+	h4h_pu_queue_t* mq, 
+	uint64_t qid)
+{
+	uint64_t w = qid / 64;
+	uint64_t bits;
+
+	if (qid >= mq->nr_queues)
+		return mq->nr_queues;
+
+	bits = (uint64_t)atomic64_read (&mq->work[w]) & (~0ULL << (qid % 64));
+	for (;;) {
+		if (bits) {
+			qid = w * 64 + __pu_ffs (bits);
+			return (qid < mq->nr_queues) ? qid : mq->nr_queues;
+		}
+		if (++w == mq->nr_words)
+			return mq->nr_queues;
+		bits = (uint64_t)atomic64_read (&mq->work[w]);
+	}
+}
+
+uint8_t h4h_pu_queue_has_work (h4h_pu_queue_t* mq)
+{
+	uint64_t w;
+
+	for (w = 0; w < mq->nr_words; w++) {
+		if (atomic64_read (&mq->work[w]))
+			return 1;
+	}
+	return 0;
+}
+
+uint8_t h4h_pu_queue_is_empty (
+	h4h_pu_queue_t* mq, 
+	uint64_t qid)
+{
+	return (atomic64_read (&mq->work[qid / 64]) & (1ULL << (qid % 64))) ? 0 : 1;
+}
+
+/* items being served are counted as well */
+uint8_t h4h_pu_queue_is_all_empty (h4h_pu_queue_t* mq)
+{
+	if (mq == NULL)
+		return 1;
+	return (atomic64_read (&mq->qic) == 0) ? 1 : 0;
+}
+
+uint64_t h4h_pu_queue_get_nr_items (h4h_pu_queue_t* mq)
+{
+	return atomic64_read (&mq->qic);
+}
@@ -0,0 +1,102 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014-2015 CSAIL, MIT
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+#ifndef _H4H_PU_QUEUE_H
+#define _H4H_PU_QUEUE_H
+
+/* a queue with a bounded multi-producer/single-consumer ring per parallel
+ * unit (or per class of a unit, if its items are scheduled by classes;
+ * see llm_sched.h). the requests to the same lpa are still served in their order: a
+ * request is dequeued only when it holds the current tag of its lpa. the tags
+ * are kept in a table whose locks are striped by lpa, and a bitmap tells the
+ * units that have queued items. */
+#define H4H_PU_QUEUE_RING_SIZE		2048	/* a default; a power of 2 */
+#define H4H_PU_QUEUE_NR_STRIPES		64
+
+/* items are kept by the callers (e.g., in llm_reqs), so that the queue does
+ * not allocate them */
+typedef h4h_llm_qitem_t h4h_pu_queue_item_t;
+
+typedef struct {
+	atomic64_t seq;	/* pos + 1 if the slot is full; pos if it is free */
+	h4h_pu_queue_item_t* item;
+} h4h_pu_queue_slot_t;
+
+typedef struct {
+	atomic64_t tail;	/* taken by producers */
+	uint64_t head;		/* only moved by the consumer */
+	atomic64_t nr_items;	/* queued + being served */
+	h4h_pu_queue_slot_t* slots;
+} __attribute__ ((aligned (64))) h4h_pu_queue_ring_t;
+
+typedef struct h4h_pu_lpa_item {
+	uint64_t lpa;
+	uint64_t cur_tag;
+	uint64_t max_tag;
+	struct h4h_pu_lpa_item* next;	/* in a bucket or in the free list */
+} h4h_pu_lpa_item_t;
+
+/* a stripe keeps its lpas in a fixed number of bucket chains; lpa items are
+ * recycled in a stripe, and they are taken from chunks that are only freed
+ * when the queue is destroyed */
+#define H4H_PU_QUEUE_NR_BUCKETS		64
+#define H4H_PU_QUEUE_LPAS_PER_CHUNK	64
+
+typedef struct h4h_pu_lpa_chunk {
+	struct h4h_pu_lpa_chunk* next;
+	h4h_pu_lpa_item_t items[H4H_PU_QUEUE_LPAS_PER_CHUNK];
+} h4h_pu_lpa_chunk_t;
+
+typedef struct {
+	h4h_spinlock_t lock;
+	h4h_pu_lpa_item_t* buckets[H4H_PU_QUEUE_NR_BUCKETS];
+	h4h_pu_lpa_item_t* free_lpas;
+	h4h_pu_lpa_chunk_t* chunks;
+} __attribute__ ((aligned (64))) h4h_pu_lpa_stripe_t;
+
+typedef struct {
+	uint64_t nr_queues;
+	uint64_t ring_size;
+	atomic64_t qic;	/* queue item count */
+	h4h_pu_queue_ring_t* rings;
+	uint64_t nr_words;
+	atomic64_t* work;	/* a bit per unit with queued items */
+	h4h_pu_lpa_stripe_t stripes[H4H_PU_QUEUE_NR_STRIPES];
+} h4h_pu_queue_t;
+
+h4h_pu_queue_t* h4h_pu_queue_create (uint64_t nr_queues, int64_t ring_size);
+void h4h_pu_queue_destroy (h4h_pu_queue_t* mq);
+uint8_t h4h_pu_queue_enqueue (h4h_pu_queue_t* mq, uint64_t qid, uint64_t lpa, void* req, h4h_pu_queue_item_t* q);
+void* h4h_pu_queue_dequeue (h4h_pu_queue_t* mq, uint64_t qid, h4h_pu_queue_item_t** out_q);
+h4h_pu_queue_item_t* h4h_pu_queue_peek (h4h_pu_queue_t* mq, uint64_t qid, uint8_t* ready);
+void h4h_pu_queue_pop (h4h_pu_queue_t* mq, uint64_t qid);
+uint8_t h4h_pu_queue_remove (h4h_pu_queue_t* mq, h4h_pu_queue_item_t* q);
+uint64_t h4h_pu_queue_next_work (h4h_pu_queue_t* mq, uint64_t qid);
+uint8_t h4h_pu_queue_has_work (h4h_pu_queue_t* mq);
+uint8_t h4h_pu_queue_is_empty (h4h_pu_queue_t* mq, uint64_t qid);
+uint8_t h4h_pu_queue_is_all_empty (h4h_pu_queue_t* mq);
+uint64_t h4h_pu_queue_get_nr_items (h4h_pu_queue_t* mq);
+
+#endif
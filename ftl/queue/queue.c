@@ -43,6 +43,37 @@ THE SOFTWARE.
 
 static uint64_t max_queue_items = 0;
 
+/* it must be called with the queue lock */
+static int __queue_grow (h4h_queue_t* mq)
+{
+	h4h_queue_chunk_t* c = NULL;
+	int i;
+
+	if ((c = (h4h_queue_chunk_t*)h4h_malloc_atomic 
+			(sizeof (h4h_queue_chunk_t))) == NULL) {
+		h4h_error ("h4h_malloc_atomic failed");
+		return 1;
+	}
+	for (i = 0; i < H4H_QUEUE_ITEMS_PER_CHUNK; i++)
+		list_add (&c->items[i].list, &mq->free_items);
+	list_add (&c->list, &mq->chunks);
+
+	return 0;
+}
+
+/* the allocator is only called if all the items are in use */
+static h4h_queue_item_t* __queue_get_item (h4h_queue_t* mq)
+{
+	h4h_queue_item_t* q = NULL;
+
+	if (list_empty (&mq->free_items) && __queue_grow (mq) != 0)
+		return NULL;
+	q = list_entry (mq->free_items.next, h4h_queue_item_t, list);
+	list_del (&q->list);
+
+	return q;
+}
+
 h4h_queue_t* h4h_queue_create (uint64_t nr_queues, int64_t max_size)
 {
 	h4h_queue_t* mq;
@@ -68,6 +99,18 @@ h4h_queue_t* h4h_queue_create (uint64_t nr_queues, int64_t max_size)
 		INIT_LIST_HEAD (&mq->qlh[loop]);
 	}
 
+	/* keep enough items for a bounded queue */
+	INIT_LIST_HEAD (&mq->free_items);
+	INIT_LIST_HEAD (&mq->chunks);
+	loop = 0;
+	do {
+		if (__queue_grow (mq) != 0) {
+			h4h_queue_destroy (mq);
+			return NULL;
+		}
+		loop += H4H_QUEUE_ITEMS_PER_CHUNK;
+	} while ((int64_t)loop < mq->max_size);
+
 	return mq;
 }
 
@@ -76,6 +119,12 @@ h4h_queue_t* h4h_queue_create (uint64_t nr_queues, int64_t max_size)
  */
 void h4h_queue_destroy (h4h_queue_t* mq)
 {
+	h4h_queue_chunk_t *c, *tmp;
+
+	list_for_each_entry_safe (c, tmp, &mq->chunks, list) {
+		list_del (&c->list);
+		h4h_free_atomic (c);
+	}
 	h4h_free_atomic (mq->qlh);
 	h4h_free_atomic (mq);
 }
@@ -94,9 +143,8 @@ uint8_t h4h_queue_enqueue (h4h_queue_t* mq, uint64_t qid, void* req)
 	h4h_spin_lock_irqsave (&mq->lock, flags);
 	if (mq->max_size == INFINITE_QUEUE || mq->qic < mq->max_size) {
 		h4h_queue_item_t* q = NULL;
-		if ((q = (h4h_queue_item_t*)h4h_malloc_atomic 
-				(sizeof (h4h_queue_item_t))) == NULL) {
-			h4h_error ("h4h_malloc_atomic failed");
+		if ((q = __queue_get_item (mq)) == NULL) {
+			h4h_error ("__queue_get_item failed");
 		} else {
 			q->ptr_req = (void*)req;
 			list_add_tail (&q->list, &mq->qlh[qid]);	/* add to tail */
@@ -128,9 +176,8 @@ uint8_t h4h_queue_enqueue_top (h4h_queue_t* mq, uint64_t qid, void* req)
 	h4h_spin_lock_irqsave (&mq->lock, flags);
 	if (mq->max_size == INFINITE_QUEUE || mq->qic < mq->max_size) {
 		h4h_queue_item_t* q = NULL;
-		if ((q = (h4h_queue_item_t*)h4h_malloc_atomic 
-				(sizeof (h4h_queue_item_t))) == NULL) {
-			h4h_error ("h4h_malloc_atomic failed");
+		if ((q = __queue_get_item (mq)) == NULL) {
+			h4h_error ("__queue_get_item failed");
 		} else {
 			q->ptr_req = (void*)req;
 			list_add (&q->list, &mq->qlh[qid]);	/* add to tail */
@@ -185,7 +232,7 @@ void* h4h_queue_dequeue (h4h_queue_t* mq, uint64_t qid)
 		if (q) {
 			req = q->ptr_req;
 			list_del (&q->list); /* remove from q */
-			h4h_free_atomic (q); /* free q */
+			list_add (&q->list, &mq->free_items); /* recycle q */
 			mq->qic--;
 		}
 	}
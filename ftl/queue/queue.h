@@ -34,6 +34,15 @@ typedef struct {
 	struct list_head list;
 } h4h_queue_item_t;
 
+/* items are recycled through a free list; they are taken from chunks that
+ * are only freed when the queue is destroyed */
+#define H4H_QUEUE_ITEMS_PER_CHUNK 64
+
+typedef struct {
+	struct list_head list;
+	h4h_queue_item_t items[H4H_QUEUE_ITEMS_PER_CHUNK];
+} h4h_queue_chunk_t;
+
 typedef struct {
 	uint64_t nr_queues;
 	int64_t max_size;
@@ -41,6 +50,8 @@ typedef struct {
 	h4h_spinlock_t lock;	/* queue lock */
 
 	struct list_head* qlh;	/* queue list header */
+	struct list_head free_items;
+	struct list_head chunks;
 } h4h_queue_t;
 
 h4h_queue_t* h4h_queue_create (uint64_t nr_queues, int64_t size);
@@ -47,32 +47,16 @@ static uint64_t get_highest_priority_tag (
 	h4h_rd_prior_queue_t* mq, 
 	uint64_t lpa)
 {
-	h4h_rd_prior_lpa_item_t* q = NULL;
-
-	HASH_FIND_INT (mq->hash_lpa, &lpa, q);
-	if (q)
-		return q->cur_tag;
-	return -1;
+	return h4h_lpa_tags_get_cur (&mq->tags, lpa);
 }
 
 static void remove_highest_priority_tag (
 	h4h_rd_prior_queue_t* mq, 
 	uint64_t lpa)
 {
-	h4h_rd_prior_lpa_item_t* q = NULL;
-
-	HASH_FIND_INT (mq->hash_lpa, &lpa, q);
-	if (q && q->lpa == lpa) {
-		if (q->max_tag == q->cur_tag) {
-			HASH_DEL (mq->hash_lpa, q);
-			h4h_free_atomic (q);
-			q = NULL;
-		} else if (q->max_tag > q->cur_tag)
-			q->cur_tag++;
-		else {
-			h4h_error ("oops!!!");
-			h4h_bug_on (1);
-		}
+	if (h4h_lpa_tags_put (&mq->tags, lpa) != 0) {
+		h4h_error ("oops!!!");
+		h4h_bug_on (1);
 	}
 }
 
@@ -80,23 +64,11 @@ static uint64_t get_new_priority_tag (
 	h4h_rd_prior_queue_t* mq, 
 	uint64_t lpa)
 {
-	h4h_rd_prior_lpa_item_t* q = NULL;
+	uint64_t tag = h4h_lpa_tags_get_new (&mq->tags, lpa);
 
-	HASH_FIND_INT (mq->hash_lpa, &lpa, q);
-	if (q == NULL) {
-		if ((q = (h4h_rd_prior_lpa_item_t*)h4h_malloc_atomic 
-				(sizeof (h4h_rd_prior_lpa_item_t))) == NULL) {
-			h4h_error ("h4h_malloc_atomic failed");
-			h4h_bug_on (1);
-		}
-		q->lpa = lpa;
-		q->max_tag = 1;
-		q->cur_tag = 1;
-		HASH_ADD_INT (mq->hash_lpa, lpa, q);
-	} else
-		q->max_tag++;
-
-	return q->max_tag;
+	/* 0 means that the lpa table could not be grown */
+	h4h_bug_on (tag == 0);
+	return tag;
 }
 
 h4h_rd_prior_queue_t* h4h_rd_prior_queue_create (
@@ -125,8 +97,14 @@ h4h_rd_prior_queue_t* h4h_rd_prior_queue_create (
 	for (loop = 0; loop < mq->nr_queues; loop++)
 		INIT_LIST_HEAD (&mq->qlh[loop]);
 
-	/* create hash */
-	mq->hash_lpa = NULL;
+	/* create an lpa table */
+	if (h4h_lpa_tags_init (&mq->tags, (mq->max_size > 0) ? 
+			mq->max_size : H4H_RD_PRIOR_QUEUE_LPA_WINDOW) != 0) {
+		h4h_msg ("h4h_lpa_tags_init failed");
+		h4h_free_atomic (mq->qlh);
+		h4h_free_atomic (mq);
+		return NULL;
+	}
 
 	h4h_msg ("** rd_prior_queue is created! **");
 
@@ -136,16 +114,12 @@ h4h_rd_prior_queue_t* h4h_rd_prior_queue_create (
 /* NOTE: it must be called when mq is empty. */
 void h4h_rd_prior_queue_destroy (h4h_rd_prior_queue_t* mq)
 {
-	h4h_rd_prior_lpa_item_t *c, *tmp;
-
 	if (mq == NULL)
 		return;
 
-	HASH_ITER (hh, mq->hash_lpa, c, tmp) {
-		h4h_warning ("hmm.. there are still some items in the hash table");
-		HASH_DEL (mq->hash_lpa, c);
-		h4h_free_atomic (c);
-	}
+	if (h4h_lpa_tags_get_nr_lpas (&mq->tags) != 0)
+		h4h_warning ("hmm.. there are still some items in the lpa table");
+	h4h_lpa_tags_free (&mq->tags);
 	h4h_free_atomic (mq->qlh);
 	h4h_free_atomic (mq);
 }
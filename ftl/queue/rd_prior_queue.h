@@ -25,12 +25,15 @@ THE SOFTWARE.
 #ifndef _H4H_RD_PRIOR_QUEUE_MQ_H
 #define _H4H_RD_PRIOR_QUEUE_MQ_H
 
-#include "../3rd/uthash.h"
+#include "lpa_tags.h"
 
 enum H4H_RD_PRIOR_QUEUE_SIZE {
 	INFINITE_RD_PRIOR_QUEUE = -1,
 };
 
+/* the lpa table of an unbounded queue is sized to this many lpas first */
+#define H4H_RD_PRIOR_QUEUE_LPA_WINDOW 1024
+
 typedef enum {
 	RD_PRIORITY_READ = 0,
 	RD_PRIORITY_WRITE = 1,
@@ -45,21 +48,13 @@ typedef struct {
 	rd_prior_iotype_t type;
 } h4h_rd_prior_queue_item_t;
 
-typedef struct {
-	struct list_head list;	/* list header */
-	uint64_t lpa;
-	uint64_t cur_tag;
-	uint64_t max_tag;
-	UT_hash_handle hh;	/* hash header */
-} h4h_rd_prior_lpa_item_t;
-
 typedef struct {
 	uint64_t nr_queues;
 	int64_t max_size;
 	int64_t qic; /* queue item count */
 	h4h_spinlock_t lock; /* queue lock */
 	struct list_head* qlh; /* queue list header */
- 	h4h_rd_prior_lpa_item_t* hash_lpa;	/* lpa hash */
+ 	h4h_lpa_tags_t tags;	/* ordering tags of lpas */
 } h4h_rd_prior_queue_t;
 
 h4h_rd_prior_queue_t* h4h_rd_prior_queue_create (uint64_t nr_queues, int64_t size);
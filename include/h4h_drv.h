@@ -95,15 +95,21 @@ enum H4H_REQTYPE {
 	REQTYPE_IO_WRITE 		= 0x000004,
 	REQTYPE_IO_ERASE 		= 0x000008,
 	REQTYPE_IO_TRIM 		= 0x000010,
+	REQTYPE_IO_FLUSH 		= 0x000020,
 	REQTYPE_NORNAL 			= 0x000100,
 	REQTYPE_RMW 			= 0x000200,
 	REQTYPE_GC 				= 0x000400,
 	REQTYPE_META 			= 0x000800,
+	REQTYPE_FUA 			= 0x001000,	/* host flag: write through the volatile buffer */
+	REQTYPE_PREFLUSH 		= 0x002000,	/* host flag: flush the volatile buffer first */
+	REQTYPE_NOCACHE 		= 0x004000,	/* host flag: bypass the read cache (e.g., scans) */
+	REQTYPE_MERGED 			= 0x008000,	/* host flag: made of adjacent host reqs (hlm_reqs_plug) */
 
 	REQTYPE_READ 			= REQTYPE_NORNAL 	| REQTYPE_IO_READ,
 	REQTYPE_READ_DUMMY 		= REQTYPE_NORNAL 	| REQTYPE_IO_READ_DUMMY,
 	REQTYPE_WRITE 			= REQTYPE_NORNAL 	| REQTYPE_IO_WRITE,
 	REQTYPE_TRIM 			= REQTYPE_NORNAL 	| REQTYPE_IO_TRIM,
+	REQTYPE_FLUSH 			= REQTYPE_NORNAL 	| REQTYPE_IO_FLUSH,
 	REQTYPE_RMW_READ 		= REQTYPE_RMW 		| REQTYPE_IO_READ,
 	REQTYPE_RMW_WRITE 		= REQTYPE_RMW 		| REQTYPE_IO_WRITE,
 	REQTYPE_GC_READ 		= REQTYPE_GC 		| REQTYPE_IO_READ,
@@ -121,6 +127,28 @@ enum H4H_REQTYPE {
 #define h4h_is_write(type) (((type & REQTYPE_IO_WRITE) == REQTYPE_IO_WRITE) ? 1 : 0)
 #define h4h_is_erase(type) (((type & REQTYPE_IO_ERASE) == REQTYPE_IO_ERASE) ? 1 : 0)
 #define h4h_is_trim(type) (((type & REQTYPE_IO_TRIM) == REQTYPE_IO_TRIM) ? 1 : 0)
+#define h4h_is_flush(type) (((type & REQTYPE_IO_FLUSH) == REQTYPE_IO_FLUSH) ? 1 : 0)
+#define h4h_is_fua(type) (((type & REQTYPE_FUA) == REQTYPE_FUA) ? 1 : 0)
+#define h4h_is_preflush(type) (((type & REQTYPE_PREFLUSH) == REQTYPE_PREFLUSH) ? 1 : 0)
+#define h4h_is_nocache(type) (((type & REQTYPE_NOCACHE) == REQTYPE_NOCACHE) ? 1 : 0)
+#define h4h_is_merged(type) (((type & REQTYPE_MERGED) == REQTYPE_MERGED) ? 1 : 0)
+#define h4h_strip_host_flags(type) ((type) & ~(REQTYPE_FUA | REQTYPE_PREFLUSH | REQTYPE_NOCACHE | REQTYPE_MERGED))
+
+/* service classes of llm reqs; the llm schedules punits by them, and the
+ * pmu reports their queueing delays. rmw reqs are host writes */
+enum H4H_LLM_CLASS {
+	LLM_CLASS_HOST_READ = 0,
+	LLM_CLASS_HOST_WRITE,
+	LLM_CLASS_GC,
+	LLM_CLASS_META,
+	LLM_NR_CLASSES,
+};
+
+#define h4h_get_llm_class(type) \
+	(h4h_is_gc(type) ? LLM_CLASS_GC : \
+	 h4h_is_meta(type) ? LLM_CLASS_META : \
+	 (h4h_is_normal(type) && h4h_is_read(type)) ? LLM_CLASS_HOST_READ : \
+	 LLM_CLASS_HOST_WRITE)
 
 
 /* a physical address */
@@ -139,7 +167,7 @@ typedef struct {
 #define H4H_BLKIO_MAX_VECS 512
 
 typedef struct {
-	uint64_t bi_rw; /* REQTYPE_WRITE or REQTYPE_READ */
+	uint64_t bi_rw; /* REQTYPE_WRITE, REQTYPE_READ, ... (with host flags) */
 	uint64_t bi_offset; /* unit: sector (512B) */
 	uint64_t bi_size; /* unit: sector (512B) */
 	uint64_t bi_bvec_cnt; /* unit: kernel-page (4KB); it must be equal to 'bi_size / 8' */
@@ -179,11 +207,22 @@ typedef struct {
 	uint8_t data[H4H_MAX_PAGES*64]; /* FIXME: OOB is fixed to 64 bytes :( */
 } h4h_flash_page_oob_t;
 
+/* storage for the queue items of an llm_req, so that the llm queues need not
+ * allocate them; an rmw req is queued twice (for read and write) */
+typedef struct {
+	void* ptr_req;
+	uint64_t lpa;
+	uint64_t tag;
+	uint64_t qid;
+	uint32_t stamp;	/* when it is queued (in us) */
+} h4h_llm_qitem_t;
+
 typedef struct {
 	uint32_t req_type; /* read, write, or trim */
 	uint8_t ret;	/* old for GC */
 	void* ptr_hlm_req;
 	void* ptr_qitem;
+	h4h_llm_qitem_t qitems[2];
 	h4h_sema_t* done;	/* maybe used by applications that require direct notifications from an interrupt handler */
 
 	/* logical / physical info */
@@ -198,7 +237,7 @@ typedef struct {
 } h4h_llm_req_t;
 
 typedef struct {
-	struct list_head list;	/* for hlm_reqs_pool */
+	uint32_t pool_idx;	/* for hlm_reqs_pool */
 	uint32_t req_type; /* read, write, or trim */
 	h4h_stopwatch_t sw;
 
@@ -207,8 +246,9 @@ typedef struct {
 		struct {
 			uint64_t nr_llm_reqs;
 			atomic64_t nr_llm_reqs_done;
-			h4h_llm_req_t llm_reqs[H4H_BLKIO_MAX_VECS];
+			h4h_llm_req_t* llm_reqs;	/* from a slab of hlm_reqs_pool */
 			h4h_sema_t done;
+			uint64_t rc_seq;	/* read-cache generation when it was issued */
 		};
 		/* for trim ops */
 		struct {
@@ -221,6 +261,7 @@ typedef struct {
 	};
 
 	void* blkio_req;
+	void* llm_slab;	/* a slab that keeps 'llm_reqs' (NULL if none) */
 	uint8_t ret;
 } h4h_hlm_req_t;
 
@@ -267,6 +308,9 @@ typedef struct {
 	uint32_t (*make_reqs) (h4h_drv_info_t* bdi, h4h_hlm_req_t* req);
 	void (*flush) (h4h_drv_info_t* bdi);
 	void (*end_req) (h4h_drv_info_t* bdi, h4h_llm_req_t* req);
+	/* it waits only for the reqs sent to the given punits before it; it is
+	 * optional (see h4h_drv_llm_barrier ()) */
+	void (*barrier) (h4h_drv_info_t* bdi, uint64_t* punit_ids, uint64_t nr_punit_ids);
 } h4h_llm_inf_t;
 
 /* a generic device interface */
@@ -371,6 +415,9 @@ typedef struct {
 	uint64_t time_gc_tot;
 	atomic64_t* util_r;
 	atomic64_t* util_w;
+	uint64_t class_q_sum[LLM_NR_CLASSES];	/* queueing delays in llm */
+	uint64_t class_q_max[LLM_NR_CLASSES];
+	uint64_t class_q_cnt[LLM_NR_CLASSES];
 } h4h_perf_monitor_t;
 
 /* the main data-structure for h4h_drv */
@@ -383,6 +430,8 @@ struct _h4h_drv_info_t {
 	h4h_hlm_inf_t* ptr_hlm_inf;
 	h4h_llm_inf_t* ptr_llm_inf;
 	h4h_ftl_inf_t* ptr_ftl_inf;
+	void* ptr_rcache;	/* read cache (NULL if disabled) */
+	void* ptr_rahead;	/* read-ahead (NULL if disabled) */
 	h4h_perf_monitor_t pm;
 };
 
@@ -391,6 +440,7 @@ h4h_drv_info_t* h4h_drv_create (void);
 int h4h_drv_setup (h4h_drv_info_t* bdi, h4h_host_inf_t* host_inf, h4h_dm_inf_t* dm_inf);
 int h4h_drv_run (h4h_drv_info_t* bdi);
 void h4h_drv_close (h4h_drv_info_t* bdi);
+void h4h_drv_llm_barrier (h4h_drv_info_t* bdi, uint64_t* punit_ids, uint64_t nr_punit_ids);
 void h4h_drv_destroy (h4h_drv_info_t* bdi);
 
 #endif /* _H4H_DRV_H */
@@ -49,6 +49,7 @@ enum H4H_MAPPING_POLICY {
 	MAPPING_POLICY_RSD,
 	MAPPING_POLICY_PAGE,
 	MAPPING_POLICY_DFTL,
+	MAPPING_POLICY_HYBRID,
 };
 
 enum H4H_GC_POLICY {
@@ -84,11 +85,23 @@ enum H4H_LLM_TYPE {
 	LLM_MULTI_QUEUE,
 };
 
+enum H4H_LLM_SCHED {
+	LLM_SCHED_FIFO = 0,	/* a queue per punit */
+	LLM_SCHED_QOS,		/* a queue per class; deadlines + weighted sharing */
+};
+
+enum H4H_LLM_SUSPEND {
+	LLM_SUSPEND_NONE = 0,
+	LLM_SUSPEND_ERASE,	/* host reads suspend erases */
+	LLM_SUSPEND_ALL,	/* host reads suspend erases and programs */
+};
+
 enum H4H_HLM_TYPE {
 	HLM_NOT_SPECIFIED = 0,
 	HLM_NO_BUFFER,
 	HLM_BUFFER,
 	HLM_DFTL,
+	HLM_RSD,
 };
 
 enum H4H_SNAPSHOT {
@@ -122,6 +135,9 @@ typedef struct {
 	uint64_t page_prog_time_us;
 	uint64_t page_read_time_us;
 	uint64_t block_erase_time_us;
+	uint64_t chip_bus_trans_time_us;	/* a page over a channel bus */
+	uint64_t suspend_time_us;	/* to suspend or resume a program/erase */
+	uint64_t max_suspends;	/* per program/erase (0: no suspend) */
 
 	uint64_t nr_blocks_per_channel;
 	uint64_t nr_blocks_per_ssd;